@@ -1,7 +1,12 @@
 #include "al_util.h"
 #include "../media/decode_thread.h"
 #include <assert.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/opt.h>
 #include <log.h>
+#include <math.h>
+#include <stdio.h>
 #include <threads.h>
 
 static void find_suitable_al_format(const AVCodecContext *cp, i32 *frame_size,
@@ -126,17 +131,60 @@ static void find_suitable_al_format(const AVCodecContext *cp, i32 *frame_size,
   }
 }
 
-bool audio_playback_context_init(audio_playback_context *c, decode_context dc) {
+void audio_output_format_init(audio_output_format *f,
+                              const AVCodecContext *cc) {
+  i32 dst_chan_layout;
+  if (cc) {
+    find_suitable_al_format(cc, &f->frame_size, &dst_chan_layout,
+                            &f->sample_format, &f->al_format);
+    f->sample_rate = cc->sample_rate;
+  } else {
+    bool float32 = alIsExtensionPresent("AL_EXT_FLOAT32");
+    dst_chan_layout = AV_CH_LAYOUT_STEREO;
+    f->sample_format = float32 ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S16;
+    f->frame_size = float32 ? 8 : 4;
+    f->al_format = float32 ? AL_FORMAT_STEREO_FLOAT32 : AL_FORMAT_STEREO16;
+    f->sample_rate = 48000;
+  }
+  av_channel_layout_from_mask(&f->layout, dst_chan_layout);
+}
+
+void audio_output_format_init_planar(audio_output_format *f,
+                                     i32 num_channels, i32 sample_rate) {
+  f->sample_format = AV_SAMPLE_FMT_FLTP;
+  f->sample_rate = sample_rate;
+  f->frame_size = num_channels * sizeof(float);
+  f->al_format = AL_NONE;
+  av_channel_layout_default(&f->layout, num_channels);
+}
+
+bool audio_playback_context_init(audio_playback_context *c, decode_context dc,
+                                 const audio_output_format *out) {
   c->dc = dc;
+  c->out = *out;
+  c->eof = false;
+  c->num_out = 0;
+  c->base_time = NAN;
+  c->base_sample = 0;
+  c->base_serial = 0;
+  c->drift = 0.0;
+  c->num_compensated_samples = 0;
   AVCodecContext *cc = c->dc.cc;
-  i32 dst_chan_layout;
-  find_suitable_al_format(cc, &c->frame_size, &dst_chan_layout,
-                          &c->out_sample_format, &c->al_format);
   c->swr = NULL;
-  av_channel_layout_from_mask(&c->out_layout, dst_chan_layout);
+  c->speed = 1.0;
+  c->tempo_graph = NULL;
+  c->tempo_src = NULL;
+  c->tempo_sink = NULL;
+  c->drop_until = 0.0;
+  c->skip_pending = false;
+  if (!(c->frame = av_frame_alloc())) {
+    log_error("unable to allocate frame");
+    goto fail_alloc_frame;
+  }
+
   i32 error;
   if ((error = swr_alloc_set_opts2(
-           &c->swr, &c->out_layout, c->out_sample_format, cc->sample_rate,
+           &c->swr, &c->out.layout, c->out.sample_format, c->out.sample_rate,
            &cc->ch_layout, cc->sample_fmt, cc->sample_rate, 0, NULL)) < 0) {
     log_error("unable to allocate and set SwrContext options: %s",
               av_err2str(error));
@@ -152,84 +200,310 @@ bool audio_playback_context_init(audio_playback_context *c, decode_context dc) {
 fail_swr_init:
   swr_free(&c->swr);
 fail_alloc_setopt:
+  av_frame_free(&c->frame);
+fail_alloc_frame:
   return false;
 }
 
 void audio_playback_context_free(audio_playback_context *c) {
+  avfilter_graph_free(&c->tempo_graph);
+  av_frame_free(&c->frame);
   swr_free(&c->swr);
   decode_context_free(&c->dc);
 }
 
-i32 audio_playback_context_fill_buffer(audio_playback_context *c, ALuint buffer,
-                                       i32 total_samples) {
-  i32 num_samples = 0;
-  AVFrame *frame = av_frame_alloc();
-  if (!frame) {
-    log_error("unable to allocate frame");
-    goto fail_alloc_frame;
+static bool init_tempo_graph(audio_playback_context *c, double speed) {
+  AVCodecContext *cc = c->dc.cc;
+  c->tempo_graph = avfilter_graph_alloc();
+  if (!c->tempo_graph) {
+    log_error("unable to allocate filter graph");
+    goto fail_alloc_graph;
   }
 
+  char layout[64];
+  char args[256];
+  av_channel_layout_describe(&cc->ch_layout, layout, sizeof layout);
+  snprintf(args, sizeof args,
+           "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+           cc->sample_rate, cc->sample_rate,
+           av_get_sample_fmt_name(cc->sample_fmt), layout);
+
   i32 error;
-  u8 *data;
-  if ((error = av_samples_alloc(&data, NULL, c->out_layout.nb_channels,
-                                total_samples, c->out_sample_format, 0)) < 0) {
-    log_error("unable to allocate audio samples: %s", av_err2str(error));
-    goto fail_alloc_samples;
+  if ((error = avfilter_graph_create_filter(
+           &c->tempo_src, avfilter_get_by_name("abuffer"), "src", args, NULL,
+           c->tempo_graph)) < 0) {
+    log_error("unable to create abuffer filter: %s", av_err2str(error));
+    goto fail_filters;
+  }
+
+  AVFilterContext *tempo;
+  snprintf(args, sizeof args, "tempo=%f", speed);
+  if ((error = avfilter_graph_create_filter(
+           &tempo, avfilter_get_by_name("atempo"), "tempo", args, NULL,
+           c->tempo_graph)) < 0) {
+    log_error("unable to create atempo filter: %s", av_err2str(error));
+    goto fail_filters;
+  }
+
+  if ((error = avfilter_graph_create_filter(
+           &c->tempo_sink, avfilter_get_by_name("abuffersink"), "sink", NULL,
+           NULL, c->tempo_graph)) < 0) {
+    log_error("unable to create abuffersink filter: %s", av_err2str(error));
+    goto fail_filters;
+  }
+
+  if ((error = avfilter_link(c->tempo_src, 0, tempo, 0)) < 0 ||
+      (error = avfilter_link(tempo, 0, c->tempo_sink, 0)) < 0 ||
+      (error = avfilter_graph_config(c->tempo_graph, NULL)) < 0) {
+    log_error("unable to configure atempo filter graph: %s",
+              av_err2str(error));
+    goto fail_filters;
+  }
+
+  return true;
+
+fail_filters:
+  avfilter_graph_free(&c->tempo_graph);
+fail_alloc_graph:
+  return false;
+}
+
+bool audio_playback_context_set_speed(audio_playback_context *c,
+                                      double speed) {
+  if (speed == c->speed) {
+    return true;
+  }
+
+  // samples buffered in the old graph are dropped, which is inaudible next to
+  // the tempo change itself
+  avfilter_graph_free(&c->tempo_graph);
+  c->speed = speed;
+  c->base_time = NAN;
+  if (speed > 0.0 && speed != 1.0 && speed <= AUDIO_PLAYBACK_MAX_TEMPO) {
+    return init_tempo_graph(c, speed);
+  }
+
+  return true;
+}
+
+void audio_playback_context_drop_until(audio_playback_context *c,
+                                       double time) {
+  c->drop_until = time;
+}
+
+void audio_playback_context_skip_to(audio_playback_context *c, double time) {
+  c->drop_until = time;
+  c->skip_pending = true;
+  c->base_time = NAN;
+}
+
+static void rebase(audio_playback_context *c, double time, i64 sample) {
+  c->base_time = time;
+  c->base_sample = sample;
+  c->drift = 0.0;
+  ++c->base_serial;
+}
+
+// compares the timestamp of a frame about to be converted against the time
+// its first sample will be output at, and stretches the output to match
+static void sync_frame(audio_playback_context *c, const AVFrame *frame) {
+  AVRational tb = c->tempo_graph
+                      ? (AVRational){1, c->dc.cc->sample_rate}
+                      : c->dc.fmt->streams[c->dc.si.index]->time_base;
+  i64 ts = c->tempo_graph ? frame->pts : frame->best_effort_timestamp;
+  if (ts == AV_NOPTS_VALUE) {
+    return;
+  }
+
+  double time = ts * av_q2d(tb);
+  i64 sample = c->num_out + swr_get_delay(c->swr, c->out.sample_rate);
+  if (isnan(c->base_time)) {
+    rebase(c, time, sample);
+    return;
   }
 
-  const u8 **in_data = NULL;
+  // time-stretched output is timed by its sample count alone
+  if (c->tempo_graph) {
+    return;
+  }
+
+  double drift =
+      time - (c->base_time +
+              (double)(sample - c->base_sample) / c->out.sample_rate);
+  if (fabs(drift) > AUDIO_SYNC_MAX_DRIFT) {
+    log_warn("audio timestamps jumped by %.3fs, rebasing", drift);
+    rebase(c, time, sample);
+    return;
+  }
+
+  c->drift = 0.9 * c->drift + 0.1 * drift;
+  if (fabs(c->drift) < AUDIO_SYNC_THRESHOLD) {
+    return;
+  }
+
+  i32 num_frame_out = (i32)av_rescale(frame->nb_samples, c->out.sample_rate,
+                                      c->dc.cc->sample_rate);
+  i32 max_delta = (i32)(num_frame_out * AUDIO_SYNC_MAX_CORRECTION);
+  i32 delta = (i32)(drift * c->out.sample_rate);
+  if (delta > max_delta) {
+    delta = max_delta;
+  } else if (delta < -max_delta) {
+    delta = -max_delta;
+  }
+  i32 error;
+  if (delta != 0 &&
+      (error = swr_set_compensation(c->swr, delta, num_frame_out)) < 0) {
+    log_warn("unable to compensate audio drift: %s", av_err2str(error));
+    return;
+  }
+
+  c->num_compensated_samples += delta < 0 ? -delta : delta;
+}
+
+static decode_frame_result decode_frame(audio_playback_context *c,
+                                        AVFrame *frame) {
+  decode_frame_result result =
+      decode_context_decode_frame(&c->dc, frame,
+                                  &(decode_frame_info){
+                                      .packet_receive_info =
+                                          {
+                                              .block = true,
+                                              .num_messages = 1,
+                                          },
+                                  });
+  assert(result != DECODE_FRAME_RESULT_TIMEOUT);
+  return result;
+}
+
+static decode_frame_result next_frame(audio_playback_context *c,
+                                      AVFrame *frame) {
+  if (!c->tempo_graph) {
+    return decode_frame(c, frame);
+  }
+
+  AVRational stream_tb = c->dc.fmt->streams[c->dc.si.index]->time_base;
+  while (true) {
+    i32 error = av_buffersink_get_frame(c->tempo_sink, frame);
+    if (error >= 0) {
+      return DECODE_FRAME_RESULT_SUCCESS;
+    } else if (error == AVERROR_EOF) {
+      return DECODE_FRAME_RESULT_EOF;
+    } else if (error != AVERROR(EAGAIN)) {
+      log_error("unable to receive time-stretched frame: %s",
+                av_err2str(error));
+      return DECODE_FRAME_RESULT_ERROR;
+    }
+
+    decode_frame_result result = decode_frame(c, frame);
+    if (result == DECODE_FRAME_RESULT_SUCCESS) {
+      frame->pts = av_rescale_q(frame->best_effort_timestamp, stream_tb,
+                                (AVRational){1, c->dc.cc->sample_rate});
+      error = av_buffersrc_add_frame(c->tempo_src, frame);
+    } else if (result == DECODE_FRAME_RESULT_EOF) {
+      error = av_buffersrc_add_frame(c->tempo_src, NULL);
+    } else {
+      return result;
+    }
+
+    if (error < 0) {
+      log_error("unable to time-stretch frame: %s", av_err2str(error));
+      return DECODE_FRAME_RESULT_ERROR;
+    }
+  }
+}
+
+static bool drop_frames(audio_playback_context *c, AVFrame *frame) {
+  AVRational tb = c->dc.fmt->streams[c->dc.si.index]->time_base;
+  while (true) {
+    decode_frame_result result = decode_frame(c, frame);
+    if (result == DECODE_FRAME_RESULT_ERROR) {
+      log_error("error receiving frame from decoding context");
+      return false;
+    } else if (result == DECODE_FRAME_RESULT_EOF) {
+      return true;
+    }
+
+    double end = (frame->best_effort_timestamp + frame->duration) * av_q2d(tb);
+    av_frame_unref(frame);
+    if (end >= c->drop_until) {
+      return true;
+    }
+  }
+}
+
+// keeps the decoder in step with the clock while playback is too fast to be
+// audible
+static i32 fill_silence(audio_playback_context *c, AVFrame *frame, u8 **data,
+                        i32 total_samples) {
+  if (!drop_frames(c, frame)) {
+    return -1;
+  }
+
+  av_samples_set_silence(data, 0, total_samples, c->out.layout.nb_channels,
+                         c->out.sample_format);
+  return total_samples;
+}
+
+i32 audio_playback_context_decode(audio_playback_context *c, u8 **data,
+                                  i32 total_samples) {
+  AVFrame *frame = c->frame;
+  i32 num_samples = 0;
+  bool planar = av_sample_fmt_is_planar(c->out.sample_format);
+  i32 num_planes = planar ? c->out.layout.nb_channels : 1;
+  i32 sample_stride = planar ? av_get_bytes_per_sample(c->out.sample_format)
+                             : c->out.frame_size;
+  if (c->skip_pending) {
+    c->skip_pending = false;
+    if (!drop_frames(c, frame)) {
+      return -1;
+    }
+  }
+
+  if (c->speed > AUDIO_PLAYBACK_MAX_TEMPO) {
+    i32 num_silent = fill_silence(c, frame, data, total_samples);
+    c->num_out += num_silent > 0 ? num_silent : 0;
+    return num_silent;
+  }
+
+  // output buffered in the SwrContext is drained first, a non-NULL input keeps
+  // it from flushing the resampler
+  const u8 **in_data = (const u8 **)frame->data;
   i32 num_in_data = 0;
-  bool flush = true, eof = false;
-  while (num_samples < total_samples && !eof) {
-    if (!flush) {
-      decode_frame_result decode_result =
-          decode_context_decode_frame(&c->dc, frame,
-                                      &(decode_frame_info){
-                                          .packet_receive_info =
-                                              {
-                                                  .block = true,
-                                                  .num_messages = 1,
-                                              },
-                                      });
-      assert(decode_result != DECODE_FRAME_RESULT_TIMEOUT);
+  bool drain = true;
+  while (num_samples < total_samples && !c->eof) {
+    if (!drain) {
+      decode_frame_result decode_result = next_frame(c, frame);
       if (decode_result == DECODE_FRAME_RESULT_SUCCESS) {
         in_data = (const u8 **)frame->data;
         num_in_data = frame->nb_samples;
+        sync_frame(c, frame);
       } else if (decode_result == DECODE_FRAME_RESULT_ERROR) {
         log_error("error receiving frame from decoding context");
-        goto fail_decode;
+        return -1;
       } else if (decode_result == DECODE_FRAME_RESULT_EOF) {
         in_data = NULL;
         num_in_data = 0;
-        eof = true;
+        c->eof = true;
       }
     } else {
-      flush = false;
+      drain = false;
     }
 
-    u8 *dst = &data[num_samples * c->frame_size];
-    i32 num_converted = swr_convert(c->swr, &dst, total_samples - num_samples,
+    u8 *dst[AV_NUM_DATA_POINTERS];
+    for (i32 i = 0; i < num_planes; ++i) {
+      dst[i] = &data[i][num_samples * sample_stride];
+    }
+    i32 num_converted = swr_convert(c->swr, dst, total_samples - num_samples,
                                     in_data, num_in_data);
     av_frame_unref(frame);
     if (num_converted < 0) {
       log_error("error converting samples: %s", av_err2str(num_converted));
-      goto fail_convert;
+      return -1;
     }
 
     num_samples += num_converted;
+    c->num_out += num_converted;
   }
 
-  alBufferData(buffer, c->al_format, data, num_samples * c->frame_size,
-               c->dc.cc->sample_rate);
-  av_freep(&data);
-  av_frame_free(&frame);
   return num_samples;
-
-fail_convert:
-fail_decode:
-  av_freep(&data);
-fail_alloc_samples:
-  av_frame_free(&frame);
-fail_alloc_frame:
-  return -1;
 }
@@ -6,18 +6,78 @@
 #include <AL/alc.h>
 #include <AL/alext.h>
 #include <libavcodec/codec_par.h>
+#include <libavfilter/avfilter.h>
 #include <libswresample/swresample.h>
 
+// above this speed multiplier audio is muted instead of time-stretched
+#define AUDIO_PLAYBACK_MAX_TEMPO 2.0
+// drift between timestamps and sample count (in seconds) that is corrected
+// by stretching, and the drift above which the stream is rebased instead
+#define AUDIO_SYNC_THRESHOLD 0.01
+#define AUDIO_SYNC_MAX_DRIFT 1.0
+// most a frame is stretched or squeezed by drift compensation
+#define AUDIO_SYNC_MAX_CORRECTION 0.1
+
+// PCM format audio is converted to, interleaved when handed to OpenAL
 typedef struct {
-  decode_context dc;
+  AVChannelLayout layout;
+  enum AVSampleFormat sample_format;
+  i32 sample_rate;
+  // bytes per sample frame (all channels)
   i32 frame_size;
-  AVChannelLayout out_layout;
-  enum AVSampleFormat out_sample_format;
+  // AL_NONE for formats that are processed further before playback
   ALenum al_format;
+} audio_output_format;
+
+typedef struct {
+  decode_context dc;
+  audio_output_format out;
   SwrContext *swr;
+  // reused for every decoded frame
+  AVFrame *frame;
+  bool eof;
+
+  double speed;
+  // pitch-preserving time stretching, NULL at 1x
+  AVFilterGraph *tempo_graph;
+  AVFilterContext *tempo_src;
+  AVFilterContext *tempo_sink;
+  // while muted or after a skip, decoded audio before this media time (in
+  // seconds) is dropped
+  double drop_until;
+  bool skip_pending;
+
+  // sample frames output since init
+  i64 num_out;
+  // media time of output sample base_sample, NAN until the first frame after
+  // a skip or speed change. Later samples advance it by speed / sample_rate.
+  double base_time;
+  i64 base_sample;
+  // bumped whenever base_time/base_sample are set
+  u32 base_serial;
+  // averaged timestamp minus sample count time (in seconds)
+  double drift;
+  i64 num_compensated_samples;
 } audio_playback_context;
 
-bool audio_playback_context_init(audio_playback_context *c, decode_context dc);
+// closest format OpenAL can play to the decoder output, cc may be NULL
+void audio_output_format_init(audio_output_format *f,
+                              const AVCodecContext *cc);
+// float planes for mixing and analysis rather than playback
+void audio_output_format_init_planar(audio_output_format *f,
+                                     i32 num_channels, i32 sample_rate);
+
+// decoded audio is converted to out, which may differ from the source format
+bool audio_playback_context_init(audio_playback_context *c, decode_context dc,
+                                 const audio_output_format *out);
 void audio_playback_context_free(audio_playback_context *c);
-i32 audio_playback_context_fill_buffer(audio_playback_context *c,
-                                        ALuint buffer, i32 total_samples);
+// decodes up to total_samples sample frames into data (one plane per channel
+// for planar formats), less only at the end of the stream, -1 on error
+i32 audio_playback_context_decode(audio_playback_context *c, u8 **data,
+                                  i32 total_samples);
+bool audio_playback_context_set_speed(audio_playback_context *c,
+                                      double speed);
+void audio_playback_context_drop_until(audio_playback_context *c,
+                                       double time);
+// drop decoded audio up to time once, e.g. when joining a clip midway
+void audio_playback_context_skip_to(audio_playback_context *c, double time);
@@ -0,0 +1,199 @@
+#include "analysis.h"
+#include "../media/clip.h"
+#include "al_util.h"
+#include <errno.h>
+#include <log.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// samples per channel handed to the callback at a time
+#define ANALYSIS_BLOCK_SIZE 4096
+#define ANALYSIS_MAX_CHANNELS 8
+
+bool analysis_source_stat(const char *url, analysis_source *s) {
+  struct stat st;
+  if (stat(url, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+
+  s->size = st.st_size;
+  s->mtime = st.st_mtim.tv_sec;
+  return true;
+}
+
+static char *append_suffix(const char *path, const char *suffix) {
+  usize size = strlen(path) + 1 + strlen(suffix) + 1;
+  char *ret = malloc(size);
+  if (ret) {
+    snprintf(ret, size, "%s.%s", path, suffix);
+  }
+
+  return ret;
+}
+
+char *analysis_sidecar_path(const char *url, const char *suffix) {
+  return append_suffix(url, suffix);
+}
+
+static char *temporary_path(const char *path) {
+  return append_suffix(path, "tmp");
+}
+
+FILE *analysis_sidecar_create(const char *path) {
+  char *tmp = temporary_path(path);
+  if (!tmp) {
+    log_error("unable to allocate temporary path");
+    return NULL;
+  }
+
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    log_warn("unable to create '%s': %s", tmp, strerror(errno));
+  }
+
+  free(tmp);
+  return f;
+}
+
+bool analysis_sidecar_commit(FILE *f, const char *path) {
+  char *tmp = temporary_path(path);
+  if (!tmp) {
+    log_error("unable to allocate temporary path");
+    fclose(f);
+    return false;
+  }
+
+  bool ok = true;
+  if (fclose(f) != 0) {
+    log_warn("unable to write '%s': %s", tmp, strerror(errno));
+    unlink(tmp);
+    ok = false;
+  } else if (rename(tmp, path) != 0) {
+    log_warn("unable to replace '%s': %s", path, strerror(errno));
+    unlink(tmp);
+    ok = false;
+  }
+
+  free(tmp);
+  return ok;
+}
+
+void analysis_sidecar_abort(FILE *f, const char *path) {
+  fclose(f);
+  char *tmp = temporary_path(path);
+  if (tmp) {
+    unlink(tmp);
+    free(tmp);
+  }
+}
+
+bool analysis_probe(const char *url, analysis_stream_info *info) {
+  clip c;
+  if (!clip_open(&c, &(clip_open_info){.url = url, .audio_only = true})) {
+    log_error("unable to open audio of '%s' for analysis", url);
+    return false;
+  }
+
+  *info = (analysis_stream_info){
+      .sample_rate = c.audio.cc->sample_rate,
+      .num_channels = c.audio.cc->ch_layout.nb_channels,
+      .start_time = c.start_time,
+      .duration = c.duration,
+  };
+  clip_close(&c);
+  return true;
+}
+
+bool analysis_decode(const char *url, i32 num_channels, double seek,
+                     const atomic_bool *cancel,
+                     void (*on_start)(const analysis_stream_info *, void *),
+                     analysis_block_callback on_block, void *userdata) {
+  float *planes[ANALYSIS_MAX_CHANNELS];
+  if (num_channels > ANALYSIS_MAX_CHANNELS) {
+    log_error("unable to analyze %d channels", num_channels);
+    goto fail_channels;
+  }
+
+  clip c;
+  if (!clip_open(&c, &(clip_open_info){
+                         .url = url,
+                         .audio_only = true,
+                         .seek = seek,
+                     })) {
+    log_error("unable to open audio of '%s' for analysis", url);
+    goto fail_clip;
+  }
+
+  if (!c.has_audio) {
+    log_error("'%s' has no audio to analyze", url);
+    goto fail_audio;
+  }
+
+  audio_output_format out;
+  audio_output_format_init_planar(&out, num_channels,
+                                  c.audio.cc->sample_rate);
+  audio_playback_context apc;
+  if (!audio_playback_context_init(&apc, clip_take_audio(&c), &out)) {
+    log_error("unable to initialize audio decoding for analysis");
+    decode_context_free(&c.audio);
+    goto fail_apc;
+  }
+
+  i32 num_planes;
+  for (num_planes = 0; num_planes < num_channels; ++num_planes) {
+    if (!(planes[num_planes] =
+              malloc(ANALYSIS_BLOCK_SIZE * sizeof *planes[num_planes]))) {
+      log_error("unable to allocate analysis block");
+      goto fail_planes;
+    }
+  }
+
+  on_start(&(analysis_stream_info){.sample_rate = out.sample_rate,
+                                   .num_channels = num_channels,
+                                   .start_time = c.start_time,
+                                   .duration = c.duration},
+           userdata);
+
+  bool ok = true;
+  while (!atomic_load(cancel)) {
+    i64 first = apc.num_out;
+    i32 n = audio_playback_context_decode(&apc, (u8 **)planes,
+                                          ANALYSIS_BLOCK_SIZE);
+    if (n < 0) {
+      log_error("unable to decode audio of '%s' for analysis", url);
+      ok = false;
+      break;
+    }
+
+    // base_time is set by the first frame of the block
+    double time = apc.base_time +
+                  (double)(first - apc.base_sample) / out.sample_rate;
+    if ((n > 0 && !on_block(planes, n, time, userdata)) ||
+        n < ANALYSIS_BLOCK_SIZE) {
+      break;
+    }
+  }
+
+  for (i32 i = 0; i < num_planes; ++i) {
+    free(planes[i]);
+  }
+  audio_playback_context_free(&apc);
+  clip_close(&c);
+  return ok && !atomic_load(cancel);
+
+fail_planes:
+  for (i32 i = 0; i < num_planes; ++i) {
+    free(planes[i]);
+  }
+  audio_playback_context_free(&apc);
+fail_apc:
+fail_audio:
+  clip_close(&c);
+fail_clip:
+fail_channels:
+  return false;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+// identity of a source file, analysis results are stale once it changes
+typedef struct {
+  i64 size;
+  i64 mtime;
+} analysis_source;
+
+// false for URLs that are not local files
+bool analysis_source_stat(const char *url, analysis_source *s);
+// analysis results live next to the source, as <url>.<suffix>
+char *analysis_sidecar_path(const char *url, const char *suffix);
+// writes go to a temporary file that replaces the sidecar on commit, so
+// readers never see a partial file
+FILE *analysis_sidecar_create(const char *path);
+bool analysis_sidecar_commit(FILE *f, const char *path);
+void analysis_sidecar_abort(FILE *f, const char *path);
+
+typedef struct {
+  i32 sample_rate;
+  i32 num_channels;
+  // media time (in seconds) of the first sample
+  double start_time;
+  double duration;
+} analysis_stream_info;
+
+// blocks of decoded samples starting at a media time (in seconds, NAN when
+// the stream has no timestamps), returning false stops decoding
+typedef bool (*analysis_block_callback)(float **planes, i32 n, double time,
+                                        void *userdata);
+
+bool analysis_probe(const char *url, analysis_stream_info *info);
+// decodes the audio of the source from seek seconds after its start to
+// num_channels float planes at its own sample rate, as fast as it decodes.
+// on_start sees the stream before the first block.
+bool analysis_decode(const char *url, i32 num_channels, double seek,
+                     const atomic_bool *cancel,
+                     void (*on_start)(const analysis_stream_info *, void *),
+                     analysis_block_callback on_block, void *userdata);
@@ -0,0 +1,594 @@
+#include "audio_thread.h"
+#include "../utils/threading_utils.h"
+#include <log.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <timespec.h>
+
+// the decode thread polls for room in the ring at this interval (in ns)
+#define DECODE_POLL_TIMEOUT ((i64)5e6)
+
+typedef enum {
+  CMD_MSG_TAG_EXIT,
+  CMD_MSG_TAG_SET_SOURCE,
+  CMD_MSG_TAG_SET_SPEED,
+  CMD_MSG_TAG_DROP_UNTIL,
+  CMD_MSG_TAG_SKIP_TO,
+} cmd_msg_tag;
+
+typedef struct {
+  cmd_msg_tag tag;
+  union {
+    // set source, has_source is false to detach
+    struct {
+      decode_context dc;
+      double offset;
+      bool has_source;
+    };
+    double speed;
+    double time;
+  };
+} cmd_msg;
+
+typedef struct {
+  audio_thread *a;
+  audio_playback_context apc;
+  bool has_source;
+  double speed;
+  u8 *chunk;
+
+  // sample frames written to the ring, in total and before the source
+  i64 num_written;
+  i64 source_start;
+  // timeline time minus media time of the source
+  double offset;
+  u32 base_serial;
+} decode_state;
+
+static void decode_state_push_anchor(decode_state *s,
+                                     const audio_clock_anchor *anchor) {
+  if (spsc_ring_can_write(&s->a->anchors) < sizeof *anchor) {
+    log_warn("audio clock anchor queue full, dropping anchor");
+    return;
+  }
+
+  spsc_ring_write(&s->a->anchors, anchor, sizeof *anchor);
+}
+
+// the clock stops following audio from the next sample written
+static void decode_state_invalidate_clock(decode_state *s) {
+  decode_state_push_anchor(s, &(audio_clock_anchor){
+                                  .sample = s->num_written,
+                                  .time = NAN,
+                                  .speed = 0.0,
+                              });
+}
+
+static void decode_state_detach(decode_state *s) {
+  if (s->has_source) {
+    audio_playback_context_free(&s->apc);
+    s->has_source = false;
+    decode_state_invalidate_clock(s);
+  }
+}
+
+static void decode_state_attach(decode_state *s, decode_context dc,
+                                double offset) {
+  decode_state_detach(s);
+  if (!audio_playback_context_init(&s->apc, dc, &s->a->out)) {
+    log_error("unable to initialize audio playback of source");
+    decode_context_free(&dc);
+    return;
+  }
+
+  s->has_source = true;
+  s->source_start = s->num_written;
+  s->offset = offset;
+  s->base_serial = s->apc.base_serial;
+  if (!audio_playback_context_set_speed(&s->apc, s->speed)) {
+    log_warn("unable to change audio playback speed");
+  }
+}
+
+// returns false on exit
+static bool decode_state_handle_command(decode_state *s, const cmd_msg *cmd) {
+  switch (cmd->tag) {
+  case CMD_MSG_TAG_EXIT:
+    return false;
+  case CMD_MSG_TAG_SET_SOURCE:
+    if (cmd->has_source) {
+      decode_state_attach(s, cmd->dc, cmd->offset);
+    } else {
+      decode_state_detach(s);
+    }
+
+    if (mpmc_send(&s->a->acks_sender,
+                  &(mpmc_send_info){
+                      .block = false,
+                      .num_messages = 1,
+                      .message_data = &s->has_source,
+                  }) != 1) {
+      log_error("unable to acknowledge audio source change");
+    }
+    break;
+  case CMD_MSG_TAG_SET_SPEED:
+    s->speed = cmd->speed;
+    if (s->has_source &&
+        !audio_playback_context_set_speed(&s->apc, cmd->speed)) {
+      log_warn("unable to change audio playback speed");
+    }
+    // muted audio is silence, anchors resume with the next audible speed
+    if (s->has_source && cmd->speed > AUDIO_PLAYBACK_MAX_TEMPO) {
+      decode_state_invalidate_clock(s);
+    }
+    break;
+  case CMD_MSG_TAG_DROP_UNTIL:
+    if (s->has_source) {
+      audio_playback_context_drop_until(&s->apc, cmd->time);
+    }
+    break;
+  case CMD_MSG_TAG_SKIP_TO:
+    if (s->has_source) {
+      audio_playback_context_skip_to(&s->apc, cmd->time);
+    }
+    break;
+  }
+
+  return true;
+}
+
+static int decode_thread_callback(void *arg) {
+  audio_thread *a = arg;
+  decode_state s = {
+      .a = a,
+      .has_source = false,
+      .speed = 1.0,
+      .chunk = malloc(a->chunk_size),
+      .num_written = 0,
+  };
+  if (!s.chunk) {
+    log_error("unable to allocate audio chunk");
+    return 1;
+  }
+
+  i32 samples_per_chunk = a->chunk_size / a->out.frame_size;
+  while (true) {
+    bool decodable = s.has_source && !s.apc.eof;
+    bool ring_full = spsc_ring_can_write(&a->ring) < (usize)a->chunk_size;
+    cmd_msg cmd;
+    i32 num_messages = mpmc_receive(
+        &a->cmds_receiver,
+        &(mpmc_receive_info){
+            .block = !decodable || ring_full,
+            .timeout = decodable ? &(i64){DECODE_POLL_TIMEOUT} : NULL,
+            .num_messages = 1,
+            .message_data = &cmd,
+        });
+    if (num_messages < 0) {
+      log_error("error receiving message from audio command queue");
+      break;
+    }
+
+    if (num_messages == 1) {
+      if (!decode_state_handle_command(&s, &cmd)) {
+        break;
+      }
+      continue;
+    }
+
+    if (!decodable || ring_full) {
+      continue;
+    }
+
+    i32 num_samples =
+        audio_playback_context_decode(&s.apc, &s.chunk, samples_per_chunk);
+    if (num_samples < 0) {
+      log_error("unable to decode audio, detaching source");
+      decode_state_detach(&s);
+      continue;
+    }
+
+    // anchors go out before their samples, so the output thread has them
+    // when it gets there
+    if (s.apc.base_serial != s.base_serial) {
+      s.base_serial = s.apc.base_serial;
+      decode_state_push_anchor(&s, &(audio_clock_anchor){
+                                       .sample = s.source_start +
+                                                 s.apc.base_sample,
+                                       .time = s.apc.base_time + s.offset,
+                                       .speed = s.speed,
+                                   });
+    }
+
+    atomic_store(&a->drift, s.apc.drift);
+    atomic_store(&a->num_compensated_samples, s.apc.num_compensated_samples);
+    spsc_ring_write(&a->ring, s.chunk, num_samples * a->out.frame_size);
+    s.num_written += num_samples;
+  }
+
+  decode_state_detach(&s);
+  free(s.chunk);
+  return 0;
+}
+
+static void set_realtime_priority(void) {
+  struct sched_param param = {
+      .sched_priority = sched_get_priority_min(SCHED_FIFO),
+  };
+  i32 error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (error) {
+    log_warn("unable to raise audio thread to real-time priority: %s",
+             strerror(error));
+  }
+}
+
+typedef struct {
+  audio_thread *a;
+  u8 *chunk;
+  ALuint free_buffers[AUDIO_THREAD_MAX_BUFFERS];
+  i32 num_free_buffers;
+  // buffers generated for the source so far
+  i32 num_buffers;
+  bool playing;
+  bool starved;
+
+  // sample frames of all buffers played to the end
+  i64 num_played;
+  audio_clock_anchor anchor;
+  audio_clock_anchor next_anchor;
+  bool has_next_anchor;
+} output_state;
+
+// returns false once the ring had nothing for a free buffer
+static bool output_state_queue_buffer(output_state *s) {
+  audio_thread *a = s->a;
+  usize size =
+      spsc_ring_read(&a->ring, s->chunk, (usize)a->chunk_size) /
+      a->out.frame_size * a->out.frame_size;
+  if (size == 0) {
+    return false;
+  }
+
+  ALuint buffer = s->free_buffers[--s->num_free_buffers];
+  alBufferData(buffer, a->out.al_format, s->chunk, (ALsizei)size,
+               a->out.sample_rate);
+  alSourceQueueBuffers(a->source, 1, &buffer);
+  return true;
+}
+
+static void output_state_update(output_state *s) {
+  audio_thread *a = s->a;
+  bool paused = atomic_load(&a->paused);
+  if (paused) {
+    if (s->playing) {
+      alSourcePause(a->source);
+      s->playing = false;
+    }
+    return;
+  }
+
+  ALint num_processed;
+  alGetSourcei(a->source, AL_BUFFERS_PROCESSED, &num_processed);
+  for (i32 i = 0; i < num_processed; ++i) {
+    ALuint buffer;
+    ALint size;
+    alSourceUnqueueBuffers(a->source, 1, &buffer);
+    alGetBufferi(buffer, AL_SIZE, &size);
+    s->num_played += size / a->out.frame_size;
+    s->free_buffers[s->num_free_buffers++] = buffer;
+  }
+
+  ALint state;
+  alGetSourcei(a->source, AL_SOURCE_STATE, &state);
+  if (s->playing && state == AL_STOPPED) {
+    s->playing = false;
+    // the ring had PCM, so this thread was too late to queue it: queue deeper
+    // from now on
+    if (spsc_ring_can_read(&a->ring) >= (usize)a->chunk_size) {
+      atomic_fetch_add(&a->num_underruns, 1);
+      if (s->num_buffers < AUDIO_THREAD_MAX_BUFFERS) {
+        s->free_buffers[s->num_free_buffers++] = a->buffers[s->num_buffers++];
+        atomic_store(&a->num_buffers, s->num_buffers);
+      }
+    }
+  }
+
+  while (s->num_free_buffers > 0) {
+    if (!output_state_queue_buffer(s)) {
+      // counted once per stretch of the source running empty
+      if (s->num_free_buffers == s->num_buffers && !s->starved) {
+        atomic_fetch_add(&a->num_ring_underflows, 1);
+        s->starved = true;
+      }
+      break;
+    }
+    s->starved = false;
+  }
+
+  // restart once the queue is full again, so an underrun does not turn into
+  // a series of tiny ones
+  if (!s->playing && s->num_free_buffers == 0) {
+    alSourcePlay(a->source);
+    s->playing = true;
+  }
+}
+
+// the played position is the samples of unqueued buffers plus the offset
+// into the buffer at the head of the queue
+static void output_state_publish_clock(output_state *s) {
+  audio_thread *a = s->a;
+  ALint offset = 0;
+  if (s->playing) {
+    alGetSourcei(a->source, AL_SAMPLE_OFFSET, &offset);
+  }
+
+  i64 position = s->num_played + offset;
+  while (true) {
+    if (!s->has_next_anchor) {
+      s->has_next_anchor =
+          spsc_ring_read(&a->anchors, &s->next_anchor,
+                         sizeof s->next_anchor) == sizeof s->next_anchor;
+    }
+    if (!s->has_next_anchor || s->next_anchor.sample > position) {
+      break;
+    }
+
+    s->anchor = s->next_anchor;
+    s->has_next_anchor = false;
+  }
+
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  mtx_lock(&a->clock_mutex);
+  a->clock_valid = s->playing && !isnan(s->anchor.time);
+  a->clock_time = s->anchor.time + (double)(position - s->anchor.sample) /
+                                       a->out.sample_rate * s->anchor.speed;
+  a->clock_speed = s->anchor.speed;
+  a->clock_wall = now;
+  mtx_unlock(&a->clock_mutex);
+}
+
+static int output_thread_callback(void *arg) {
+  audio_thread *a = arg;
+  set_realtime_priority();
+
+  output_state s = {
+      .a = a,
+      .chunk = malloc(a->chunk_size),
+      .num_free_buffers = 0,
+      .num_buffers = AUDIO_THREAD_NUM_BUFFERS_DEFAULT,
+      .playing = false,
+      .starved = true,
+      .num_played = 0,
+      .anchor = {.sample = 0, .time = NAN, .speed = 0.0},
+      .has_next_anchor = false,
+  };
+  if (!s.chunk) {
+    log_error("unable to allocate audio chunk");
+    return 1;
+  }
+
+  for (i32 i = 0; i < s.num_buffers; ++i) {
+    s.free_buffers[s.num_free_buffers++] = a->buffers[i];
+  }
+
+  struct timespec interval = {
+      .tv_nsec = (long)(AUDIO_THREAD_CHUNK_DURATION / 2 * 1e9),
+  };
+  while (!atomic_load(&a->exit)) {
+    output_state_update(&s);
+    output_state_publish_clock(&s);
+    thrd_sleep(&interval, NULL);
+  }
+
+  alSourceStop(a->source);
+  free(s.chunk);
+  return 0;
+}
+
+static bool send_command(audio_thread *a, const cmd_msg *cmd) {
+  if (mpmc_send(&a->cmds, &(mpmc_send_info){
+                              .block = false,
+                              .num_messages = 1,
+                              .message_data = cmd,
+                          }) != 1) {
+    log_error("unable to send audio thread command");
+    return false;
+  }
+
+  return true;
+}
+
+bool audio_thread_init(audio_thread *a, const audio_output_format *out) {
+  a->out = *out;
+  a->chunk_size = (i32)(out->sample_rate * AUDIO_THREAD_CHUNK_DURATION) *
+                  out->frame_size;
+  atomic_init(&a->exit, false);
+  atomic_init(&a->paused, false);
+  atomic_init(&a->num_underruns, 0);
+  atomic_init(&a->num_ring_underflows, 0);
+  atomic_init(&a->num_buffers, AUDIO_THREAD_NUM_BUFFERS_DEFAULT);
+  atomic_init(&a->drift, 0.0);
+  atomic_init(&a->num_compensated_samples, 0);
+  a->clock_valid = false;
+
+  if (!spsc_ring_init(&a->ring, (usize)(out->sample_rate *
+                                         AUDIO_THREAD_RING_DURATION) *
+                                     out->frame_size)) {
+    log_error("unable to initialize PCM ring");
+    goto fail_ring;
+  }
+
+  if (!spsc_ring_init(&a->anchors,
+                      AUDIO_THREAD_MAX_ANCHORS * sizeof(audio_clock_anchor))) {
+    log_error("unable to initialize audio clock anchor ring");
+    goto fail_anchors;
+  }
+
+  i32 error;
+  if ((error = mtx_init(&a->clock_mutex, mtx_plain)) != thrd_success) {
+    log_error("unable to initialize audio clock mutex: %s",
+              thrd_error_to_string(error));
+    goto fail_clock_mutex;
+  }
+
+  alGenBuffers(AUDIO_THREAD_MAX_BUFFERS, a->buffers);
+  alGenSources(1, &a->source);
+  ALenum al_error;
+  if ((al_error = alGetError()) != AL_NO_ERROR) {
+    log_error("unable to create OpenAL source: %s", alGetString(al_error));
+    goto fail_al;
+  }
+
+  if (!mpmc_init(
+          &(mpmc_init_info){
+              .enable_timeout = true,
+              .message_size = sizeof(cmd_msg),
+              .auto_grow = true,
+              .initial_num_messages = 8,
+          },
+          &a->cmds, &a->cmds_receiver)) {
+    log_error("unable to initialize audio command MPMC channels");
+    goto fail_cmd_mpmc;
+  }
+
+  if (!mpmc_init(
+          &(mpmc_init_info){
+              .enable_timeout = false,
+              .message_size = sizeof(bool),
+              .auto_grow = true,
+              .initial_num_messages = 1,
+          },
+          &a->acks_sender, &a->acks)) {
+    log_error("unable to initialize audio ack MPMC channels");
+    goto fail_ack_mpmc;
+  }
+
+  if ((error = thrd_create(&a->decode_thread, decode_thread_callback, a)) !=
+      thrd_success) {
+    log_error("unable to start audio decode thread: %s",
+              thrd_error_to_string(error));
+    goto fail_decode_thread;
+  }
+
+  if ((error = thrd_create(&a->output_thread, output_thread_callback, a)) !=
+      thrd_success) {
+    log_error("unable to start audio output thread: %s",
+              thrd_error_to_string(error));
+    goto fail_output_thread;
+  }
+
+  return true;
+
+fail_output_thread:
+  send_command(a, &(cmd_msg){.tag = CMD_MSG_TAG_EXIT});
+  thrd_join(a->decode_thread, NULL);
+fail_decode_thread:
+  mpmc_free(MPMC_COMMON_HANDLE(a->acks));
+fail_ack_mpmc:
+  mpmc_free(MPMC_COMMON_HANDLE(a->cmds));
+fail_cmd_mpmc:
+fail_al:
+  alDeleteSources(1, &a->source);
+  alDeleteBuffers(AUDIO_THREAD_MAX_BUFFERS, a->buffers);
+  mtx_destroy(&a->clock_mutex);
+fail_clock_mutex:
+  spsc_ring_free(&a->anchors);
+fail_anchors:
+  spsc_ring_free(&a->ring);
+fail_ring:
+  return false;
+}
+
+void audio_thread_free(audio_thread *a) {
+  atomic_store(&a->exit, true);
+  if (thrd_join(a->output_thread, NULL) != thrd_success) {
+    log_warn("unable to join audio output thread");
+  }
+  if (!send_command(a, &(cmd_msg){.tag = CMD_MSG_TAG_EXIT}) ||
+      thrd_join(a->decode_thread, NULL) != thrd_success) {
+    log_warn("unable to join audio decode thread");
+  }
+
+  mpmc_free(MPMC_COMMON_HANDLE(a->acks));
+  mpmc_free(MPMC_COMMON_HANDLE(a->cmds));
+  alDeleteSources(1, &a->source);
+  alDeleteBuffers(AUDIO_THREAD_MAX_BUFFERS, a->buffers);
+  mtx_destroy(&a->clock_mutex);
+  spsc_ring_free(&a->anchors);
+  spsc_ring_free(&a->ring);
+}
+
+bool audio_thread_set_source(audio_thread *a, decode_context *dc,
+                             double offset) {
+  cmd_msg cmd = {
+      .tag = CMD_MSG_TAG_SET_SOURCE,
+      .offset = offset,
+      .has_source = dc != NULL,
+  };
+  if (dc) {
+    cmd.dc = *dc;
+  }
+  if (!send_command(a, &cmd)) {
+    if (dc) {
+      decode_context_free(dc);
+    }
+    return false;
+  }
+
+  bool attached;
+  if (mpmc_receive(&a->acks, &(mpmc_receive_info){
+                                 .block = true,
+                                 .num_messages = 1,
+                                 .message_data = &attached,
+                             }) != 1) {
+    log_error("unable to receive audio source change acknowledgement");
+    return false;
+  }
+
+  return attached || !dc;
+}
+
+bool audio_thread_set_speed(audio_thread *a, double speed) {
+  return send_command(a,
+                      &(cmd_msg){.tag = CMD_MSG_TAG_SET_SPEED, .speed = speed});
+}
+
+bool audio_thread_drop_until(audio_thread *a, double time) {
+  return send_command(a,
+                      &(cmd_msg){.tag = CMD_MSG_TAG_DROP_UNTIL, .time = time});
+}
+
+bool audio_thread_skip_to(audio_thread *a, double time) {
+  return send_command(a, &(cmd_msg){.tag = CMD_MSG_TAG_SKIP_TO, .time = time});
+}
+
+void audio_thread_set_paused(audio_thread *a, bool paused) {
+  atomic_store(&a->paused, paused);
+}
+
+void audio_thread_get_stats(audio_thread *a, audio_thread_stats *stats) {
+  stats->num_underruns = atomic_load(&a->num_underruns);
+  stats->num_ring_underflows = atomic_load(&a->num_ring_underflows);
+  stats->num_buffers = atomic_load(&a->num_buffers);
+  stats->ring_fill = (double)spsc_ring_can_read(&a->ring) /
+                     a->out.frame_size / a->out.sample_rate;
+  stats->drift = atomic_load(&a->drift);
+  stats->num_compensated_samples = atomic_load(&a->num_compensated_samples);
+}
+
+bool audio_thread_clock_time(audio_thread *a, double *time) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  mtx_lock(&a->clock_mutex);
+  bool valid = a->clock_valid;
+  if (valid) {
+    double elapsed = timespec_to_double(timespec_sub(now, a->clock_wall));
+    *time = a->clock_time + elapsed * a->clock_speed;
+  }
+  mtx_unlock(&a->clock_mutex);
+  return valid;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "../media/decode_thread.h"
+#include "../utils/mpmc.h"
+#include "../utils/spsc_ring.h"
+#include "../utils/types.h"
+#include "al_util.h"
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+
+// PCM handed to OpenAL per buffer
+#define AUDIO_THREAD_CHUNK_DURATION 0.01
+#define AUDIO_THREAD_RING_DURATION 0.2
+// buffers queued on the source at start, grown on every underrun
+#define AUDIO_THREAD_NUM_BUFFERS_DEFAULT 4
+#define AUDIO_THREAD_MAX_BUFFERS 32
+#define AUDIO_THREAD_MAX_ANCHORS 64
+
+// maps the PCM stream onto the timeline from a sample on, until the next
+// anchor
+typedef struct {
+  // sample frames written to the ring before this one
+  i64 sample;
+  // timeline time (in seconds) of the sample, NAN while audio cannot be the
+  // master clock (detached, muted)
+  double time;
+  double speed;
+} audio_clock_anchor;
+
+typedef struct {
+  // source ran dry and had to be restarted
+  i32 num_underruns;
+  // an OpenAL buffer was free but the ring had nothing to fill it with
+  i32 num_ring_underflows;
+  i32 num_buffers;
+  // seconds of PCM waiting in the ring
+  double ring_fill;
+  // averaged difference of audio timestamps and sample count (in seconds),
+  // and the samples inserted or removed to correct it
+  double drift;
+  i64 num_compensated_samples;
+} audio_thread_stats;
+
+typedef struct {
+  audio_output_format out;
+  // bytes per chunk
+  i32 chunk_size;
+  spsc_ring ring;
+  // audio_clock_anchor entries, in the order of the samples they refer to
+  spsc_ring anchors;
+
+  ALuint source;
+  ALuint buffers[AUDIO_THREAD_MAX_BUFFERS];
+
+  thrd_t decode_thread;
+  thrd_t output_thread;
+  mpmc_sender cmds;
+  mpmc_receiver cmds_receiver;
+  mpmc_sender acks_sender;
+  mpmc_receiver acks;
+
+  atomic_bool exit;
+  atomic_bool paused;
+  atomic_int num_underruns;
+  atomic_int num_ring_underflows;
+  atomic_int num_buffers;
+  _Atomic double drift;
+  atomic_llong num_compensated_samples;
+
+  // timeline time of the sample being played, published by the output thread
+  mtx_t clock_mutex;
+  bool clock_valid;
+  double clock_time;
+  double clock_speed;
+  struct timespec clock_wall;
+} audio_thread;
+
+// decodes and resamples on one thread into a PCM ring, which a real-time
+// priority thread feeds to OpenAL, the AL context must be current
+bool audio_thread_init(audio_thread *a, const audio_output_format *out);
+void audio_thread_free(audio_thread *a);
+
+// takes ownership of dc, NULL detaches the current source. Media time plus
+// offset is timeline time. Returns once the previous source is freed, so its
+// clip can be closed right after.
+bool audio_thread_set_source(audio_thread *a, decode_context *dc,
+                             double offset);
+bool audio_thread_set_speed(audio_thread *a, double speed);
+bool audio_thread_drop_until(audio_thread *a, double time);
+bool audio_thread_skip_to(audio_thread *a, double time);
+void audio_thread_set_paused(audio_thread *a, bool paused);
+void audio_thread_get_stats(audio_thread *a, audio_thread_stats *stats);
+// timeline time of the sample heard now, false while audio is not playing at
+// a speed it can be the master clock for
+bool audio_thread_clock_time(audio_thread *a, double *time);
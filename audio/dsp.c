@@ -0,0 +1,215 @@
+#include "dsp.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void dsp_clear(float *dst, i32 n) { memset(dst, 0, n * sizeof *dst); }
+
+void dsp_mix_ramp(float *restrict dst, const float *restrict src, i32 n,
+                  float gain0, float gain1) {
+  float step = (gain1 - gain0) / n;
+  i32 i = 0;
+#ifdef __SSE2__
+  __m128 gain = _mm_setr_ps(gain0, gain0 + step, gain0 + 2 * step,
+                            gain0 + 3 * step);
+  __m128 gain_step = _mm_set1_ps(4 * step);
+  for (; i + 4 <= n; i += 4) {
+    __m128 d = _mm_loadu_ps(&dst[i]);
+    __m128 s = _mm_loadu_ps(&src[i]);
+    _mm_storeu_ps(&dst[i], _mm_add_ps(d, _mm_mul_ps(s, gain)));
+    gain = _mm_add_ps(gain, gain_step);
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] += src[i] * (gain0 + step * i);
+  }
+}
+
+void dsp_mul_ramp(float *dst, i32 n, float gain0, float gain1) {
+  float step = (gain1 - gain0) / n;
+  i32 i = 0;
+#ifdef __SSE2__
+  __m128 gain = _mm_setr_ps(gain0, gain0 + step, gain0 + 2 * step,
+                            gain0 + 3 * step);
+  __m128 gain_step = _mm_set1_ps(4 * step);
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(&dst[i], _mm_mul_ps(_mm_loadu_ps(&dst[i]), gain));
+    gain = _mm_add_ps(gain, gain_step);
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] *= gain0 + step * i;
+  }
+}
+
+float dsp_peak(const float *src, i32 n) {
+  float peak = 0.0f;
+  i32 i = 0;
+#ifdef __SSE2__
+  // clearing the sign bit is the absolute value
+  __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 peaks = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4) {
+    peaks = _mm_max_ps(peaks, _mm_and_ps(_mm_loadu_ps(&src[i]), abs_mask));
+  }
+  peaks = _mm_max_ps(peaks, _mm_movehl_ps(peaks, peaks));
+  peaks = _mm_max_ss(peaks, _mm_shuffle_ps(peaks, peaks, 1));
+  peak = _mm_cvtss_f32(peaks);
+#endif
+  for (; i < n; ++i) {
+    peak = fmaxf(peak, fabsf(src[i]));
+  }
+
+  return peak;
+}
+
+void dsp_min_max_sum_sq(const float *src, i32 n, float *min, float *max,
+                        float *sum_sq) {
+  float lo = INFINITY, hi = -INFINITY, sum = 0.0f;
+  i32 i = 0;
+#ifdef __SSE2__
+  __m128 los = _mm_set1_ps(INFINITY), his = _mm_set1_ps(-INFINITY);
+  __m128 sums = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4) {
+    __m128 s = _mm_loadu_ps(&src[i]);
+    los = _mm_min_ps(los, s);
+    his = _mm_max_ps(his, s);
+    sums = _mm_add_ps(sums, _mm_mul_ps(s, s));
+  }
+  los = _mm_min_ps(los, _mm_movehl_ps(los, los));
+  lo = _mm_cvtss_f32(_mm_min_ss(los, _mm_shuffle_ps(los, los, 1)));
+  his = _mm_max_ps(his, _mm_movehl_ps(his, his));
+  hi = _mm_cvtss_f32(_mm_max_ss(his, _mm_shuffle_ps(his, his, 1)));
+  sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+  sum = _mm_cvtss_f32(_mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1)));
+#endif
+  for (; i < n; ++i) {
+    lo = fminf(lo, src[i]);
+    hi = fmaxf(hi, src[i]);
+    sum += src[i] * src[i];
+  }
+
+  *min = lo;
+  *max = hi;
+  *sum_sq = sum;
+}
+
+float dsp_sum_sq(const float *src, i32 n) {
+  float sum = 0.0f;
+  i32 i = 0;
+#ifdef __SSE2__
+  __m128 sums = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4) {
+    __m128 s = _mm_loadu_ps(&src[i]);
+    sums = _mm_add_ps(sums, _mm_mul_ps(s, s));
+  }
+  sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+  sum = _mm_cvtss_f32(_mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1)));
+#endif
+  for (; i < n; ++i) {
+    sum += src[i] * src[i];
+  }
+
+  return sum;
+}
+
+// all phases of one input sample are computed in one vector
+float dsp_true_peak(const float *src, i32 n, const float *taps) {
+  float peak = 0.0f;
+#if defined(__SSE2__) && DSP_TRUE_PEAK_PHASES == 4
+  __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 peaks = _mm_setzero_ps();
+  for (i32 i = 0; i < n; ++i) {
+    __m128 y = _mm_setzero_ps();
+    for (i32 k = 0; k < DSP_TRUE_PEAK_TAPS; ++k) {
+      y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(src[i - k]),
+                                   _mm_loadu_ps(&taps[k * 4])));
+    }
+    peaks = _mm_max_ps(peaks, _mm_and_ps(y, abs_mask));
+  }
+  peaks = _mm_max_ps(peaks, _mm_movehl_ps(peaks, peaks));
+  peaks = _mm_max_ss(peaks, _mm_shuffle_ps(peaks, peaks, 1));
+  peak = _mm_cvtss_f32(peaks);
+#else
+  for (i32 i = 0; i < n; ++i) {
+    for (i32 p = 0; p < DSP_TRUE_PEAK_PHASES; ++p) {
+      float y = 0.0f;
+      for (i32 k = 0; k < DSP_TRUE_PEAK_TAPS; ++k) {
+        y += src[i - k] * taps[k * DSP_TRUE_PEAK_PHASES + p];
+      }
+      peak = fmaxf(peak, fabsf(y));
+    }
+  }
+#endif
+
+  return peak;
+}
+
+static void biquad_scalar(float *p, i32 n, const dsp_biquad_coeffs *c,
+                          float *z1, float *z2) {
+  float s1 = *z1, s2 = *z2;
+  for (i32 i = 0; i < n; ++i) {
+    float x = p[i];
+    float y = c->b0 * x + s1;
+    s1 = c->b1 * x - c->a1 * y + s2;
+    s2 = c->b2 * x - c->a2 * y;
+    p[i] = y;
+  }
+  *z1 = s1;
+  *z2 = s2;
+}
+
+// the recursion runs along time, so channels are the lanes: blocks of four
+// samples per channel are loaded whole and transposed so that each vector
+// holds one sample of every channel
+void dsp_biquad(float **planes, i32 num_channels, i32 n,
+                const dsp_biquad_coeffs *c, float *z1, float *z2) {
+  i32 i = 0;
+#ifdef __SSE2__
+  float s1[DSP_MAX_CHANNELS] = {0}, s2[DSP_MAX_CHANNELS] = {0};
+  for (i32 ch = 0; ch < num_channels; ++ch) {
+    s1[ch] = z1[ch];
+    s2[ch] = z2[ch];
+  }
+
+  __m128 b0 = _mm_set1_ps(c->b0), b1 = _mm_set1_ps(c->b1),
+         b2 = _mm_set1_ps(c->b2), a1 = _mm_set1_ps(c->a1),
+         a2 = _mm_set1_ps(c->a2);
+  __m128 v1 = _mm_loadu_ps(s1), v2 = _mm_loadu_ps(s2);
+  for (; i + 4 <= n; i += 4) {
+    __m128 x[DSP_MAX_CHANNELS];
+    for (i32 ch = 0; ch < DSP_MAX_CHANNELS; ++ch) {
+      x[ch] = ch < num_channels ? _mm_loadu_ps(&planes[ch][i])
+                                : _mm_setzero_ps();
+    }
+    _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+
+    for (i32 k = 0; k < 4; ++k) {
+      __m128 y = _mm_add_ps(_mm_mul_ps(b0, x[k]), v1);
+      v1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x[k]), _mm_mul_ps(a1, y)),
+                      v2);
+      v2 = _mm_sub_ps(_mm_mul_ps(b2, x[k]), _mm_mul_ps(a2, y));
+      x[k] = y;
+    }
+
+    _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+    for (i32 ch = 0; ch < num_channels; ++ch) {
+      _mm_storeu_ps(&planes[ch][i], x[ch]);
+    }
+  }
+
+  _mm_storeu_ps(s1, v1);
+  _mm_storeu_ps(s2, v2);
+  for (i32 ch = 0; ch < num_channels; ++ch) {
+    z1[ch] = s1[ch];
+    z2[ch] = s2[ch];
+  }
+#endif
+
+  for (i32 ch = 0; ch < num_channels; ++ch) {
+    biquad_scalar(&planes[ch][i], n - i, c, &z1[ch], &z2[ch]);
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../utils/types.h"
+
+// float kernels on blocks of samples, vectorised where the target allows,
+// buffers must not overlap
+
+// channels processed side by side in one vector
+#define DSP_MAX_CHANNELS 4
+// polyphase interpolator of dsp_true_peak
+#define DSP_TRUE_PEAK_PHASES 4
+#define DSP_TRUE_PEAK_TAPS 12
+
+// normalized by a0, transposed direct form II
+typedef struct {
+  float b0, b1, b2, a1, a2;
+} dsp_biquad_coeffs;
+
+void dsp_clear(float *dst, i32 n);
+// dst[i] += src[i] * gain, with gain going linearly from gain0 at i = 0
+// towards gain1 at i = n
+void dsp_mix_ramp(float *restrict dst, const float *restrict src, i32 n,
+                  float gain0, float gain1);
+// dst[i] *= gain, ramped like dsp_mix_ramp
+void dsp_mul_ramp(float *dst, i32 n, float gain0, float gain1);
+// largest absolute sample
+float dsp_peak(const float *src, i32 n);
+// smallest and largest sample and the sum of squares
+void dsp_min_max_sum_sq(const float *src, i32 n, float *min, float *max,
+                        float *sum_sq);
+float dsp_sum_sq(const float *src, i32 n);
+// largest absolute sample of src upsampled by DSP_TRUE_PEAK_PHASES.
+// src[-DSP_TRUE_PEAK_TAPS + 1] to src[-1] are the history of the filter and
+// taps[tap * DSP_TRUE_PEAK_PHASES + phase] its coefficients.
+float dsp_true_peak(const float *src, i32 n, const float *taps);
+// filters num_channels planes in place, z1 and z2 hold the state per channel
+void dsp_biquad(float **planes, i32 num_channels, i32 n,
+                const dsp_biquad_coeffs *c, float *z1, float *z2);
@@ -0,0 +1,336 @@
+#include "effects.h"
+#include <log.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timespec.h>
+
+static const char *effect_type_to_string(effect_type type) {
+  switch (type) {
+  case EFFECT_TYPE_EQ:
+    return "eq";
+  case EFFECT_TYPE_COMPRESSOR:
+    return "compressor";
+  case EFFECT_TYPE_LIMITER:
+    return "limiter";
+  default:
+    return "unknown";
+  }
+}
+
+static float db_to_gain(float db) { return powf(10.0f, db / 20.0f); }
+
+// RBJ audio EQ cookbook
+static void update_eq_coeffs(effect_chain *c, effect *e) {
+  float w0 = 2.0f * (float)M_PI * e->params[EQ_PARAM_FREQUENCY] /
+             c->sample_rate;
+  float cos_w0 = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * e->params[EQ_PARAM_Q]);
+  float a = powf(10.0f, e->params[EQ_PARAM_GAIN] / 40.0f);
+  float sqrt_a_alpha = 2.0f * sqrtf(a) * alpha;
+  float b0, b1, b2, a0, a1, a2;
+  switch (e->eq.type) {
+  case EQ_TYPE_PEAK:
+    b0 = 1.0f + alpha * a;
+    b1 = -2.0f * cos_w0;
+    b2 = 1.0f - alpha * a;
+    a0 = 1.0f + alpha / a;
+    a1 = -2.0f * cos_w0;
+    a2 = 1.0f - alpha / a;
+    break;
+  case EQ_TYPE_LOW_SHELF:
+    b0 = a * ((a + 1.0f) - (a - 1.0f) * cos_w0 + sqrt_a_alpha);
+    b1 = 2.0f * a * ((a - 1.0f) - (a + 1.0f) * cos_w0);
+    b2 = a * ((a + 1.0f) - (a - 1.0f) * cos_w0 - sqrt_a_alpha);
+    a0 = (a + 1.0f) + (a - 1.0f) * cos_w0 + sqrt_a_alpha;
+    a1 = -2.0f * ((a - 1.0f) + (a + 1.0f) * cos_w0);
+    a2 = (a + 1.0f) + (a - 1.0f) * cos_w0 - sqrt_a_alpha;
+    break;
+  case EQ_TYPE_HIGH_SHELF:
+    b0 = a * ((a + 1.0f) + (a - 1.0f) * cos_w0 + sqrt_a_alpha);
+    b1 = -2.0f * a * ((a - 1.0f) + (a + 1.0f) * cos_w0);
+    b2 = a * ((a + 1.0f) + (a - 1.0f) * cos_w0 - sqrt_a_alpha);
+    a0 = (a + 1.0f) - (a - 1.0f) * cos_w0 + sqrt_a_alpha;
+    a1 = 2.0f * ((a - 1.0f) - (a + 1.0f) * cos_w0);
+    a2 = (a + 1.0f) - (a - 1.0f) * cos_w0 - sqrt_a_alpha;
+    break;
+  case EQ_TYPE_LOW_PASS:
+    b0 = (1.0f - cos_w0) / 2.0f;
+    b1 = 1.0f - cos_w0;
+    b2 = (1.0f - cos_w0) / 2.0f;
+    a0 = 1.0f + alpha;
+    a1 = -2.0f * cos_w0;
+    a2 = 1.0f - alpha;
+    break;
+  case EQ_TYPE_HIGH_PASS:
+  default:
+    b0 = (1.0f + cos_w0) / 2.0f;
+    b1 = -(1.0f + cos_w0);
+    b2 = (1.0f + cos_w0) / 2.0f;
+    a0 = 1.0f + alpha;
+    a1 = -2.0f * cos_w0;
+    a2 = 1.0f - alpha;
+    break;
+  }
+
+  e->eq.coeffs = (dsp_biquad_coeffs){
+      .b0 = b0 / a0,
+      .b1 = b1 / a0,
+      .b2 = b2 / a0,
+      .a1 = a1 / a0,
+      .a2 = a2 / a0,
+  };
+}
+
+void effect_chain_init(effect_chain *c, i32 sample_rate, i32 num_channels) {
+  c->sample_rate = sample_rate;
+  c->num_channels =
+      num_channels > DSP_MAX_CHANNELS ? DSP_MAX_CHANNELS : num_channels;
+  c->num_effects = 0;
+}
+
+void effect_chain_free(effect_chain *c) {
+  for (i32 i = 0; i < c->num_effects; ++i) {
+    effect *e = &c->effects[i];
+    if (e->type == EFFECT_TYPE_LIMITER) {
+      for (i32 ch = 0; ch < c->num_channels; ++ch) {
+        free(e->limiter.delay[ch]);
+      }
+    }
+  }
+
+  c->num_effects = 0;
+}
+
+static effect *add_effect(effect_chain *c, effect_type type,
+                          const float *params, i32 num_params) {
+  if (c->num_effects == EFFECT_CHAIN_MAX_EFFECTS) {
+    log_error("effect chain is full, unable to add %s",
+              effect_type_to_string(type));
+    return NULL;
+  }
+
+  effect *e = &c->effects[c->num_effects];
+  memset(e, 0, sizeof *e);
+  e->type = type;
+  memcpy(e->params, params, num_params * sizeof *params);
+  memcpy(e->targets, params, num_params * sizeof *params);
+  return e;
+}
+
+i32 effect_chain_add_eq(effect_chain *c, eq_type type, float frequency,
+                        float q, float gain) {
+  effect *e = add_effect(c, EFFECT_TYPE_EQ, (float[]){frequency, q, gain}, 3);
+  if (!e) {
+    return -1;
+  }
+
+  e->eq.type = type;
+  update_eq_coeffs(c, e);
+  return c->num_effects++;
+}
+
+i32 effect_chain_add_compressor(effect_chain *c, float threshold, float ratio,
+                                float attack, float release, float makeup) {
+  effect *e =
+      add_effect(c, EFFECT_TYPE_COMPRESSOR,
+                 (float[]){threshold, ratio, attack, release, makeup}, 5);
+  if (!e) {
+    return -1;
+  }
+
+  e->compressor.envelope = -INFINITY;
+  e->compressor.gain = db_to_gain(makeup);
+  return c->num_effects++;
+}
+
+i32 effect_chain_add_limiter(effect_chain *c, float ceiling, float release) {
+  effect *e =
+      add_effect(c, EFFECT_TYPE_LIMITER, (float[]){ceiling, release}, 2);
+  if (!e) {
+    return -1;
+  }
+
+  i32 num_delay;
+  for (num_delay = 0; num_delay < c->num_channels; ++num_delay) {
+    e->limiter.delay[num_delay] =
+        calloc(LIMITER_LOOKAHEAD, sizeof *e->limiter.delay[num_delay]);
+    if (!e->limiter.delay[num_delay]) {
+      log_error("unable to allocate limiter delay line");
+      goto fail_delay;
+    }
+  }
+
+  e->limiter.delay_pos = 0;
+  e->limiter.gain = 1.0f;
+  return c->num_effects++;
+
+fail_delay:
+  for (i32 i = 0; i < num_delay; ++i) {
+    free(e->limiter.delay[i]);
+  }
+  return -1;
+}
+
+void effect_chain_set_param(effect_chain *c, i32 effect, i32 param,
+                            float value) {
+  c->effects[effect].targets[param] = value;
+}
+
+// one-pole smoothing evaluated once per block, returns whether anything moved
+static bool smooth_params(effect_chain *c, effect *e, i32 n) {
+  float k = 1.0f - expf(-(float)n / (c->sample_rate * EFFECT_SMOOTHING_TIME));
+  bool changed = false;
+  for (i32 i = 0; i < EFFECT_MAX_PARAMS; ++i) {
+    float d = e->targets[i] - e->params[i];
+    if (d != 0.0f) {
+      // snap once close enough, so coefficients stop being recomputed
+      e->params[i] = fabsf(d) < 1e-4f * fabsf(e->targets[i]) + 1e-6f
+                         ? e->targets[i]
+                         : e->params[i] + d * k;
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+static float block_peak(effect_chain *c, float **planes, i32 n) {
+  float peak = 0.0f;
+  for (i32 ch = 0; ch < c->num_channels; ++ch) {
+    peak = fmaxf(peak, dsp_peak(planes[ch], n));
+  }
+
+  return peak;
+}
+
+// feed-forward with a peak detector that runs at block rate, the gain is
+// ramped across each block
+static void process_compressor(effect_chain *c, effect *e, float **planes,
+                               i32 n) {
+  float block_time = (float)n / c->sample_rate;
+  float level = 20.0f * log10f(block_peak(c, planes, n) + 1e-9f);
+  float *env = &e->compressor.envelope;
+  float time = level > *env ? e->params[COMPRESSOR_PARAM_ATTACK]
+                            : e->params[COMPRESSOR_PARAM_RELEASE];
+  float k = time > 0.0f ? expf(-block_time / time) : 0.0f;
+  *env = isinf(*env) ? level : k * *env + (1.0f - k) * level;
+
+  float threshold = e->params[COMPRESSOR_PARAM_THRESHOLD];
+  float gain_db = e->params[COMPRESSOR_PARAM_MAKEUP];
+  if (*env > threshold) {
+    gain_db += (*env - threshold) * (1.0f / e->params[COMPRESSOR_PARAM_RATIO] -
+                                     1.0f);
+  }
+
+  float gain = db_to_gain(gain_db);
+  for (i32 ch = 0; ch < c->num_channels; ++ch) {
+    dsp_mul_ramp(planes[ch], n, e->compressor.gain, gain);
+  }
+  e->compressor.gain = gain;
+}
+
+// output is delayed by LIMITER_LOOKAHEAD samples. The gain ramp over a block
+// stays below what both the block and the look-ahead allow, so peaks are
+// never let through.
+static void process_limiter_block(effect_chain *c, effect *e, float **planes,
+                                  i32 n) {
+  i32 pos = e->limiter.delay_pos;
+  for (i32 ch = 0; ch < c->num_channels; ++ch) {
+    float *delay = e->limiter.delay[ch];
+    float *p = planes[ch];
+    for (i32 i = 0; i < n; ++i) {
+      i32 j = (pos + i) % LIMITER_LOOKAHEAD;
+      float x = p[i];
+      p[i] = delay[j];
+      delay[j] = x;
+    }
+  }
+  e->limiter.delay_pos = (pos + n) % LIMITER_LOOKAHEAD;
+
+  float ceiling = db_to_gain(e->params[LIMITER_PARAM_CEILING]);
+  float release = e->params[LIMITER_PARAM_RELEASE];
+  float k = release > 0.0f
+                ? expf(-(float)n / (c->sample_rate * release))
+                : 0.0f;
+  float gain = 1.0f - (1.0f - e->limiter.gain) * k;
+  float peak = fmaxf(block_peak(c, planes, n),
+                     block_peak(c, e->limiter.delay, LIMITER_LOOKAHEAD));
+  if (peak * gain > ceiling) {
+    gain = ceiling / peak;
+  }
+
+  for (i32 ch = 0; ch < c->num_channels; ++ch) {
+    dsp_mul_ramp(planes[ch], n, e->limiter.gain, gain);
+  }
+  e->limiter.gain = gain;
+}
+
+static void process_limiter(effect_chain *c, effect *e, float **planes,
+                            i32 n) {
+  float *block[DSP_MAX_CHANNELS];
+  for (i32 offset = 0; offset < n; offset += LIMITER_LOOKAHEAD) {
+    for (i32 ch = 0; ch < c->num_channels; ++ch) {
+      block[ch] = &planes[ch][offset];
+    }
+
+    i32 len = n - offset < LIMITER_LOOKAHEAD ? n - offset : LIMITER_LOOKAHEAD;
+    process_limiter_block(c, e, block, len);
+  }
+}
+
+static void process_effect(effect_chain *c, effect *e, float **planes,
+                           i32 n) {
+  bool changed = smooth_params(c, e, n);
+  switch (e->type) {
+  case EFFECT_TYPE_EQ:
+    if (changed) {
+      update_eq_coeffs(c, e);
+    }
+    dsp_biquad(planes, c->num_channels, n, &e->eq.coeffs, e->eq.z1, e->eq.z2);
+    break;
+  case EFFECT_TYPE_COMPRESSOR:
+    process_compressor(c, e, planes, n);
+    break;
+  case EFFECT_TYPE_LIMITER:
+    process_limiter(c, e, planes, n);
+    break;
+  }
+}
+
+void effect_chain_process(effect_chain *c, float **planes, i32 n) {
+  if (n <= 0) {
+    return;
+  }
+
+  for (i32 i = 0; i < c->num_effects; ++i) {
+    effect *e = &c->effects[i];
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    process_effect(c, e, planes, n);
+    timespec_get(&end, TIME_UTC);
+
+    double time = timespec_to_double(timespec_sub(end, start));
+    ++e->stats.num_blocks;
+    e->stats.num_samples += n;
+    e->stats.time += time;
+    e->stats.max_time = fmax(e->stats.max_time, time);
+  }
+}
+
+void effect_chain_log_stats(const effect_chain *c, const char *name) {
+  for (i32 i = 0; i < c->num_effects; ++i) {
+    const effect *e = &c->effects[i];
+    if (e->stats.num_blocks == 0) {
+      continue;
+    }
+
+    double audio_time = (double)e->stats.num_samples / c->sample_rate;
+    log_info("%s effect %d (%s): %.2fus per block, %.3f%% of realtime, "
+             "%.2fus worst",
+             name, i, effect_type_to_string(e->type),
+             e->stats.time / e->stats.num_blocks * 1e6,
+             e->stats.time / audio_time * 100.0, e->stats.max_time * 1e6);
+  }
+}
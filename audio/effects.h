@@ -0,0 +1,96 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "dsp.h"
+
+#define EFFECT_CHAIN_MAX_EFFECTS 16
+#define EFFECT_MAX_PARAMS 5
+// parameter changes settle over roughly this time (in seconds)
+#define EFFECT_SMOOTHING_TIME 0.02
+// look-ahead of the limiter, which is also the latency it adds (in samples)
+#define LIMITER_LOOKAHEAD 256
+
+typedef enum {
+  EFFECT_TYPE_EQ,
+  EFFECT_TYPE_COMPRESSOR,
+  EFFECT_TYPE_LIMITER,
+} effect_type;
+
+typedef enum {
+  EQ_TYPE_PEAK,
+  EQ_TYPE_LOW_SHELF,
+  EQ_TYPE_HIGH_SHELF,
+  EQ_TYPE_LOW_PASS,
+  EQ_TYPE_HIGH_PASS,
+} eq_type;
+
+// frequency in Hz, gain in dB
+enum { EQ_PARAM_FREQUENCY, EQ_PARAM_Q, EQ_PARAM_GAIN };
+// threshold and makeup in dB, attack and release in seconds
+enum {
+  COMPRESSOR_PARAM_THRESHOLD,
+  COMPRESSOR_PARAM_RATIO,
+  COMPRESSOR_PARAM_ATTACK,
+  COMPRESSOR_PARAM_RELEASE,
+  COMPRESSOR_PARAM_MAKEUP,
+};
+enum { LIMITER_PARAM_CEILING, LIMITER_PARAM_RELEASE };
+
+typedef struct {
+  i64 num_blocks;
+  i64 num_samples;
+  // seconds spent processing
+  double time;
+  double max_time;
+} effect_stats;
+
+typedef struct {
+  effect_type type;
+  // params approach targets once per block
+  float params[EFFECT_MAX_PARAMS];
+  float targets[EFFECT_MAX_PARAMS];
+  effect_stats stats;
+  union {
+    struct {
+      eq_type type;
+      dsp_biquad_coeffs coeffs;
+      float z1[DSP_MAX_CHANNELS];
+      float z2[DSP_MAX_CHANNELS];
+    } eq;
+    struct {
+      // detected level in dB
+      float envelope;
+      float gain;
+    } compressor;
+    struct {
+      float *delay[DSP_MAX_CHANNELS];
+      i32 delay_pos;
+      float gain;
+    } limiter;
+  };
+} effect;
+
+// in-place processing of planar float blocks, effects run in the order they
+// were added
+typedef struct {
+  i32 sample_rate;
+  i32 num_channels;
+  i32 num_effects;
+  effect effects[EFFECT_CHAIN_MAX_EFFECTS];
+} effect_chain;
+
+void effect_chain_init(effect_chain *c, i32 sample_rate, i32 num_channels);
+void effect_chain_free(effect_chain *c);
+
+// all return the effect index or -1
+i32 effect_chain_add_eq(effect_chain *c, eq_type type, float frequency,
+                        float q, float gain);
+i32 effect_chain_add_compressor(effect_chain *c, float threshold, float ratio,
+                                float attack, float release, float makeup);
+i32 effect_chain_add_limiter(effect_chain *c, float ceiling, float release);
+
+void effect_chain_set_param(effect_chain *c, i32 effect, i32 param,
+                            float value);
+void effect_chain_process(effect_chain *c, float **planes, i32 n);
+// average and worst cost per effect, as time per block and share of realtime
+void effect_chain_log_stats(const effect_chain *c, const char *name);
@@ -0,0 +1,556 @@
+#include "loudness.h"
+#include "../utils/threading_utils.h"
+#include "analysis.h"
+#include <log.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <timespec.h>
+#include <unistd.h>
+
+#define LOUDNESS_MAGIC "CVEDLUF"
+#define LOUDNESS_SUFFIX "loudness"
+// sources are downmixed, both channels weigh 1.0
+#define LOUDNESS_NUM_CHANNELS 2
+// samples measured per pass over the true-peak scratch
+#define LOUDNESS_SCRATCH_SIZE 1024
+// audio decoded before a part starts to settle the filters (in seconds)
+#define LOUDNESS_PREROLL 0.5
+
+// BS.1770 pre-filter, as derived for arbitrary sample rates by libebur128
+static void k_weighting(i32 sample_rate, dsp_biquad_coeffs *shelf,
+                        dsp_biquad_coeffs *highpass) {
+  double f0 = 1681.974450955533;
+  double g = 3.999843853973347;
+  double q = 0.7071752369554196;
+  double k = tan(M_PI * f0 / sample_rate);
+  double vh = pow(10.0, g / 20.0);
+  double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+  *shelf = (dsp_biquad_coeffs){
+      .b0 = (vh + vb * k / q + k * k) / a0,
+      .b1 = 2.0 * (k * k - vh) / a0,
+      .b2 = (vh - vb * k / q + k * k) / a0,
+      .a1 = 2.0 * (k * k - 1.0) / a0,
+      .a2 = (1.0 - k / q + k * k) / a0,
+  };
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / sample_rate);
+  a0 = 1.0 + k / q + k * k;
+  *highpass = (dsp_biquad_coeffs){
+      .b0 = 1.0,
+      .b1 = -2.0,
+      .b2 = 1.0,
+      .a1 = 2.0 * (k * k - 1.0) / a0,
+      .a2 = (1.0 - k / q + k * k) / a0,
+  };
+}
+
+// Hann-windowed sinc interpolator, each phase normalized to unity gain
+static void true_peak_taps(float *taps) {
+  i32 len = DSP_TRUE_PEAK_TAPS * DSP_TRUE_PEAK_PHASES;
+  double center = (len - 1) / 2.0;
+  double sums[DSP_TRUE_PEAK_PHASES] = {0};
+  double h[DSP_TRUE_PEAK_TAPS * DSP_TRUE_PEAK_PHASES];
+  for (i32 i = 0; i < len; ++i) {
+    double x = M_PI * (i - center) / DSP_TRUE_PEAK_PHASES;
+    double w = 0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / len);
+    h[i] = sin(x) / x * w;
+    sums[i % DSP_TRUE_PEAK_PHASES] += h[i];
+  }
+
+  // tap k of phase p is h[k * phases + p]
+  for (i32 i = 0; i < len; ++i) {
+    taps[i] = (float)(h[i] / sums[i % DSP_TRUE_PEAK_PHASES]);
+  }
+}
+
+bool loudness_meter_init(loudness_meter *m, i32 sample_rate,
+                         i32 num_channels) {
+  if (num_channels > DSP_MAX_CHANNELS) {
+    log_error("unable to measure loudness of %d channels", num_channels);
+    goto fail_channels;
+  }
+
+  m->sample_rate = sample_rate;
+  m->num_channels = num_channels;
+  k_weighting(sample_rate, &m->shelf, &m->highpass);
+  memset(m->z1, 0, sizeof m->z1);
+  memset(m->z2, 0, sizeof m->z2);
+  true_peak_taps(m->true_peak_taps);
+
+  i32 num_scratch;
+  for (num_scratch = 0; num_scratch < num_channels; ++num_scratch) {
+    if (!(m->true_peak_scratch[num_scratch] =
+              calloc(DSP_TRUE_PEAK_TAPS - 1 + LOUDNESS_SCRATCH_SIZE,
+                     sizeof *m->true_peak_scratch[num_scratch]))) {
+      log_error("unable to allocate true-peak scratch");
+      goto fail_scratch;
+    }
+  }
+
+  m->segment_size = llround(sample_rate * LOUDNESS_SEGMENT_DURATION);
+  m->segments = NULL;
+  m->segments_capacity = 0;
+  m->max_segments = INT64_MAX;
+  loudness_meter_restart(m);
+  return true;
+
+fail_scratch:
+  for (i32 i = 0; i < num_scratch; ++i) {
+    free(m->true_peak_scratch[i]);
+  }
+fail_channels:
+  return false;
+}
+
+void loudness_meter_free(loudness_meter *m) {
+  for (i32 i = 0; i < m->num_channels; ++i) {
+    free(m->true_peak_scratch[i]);
+  }
+  free(m->segments);
+}
+
+void loudness_meter_restart(loudness_meter *m) {
+  m->true_peak = 0.0f;
+  m->segment_fill = 0;
+  m->segment_energy = 0.0;
+  m->num_segments = 0;
+}
+
+bool loudness_meter_full(const loudness_meter *m) {
+  return m->num_segments >= m->max_segments;
+}
+
+static bool push_segments(loudness_meter *m, const double *segments,
+                          i64 num_segments) {
+  if (m->num_segments + num_segments > m->segments_capacity) {
+    i64 capacity = m->segments_capacity ? m->segments_capacity : 1024;
+    while (capacity < m->num_segments + num_segments) {
+      capacity *= 2;
+    }
+
+    double *grown = realloc(m->segments, capacity * sizeof *m->segments);
+    if (!grown) {
+      log_error("unable to grow loudness segments");
+      return false;
+    }
+    m->segments = grown;
+    m->segments_capacity = capacity;
+  }
+
+  memcpy(&m->segments[m->num_segments], segments,
+         num_segments * sizeof *segments);
+  m->num_segments += num_segments;
+  return true;
+}
+
+bool loudness_meter_process(loudness_meter *m, float **planes, i32 n) {
+  float *p[DSP_MAX_CHANNELS];
+  for (i32 offset = 0; offset < n && !loudness_meter_full(m);) {
+    i32 len = n - offset < LOUDNESS_SCRATCH_SIZE ? n - offset
+                                                 : LOUDNESS_SCRATCH_SIZE;
+    // true peak is measured before weighting
+    for (i32 ch = 0; ch < m->num_channels; ++ch) {
+      float *s = m->true_peak_scratch[ch];
+      p[ch] = &planes[ch][offset];
+      memcpy(&s[DSP_TRUE_PEAK_TAPS - 1], p[ch], len * sizeof *s);
+      m->true_peak = fmaxf(m->true_peak,
+                           dsp_true_peak(&s[DSP_TRUE_PEAK_TAPS - 1], len,
+                                         m->true_peak_taps));
+      memmove(s, &s[len], (DSP_TRUE_PEAK_TAPS - 1) * sizeof *s);
+    }
+
+    dsp_biquad(p, m->num_channels, len, &m->shelf, m->z1[0], m->z2[0]);
+    dsp_biquad(p, m->num_channels, len, &m->highpass, m->z1[1], m->z2[1]);
+    for (i32 i = 0; i < len && !loudness_meter_full(m);) {
+      i64 left = m->segment_size - m->segment_fill;
+      i32 l = left < len - i ? (i32)left : len - i;
+      for (i32 ch = 0; ch < m->num_channels; ++ch) {
+        m->segment_energy += dsp_sum_sq(&p[ch][i], l);
+      }
+
+      m->segment_fill += l;
+      i += l;
+      if (m->segment_fill == m->segment_size) {
+        double mean_square = m->segment_energy / m->segment_size;
+        if (!push_segments(m, &mean_square, 1)) {
+          return false;
+        }
+        m->segment_fill = 0;
+        m->segment_energy = 0.0;
+      }
+    }
+
+    offset += len;
+  }
+
+  return true;
+}
+
+bool loudness_meter_append(loudness_meter *dst, const loudness_meter *src) {
+  dst->true_peak = fmaxf(dst->true_peak, src->true_peak);
+  return push_segments(dst, src->segments, src->num_segments);
+}
+
+static double loudness(double energy) {
+  return -0.691 + 10.0 * log10(energy);
+}
+
+static double energy(double loudness) {
+  return pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+// mean energy of every window of num_window consecutive segments
+static i64 window_energies(const loudness_meter *m, i32 num_window,
+                           double *out) {
+  i64 n = m->num_segments - num_window + 1;
+  double sum = 0.0;
+  for (i64 i = 0; i < m->num_segments; ++i) {
+    sum += m->segments[i];
+    if (i >= num_window) {
+      sum -= m->segments[i - num_window];
+    }
+    if (i >= num_window - 1) {
+      out[i - num_window + 1] = sum / num_window;
+    }
+  }
+
+  return n > 0 ? n : 0;
+}
+
+// mean of the energies above the absolute gate and then above the mean
+// relative gate, 0 once nothing passes
+static double gated_mean(const double *energies, i64 n, double relative_gate,
+                         double *relative_threshold) {
+  double absolute = energy(LOUDNESS_ABSOLUTE_GATE);
+  double sum = 0.0;
+  i64 count = 0;
+  for (i64 i = 0; i < n; ++i) {
+    if (energies[i] > absolute) {
+      sum += energies[i];
+      ++count;
+    }
+  }
+
+  if (count == 0) {
+    *relative_threshold = INFINITY;
+    return 0.0;
+  }
+
+  *relative_threshold = fmax(absolute, energy(loudness(sum / count) +
+                                              relative_gate));
+  sum = 0.0;
+  count = 0;
+  for (i64 i = 0; i < n; ++i) {
+    if (energies[i] > *relative_threshold) {
+      sum += energies[i];
+      ++count;
+    }
+  }
+
+  return count ? sum / count : 0.0;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+void loudness_meter_result(const loudness_meter *m, loudness_result *r) {
+  r->integrated = -INFINITY;
+  r->range = 0.0;
+  r->true_peak = 20.0 * log10(m->true_peak);
+
+  double *energies = malloc(
+      (m->num_segments > 0 ? m->num_segments : 1) * sizeof *energies);
+  if (!energies) {
+    log_error("unable to allocate loudness blocks");
+    return;
+  }
+
+  double threshold;
+  i64 n = window_energies(m, LOUDNESS_BLOCK_SEGMENTS, energies);
+  double mean = gated_mean(energies, n, LOUDNESS_RELATIVE_GATE, &threshold);
+  if (mean > 0.0) {
+    r->integrated = loudness(mean);
+  }
+
+  // loudness range is the spread of gated short-term loudness between the
+  // 10th and 95th percentile
+  n = window_energies(m, LOUDNESS_SHORT_TERM_SEGMENTS, energies);
+  gated_mean(energies, n, LOUDNESS_RANGE_GATE, &threshold);
+  i64 num_gated = 0;
+  for (i64 i = 0; i < n; ++i) {
+    if (energies[i] > threshold) {
+      energies[num_gated++] = energies[i];
+    }
+  }
+
+  if (num_gated > 0) {
+    qsort(energies, num_gated, sizeof *energies, compare_double);
+    double low = energies[(i64)llround((num_gated - 1) * 0.10)];
+    double high = energies[(i64)llround((num_gated - 1) * 0.95)];
+    r->range = loudness(high) - loudness(low);
+  }
+
+  free(energies);
+}
+
+typedef struct {
+  char magic[8];
+  u32 version;
+  u32 reserved;
+  i64 source_size;
+  i64 source_mtime;
+  loudness_result result;
+} loudness_file_header;
+
+static bool load(const char *url, loudness_result *r) {
+  analysis_source source;
+  if (!analysis_source_stat(url, &source)) {
+    return false;
+  }
+
+  char *path = analysis_sidecar_path(url, LOUDNESS_SUFFIX);
+  if (!path) {
+    log_error("unable to allocate loudness path");
+    return false;
+  }
+
+  FILE *f = fopen(path, "rb");
+  free(path);
+  if (!f) {
+    return false;
+  }
+
+  loudness_file_header h;
+  bool ok = fread(&h, sizeof h, 1, f) == 1 &&
+            memcmp(h.magic, LOUDNESS_MAGIC, sizeof h.magic) == 0 &&
+            h.version == LOUDNESS_VERSION && h.source_size == source.size &&
+            h.source_mtime == source.mtime;
+  fclose(f);
+  if (ok) {
+    *r = h.result;
+  }
+
+  return ok;
+}
+
+static void save(const char *url, const loudness_result *r) {
+  analysis_source source;
+  if (!analysis_source_stat(url, &source)) {
+    return;
+  }
+
+  char *path = analysis_sidecar_path(url, LOUDNESS_SUFFIX);
+  if (!path) {
+    log_error("unable to allocate loudness path");
+    return;
+  }
+
+  FILE *f = analysis_sidecar_create(path);
+  if (f) {
+    loudness_file_header h = {
+        .version = LOUDNESS_VERSION,
+        .reserved = 0,
+        .source_size = source.size,
+        .source_mtime = source.mtime,
+        .result = *r,
+    };
+    memcpy(h.magic, LOUDNESS_MAGIC, sizeof h.magic);
+    if (fwrite(&h, sizeof h, 1, f) == 1) {
+      analysis_sidecar_commit(f, path);
+    } else {
+      log_warn("unable to write loudness '%s'", path);
+      analysis_sidecar_abort(f, path);
+    }
+  }
+
+  free(path);
+}
+
+// consecutive segments of a source measured by one thread
+typedef struct {
+  const char *url;
+  const atomic_bool *cancel;
+  thrd_t thread;
+  i64 first_segment;
+  double start_time;
+  // still settling the filters before the first segment
+  bool settling;
+  bool success;
+  loudness_meter meter;
+} chunk;
+
+static void chunk_on_start(const analysis_stream_info *info, void *userdata) {
+  chunk *c = userdata;
+  c->start_time = info->start_time;
+}
+
+static bool chunk_on_block(float **planes, i32 n, double time,
+                           void *userdata) {
+  chunk *c = userdata;
+  float *p[LOUDNESS_NUM_CHANNELS];
+  for (i32 i = 0; i < LOUDNESS_NUM_CHANNELS; ++i) {
+    p[i] = planes[i];
+  }
+  if (c->settling) {
+    if (isnan(time)) {
+      log_warn("'%s' has no audio timestamps to split it at", c->url);
+      c->success = false;
+      return false;
+    }
+
+    double start =
+        c->start_time + c->first_segment * LOUDNESS_SEGMENT_DURATION;
+    i64 first = (i64)ceil((start - time) * c->meter.sample_rate);
+    if (first >= n) {
+      return loudness_meter_process(&c->meter, p, n);
+    }
+
+    if (first > 0) {
+      if (!loudness_meter_process(&c->meter, p, (i32)first)) {
+        return false;
+      }
+      n -= first;
+      for (i32 i = 0; i < LOUDNESS_NUM_CHANNELS; ++i) {
+        p[i] += first;
+      }
+    }
+    loudness_meter_restart(&c->meter);
+    c->settling = false;
+  }
+
+  return loudness_meter_process(&c->meter, p, n) &&
+         !loudness_meter_full(&c->meter);
+}
+
+static int chunk_thread_callback(void *arg) {
+  chunk *c = arg;
+  double seek = c->first_segment * LOUDNESS_SEGMENT_DURATION - LOUDNESS_PREROLL;
+  c->success = true;
+  if (!analysis_decode(c->url, LOUDNESS_NUM_CHANNELS, seek > 0.0 ? seek : 0.0,
+                       c->cancel, chunk_on_start, chunk_on_block, c)) {
+    c->success = false;
+  }
+
+  return 0;
+}
+
+// splits the source into num_chunks parts of whole segments, measured side by
+// side and merged in order
+static bool measure(const char *url, const analysis_stream_info *info,
+                    i32 num_chunks, const atomic_bool *cancel,
+                    loudness_result *r) {
+  chunk *chunks = calloc(num_chunks, sizeof *chunks);
+  if (!chunks) {
+    log_error("unable to allocate loudness chunks");
+    goto fail_chunks;
+  }
+
+  i64 num_segments = (i64)ceil(info->duration / LOUDNESS_SEGMENT_DURATION);
+  i64 segments_per_chunk = (num_segments + num_chunks - 1) / num_chunks;
+  i32 num_started;
+  for (num_started = 0; num_started < num_chunks; ++num_started) {
+    chunk *c = &chunks[num_started];
+    c->url = url;
+    c->cancel = cancel;
+    c->first_segment = num_started * segments_per_chunk;
+    c->settling = num_started > 0;
+    if (!loudness_meter_init(&c->meter, info->sample_rate,
+                             LOUDNESS_NUM_CHANNELS)) {
+      goto fail_start;
+    }
+    if (num_started < num_chunks - 1) {
+      c->meter.max_segments = segments_per_chunk;
+    }
+
+    i32 error;
+    if ((error = thrd_create(&c->thread, chunk_thread_callback, c)) !=
+        thrd_success) {
+      log_error("unable to start loudness thread: %s",
+                thrd_error_to_string(error));
+      loudness_meter_free(&c->meter);
+      goto fail_start;
+    }
+  }
+
+  bool ok = true;
+  for (i32 i = 0; i < num_chunks; ++i) {
+    thrd_join(chunks[i].thread, NULL);
+    ok = ok && chunks[i].success;
+    if (ok && i > 0) {
+      ok = loudness_meter_append(&chunks[0].meter, &chunks[i].meter);
+    }
+  }
+
+  if (ok) {
+    loudness_meter_result(&chunks[0].meter, r);
+  }
+
+  for (i32 i = 0; i < num_chunks; ++i) {
+    loudness_meter_free(&chunks[i].meter);
+  }
+  free(chunks);
+  return ok;
+
+fail_start:
+  // parts already started run to their end
+  for (i32 i = 0; i < num_started; ++i) {
+    thrd_join(chunks[i].thread, NULL);
+    loudness_meter_free(&chunks[i].meter);
+  }
+  free(chunks);
+fail_chunks:
+  return false;
+}
+
+bool loudness_scan(const char *url, const atomic_bool *cancel,
+                   loudness_result *r) {
+  if (load(url, r)) {
+    return true;
+  }
+
+  analysis_stream_info info;
+  if (!analysis_probe(url, &info)) {
+    return false;
+  }
+
+  struct timespec start;
+  timespec_get(&start, TIME_UTC);
+  i32 num_chunks = 1;
+  if (info.duration > 0.0) {
+    i64 num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_chunks = (i32)fmin(info.duration / LOUDNESS_MIN_CHUNK_DURATION,
+                           fmin(num_cpus, LOUDNESS_MAX_THREADS));
+    num_chunks = num_chunks < 1 ? 1 : num_chunks;
+  }
+
+  // parts need timestamps to start at the right sample
+  if (!measure(url, &info, num_chunks, cancel, r)) {
+    if (num_chunks == 1 || atomic_load(cancel)) {
+      return false;
+    }
+
+    log_warn("unable to measure loudness of '%s' in parts, measuring it "
+             "in one",
+             url);
+    num_chunks = 1;
+    if (!measure(url, &info, 1, cancel, r)) {
+      return false;
+    }
+  }
+
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  log_info("measured loudness of '%s' with %d threads in %.2fs", url,
+           num_chunks, timespec_to_double(timespec_sub(end, start)));
+  save(url, r);
+  return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "dsp.h"
+#include <stdatomic.h>
+
+// EBU R128 / ITU-R BS.1770 measurement: gating blocks are 4 segments of
+// 100ms, short-term loudness 30 of them
+#define LOUDNESS_SEGMENT_DURATION 0.1
+#define LOUDNESS_BLOCK_SEGMENTS 4
+#define LOUDNESS_SHORT_TERM_SEGMENTS 30
+#define LOUDNESS_ABSOLUTE_GATE -70.0
+#define LOUDNESS_RELATIVE_GATE -10.0
+#define LOUDNESS_RANGE_GATE -20.0
+#define LOUDNESS_VERSION 1
+// most threads a source is scanned with, each decoding a part of it
+#define LOUDNESS_MAX_THREADS 8
+// parts are not made shorter than this (in seconds)
+#define LOUDNESS_MIN_CHUNK_DURATION 60.0
+
+typedef struct {
+  // LUFS, -INFINITY for silence
+  double integrated;
+  // LU
+  double range;
+  // dBTP
+  double true_peak;
+} loudness_result;
+
+typedef struct {
+  i32 sample_rate;
+  i32 num_channels;
+  // K-weighting: high shelf, then high-pass
+  dsp_biquad_coeffs shelf;
+  dsp_biquad_coeffs highpass;
+  float z1[2][DSP_MAX_CHANNELS];
+  float z2[2][DSP_MAX_CHANNELS];
+  float true_peak_taps[DSP_TRUE_PEAK_TAPS * DSP_TRUE_PEAK_PHASES];
+  // filter history followed by the samples being measured, per channel
+  float *true_peak_scratch[DSP_MAX_CHANNELS];
+  float true_peak;
+
+  i64 segment_size;
+  i64 segment_fill;
+  double segment_energy;
+  // mean square of every complete segment, channel weighted
+  double *segments;
+  i64 num_segments;
+  i64 segments_capacity;
+  // segments after which further samples are ignored
+  i64 max_segments;
+} loudness_meter;
+
+bool loudness_meter_init(loudness_meter *m, i32 sample_rate,
+                         i32 num_channels);
+void loudness_meter_free(loudness_meter *m);
+// planes are K-weighted in place
+bool loudness_meter_process(loudness_meter *m, float **planes, i32 n);
+// forgets what was measured but keeps the filter state, to discard audio
+// decoded only to settle the filters
+void loudness_meter_restart(loudness_meter *m);
+bool loudness_meter_full(const loudness_meter *m);
+// continues dst with the segments of src, which measured the audio right
+// after it. Gating runs on the merged segments, so the result matches
+// measuring everything with one meter.
+bool loudness_meter_append(loudness_meter *dst, const loudness_meter *src);
+void loudness_meter_result(const loudness_meter *m, loudness_result *r);
+
+// measures the source, in parallel parts where it is long enough, or reads
+// the result from its sidecar
+bool loudness_scan(const char *url, const atomic_bool *cancel,
+                   loudness_result *r);
@@ -0,0 +1,376 @@
+#include "mixer.h"
+#include "../utils/threading_utils.h"
+#include "dsp.h"
+#include <log.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// decode threads poll for room in their rings at this interval (in ns)
+#define DECODE_POLL_INTERVAL ((long)2e6)
+
+bool mixer_init(mixer *m, i32 sample_rate, i32 max_tracks) {
+  audio_output_format_init_planar(&m->format, MIXER_NUM_CHANNELS,
+                                  sample_rate);
+  m->num_tracks = max_tracks;
+  m->position = 0;
+  effect_chain_init(&m->master, sample_rate, MIXER_NUM_CHANNELS);
+
+  if (!(m->tracks = calloc(max_tracks, sizeof *m->tracks))) {
+    log_error("unable to allocate %d mixer tracks", max_tracks);
+    goto fail_tracks;
+  }
+
+  i32 num_scratch;
+  for (num_scratch = 0; num_scratch < MIXER_NUM_CHANNELS; ++num_scratch) {
+    m->scratch[num_scratch] =
+        malloc(MIXER_BLOCK_SIZE * sizeof *m->scratch[num_scratch]);
+    if (!m->scratch[num_scratch]) {
+      log_error("unable to allocate mixer scratch block");
+      goto fail_scratch;
+    }
+  }
+
+  return true;
+
+fail_scratch:
+  for (i32 i = 0; i < num_scratch; ++i) {
+    free(m->scratch[i]);
+  }
+  free(m->tracks);
+fail_tracks:
+  return false;
+}
+
+void mixer_free(mixer *m) {
+  for (i32 i = 0; i < m->num_tracks; ++i) {
+    mixer_remove_track(m, i);
+  }
+
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    free(m->scratch[i]);
+  }
+  free(m->tracks);
+  effect_chain_free(&m->master);
+}
+
+// fades are linear in amplitude
+static float envelope(const mixer_track_info *info, i64 position) {
+  float e = 1.0f;
+  if (position < info->fade_in) {
+    e = (float)position / info->fade_in;
+  }
+  if (info->duration != INT64_MAX &&
+      position > info->duration - info->fade_out) {
+    e *= (float)(info->duration - position) / info->fade_out;
+  }
+
+  return e < 0.0f ? 0.0f : e;
+}
+
+// constant-power pan law, unity gain in the center
+static void channel_gains(const mixer_track_info *info, i64 position,
+                          float gains[MIXER_NUM_CHANNELS]) {
+  float angle = (info->pan + 1.0f) * (float)M_PI / 4.0f;
+  float g = info->gain * envelope(info, position) * (float)M_SQRT2;
+  gains[0] = g * cosf(angle);
+  gains[1] = g * sinf(angle);
+}
+
+static void sleep_poll_interval(void) {
+  thrd_sleep(&(struct timespec){.tv_nsec = DECODE_POLL_INTERVAL}, NULL);
+}
+
+// decodes until the track's duration or the end of its stream, staying at
+// most a ring ahead of the mix
+static int track_decode_callback(void *arg) {
+  mixer_track *t = arg;
+  usize chunk_bytes = MIXER_BLOCK_SIZE * sizeof(float);
+  i64 num_decoded = 0;
+  while (!atomic_load(&t->exit)) {
+    if (spsc_ring_can_write(&t->rings[MIXER_NUM_CHANNELS - 1]) <
+        chunk_bytes) {
+      sleep_poll_interval();
+      continue;
+    }
+
+    i32 n = MIXER_BLOCK_SIZE;
+    if (t->info.duration - num_decoded < n) {
+      n = (i32)(t->info.duration - num_decoded);
+    }
+
+    i32 num_samples =
+        audio_playback_context_decode(&t->apc, (u8 **)t->chunk, n);
+    if (num_samples < 0) {
+      atomic_store(&t->failed, true);
+      break;
+    }
+
+    // the last plane goes in last, so PCM readable there is readable in
+    // every plane
+    for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+      spsc_ring_write(&t->rings[i], t->chunk[i], num_samples * sizeof(float));
+    }
+    num_decoded += num_samples;
+    if (num_samples < n || num_decoded >= t->info.duration) {
+      break;
+    }
+  }
+
+  atomic_store(&t->done, true);
+  return 0;
+}
+
+i32 mixer_add_track(mixer *m, decode_context dc,
+                    const mixer_track_info *info) {
+  i32 track;
+  for (track = 0; track < m->num_tracks && m->tracks[track].used; ++track) {
+  }
+
+  if (track == m->num_tracks) {
+    log_error("all %d mixer tracks are in use", m->num_tracks);
+    goto fail_track;
+  }
+
+  mixer_track *t = &m->tracks[track];
+  if (!audio_playback_context_init(&t->apc, dc, &m->format)) {
+    log_error("unable to initialize audio playback of mixer track");
+    goto fail_track;
+  }
+
+  usize ring_size =
+      (usize)(m->format.sample_rate * MIXER_RING_DURATION) * sizeof(float);
+  i32 num_rings;
+  for (num_rings = 0; num_rings < MIXER_NUM_CHANNELS; ++num_rings) {
+    if (!spsc_ring_init(&t->rings[num_rings], ring_size)) {
+      log_error("unable to initialize mixer track PCM ring");
+      goto fail_rings;
+    }
+  }
+
+  i32 num_chunks;
+  for (num_chunks = 0; num_chunks < MIXER_NUM_CHANNELS; ++num_chunks) {
+    if (!(t->chunk[num_chunks] =
+              malloc(MIXER_BLOCK_SIZE * sizeof *t->chunk[num_chunks]))) {
+      log_error("unable to allocate mixer track chunk");
+      goto fail_chunks;
+    }
+  }
+
+  t->info = *info;
+  t->position = 0;
+  t->num_late = 0;
+  t->num_underruns = 0;
+  channel_gains(&t->info, 0, t->gains);
+  effect_chain_init(&t->effects, m->format.sample_rate, MIXER_NUM_CHANNELS);
+  atomic_init(&t->exit, false);
+  atomic_init(&t->done, false);
+  atomic_init(&t->failed, false);
+
+  i32 error;
+  if ((error = thrd_create(&t->thread, track_decode_callback, t)) !=
+      thrd_success) {
+    log_error("unable to start mixer track decode thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  t->used = true;
+  t->active = true;
+  return track;
+
+fail_thread:
+  effect_chain_free(&t->effects);
+fail_chunks:
+  for (i32 i = 0; i < num_chunks; ++i) {
+    free(t->chunk[i]);
+  }
+fail_rings:
+  for (i32 i = 0; i < num_rings; ++i) {
+    spsc_ring_free(&t->rings[i]);
+  }
+  // the playback context owns dc from here on
+  audio_playback_context_free(&t->apc);
+  return -1;
+fail_track:
+  decode_context_free(&dc);
+  return -1;
+}
+
+void mixer_remove_track(mixer *m, i32 track) {
+  mixer_track *t = &m->tracks[track];
+  if (!t->used) {
+    return;
+  }
+
+  atomic_store(&t->exit, true);
+  if (thrd_join(t->thread, NULL) != thrd_success) {
+    log_warn("unable to join mixer track decode thread");
+  }
+
+  audio_playback_context_free(&t->apc);
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    spsc_ring_free(&t->rings[i]);
+    free(t->chunk[i]);
+  }
+  effect_chain_free(&t->effects);
+  t->used = false;
+  t->active = false;
+}
+
+void mixer_reap(mixer *m) {
+  char name[32];
+  for (i32 i = 0; i < m->num_tracks; ++i) {
+    mixer_track *t = &m->tracks[i];
+    if (!t->used || t->active) {
+      continue;
+    }
+
+    if (atomic_load(&t->failed)) {
+      log_error("unable to decode mixer track %d, removed it", i);
+    }
+    if (t->num_underruns > 0) {
+      log_warn("mixer track %d underran %d times", i, t->num_underruns);
+    }
+    snprintf(name, sizeof name, "track %d", i);
+    effect_chain_log_stats(&t->effects, name);
+    mixer_remove_track(m, i);
+  }
+}
+
+void mixer_set_gain(mixer *m, i32 track, float gain) {
+  m->tracks[track].info.gain = gain;
+}
+
+void mixer_set_pan(mixer *m, i32 track, float pan) {
+  m->tracks[track].info.pan = pan;
+}
+
+i32 mixer_num_active_tracks(const mixer *m) {
+  i32 num_active = 0;
+  for (i32 i = 0; i < m->num_tracks; ++i) {
+    num_active += m->tracks[i].active;
+  }
+
+  return num_active;
+}
+
+// samples of the block the track plays, from offset into the block on
+static i32 track_block(const mixer *m, const mixer_track *t, i32 num_samples,
+                       i32 *offset) {
+  // tracks starting within the block are mixed from their first sample on
+  *offset =
+      t->info.start > m->position ? (i32)(t->info.start - m->position) : 0;
+  if (*offset >= num_samples) {
+    return 0;
+  }
+
+  i32 n = num_samples - *offset;
+  if (t->info.duration - t->position < n) {
+    n = (i32)(t->info.duration - t->position);
+  }
+  return n;
+}
+
+void mixer_wait(mixer *m, i32 num_samples) {
+  for (i32 i = 0; i < m->num_tracks; ++i) {
+    mixer_track *t = &m->tracks[i];
+    i32 offset;
+    i32 n = t->active ? track_block(m, t, num_samples, &offset) : 0;
+    while (n > 0 && !atomic_load(&t->done) &&
+           spsc_ring_can_read(&t->rings[MIXER_NUM_CHANNELS - 1]) <
+               (t->num_late + n) * sizeof(float)) {
+      sleep_poll_interval();
+    }
+  }
+}
+
+// returns false once the track failed to decode
+static bool mix_track(mixer *m, mixer_track *t, float **out,
+                      i32 num_samples) {
+  i32 offset;
+  i32 n = track_block(m, t, num_samples, &offset);
+  if (offset >= num_samples) {
+    return true;
+  }
+
+  // done is read first, so once it is set the rings hold everything
+  bool done = atomic_load(&t->done);
+  usize available =
+      spsc_ring_can_read(&t->rings[MIXER_NUM_CHANNELS - 1]) / sizeof(float);
+  // PCM that arrives after an underrun played its block as silence is late
+  while (t->num_late > 0 && available > 0) {
+    i32 num_skipped = MIXER_BLOCK_SIZE;
+    if (t->num_late < num_skipped) {
+      num_skipped = (i32)t->num_late;
+    }
+    if (available < (usize)num_skipped) {
+      num_skipped = (i32)available;
+    }
+    for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+      spsc_ring_read(&t->rings[i], m->scratch[i],
+                     num_skipped * sizeof(float));
+    }
+    t->num_late -= num_skipped;
+    available -= num_skipped;
+  }
+
+  i32 num_read = available < (usize)n ? (i32)available : n;
+  if (num_read < n && !done) {
+    // the rest of the block stays silent, the track keeps its place
+    ++t->num_underruns;
+    t->num_late += n - num_read;
+  }
+
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    spsc_ring_read(&t->rings[i], m->scratch[i], num_read * sizeof(float));
+  }
+
+  effect_chain_process(&t->effects, m->scratch, num_read);
+  float gains[MIXER_NUM_CHANNELS];
+  channel_gains(&t->info, t->position + n, gains);
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    if (num_read > 0) {
+      dsp_mix_ramp(&out[i][offset], m->scratch[i], num_read, t->gains[i],
+                   gains[i]);
+    }
+    t->gains[i] = gains[i];
+  }
+
+  t->position += n;
+  if ((done && (usize)num_read == available) ||
+      t->position >= t->info.duration) {
+    t->active = false;
+    return !atomic_load(&t->failed);
+  }
+
+  return true;
+}
+
+bool mixer_mix(mixer *m, float **out, i32 num_samples) {
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    dsp_clear(out[i], num_samples);
+  }
+
+  bool ok = true;
+  for (i32 i = 0; i < m->num_tracks; ++i) {
+    if (m->tracks[i].active) {
+      ok &= mix_track(m, &m->tracks[i], out, num_samples);
+    }
+  }
+
+  effect_chain_process(&m->master, out, num_samples);
+  m->position += num_samples;
+  return ok;
+}
+
+void mixer_log_effect_stats(const mixer *m) {
+  char name[32];
+  for (i32 i = 0; i < m->num_tracks; ++i) {
+    if (m->tracks[i].used) {
+      snprintf(name, sizeof name, "track %d", i);
+      effect_chain_log_stats(&m->tracks[i].effects, name);
+    }
+  }
+  effect_chain_log_stats(&m->master, "master");
+}
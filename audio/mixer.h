@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../media/decode_thread.h"
+#include "../utils/spsc_ring.h"
+#include "../utils/types.h"
+#include "al_util.h"
+#include "effects.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+// samples mixed per block, smaller requests are mixed as a partial block
+#define MIXER_BLOCK_SIZE 256
+#define MIXER_NUM_CHANNELS 2
+// decoded PCM buffered ahead of the mix per track (in seconds)
+#define MIXER_RING_DURATION 0.5
+
+typedef struct {
+  // sample of the mix the track starts at
+  i64 start;
+  // samples the track plays for, INT64_MAX until the end of its stream
+  i64 duration;
+  i64 fade_in;
+  i64 fade_out;
+  // linear gain, pan from -1 (left) to 1 (right)
+  float gain;
+  float pan;
+} mixer_track_info;
+
+typedef struct {
+  // owned by the decode thread until it is joined
+  audio_playback_context apc;
+  thrd_t thread;
+  // decoded planes, written by the decode thread and read by the mix
+  spsc_ring rings[MIXER_NUM_CHANNELS];
+  float *chunk[MIXER_NUM_CHANNELS];
+  atomic_bool exit;
+  // set by the decode thread once everything it decodes is in the rings
+  atomic_bool done;
+  atomic_bool failed;
+
+  // the slot holds a decode thread and buffers until it is reaped
+  bool used;
+  // still mixed, cleared by the mix once the track has played out
+  bool active;
+  // blocks the rings could not fill
+  i32 num_underruns;
+  mixer_track_info info;
+  // samples of the track mixed so far, silence of underruns included
+  i64 position;
+  // samples an underrun played as silence, dropped from the rings once they
+  // arrive so the track stays on the timeline
+  i64 num_late;
+  // per-channel gain reached at the end of the previous block, changes are
+  // ramped from there over the next block
+  float gains[MIXER_NUM_CHANNELS];
+  // runs before gain and pan
+  effect_chain effects;
+} mixer_track;
+
+// sums tracks resampled to planar float stereo at the project rate
+typedef struct {
+  audio_output_format format;
+  i32 num_tracks;
+  mixer_track *tracks;
+  // a block of the track being mixed
+  float *scratch[MIXER_NUM_CHANNELS];
+  i64 position;
+  // runs on the sum of all tracks
+  effect_chain master;
+} mixer;
+
+bool mixer_init(mixer *m, i32 sample_rate, i32 max_tracks);
+void mixer_free(mixer *m);
+
+// takes ownership of dc, returns the track index or -1
+i32 mixer_add_track(mixer *m, decode_context dc, const mixer_track_info *info);
+// stops the track's decode thread and frees it, not for the mix thread
+void mixer_remove_track(mixer *m, i32 track);
+// removes every track the mix has finished, logging its stats
+void mixer_reap(mixer *m);
+// blocks until every track has the next num_samples decoded, late samples
+// included, so an offline mix never underruns
+void mixer_wait(mixer *m, i32 num_samples);
+void mixer_set_gain(mixer *m, i32 track, float gain);
+void mixer_set_pan(mixer *m, i32 track, float pan);
+i32 mixer_num_active_tracks(const mixer *m);
+
+// mixes the next num_samples (at most MIXER_BLOCK_SIZE) into out, one plane
+// per channel. Only reads PCM the decode threads buffered, does not allocate
+// or block. Returns false on decode errors, tracks that fail or play out are
+// marked inactive and left to mixer_reap.
+bool mixer_mix(mixer *m, float **out, i32 num_samples);
+// effect cost of the master and every active track
+void mixer_log_effect_stats(const mixer *m);
@@ -0,0 +1,271 @@
+#include "offline_render.h"
+#include "../media/clip.h"
+#include "loudness.h"
+#include "mixer.h"
+#include <log.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timespec.h>
+
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAV_HEADER_SIZE 58
+
+static void put_u16(u8 *p, u32 v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put_u32(u8 *p, u32 v) {
+  put_u16(p, v & 0xffff);
+  put_u16(p + 2, v >> 16);
+}
+
+// RIFF header with fmt, fact and data chunks, rewritten once the length is
+// known
+static bool write_wav_header(FILE *f, i32 sample_rate, i64 num_samples) {
+  u32 block_align = MIXER_NUM_CHANNELS * sizeof(float);
+  u32 data_size = (u32)(num_samples * block_align);
+  u8 h[WAV_HEADER_SIZE];
+  memcpy(h, "RIFF", 4);
+  put_u32(h + 4, WAV_HEADER_SIZE - 8 + data_size);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  put_u32(h + 16, 18);
+  put_u16(h + 20, WAVE_FORMAT_IEEE_FLOAT);
+  put_u16(h + 22, MIXER_NUM_CHANNELS);
+  put_u32(h + 24, sample_rate);
+  put_u32(h + 28, sample_rate * block_align);
+  put_u16(h + 32, block_align);
+  put_u16(h + 34, 32);
+  put_u16(h + 36, 0);
+  memcpy(h + 38, "fact", 4);
+  put_u32(h + 42, 4);
+  put_u32(h + 46, (u32)num_samples);
+  memcpy(h + 50, "data", 4);
+  put_u32(h + 54, data_size);
+  return fseek(f, 0, SEEK_SET) == 0 && fwrite(h, sizeof h, 1, f) == 1;
+}
+
+// clips are added once they start within the next block
+static void open_due_clips(playlist_mix *p) {
+  mixer *m = &p->m;
+  i32 rate = m->format.sample_rate;
+  while (p->next_url < p->num_urls &&
+         llround(p->next_start * rate) < m->position + MIXER_BLOCK_SIZE) {
+    const char *url = p->urls[p->next_url];
+    bool first = p->next_url == 0;
+    bool last = ++p->next_url == p->num_urls;
+
+    clip *c = malloc(sizeof *c);
+    if (!c) {
+      log_error("unable to allocate clip");
+      continue;
+    }
+
+    if (!clip_open(c, &(clip_open_info){
+                          .url = url,
+                          .offset = p->next_start,
+                          .audio_only = true,
+                      })) {
+      log_error("unable to open audio of clip '%s', skipping it", url);
+      free(c);
+      continue;
+    }
+
+    i64 fade = llround(p->crossfade * rate);
+    mixer_track_info track_info = {
+        .start = llround(c->offset * rate),
+        .duration = llround(c->duration * rate),
+        .fade_in = first ? 0 : fade,
+        .fade_out = last ? 0 : fade,
+        .gain = 1.0f,
+        .pan = 0.0f,
+    };
+    i32 track = mixer_add_track(m, clip_take_audio(c), &track_info);
+    if (track < 0) {
+      log_error("unable to add clip '%s' to the mix, skipping it", url);
+      clip_close(c);
+      free(c);
+      continue;
+    }
+
+    p->clips[track] = c;
+    if (track_info.start + track_info.duration > p->end) {
+      p->end = track_info.start + track_info.duration;
+    }
+    p->next_start += c->duration - p->crossfade;
+  }
+}
+
+static void close_finished_clips(playlist_mix *p) {
+  for (i32 i = 0; i < PLAYLIST_MIX_MAX_TRACKS; ++i) {
+    if (p->clips[i] && !p->m.tracks[i].used) {
+      clip_close(p->clips[i]);
+      free(p->clips[i]);
+      p->clips[i] = NULL;
+    }
+  }
+}
+
+bool playlist_mix_init(playlist_mix *p, const char **urls, i32 num_urls,
+                       i32 sample_rate, double crossfade) {
+  if (!mixer_init(&p->m, sample_rate, PLAYLIST_MIX_MAX_TRACKS)) {
+    log_error("unable to initialize mixer");
+    return false;
+  }
+
+  p->urls = urls;
+  p->num_urls = num_urls;
+  p->next_url = 0;
+  p->next_start = 0.0;
+  p->end = 0;
+  p->crossfade = crossfade;
+  for (i32 i = 0; i < PLAYLIST_MIX_MAX_TRACKS; ++i) {
+    p->clips[i] = NULL;
+  }
+  return true;
+}
+
+void playlist_mix_free(playlist_mix *p) {
+  mixer_log_effect_stats(&p->m);
+  // decoders go before the clips they read from
+  for (i32 i = 0; i < PLAYLIST_MIX_MAX_TRACKS; ++i) {
+    mixer_remove_track(&p->m, i);
+  }
+  close_finished_clips(p);
+  mixer_free(&p->m);
+}
+
+bool playlist_mix_next(playlist_mix *p, float **out, i32 *num_samples) {
+  open_due_clips(p);
+  if (p->next_url >= p->num_urls && p->m.position >= p->end) {
+    *num_samples = 0;
+    return true;
+  }
+
+  i32 n = MIXER_BLOCK_SIZE;
+  if (p->next_url >= p->num_urls && p->end - p->m.position < n) {
+    n = (i32)(p->end - p->m.position);
+  }
+
+  mixer_wait(&p->m, n);
+  bool ok = mixer_mix(&p->m, out, n);
+  // decoders go before the clips they read from
+  mixer_reap(&p->m);
+  close_finished_clips(p);
+  *num_samples = n;
+  return ok;
+}
+
+bool offline_render_playlist(const char **urls, i32 num_urls,
+                             const offline_render_info *info) {
+  struct timespec start;
+  timespec_get(&start, TIME_UTC);
+
+  FILE *f = fopen(info->path, "wb");
+  if (!f) {
+    log_error("unable to open '%s' for writing", info->path);
+    goto fail_open;
+  }
+
+  if (!write_wav_header(f, info->sample_rate, 0)) {
+    log_error("unable to write WAV header");
+    goto fail_header;
+  }
+
+  playlist_mix mix;
+  if (!playlist_mix_init(&mix, urls, num_urls, info->sample_rate,
+                         info->crossfade)) {
+    goto fail_mixer;
+  }
+
+  loudness_meter meter;
+  if (!loudness_meter_init(&meter, info->sample_rate, MIXER_NUM_CHANNELS)) {
+    log_error("unable to initialize loudness meter");
+    goto fail_meter;
+  }
+
+  float block[MIXER_NUM_CHANNELS][MIXER_BLOCK_SIZE];
+  float *planes[MIXER_NUM_CHANNELS];
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    planes[i] = block[i];
+  }
+  float interleaved[MIXER_NUM_CHANNELS * MIXER_BLOCK_SIZE];
+
+  bool ok = true;
+  while (true) {
+    i32 n;
+    if (!playlist_mix_next(&mix, planes, &n)) {
+      ok = false;
+    }
+    if (n == 0) {
+      break;
+    }
+
+    for (i32 i = 0; i < n; ++i) {
+      for (i32 ch = 0; ch < MIXER_NUM_CHANNELS; ++ch) {
+        interleaved[i * MIXER_NUM_CHANNELS + ch] = block[ch][i];
+      }
+    }
+
+    // WAV is little-endian, as are the hosts this runs on
+    if (fwrite(interleaved, sizeof interleaved[0] * MIXER_NUM_CHANNELS, n, f) !=
+        (usize)n) {
+      log_error("unable to write samples to '%s'", info->path);
+      ok = false;
+      break;
+    }
+
+    // weighting overwrites the block, which is written out by now
+    if (!loudness_meter_process(&meter, planes, n)) {
+      ok = false;
+    }
+  }
+
+  i64 num_samples = mix.m.position;
+  playlist_mix_free(&mix);
+
+  if (!write_wav_header(f, info->sample_rate, num_samples)) {
+    log_error("unable to finalize WAV header");
+    ok = false;
+  }
+
+  if (fclose(f) != 0) {
+    log_error("unable to close '%s'", info->path);
+    ok = false;
+  }
+
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  double elapsed = timespec_to_double(timespec_sub(end, start));
+  double duration = (double)num_samples / info->sample_rate;
+  log_info("rendered %.2fs of audio in %.2fs (%.1fx realtime)", duration,
+           elapsed, duration / elapsed);
+  loudness_result loudness;
+  loudness_meter_result(&meter, &loudness);
+  loudness_meter_free(&meter);
+  log_info("mix: %.1f LUFS integrated, %.1f LU range, %.1f dBTP",
+           loudness.integrated, loudness.range, loudness.true_peak);
+
+  for (i32 i = 0; i < num_urls && info->source_loudness; ++i) {
+    atomic_bool cancel = false;
+    if (loudness_scan(urls[i], &cancel, &loudness)) {
+      log_info("'%s': %.1f LUFS integrated, %.1f LU range, %.1f dBTP",
+               urls[i], loudness.integrated, loudness.range,
+               loudness.true_peak);
+    } else {
+      log_warn("unable to measure loudness of '%s'", urls[i]);
+    }
+  }
+  return ok;
+
+fail_meter:
+  playlist_mix_free(&mix);
+fail_mixer:
+fail_header:
+  fclose(f);
+fail_open:
+  return false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../media/clip.h"
+#include "../utils/types.h"
+#include "mixer.h"
+
+// clips overlapping at any point in time, each is a mixer track
+#define PLAYLIST_MIX_MAX_TRACKS 8
+
+// mixes the audio of clips placed back to back, block by block, like in
+// playback
+typedef struct {
+  mixer m;
+  const char **urls;
+  i32 num_urls;
+  i32 next_url;
+  // timeline time the next clip starts at
+  double next_start;
+  // sample the last of the opened clips ends at
+  i64 end;
+  // overlap of consecutive clips (in seconds)
+  double crossfade;
+  // owners of the decoders of the mixer tracks
+  clip *clips[PLAYLIST_MIX_MAX_TRACKS];
+} playlist_mix;
+
+bool playlist_mix_init(playlist_mix *p, const char **urls, i32 num_urls,
+                       i32 sample_rate, double crossfade);
+void playlist_mix_free(playlist_mix *p);
+// mixes the next block (at most MIXER_BLOCK_SIZE samples) into out, one plane
+// per channel. num_samples is 0 at the end of the playlist. Returns false on
+// decode errors, the mix goes on without the failing clips.
+bool playlist_mix_next(playlist_mix *p, float **out, i32 *num_samples);
+
+typedef struct {
+  // 32-bit float stereo WAV
+  const char *path;
+  i32 sample_rate;
+  // overlap of consecutive clips (in seconds), faded like in playback
+  double crossfade;
+  // also measures the loudness of every source, not only of the mix
+  bool source_loudness;
+} offline_render_info;
+
+// mixes the audio of the clips placed back to back as fast as they decode,
+// without an audio device. The output only depends on the input files.
+bool offline_render_playlist(const char **urls, i32 num_urls,
+                             const offline_render_info *info);
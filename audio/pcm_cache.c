@@ -0,0 +1,611 @@
+#include "pcm_cache.h"
+#include "../media/clip.h"
+#include "../utils/fs.h"
+#include "../utils/hash.h"
+#include "../utils/threading_utils.h"
+#include "al_util.h"
+#include "dsp.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <log.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PCM_CACHE_MAGIC "CVEDPCM"
+// samples decoded straight into the mapping per call
+#define BUILD_CHUNK_SIZE 4096
+// headroom over the probed duration, which is not exact for every container
+#define CAPACITY_MARGIN 1.05
+
+// tells apart the build files of one process
+static atomic_uint num_builds;
+
+bool pcm_cache_init(pcm_cache *c, const char *dir, i64 budget) {
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    log_error("unable to create PCM cache directory '%s': %s", dir,
+              strerror(errno));
+    goto fail_mkdir;
+  }
+
+  if (!(c->dir = strdup(dir))) {
+    log_error("unable to allocate PCM cache directory");
+    goto fail_dir;
+  }
+
+  c->budget = budget;
+  c->open_paths = NULL;
+  c->num_open = 0;
+  c->open_capacity = 0;
+  i32 error;
+  if ((error = mtx_init(&c->evict_mutex, mtx_plain)) != thrd_success) {
+    log_error("unable to initialize PCM cache mutex: %s",
+              thrd_error_to_string(error));
+    goto fail_mutex;
+  }
+
+  pcm_cache_evict(c);
+  return true;
+
+fail_mutex:
+  free(c->dir);
+fail_dir:
+fail_mkdir:
+  return false;
+}
+
+void pcm_cache_free(pcm_cache *c) {
+  mtx_destroy(&c->evict_mutex);
+  free(c->open_paths);
+  free(c->dir);
+}
+
+static bool add_open_path(pcm_cache *c, char *path) {
+  mtx_lock(&c->evict_mutex);
+  if (c->num_open == c->open_capacity) {
+    i32 capacity = c->open_capacity ? c->open_capacity * 2 : 8;
+    char **grown = realloc(c->open_paths, capacity * sizeof *grown);
+    if (!grown) {
+      mtx_unlock(&c->evict_mutex);
+      log_error("unable to allocate PCM cache open path list");
+      return false;
+    }
+    c->open_paths = grown;
+    c->open_capacity = capacity;
+  }
+
+  c->open_paths[c->num_open++] = path;
+  mtx_unlock(&c->evict_mutex);
+  return true;
+}
+
+static void remove_open_path(pcm_cache *c, const char *path) {
+  mtx_lock(&c->evict_mutex);
+  for (i32 i = 0; i < c->num_open; ++i) {
+    if (c->open_paths[i] == path) {
+      c->open_paths[i] = c->open_paths[--c->num_open];
+      break;
+    }
+  }
+  mtx_unlock(&c->evict_mutex);
+}
+
+// called with evict_mutex held
+static bool is_open(const pcm_cache *c, const char *path) {
+  for (i32 i = 0; i < c->num_open; ++i) {
+    if (strcmp(c->open_paths[i], path) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// files still being built by this or another process, abandoned builds only
+// count once they are old enough
+static bool is_building(const char *path, i64 mtime) {
+  i32 fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  pcm_cache_header h;
+  bool building = pread(fd, &h, sizeof h, 0) == (ssize_t)sizeof h &&
+                  memcmp(h.magic, PCM_CACHE_MAGIC, sizeof h.magic) == 0 &&
+                  !h.complete &&
+                  time(NULL) - mtime < PCM_CACHE_ABANDONED_AGE;
+  close(fd);
+  return building;
+}
+
+typedef struct {
+  char *path;
+  i64 size;
+  i64 mtime;
+} cache_file;
+
+static int compare_mtime(const void *a, const void *b) {
+  const cache_file *fa = a, *fb = b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+void pcm_cache_evict(pcm_cache *c) {
+  mtx_lock(&c->evict_mutex);
+  DIR *d = opendir(c->dir);
+  if (!d) {
+    log_warn("unable to open PCM cache directory '%s': %s", c->dir,
+             strerror(errno));
+    mtx_unlock(&c->evict_mutex);
+    return;
+  }
+
+  cache_file *files = NULL;
+  i32 num_files = 0, capacity = 0;
+  i64 total = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d))) {
+    usize len = strlen(ent->d_name);
+    if (len < 4 || strcmp(&ent->d_name[len - 4], ".pcm") != 0) {
+      continue;
+    }
+
+    char *path = path_concat(c->dir, ent->d_name, false);
+    struct stat st;
+    if (!path || stat(path, &st) != 0) {
+      free(path);
+      continue;
+    }
+
+    if (num_files == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      cache_file *grown = realloc(files, capacity * sizeof *files);
+      if (!grown) {
+        log_error("unable to allocate PCM cache file list");
+        free(path);
+        break;
+      }
+      files = grown;
+    }
+
+    files[num_files++] = (cache_file){
+        .path = path,
+        .size = st.st_size,
+        .mtime = st.st_mtim.tv_sec,
+    };
+    total += st.st_size;
+  }
+  closedir(d);
+
+  qsort(files, num_files, sizeof *files, compare_mtime);
+  for (i32 i = 0; i < num_files; ++i) {
+    if (total > c->budget && !is_open(c, files[i].path) &&
+        !is_building(files[i].path, files[i].mtime)) {
+      if (unlink(files[i].path) == 0) {
+        log_debug("evicted PCM cache file '%s'", files[i].path);
+        total -= files[i].size;
+      } else {
+        log_warn("unable to evict PCM cache file '%s': %s", files[i].path,
+                 strerror(errno));
+      }
+    }
+    free(files[i].path);
+  }
+
+  free(files);
+  mtx_unlock(&c->evict_mutex);
+}
+
+static void map_planes(pcm_cache_entry *e) {
+  e->header = (pcm_cache_header *)e->map;
+  for (i32 i = 0; i < PCM_CACHE_NUM_CHANNELS; ++i) {
+    e->planes[i] = (float *)(e->map + PCM_CACHE_HEADER_SIZE) +
+                   i * e->header->capacity;
+  }
+}
+
+static bool map_file(pcm_cache_entry *e, usize size, bool writable) {
+  e->map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, e->fd, 0);
+  if (e->map == MAP_FAILED) {
+    log_error("unable to map PCM cache file '%s': %s", e->path,
+              strerror(errno));
+    e->map = NULL;
+    return false;
+  }
+
+  e->map_size = size;
+  return true;
+}
+
+// maps an existing cache file if it is complete and matches the source
+static bool open_existing(pcm_cache_entry *e, const struct stat *source,
+                          i32 sample_rate) {
+  struct stat st;
+  if ((e->fd = open(e->path, O_RDONLY)) < 0) {
+    return false;
+  }
+
+  if (fstat(e->fd, &st) != 0 || st.st_size < PCM_CACHE_HEADER_SIZE ||
+      !map_file(e, st.st_size, false)) {
+    goto fail_map;
+  }
+
+  const pcm_cache_header *h = (const pcm_cache_header *)e->map;
+  if (memcmp(h->magic, PCM_CACHE_MAGIC, sizeof h->magic) != 0 ||
+      h->version != PCM_CACHE_VERSION || h->sample_rate != sample_rate ||
+      h->num_channels != PCM_CACHE_NUM_CHANNELS ||
+      !atomic_load_explicit(&h->complete, memory_order_acquire) ||
+      h->source_size != source->st_size ||
+      h->source_mtime != source->st_mtim.tv_sec ||
+      (usize)st.st_size < PCM_CACHE_HEADER_SIZE + PCM_CACHE_NUM_CHANNELS *
+                                                     h->capacity *
+                                                     sizeof(float)) {
+    goto fail_header;
+  }
+
+  // opening counts as use for eviction
+  futimens(e->fd, NULL);
+  map_planes(e);
+  atomic_store(&e->num_samples, h->num_samples);
+  return true;
+
+fail_header:
+  munmap(e->map, e->map_size);
+  e->map = NULL;
+fail_map:
+  close(e->fd);
+  e->fd = -1;
+  return false;
+}
+
+typedef struct {
+  pcm_cache_entry *e;
+  i32 sample_rate;
+  struct stat source;
+} build_info;
+
+static bool create_file(pcm_cache_entry *e, const build_info *info,
+                        i64 capacity) {
+  usize size =
+      PCM_CACHE_HEADER_SIZE + PCM_CACHE_NUM_CHANNELS * capacity * sizeof(float);
+  if ((e->fd = open(e->build_path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+    log_error("unable to create PCM cache file '%s': %s", e->build_path,
+              strerror(errno));
+    goto fail_open;
+  }
+
+  if (ftruncate(e->fd, size) != 0) {
+    log_error("unable to size PCM cache file '%s': %s", e->build_path,
+              strerror(errno));
+    goto fail_truncate;
+  }
+
+  if (!map_file(e, size, true)) {
+    goto fail_truncate;
+  }
+
+  pcm_cache_header *h = (pcm_cache_header *)e->map;
+  *h = (pcm_cache_header){
+      .version = PCM_CACHE_VERSION,
+      .sample_rate = info->sample_rate,
+      .num_channels = PCM_CACHE_NUM_CHANNELS,
+      .complete = 0,
+      .capacity = capacity,
+      .num_samples = 0,
+      .source_size = info->source.st_size,
+      .source_mtime = info->source.st_mtim.tv_sec,
+      .start_time = 0.0,
+  };
+  memcpy(h->magic, PCM_CACHE_MAGIC, sizeof h->magic);
+  map_planes(e);
+  return true;
+
+fail_truncate:
+  close(e->fd);
+  e->fd = -1;
+  unlink(e->build_path);
+fail_open:
+  return false;
+}
+
+static bool build(pcm_cache_entry *e, const build_info *info) {
+  clip c;
+  if (!clip_open(&c, &(clip_open_info){.url = e->url, .audio_only = true})) {
+    log_error("unable to open audio of '%s' for caching", e->url);
+    goto fail_clip;
+  }
+
+  if (!(c.duration > 0.0)) {
+    log_error("'%s' has no known duration, not caching its audio", e->url);
+    goto fail_duration;
+  }
+
+  i64 capacity = (i64)(c.duration * info->sample_rate * CAPACITY_MARGIN) +
+                 info->sample_rate;
+  if (!create_file(e, info, capacity)) {
+    goto fail_file;
+  }
+
+  audio_output_format out;
+  audio_output_format_init_planar(&out, PCM_CACHE_NUM_CHANNELS,
+                                  info->sample_rate);
+  audio_playback_context apc;
+  if (!audio_playback_context_init(&apc, clip_take_audio(&c), &out)) {
+    log_error("unable to initialize audio decoding for caching");
+    decode_context_free(&c.audio);
+    goto fail_apc;
+  }
+
+  pcm_cache_header *h = e->header;
+  i64 position = 0;
+  bool ok = true;
+  while (position < capacity && !atomic_load(&e->cancel)) {
+    u8 *dst[PCM_CACHE_NUM_CHANNELS];
+    for (i32 i = 0; i < PCM_CACHE_NUM_CHANNELS; ++i) {
+      dst[i] = (u8 *)&e->planes[i][position];
+    }
+
+    i32 n = capacity - position < BUILD_CHUNK_SIZE ? (i32)(capacity - position)
+                                                   : BUILD_CHUNK_SIZE;
+    i32 num_decoded = audio_playback_context_decode(&apc, dst, n);
+    if (num_decoded < 0) {
+      log_error("unable to decode audio of '%s' for caching", e->url);
+      ok = false;
+      break;
+    }
+
+    if (position == 0) {
+      h->start_time = isnan(apc.base_time)
+                          ? c.start_time
+                          : apc.base_time -
+                                (double)apc.base_sample / info->sample_rate;
+    }
+    position += num_decoded;
+    atomic_store(&e->num_samples, position);
+    if (num_decoded < n) {
+      break;
+    }
+  }
+
+  if (position == capacity) {
+    log_warn("audio of '%s' is longer than probed, cache is truncated",
+             e->url);
+  }
+
+  h->num_samples = position;
+  bool complete = ok && !atomic_load(&e->cancel);
+  atomic_store_explicit(&h->complete, complete, memory_order_release);
+  if (msync(e->map, e->map_size, MS_ASYNC) != 0) {
+    log_warn("unable to flush PCM cache file '%s': %s", e->path,
+             strerror(errno));
+  }
+
+  audio_playback_context_free(&apc);
+  clip_close(&c);
+  // the mapping stays valid if another build of the source replaces the file
+  if (!complete) {
+    unlink(e->build_path);
+  } else if (rename(e->build_path, e->path) != 0) {
+    log_warn("unable to move PCM cache file '%s' into place: %s",
+             e->build_path, strerror(errno));
+    unlink(e->build_path);
+  }
+  return ok;
+
+fail_apc:
+fail_file:
+fail_duration:
+  clip_close(&c);
+fail_clip:
+  return false;
+}
+
+static int build_thread_callback(void *arg) {
+  build_info *info = arg;
+  pcm_cache_entry *e = info->e;
+  bool ok = build(e, info);
+  atomic_store(&e->failed, !ok);
+  if (ok) {
+    log_debug("cached %" PRIi64 " audio samples of '%s'",
+              (i64)atomic_load(&e->num_samples), e->url);
+    pcm_cache_evict(e->cache);
+  }
+
+  free(info);
+  return ok ? 0 : 1;
+}
+
+bool pcm_cache_open(pcm_cache *c, pcm_cache_entry *e, const char *url,
+                    i32 sample_rate) {
+  e->cache = c;
+  e->url = NULL;
+  e->path = NULL;
+  e->build_path = NULL;
+  e->fd = -1;
+  e->map = NULL;
+  e->header = NULL;
+  e->building = false;
+  atomic_init(&e->cancel, false);
+  atomic_init(&e->failed, false);
+  atomic_init(&e->num_samples, 0);
+
+  build_info *info = malloc(sizeof *info);
+  if (!info) {
+    log_error("unable to allocate PCM cache build info");
+    goto fail_info;
+  }
+
+  info->e = e;
+  info->sample_rate = sample_rate;
+  // non-file URLs are keyed by name alone
+  if (stat(url, &info->source) != 0) {
+    memset(&info->source, 0, sizeof info->source);
+  }
+
+  char *key = path_absolute(url);
+  u64 h = hash_fnv1a_str(HASH_FNV1A_INIT, key ? key : url);
+  free(key);
+  i64 source_size = info->source.st_size;
+  i64 source_mtime = info->source.st_mtim.tv_sec;
+  h = hash_fnv1a(h, &source_size, sizeof source_size);
+  h = hash_fnv1a(h, &source_mtime, sizeof source_mtime);
+  h = hash_fnv1a(h, &sample_rate, sizeof sample_rate);
+
+  char name[64];
+  snprintf(name, sizeof name, "%016" PRIx64 ".pcm", h);
+  if (!(e->url = strdup(url)) ||
+      !(e->path = path_concat(c->dir, name, false))) {
+    log_error("unable to allocate PCM cache paths");
+    goto fail_paths;
+  }
+
+  // registered before the file is opened or created, so eviction never
+  // deletes it in between
+  if (!add_open_path(c, e->path)) {
+    goto fail_paths;
+  }
+
+  if (open_existing(e, &info->source, sample_rate)) {
+    free(info);
+    return true;
+  }
+
+  snprintf(name, sizeof name, "%016" PRIx64 ".%d.%u.pcm", h, (int)getpid(),
+           atomic_fetch_add(&num_builds, 1));
+  if (!(e->build_path = path_concat(c->dir, name, false))) {
+    log_error("unable to allocate PCM cache paths");
+    goto fail_build_path;
+  }
+  if (!add_open_path(c, e->build_path)) {
+    goto fail_add_build_path;
+  }
+
+  i32 error;
+  if ((error = thrd_create(&e->thread, build_thread_callback, info)) !=
+      thrd_success) {
+    log_error("unable to start PCM cache thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  e->building = true;
+  return true;
+
+fail_thread:
+  remove_open_path(c, e->build_path);
+fail_add_build_path:
+  free(e->build_path);
+fail_build_path:
+  remove_open_path(c, e->path);
+fail_paths:
+  free(e->path);
+  free(e->url);
+  free(info);
+fail_info:
+  return false;
+}
+
+void pcm_cache_entry_close(pcm_cache_entry *e) {
+  if (e->building) {
+    atomic_store(&e->cancel, true);
+    thrd_join(e->thread, NULL);
+  }
+
+  if (e->map) {
+    munmap(e->map, e->map_size);
+  }
+  if (e->fd >= 0) {
+    close(e->fd);
+  }
+  if (e->build_path) {
+    remove_open_path(e->cache, e->build_path);
+  }
+  remove_open_path(e->cache, e->path);
+  free(e->build_path);
+  free(e->path);
+  free(e->url);
+}
+
+bool pcm_cache_entry_complete(pcm_cache_entry *e) {
+  // the header is mapped before the first store to num_samples
+  return atomic_load(&e->num_samples) > 0 &&
+         atomic_load_explicit(&e->header->complete, memory_order_acquire);
+}
+
+i64 pcm_cache_entry_sample(pcm_cache_entry *e, double time) {
+  if (atomic_load(&e->num_samples) == 0) {
+    return 0;
+  }
+
+  return llround((time - e->header->start_time) * e->header->sample_rate);
+}
+
+i32 pcm_cache_entry_read(pcm_cache_entry *e, float **dst, i64 start, i32 n) {
+  // planes are published before the first store to num_samples
+  i64 available = atomic_load(&e->num_samples);
+  i64 first = start < 0 ? 0 : start;
+  i64 last = start + n < available ? start + n : available;
+  i32 num_copied = last > first ? (i32)(last - first) : 0;
+  i32 offset = (i32)(first - start);
+  for (i32 i = 0; i < PCM_CACHE_NUM_CHANNELS; ++i) {
+    if (num_copied == 0) {
+      dsp_clear(dst[i], n);
+      continue;
+    }
+
+    dsp_clear(dst[i], offset);
+    memcpy(&dst[i][offset], &e->planes[i][first],
+           num_copied * sizeof(float));
+    dsp_clear(&dst[i][offset + num_copied], n - offset - num_copied);
+  }
+
+  return num_copied;
+}
+
+void pcm_cache_entry_read_loop(pcm_cache_entry *e, float **dst,
+                               i64 *position, i64 loop_start, i64 loop_end,
+                               i32 n) {
+  if (loop_end <= loop_start) {
+    for (i32 i = 0; i < PCM_CACHE_NUM_CHANNELS; ++i) {
+      dsp_clear(dst[i], n);
+    }
+    return;
+  }
+
+  float *d[PCM_CACHE_NUM_CHANNELS];
+  i32 done = 0;
+  while (done < n) {
+    if (*position < loop_start || *position >= loop_end) {
+      *position = loop_start;
+    }
+
+    i64 left = loop_end - *position;
+    i32 len = left < n - done ? (i32)left : n - done;
+    for (i32 i = 0; i < PCM_CACHE_NUM_CHANNELS; ++i) {
+      d[i] = &dst[i][done];
+    }
+
+    pcm_cache_entry_read(e, d, *position, len);
+    *position += len;
+    done += len;
+  }
+}
+
+i32 pcm_cache_entry_read_grain(pcm_cache_entry *e, float **dst, i64 start,
+                               i32 n) {
+  i32 num_read = pcm_cache_entry_read(e, dst, start, n);
+  i32 fade = PCM_CACHE_GRAIN_FADE < n / 2 ? PCM_CACHE_GRAIN_FADE : n / 2;
+  for (i32 i = 0; i < PCM_CACHE_NUM_CHANNELS && fade > 0; ++i) {
+    dsp_mul_ramp(dst[i], fade, 0.0f, 1.0f);
+    dsp_mul_ramp(&dst[i][n - fade], fade, 1.0f, 0.0f);
+  }
+
+  return num_read;
+}
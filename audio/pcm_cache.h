@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+#define PCM_CACHE_NUM_CHANNELS 2
+#define PCM_CACHE_VERSION 1
+// samples are stored after a page-sized header
+#define PCM_CACHE_HEADER_SIZE 4096
+#define PCM_CACHE_BUDGET_DEFAULT ((i64)4 << 30)
+// fade at each end of a scrub grain, in samples
+#define PCM_CACHE_GRAIN_FADE 64
+// incomplete files untouched for this long (in seconds) were left by a build
+// that never finished and may be evicted
+#define PCM_CACHE_ABANDONED_AGE (24 * 60 * 60)
+
+// on-disk layout: header, then one plane of capacity floats per channel
+typedef struct {
+  char magic[8];
+  u32 version;
+  i32 sample_rate;
+  i32 num_channels;
+  // set last by the build, with release order, readers load it with acquire
+  _Atomic u32 complete;
+  i64 capacity;
+  i64 num_samples;
+  // the cache is stale once the source changes
+  i64 source_size;
+  i64 source_mtime;
+  // media time (in seconds) of the first sample
+  double start_time;
+} pcm_cache_header;
+
+// directory of cache files, least recently opened ones are deleted once they
+// take more than the budget
+typedef struct {
+  char *dir;
+  i64 budget;
+  // guards eviction and the paths of open entries, which it skips
+  mtx_t evict_mutex;
+  char **open_paths;
+  i32 num_open;
+  i32 open_capacity;
+} pcm_cache;
+
+// decoded audio of one source, readable while it is still being decoded
+typedef struct {
+  pcm_cache *cache;
+  char *url;
+  char *path;
+  // file the build writes, renamed to path once complete, so builds of the
+  // same source never write into one file
+  char *build_path;
+  i32 fd;
+  u8 *map;
+  usize map_size;
+  pcm_cache_header *header;
+  float *planes[PCM_CACHE_NUM_CHANNELS];
+
+  thrd_t thread;
+  bool building;
+  atomic_bool cancel;
+  atomic_bool failed;
+  // samples decoded so far, the rest reads as silence
+  atomic_llong num_samples;
+} pcm_cache_entry;
+
+bool pcm_cache_init(pcm_cache *c, const char *dir, i64 budget);
+void pcm_cache_free(pcm_cache *c);
+// deletes the least recently used files until the cache fits its budget
+void pcm_cache_evict(pcm_cache *c);
+
+// maps an up-to-date cache file of the source, or starts decoding it into a
+// new one on a background thread
+bool pcm_cache_open(pcm_cache *c, pcm_cache_entry *e, const char *url,
+                    i32 sample_rate);
+void pcm_cache_entry_close(pcm_cache_entry *e);
+bool pcm_cache_entry_complete(pcm_cache_entry *e);
+// sample index of a media time (in seconds)
+i64 pcm_cache_entry_sample(pcm_cache_entry *e, double time);
+
+// copies n samples per channel from start into dst, sample accurate. Samples
+// outside the decoded range are silence. Returns the number of decoded
+// samples copied.
+i32 pcm_cache_entry_read(pcm_cache_entry *e, float **dst, i64 start, i32 n);
+// reads n samples of [loop_start, loop_end) repeated, from *position on,
+// and advances *position. An empty loop reads silence.
+void pcm_cache_entry_read_loop(pcm_cache_entry *e, float **dst,
+                               i64 *position, i64 loop_start, i64 loop_end,
+                               i32 n);
+// a grain of n samples starting at start, faded in and out so consecutive
+// grains at arbitrary positions do not click
+i32 pcm_cache_entry_read_grain(pcm_cache_entry *e, float **dst, i64 start,
+                               i32 n);
@@ -0,0 +1,404 @@
+#include "waveform.h"
+#include "../utils/threading_utils.h"
+#include "analysis.h"
+#include "dsp.h"
+#include <log.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timespec.h>
+
+#define WAVEFORM_MAGIC "CVEDPKS"
+#define WAVEFORM_SUFFIX "peaks"
+
+typedef struct {
+  char magic[8];
+  u32 version;
+  i32 sample_rate;
+  i32 num_channels;
+  i32 num_levels;
+  i64 num_samples;
+  i64 source_size;
+  i64 source_mtime;
+  double start_time;
+  i64 num_buckets[WAVEFORM_NUM_LEVELS];
+} waveform_file_header;
+
+static i64 bucket_size(i32 level) {
+  i64 size = WAVEFORM_BUCKET_SIZE;
+  for (i32 i = 0; i < level; ++i) {
+    size *= WAVEFORM_LEVEL_RATIO;
+  }
+
+  return size;
+}
+
+static i16 quantize(float x) {
+  x = x < -1.0f ? -1.0f : x > 1.0f ? 1.0f : x;
+  return (i16)lrintf(x * INT16_MAX);
+}
+
+static void init_empty(waveform *w) {
+  w->sample_rate = 0;
+  w->num_samples = 0;
+  w->start_time = 0.0;
+  for (i32 i = 0; i < WAVEFORM_NUM_LEVELS; ++i) {
+    w->num_buckets[i] = 0;
+    w->levels[i] = NULL;
+  }
+}
+
+void waveform_free(waveform *w) {
+  for (i32 i = 0; i < WAVEFORM_NUM_LEVELS; ++i) {
+    free(w->levels[i]);
+  }
+}
+
+bool waveform_load(waveform *w, const char *url) {
+  init_empty(w);
+  analysis_source source;
+  if (!analysis_source_stat(url, &source)) {
+    return false;
+  }
+
+  char *path = analysis_sidecar_path(url, WAVEFORM_SUFFIX);
+  if (!path) {
+    log_error("unable to allocate waveform path");
+    goto fail_path;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    goto fail_open;
+  }
+
+  waveform_file_header h;
+  if (fread(&h, sizeof h, 1, f) != 1 ||
+      memcmp(h.magic, WAVEFORM_MAGIC, sizeof h.magic) != 0 ||
+      h.version != WAVEFORM_VERSION ||
+      h.num_channels != WAVEFORM_NUM_CHANNELS ||
+      h.num_levels != WAVEFORM_NUM_LEVELS || h.source_size != source.size ||
+      h.source_mtime != source.mtime) {
+    log_debug("waveform '%s' is stale", path);
+    goto fail_header;
+  }
+
+  w->sample_rate = h.sample_rate;
+  w->num_samples = h.num_samples;
+  w->start_time = h.start_time;
+  for (i32 i = 0; i < WAVEFORM_NUM_LEVELS; ++i) {
+    usize n = h.num_buckets[i] * WAVEFORM_NUM_CHANNELS;
+    w->num_buckets[i] = h.num_buckets[i];
+    if (!(w->levels[i] = malloc(n * sizeof *w->levels[i])) ||
+        fread(w->levels[i], sizeof *w->levels[i], n, f) != n) {
+      log_warn("unable to read waveform '%s'", path);
+      goto fail_levels;
+    }
+  }
+
+  fclose(f);
+  free(path);
+  return true;
+
+fail_levels:
+  waveform_free(w);
+  init_empty(w);
+fail_header:
+  fclose(f);
+fail_open:
+  free(path);
+fail_path:
+  return false;
+}
+
+bool waveform_save(const waveform *w, const char *url) {
+  analysis_source source;
+  if (!analysis_source_stat(url, &source)) {
+    return false;
+  }
+
+  char *path = analysis_sidecar_path(url, WAVEFORM_SUFFIX);
+  if (!path) {
+    log_error("unable to allocate waveform path");
+    goto fail_path;
+  }
+
+  FILE *f = analysis_sidecar_create(path);
+  if (!f) {
+    goto fail_create;
+  }
+
+  waveform_file_header h = {
+      .version = WAVEFORM_VERSION,
+      .sample_rate = w->sample_rate,
+      .num_channels = WAVEFORM_NUM_CHANNELS,
+      .num_levels = WAVEFORM_NUM_LEVELS,
+      .num_samples = w->num_samples,
+      .source_size = source.size,
+      .source_mtime = source.mtime,
+      .start_time = w->start_time,
+  };
+  memcpy(h.magic, WAVEFORM_MAGIC, sizeof h.magic);
+  memcpy(h.num_buckets, w->num_buckets, sizeof h.num_buckets);
+  if (fwrite(&h, sizeof h, 1, f) != 1) {
+    goto fail_write;
+  }
+
+  for (i32 i = 0; i < WAVEFORM_NUM_LEVELS; ++i) {
+    usize n = w->num_buckets[i] * WAVEFORM_NUM_CHANNELS;
+    if (fwrite(w->levels[i], sizeof *w->levels[i], n, f) != n) {
+      goto fail_write;
+    }
+  }
+
+  bool ok = analysis_sidecar_commit(f, path);
+  free(path);
+  return ok;
+
+fail_write:
+  log_warn("unable to write waveform '%s'", path);
+  analysis_sidecar_abort(f, path);
+fail_create:
+  free(path);
+fail_path:
+  return false;
+}
+
+// bucket being filled on one level
+typedef struct {
+  float min[WAVEFORM_NUM_CHANNELS];
+  float max[WAVEFORM_NUM_CHANNELS];
+  double sum_sq[WAVEFORM_NUM_CHANNELS];
+  i64 count;
+} accumulator;
+
+typedef struct {
+  waveform *w;
+  i64 capacity[WAVEFORM_NUM_LEVELS];
+  accumulator acc[WAVEFORM_NUM_LEVELS];
+  bool ok;
+} generator;
+
+static void reset(accumulator *a) {
+  for (i32 ch = 0; ch < WAVEFORM_NUM_CHANNELS; ++ch) {
+    a->min[ch] = INFINITY;
+    a->max[ch] = -INFINITY;
+    a->sum_sq[ch] = 0.0;
+  }
+  a->count = 0;
+}
+
+static void merge(accumulator *dst, const accumulator *src) {
+  for (i32 ch = 0; ch < WAVEFORM_NUM_CHANNELS; ++ch) {
+    dst->min[ch] = fminf(dst->min[ch], src->min[ch]);
+    dst->max[ch] = fmaxf(dst->max[ch], src->max[ch]);
+    dst->sum_sq[ch] += src->sum_sq[ch];
+  }
+  dst->count += src->count;
+}
+
+// appends the bucket of a level and folds it into the next one
+static void emit(generator *g, i32 level) {
+  waveform *w = g->w;
+  accumulator *a = &g->acc[level];
+  if (w->num_buckets[level] == g->capacity[level]) {
+    i64 capacity = g->capacity[level] ? g->capacity[level] * 2 : 1024;
+    waveform_peak *grown =
+        realloc(w->levels[level],
+                capacity * WAVEFORM_NUM_CHANNELS * sizeof *w->levels[level]);
+    if (!grown) {
+      log_error("unable to grow waveform level %d", level);
+      g->ok = false;
+      return;
+    }
+    w->levels[level] = grown;
+    g->capacity[level] = capacity;
+  }
+
+  waveform_peak *p =
+      &w->levels[level][w->num_buckets[level]++ * WAVEFORM_NUM_CHANNELS];
+  for (i32 ch = 0; ch < WAVEFORM_NUM_CHANNELS; ++ch) {
+    p[ch] = (waveform_peak){
+        .min = quantize(a->min[ch]),
+        .max = quantize(a->max[ch]),
+        .rms = quantize(sqrtf((float)(a->sum_sq[ch] / a->count))),
+    };
+  }
+
+  if (level + 1 < WAVEFORM_NUM_LEVELS) {
+    merge(&g->acc[level + 1], a);
+    if (g->acc[level + 1].count == bucket_size(level + 1)) {
+      emit(g, level + 1);
+    }
+  }
+  reset(a);
+}
+
+static void on_start(const analysis_stream_info *info, void *userdata) {
+  generator *g = userdata;
+  g->w->sample_rate = info->sample_rate;
+  g->w->start_time = info->start_time;
+}
+
+static bool on_block(float **planes, i32 n, double time, void *userdata) {
+  (void)time;
+  generator *g = userdata;
+  accumulator *a = &g->acc[0];
+  for (i32 i = 0; i < n && g->ok;) {
+    i32 len = (i32)(WAVEFORM_BUCKET_SIZE - a->count);
+    len = len < n - i ? len : n - i;
+    for (i32 ch = 0; ch < WAVEFORM_NUM_CHANNELS; ++ch) {
+      float min, max, sum_sq;
+      dsp_min_max_sum_sq(&planes[ch][i], len, &min, &max, &sum_sq);
+      a->min[ch] = fminf(a->min[ch], min);
+      a->max[ch] = fmaxf(a->max[ch], max);
+      a->sum_sq[ch] += sum_sq;
+    }
+
+    a->count += len;
+    i += len;
+    if (a->count == WAVEFORM_BUCKET_SIZE) {
+      emit(g, 0);
+    }
+  }
+
+  g->w->num_samples += n;
+  return g->ok;
+}
+
+bool waveform_generate(waveform *w, const char *url,
+                       const atomic_bool *cancel) {
+  init_empty(w);
+  generator g = {.w = w, .capacity = {0}, .ok = true};
+  for (i32 i = 0; i < WAVEFORM_NUM_LEVELS; ++i) {
+    reset(&g.acc[i]);
+  }
+
+  struct timespec start;
+  timespec_get(&start, TIME_UTC);
+  if (!analysis_decode(url, WAVEFORM_NUM_CHANNELS, 0.0, cancel, on_start,
+                       on_block, &g) ||
+      !g.ok) {
+    waveform_free(w);
+    init_empty(w);
+    return false;
+  }
+
+  // the tail ends in a partial bucket on every level
+  for (i32 i = 0; i < WAVEFORM_NUM_LEVELS && g.ok; ++i) {
+    if (g.acc[i].count > 0) {
+      emit(&g, i);
+    }
+  }
+
+  if (!g.ok) {
+    waveform_free(w);
+    init_empty(w);
+    return false;
+  }
+
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  double elapsed = timespec_to_double(timespec_sub(end, start));
+  double duration = (double)w->num_samples / w->sample_rate;
+  log_info("generated waveform of '%s', %.2fs of audio in %.2fs (%.1fx "
+           "realtime)",
+           url, duration, elapsed, duration / elapsed);
+  return true;
+}
+
+void waveform_columns(const waveform *w, i32 channel, double start,
+                      double end, i32 num_columns, waveform_column *out) {
+  double first = (start - w->start_time) * w->sample_rate;
+  double samples_per_column = (end - start) * w->sample_rate / num_columns;
+  i32 level = 0;
+  while (level + 1 < WAVEFORM_NUM_LEVELS &&
+         bucket_size(level + 1) <= samples_per_column) {
+    ++level;
+  }
+
+  // zoomed in past the finest level, neighbouring columns share a bucket
+  double size = (double)bucket_size(level);
+  const waveform_peak *peaks = w->levels[level];
+  i64 num_buckets = w->num_buckets[level];
+  for (i32 i = 0; i < num_columns; ++i) {
+    i64 b0 = (i64)floor((first + i * samples_per_column) / size);
+    i64 b1 = (i64)floor((first + (i + 1) * samples_per_column) / size);
+    b0 = b0 < 0 ? 0 : b0;
+    b1 = b1 <= b0 ? b0 + 1 : b1;
+    b1 = b1 > num_buckets ? num_buckets : b1;
+    if (b0 >= b1) {
+      out[i] = (waveform_column){0};
+      continue;
+    }
+
+    i32 min = INT16_MAX, max = INT16_MIN;
+    double sum_sq = 0.0;
+    for (i64 b = b0; b < b1; ++b) {
+      const waveform_peak *p = &peaks[b * WAVEFORM_NUM_CHANNELS + channel];
+      min = p->min < min ? p->min : min;
+      max = p->max > max ? p->max : max;
+      sum_sq += (double)p->rms * p->rms;
+    }
+
+    out[i] = (waveform_column){
+        .min = (float)min / INT16_MAX,
+        .max = (float)max / INT16_MAX,
+        .rms = (float)(sqrt(sum_sq / (b1 - b0)) / INT16_MAX),
+    };
+  }
+}
+
+static int job_thread_callback(void *arg) {
+  waveform_job *j = arg;
+  if (waveform_load(&j->waveform, j->url)) {
+    j->success = true;
+  } else if (waveform_generate(&j->waveform, j->url, &j->cancel)) {
+    // non-file sources are generated on every run
+    waveform_save(&j->waveform, j->url);
+    j->success = true;
+  } else {
+    j->success = false;
+  }
+
+  atomic_store(&j->done, true);
+  return 0;
+}
+
+bool waveform_job_start(waveform_job *j, const char *url) {
+  atomic_init(&j->cancel, false);
+  atomic_init(&j->done, false);
+  j->success = false;
+  if (!(j->url = strdup(url))) {
+    log_error("unable to allocate waveform URL");
+    goto fail_url;
+  }
+
+  i32 error;
+  if ((error = thrd_create(&j->thread, job_thread_callback, j)) !=
+      thrd_success) {
+    log_error("unable to start waveform thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  return true;
+
+fail_thread:
+  free(j->url);
+fail_url:
+  return false;
+}
+
+bool waveform_job_done(waveform_job *j) { return atomic_load(&j->done); }
+
+void waveform_job_free(waveform_job *j) {
+  atomic_store(&j->cancel, true);
+  thrd_join(j->thread, NULL);
+  if (j->success) {
+    waveform_free(&j->waveform);
+  }
+  free(j->url);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <stdatomic.h>
+#include <threads.h>
+
+// the peak pyramid: buckets of 256, 4096 and 65536 samples
+#define WAVEFORM_NUM_LEVELS 3
+#define WAVEFORM_BUCKET_SIZE 256
+#define WAVEFORM_LEVEL_RATIO 16
+#define WAVEFORM_NUM_CHANNELS 2
+#define WAVEFORM_VERSION 1
+
+// scaled so INT16_MAX is full scale
+typedef struct {
+  i16 min, max, rms;
+} waveform_peak;
+
+typedef struct {
+  i32 sample_rate;
+  i64 num_samples;
+  // media time (in seconds) of the first sample
+  double start_time;
+  i64 num_buckets[WAVEFORM_NUM_LEVELS];
+  // channels interleaved per bucket
+  waveform_peak *levels[WAVEFORM_NUM_LEVELS];
+} waveform;
+
+// one pixel column of a drawn waveform
+typedef struct {
+  float min, max, rms;
+} waveform_column;
+
+// reads the sidecar of the source if it is up to date
+bool waveform_load(waveform *w, const char *url);
+bool waveform_save(const waveform *w, const char *url);
+// decodes all audio of the source, stops early once cancel is set
+bool waveform_generate(waveform *w, const char *url,
+                       const atomic_bool *cancel);
+void waveform_free(waveform *w);
+// reduces [start, end) (media time in seconds) to num_columns columns from
+// the coarsest level with at least one bucket per column, so the cost
+// follows the number of columns rather than the zoom
+void waveform_columns(const waveform *w, i32 channel, double start,
+                      double end, i32 num_columns, waveform_column *out);
+
+// loads or generates (and saves) the waveform of a source in the background
+typedef struct {
+  char *url;
+  thrd_t thread;
+  atomic_bool cancel;
+  atomic_bool done;
+  bool success;
+  waveform waveform;
+} waveform_job;
+
+bool waveform_job_start(waveform_job *j, const char *url);
+bool waveform_job_done(waveform_job *j);
+// cancels the job if it is still running
+void waveform_job_free(waveform_job *j);
@@ -0,0 +1,354 @@
+#include "blur.h"
+#include <log.h>
+#include <math.h>
+#include <string.h>
+
+// std140 layout of the blur_params block
+typedef struct {
+  // x offset in texels, y weight
+  GLfloat taps[BLUR_GAUSSIAN_MAX_TAPS][4];
+  GLfloat direction[2];
+  GLfloat amount;
+  GLint num_taps;
+} blur_params;
+
+// draws a blur pass, source on unit 0 and coarse on unit 1
+static void draw(blur_library *b, shader_program *p, const blur_params *params,
+                 const GLuint *inputs, i32 num_inputs) {
+  if (!shader_program_use(p)) {
+    return;
+  }
+  uniform_buffer_update(&b->params, params);
+  glDisable(GL_BLEND);
+  for (i32 i = num_inputs - 1; i >= 0; --i) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, inputs[i]);
+  }
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static shader_program *create_program(shader_manager *m, const char *fs,
+                                      bool coarse) {
+  shader_program *p = shader_create_vf(m, "effect.vs.glsl", fs);
+  if (!p) {
+    log_error("unable to create blur shader '%s'", fs);
+    return NULL;
+  }
+  shader_program_set_sampler(p, shader_program_uniform(p, "source"), 0);
+  if (coarse) {
+    shader_program_set_sampler(p, shader_program_uniform(p, "coarse"), 1);
+  }
+  shader_program_bind_block(p, "blur_params", BLUR_PARAMS_BINDING);
+  return p;
+}
+
+bool blur_library_init(blur_library *b, shader_manager *m) {
+  b->manager = m;
+  if (!uniform_buffer_init(&b->params, BLUR_PARAMS_BINDING,
+                           sizeof(blur_params))) {
+    log_error("unable to create blur parameter buffer");
+    goto fail_params;
+  }
+
+  if (!(b->gaussian = create_program(m, "blur/gaussian.fs.glsl", false))) {
+    goto fail_gaussian;
+  }
+  if (!(b->kawase_down =
+            create_program(m, "blur/kawase_down.fs.glsl", false))) {
+    goto fail_kawase_down;
+  }
+  if (!(b->kawase_up = create_program(m, "blur/kawase_up.fs.glsl", false))) {
+    goto fail_kawase_up;
+  }
+  if (!(b->pyramid_down =
+            create_program(m, "blur/pyramid_down.fs.glsl", false))) {
+    goto fail_pyramid_down;
+  }
+  if (!(b->pyramid_up = create_program(m, "blur/pyramid_up.fs.glsl", true))) {
+    goto fail_pyramid_up;
+  }
+  if (!(b->glow = create_program(m, "blur/glow.fs.glsl", true))) {
+    goto fail_glow;
+  }
+  return true;
+
+fail_glow:
+  shader_program_destroy(m, b->pyramid_up);
+fail_pyramid_up:
+  shader_program_destroy(m, b->pyramid_down);
+fail_pyramid_down:
+  shader_program_destroy(m, b->kawase_up);
+fail_kawase_up:
+  shader_program_destroy(m, b->kawase_down);
+fail_kawase_down:
+  shader_program_destroy(m, b->gaussian);
+fail_gaussian:
+  uniform_buffer_free(&b->params);
+fail_params:
+  return false;
+}
+
+void blur_library_free(blur_library *b) {
+  shader_program_destroy(b->manager, b->glow);
+  shader_program_destroy(b->manager, b->pyramid_up);
+  shader_program_destroy(b->manager, b->pyramid_down);
+  shader_program_destroy(b->manager, b->kawase_up);
+  shader_program_destroy(b->manager, b->kawase_down);
+  shader_program_destroy(b->manager, b->gaussian);
+  uniform_buffer_free(&b->params);
+}
+
+// adds a pass of run reading inputs into a new width x height resource of
+// the format of inputs[0], -1 on errors
+static render_resource add_pass(render_graph *g, const char *name,
+                                render_pass_callback run, i32 arg,
+                                void *user, const render_resource *inputs,
+                                i32 num_inputs, i32 width, i32 height) {
+  render_resource output = render_graph_create(
+      g, g->resources[inputs[0]].internal_format, width, height);
+  if (output < 0) {
+    return -1;
+  }
+  render_pass pass = {
+      .name = name,
+      .run = run,
+      .arg = arg,
+      .user = user,
+      .num_inputs = num_inputs,
+      .output = output,
+  };
+  memcpy(pass.inputs, inputs, num_inputs * sizeof *inputs);
+  return render_graph_add_pass(g, &pass) ? output : -1;
+}
+
+static void run_pyramid_down(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  blur_library *b = user;
+  draw(b, b->pyramid_down, &(blur_params){0}, inputs, 1);
+}
+
+bool blur_pyramid_add(blur_library *lib, render_graph *g,
+                      render_resource source, i32 num_levels,
+                      blur_pyramid *out) {
+  if (num_levels > BLUR_MAX_LEVELS) {
+    num_levels = BLUR_MAX_LEVELS;
+  }
+  out->num_levels = 0;
+  out->levels[0] = source;
+  while (out->num_levels < num_levels) {
+    const render_graph_resource *prev =
+        &g->resources[out->levels[out->num_levels]];
+    if (prev->width < 2 || prev->height < 2) {
+      break;
+    }
+    render_resource level = add_pass(
+        g, "pyramid down", run_pyramid_down, 0, lib,
+        &out->levels[out->num_levels], 1, (prev->width + 1) / 2,
+        (prev->height + 1) / 2);
+    if (level < 0) {
+      return false;
+    }
+    out->levels[++out->num_levels] = level;
+  }
+  return true;
+}
+
+// normalized Gaussian weights folded into bilinear taps: the centre texel,
+// then one fetch between each pair of neighbouring texels on either side,
+// weighted by both. Returns the number of taps.
+static i32 gaussian_taps(GLfloat sigma, GLfloat taps[][4]) {
+  sigma = fminf(fmaxf(sigma, 0.1f), BLUR_GAUSSIAN_MAX_SIGMA);
+  i32 radius = (i32)ceilf(3.0f * sigma);
+  if (radius > 2 * (BLUR_GAUSSIAN_MAX_TAPS - 1)) {
+    radius = 2 * (BLUR_GAUSSIAN_MAX_TAPS - 1);
+  }
+
+  double weights[2 * BLUR_GAUSSIAN_MAX_TAPS];
+  double total = 0.0;
+  for (i32 k = 0; k <= radius; ++k) {
+    weights[k] = exp(-(double)(k * k) / (2.0 * sigma * sigma));
+    total += k == 0 ? weights[k] : 2.0 * weights[k];
+  }
+
+  taps[0][0] = 0.0f;
+  taps[0][1] = (GLfloat)(weights[0] / total);
+  i32 n = 1;
+  for (i32 k = 1; k <= radius; k += 2) {
+    double w1 = weights[k];
+    double w2 = k + 1 <= radius ? weights[k + 1] : 0.0;
+    taps[n][0] = (GLfloat)((k * w1 + (k + 1) * w2) / (w1 + w2));
+    taps[n][1] = (GLfloat)((w1 + w2) / total);
+    ++n;
+  }
+  return n;
+}
+
+// arg 0 blurs horizontally, 1 vertically
+static void run_gaussian(i32 arg, const GLuint *inputs, void *user) {
+  gaussian_blur *b = user;
+  blur_params params = {
+      .direction = {arg == 0 ? 1.0f : 0.0f, arg == 0 ? 0.0f : 1.0f},
+  };
+  params.num_taps = gaussian_taps(b->sigma, params.taps);
+  draw(b->lib, b->lib->gaussian, &params, inputs, 1);
+}
+
+static render_resource add_gaussian(compositor_effect *effect,
+                                    render_graph *g, render_resource input) {
+  render_resource r = input;
+  for (i32 i = 0; i < 2 && r >= 0; ++i) {
+    const render_graph_resource *in = &g->resources[r];
+    r = add_pass(g, i == 0 ? "gaussian blur x" : "gaussian blur y",
+                 run_gaussian, i, effect, &r, 1, in->width, in->height);
+  }
+  return r;
+}
+
+void gaussian_blur_init(gaussian_blur *b, blur_library *lib, GLfloat sigma) {
+  b->effect.add_passes = add_gaussian;
+  b->lib = lib;
+  b->sigma = sigma;
+}
+
+static void run_kawase_down(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  kawase_blur *b = user;
+  draw(b->lib, b->lib->kawase_down, &(blur_params){.amount = b->offset},
+       inputs, 1);
+}
+
+static void run_kawase_up(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  kawase_blur *b = user;
+  draw(b->lib, b->lib->kawase_up, &(blur_params){.amount = b->offset},
+       inputs, 1);
+}
+
+static render_resource add_kawase(compositor_effect *effect, render_graph *g,
+                                  render_resource input) {
+  kawase_blur *b = (kawase_blur *)effect;
+  // sizes of the levels, the doublings return through the same ones
+  i32 widths[BLUR_MAX_LEVELS + 1], heights[BLUR_MAX_LEVELS + 1];
+  widths[0] = g->resources[input].width;
+  heights[0] = g->resources[input].height;
+  i32 num_levels = 0;
+  render_resource r = input;
+  while (num_levels < b->iterations && num_levels < BLUR_MAX_LEVELS &&
+         widths[num_levels] > 1 && heights[num_levels] > 1) {
+    widths[num_levels + 1] = (widths[num_levels] + 1) / 2;
+    heights[num_levels + 1] = (heights[num_levels] + 1) / 2;
+    ++num_levels;
+    if ((r = add_pass(g, "kawase down", run_kawase_down, 0, b, &r, 1,
+                      widths[num_levels], heights[num_levels])) < 0) {
+      return -1;
+    }
+  }
+  for (i32 i = num_levels - 1; i >= 0; --i) {
+    if ((r = add_pass(g, "kawase up", run_kawase_up, 0, b, &r, 1, widths[i],
+                      heights[i])) < 0) {
+      return -1;
+    }
+  }
+  return r;
+}
+
+void kawase_blur_init(kawase_blur *b, blur_library *lib, i32 iterations,
+                      GLfloat offset) {
+  b->effect.add_passes = add_kawase;
+  b->lib = lib;
+  b->iterations = iterations;
+  b->offset = offset;
+}
+
+// level arg of a pyramid blur: level arg mixed with the coarser result, by
+// how far the radius reaches past the level's texel size
+static void run_pyramid_up(i32 arg, const GLuint *inputs, void *user) {
+  pyramid_blur *b = user;
+  float amount = log2f(fmaxf(b->radius, 1.0f)) - (float)arg;
+  draw(b->lib, b->lib->pyramid_up,
+       &(blur_params){.amount = fminf(fmaxf(amount, 0.0f), 1.0f)}, inputs,
+       2);
+}
+
+// adds the passes from level num_levels of p up to last_level, each mixing a
+// level with the result of the coarser ones. Returns the result at the size
+// of last_level, -1 on errors
+static render_resource add_upsampling(render_graph *g, const blur_pyramid *p,
+                                      i32 last_level, render_pass_callback run,
+                                      void *user) {
+  render_resource r = p->levels[p->num_levels];
+  for (i32 k = p->num_levels - 1; k >= last_level; --k) {
+    const render_graph_resource *level = &g->resources[p->levels[k]];
+    if ((r = add_pass(g, "pyramid up", run, k, user,
+                      (render_resource[]){p->levels[k], r}, 2, level->width,
+                      level->height)) < 0) {
+      return -1;
+    }
+  }
+  return r;
+}
+
+static render_resource add_pyramid_blur(compositor_effect *effect,
+                                        render_graph *g,
+                                        render_resource input) {
+  pyramid_blur *b = (pyramid_blur *)effect;
+  blur_pyramid p;
+  if (!blur_pyramid_add(b->lib, g, input, b->num_levels, &p)) {
+    return -1;
+  }
+  return add_upsampling(g, &p, 0, run_pyramid_up, b);
+}
+
+void pyramid_blur_init(pyramid_blur *b, blur_library *lib, GLfloat max_radius) {
+  b->effect.add_passes = add_pyramid_blur;
+  b->lib = lib;
+  // the coarsest level's texels are about the radius
+  b->num_levels = (i32)ceilf(log2f(fmaxf(max_radius, 1.0f)));
+  if (b->num_levels > BLUR_MAX_LEVELS) {
+    b->num_levels = BLUR_MAX_LEVELS;
+  }
+  b->radius = max_radius;
+}
+
+static void run_glow_up(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  glow_effect *e = user;
+  draw(e->lib, e->lib->pyramid_up,
+       &(blur_params){.amount = BLUR_GLOW_SPREAD}, inputs, 2);
+}
+
+static void run_glow(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  glow_effect *e = user;
+  draw(e->lib, e->lib->glow,
+       &(blur_params){.amount = e->intensity}, inputs, 2);
+}
+
+static render_resource add_glow(compositor_effect *effect, render_graph *g,
+                                render_resource input) {
+  glow_effect *e = (glow_effect *)effect;
+  blur_pyramid p;
+  if (!blur_pyramid_add(e->lib, g, input, e->num_levels, &p)) {
+    return -1;
+  } else if (p.num_levels == 0) {
+    // nothing to blur
+    return input;
+  }
+  // the levels blurred together, added to the sharp layer
+  render_resource blurred = add_upsampling(g, &p, 1, run_glow_up, e);
+  if (blurred < 0) {
+    return -1;
+  }
+  const render_graph_resource *in = &g->resources[input];
+  return add_pass(g, "glow", run_glow, 0, e,
+                  (render_resource[]){input, blurred}, 2, in->width,
+                  in->height);
+}
+
+void glow_effect_init(glow_effect *g, blur_library *lib, i32 num_levels,
+                      GLfloat intensity) {
+  g->effect.add_passes = add_glow;
+  g->lib = lib;
+  g->num_levels = num_levels;
+  g->intensity = intensity;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "compositor.h"
+#include "render_graph.h"
+#include "shader.h"
+#include "uniform_buffer.h"
+#include <glad/gles2.h>
+
+// uniform buffer binding point of the blur_params block, see
+// shaders/blur/blur_params.glsl
+#define BLUR_PARAMS_BINDING 2
+// bilinear taps of one Gaussian pass, the centre included
+#define BLUR_GAUSSIAN_MAX_TAPS 32
+// largest sigma the taps cover, about a third of 2 * (taps - 1) texels
+#define BLUR_GAUSSIAN_MAX_SIGMA 20.0f
+// halvings of a pyramid or Kawase blur
+#define BLUR_MAX_LEVELS 8
+// share of the coarser levels in each level of a glow
+#define BLUR_GLOW_SPREAD 0.6f
+
+// programs and parameters shared by the blur effects. Every blur is a chain
+// of fragment passes in the compositor's render graph, so intermediate
+// images come from its framebuffer pool.
+typedef struct {
+  shader_manager *manager;
+  shader_program *gaussian;
+  shader_program *kawase_down;
+  shader_program *kawase_up;
+  shader_program *pyramid_down;
+  shader_program *pyramid_up;
+  shader_program *glow;
+  uniform_buffer params;
+} blur_library;
+
+bool blur_library_init(blur_library *b, shader_manager *m);
+// call before shader_manager_free
+void blur_library_free(blur_library *b);
+
+typedef struct {
+  i32 num_levels;
+  // levels[0] is the source, each further level is half the size of the last
+  render_resource levels[BLUR_MAX_LEVELS + 1];
+} blur_pyramid;
+
+// adds the passes downsampling source to levels 1 to num_levels to g. Stops
+// early once a level would be smaller than a texel. False on errors.
+bool blur_pyramid_add(blur_library *lib, render_graph *g,
+                      render_resource source, i32 num_levels,
+                      blur_pyramid *out);
+
+// separable Gaussian, two passes with linear sampling halving the taps. Cost
+// grows with sigma, large radii are cheaper with the pyramid or Kawase blur.
+typedef struct {
+  compositor_effect effect;
+  blur_library *lib;
+  // texels, up to BLUR_GAUSSIAN_MAX_SIGMA, read every frame
+  GLfloat sigma;
+} gaussian_blur;
+
+void gaussian_blur_init(gaussian_blur *b, blur_library *lib, GLfloat sigma);
+
+// dual Kawase: iterations halvings and as many doublings of 5 and 8 taps,
+// for large radii at a fixed cost of about 1.3 full-size passes
+typedef struct {
+  compositor_effect effect;
+  blur_library *lib;
+  // changing it rebuilds the graph
+  i32 iterations;
+  // spreads the taps, 1 is the plain filter, read every frame
+  GLfloat offset;
+} kawase_blur;
+
+void kawase_blur_init(kawase_blur *b, blur_library *lib, i32 iterations,
+                      GLfloat offset);
+
+// blurs by up to max_radius pixels through a pyramid of the input, each level
+// blending in the blurred coarser ones. The radius changes smoothly without
+// rebuilding the graph.
+typedef struct {
+  compositor_effect effect;
+  blur_library *lib;
+  i32 num_levels;
+  // pixels, up to the max_radius of init, read every frame
+  GLfloat radius;
+} pyramid_blur;
+
+void pyramid_blur_init(pyramid_blur *b, blur_library *lib, GLfloat max_radius);
+
+// adds a wide blur of the layer to itself, from a pyramid of num_levels
+typedef struct {
+  compositor_effect effect;
+  blur_library *lib;
+  i32 num_levels;
+  // read every frame
+  GLfloat intensity;
+} glow_effect;
+
+void glow_effect_init(glow_effect *g, blur_library *lib, i32 num_levels,
+                      GLfloat intensity);
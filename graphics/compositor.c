@@ -0,0 +1,354 @@
+#include "compositor.h"
+#include "../utils/hash.h"
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+
+// std140 layout of the layer_params block
+typedef struct {
+  GLfloat transform_x[4];
+  GLfloat transform_y[4];
+  GLfloat opacity;
+  GLfloat padding[3];
+} layer_params;
+
+static void set_params(compositor *c, const GLfloat *transform,
+                       GLfloat opacity) {
+  layer_params params = {
+      .transform_x = {transform[0], transform[1], transform[2], 0.0f},
+      .transform_y = {transform[3], transform[4], transform[5], 0.0f},
+      .opacity = opacity,
+  };
+  uniform_buffer_update(&c->params, &params);
+}
+
+// colours are premultiplied
+static void set_blend(compositor_blend blend) {
+  glEnable(GL_BLEND);
+  glBlendEquation(GL_FUNC_ADD);
+  switch (blend) {
+  case COMPOSITOR_BLEND_NORMAL:
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    break;
+  case COMPOSITOR_BLEND_ADD:
+    glBlendFunc(GL_ONE, GL_ONE);
+    break;
+  case COMPOSITOR_BLEND_MULTIPLY:
+    // src * dst + dst * (1 - alpha), dst where the layer is transparent
+    glBlendFunc(GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+    break;
+  case COMPOSITOR_BLEND_SCREEN:
+    // src + dst - src * dst
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_COLOR);
+    break;
+  }
+}
+
+static void bind_textures(const GLuint *textures, i32 num_textures) {
+  for (i32 i = 0; i < num_textures; ++i) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+  }
+}
+
+// draws the source of a layer without effects straight into the output
+static void draw_layer(i32 arg, const GLuint *inputs, void *user) {
+  (void)inputs;
+  compositor *c = user;
+  const compositor_layer *l = &c->layers[arg];
+  if (!shader_program_use(l->program)) {
+    return;
+  }
+  set_params(c, l->transform, l->opacity);
+  set_blend(l->blend);
+  bind_textures(l->textures, l->num_textures);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// draws the source of a layer untransformed into the target its effects read
+static void draw_source(i32 arg, const GLuint *inputs, void *user) {
+  (void)inputs;
+  compositor *c = user;
+  const compositor_layer *l = &c->layers[arg];
+  if (!shader_program_use(l->program)) {
+    return;
+  }
+  set_params(c, (GLfloat[])COMPOSITOR_IDENTITY, 1.0f);
+  glDisable(GL_BLEND);
+  bind_textures(l->textures, l->num_textures);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// blends the result of a layer's effects into the output
+static void draw_composite(i32 arg, const GLuint *inputs, void *user) {
+  compositor *c = user;
+  const compositor_layer *l = &c->layers[arg];
+  if (!shader_program_use(c->composite)) {
+    return;
+  }
+  set_params(c, l->transform, l->opacity);
+  set_blend(l->blend);
+  bind_textures(inputs, 1);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static void run_shader_effect(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  compositor_shader_effect *e = user;
+  if (!shader_program_use(e->program)) {
+    return;
+  }
+  glDisable(GL_BLEND);
+  bind_textures(inputs, 1);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+render_resource compositor_add_effect_pass(render_graph *g,
+                                           render_resource input,
+                                           const char *name,
+                                           render_pass_callback run,
+                                           void *user) {
+  const render_graph_resource *in = &g->resources[input];
+  render_resource output =
+      render_graph_create(g, in->internal_format, in->width, in->height);
+  if (output < 0 || !render_graph_add_pass(g, &(render_pass){
+                                                  .name = name,
+                                                  .run = run,
+                                                  .user = user,
+                                                  .inputs = {input},
+                                                  .num_inputs = 1,
+                                                  .output = output,
+                                              })) {
+    return -1;
+  }
+  return output;
+}
+
+static render_resource add_shader_effect(compositor_effect *effect,
+                                         render_graph *g,
+                                         render_resource input) {
+  return compositor_add_effect_pass(g, input, "shader effect",
+                                    run_shader_effect, effect);
+}
+
+void compositor_shader_effect_init(compositor_shader_effect *e,
+                                   shader_program *program) {
+  e->effect.add_passes = add_shader_effect;
+  e->program = program;
+  e->source_handle = shader_program_uniform(program, "source");
+  shader_program_set_sampler(program, e->source_handle, 0);
+}
+
+bool compositor_init(compositor *c, shader_manager *m) {
+  c->manager = m;
+  c->built = false;
+  c->structure = 0;
+  c->built_num_layers = 0;
+  c->built_num_effects = NULL;
+  c->built_effects = NULL;
+  c->built_layers_capacity = 0;
+  c->built_effects_capacity = 0;
+  c->layers = NULL;
+  c->num_builds = 0;
+  fbo_pool_init(&c->pool);
+  render_graph_init(&c->graph, &c->pool);
+
+  if (!uniform_buffer_init(&c->params, COMPOSITOR_PARAMS_BINDING,
+                           sizeof(layer_params))) {
+    log_error("unable to create layer parameter buffer");
+    goto fail_params;
+  }
+  if (!(c->composite =
+            shader_create_vf(m, "layer.vs.glsl", "composite.fs.glsl"))) {
+    log_error("unable to create compositing shader");
+    goto fail_composite;
+  }
+  shader_program_set_sampler(
+      c->composite, shader_program_uniform(c->composite, "source"), 0);
+  shader_program_bind_block(c->composite, "layer_params",
+                            COMPOSITOR_PARAMS_BINDING);
+  return true;
+
+fail_composite:
+  uniform_buffer_free(&c->params);
+fail_params:
+  render_graph_free(&c->graph);
+  fbo_pool_free(&c->pool);
+  return false;
+}
+
+void compositor_free(compositor *c) {
+  log_info("compositor: graph built %" PRIi64 " times", c->num_builds);
+  shader_program_destroy(c->manager, c->composite);
+  uniform_buffer_free(&c->params);
+  render_graph_free(&c->graph);
+  fbo_pool_free(&c->pool);
+  free(c->built_effects);
+  free(c->built_num_effects);
+}
+
+static u64 structure_key(const compositor_layer *layers, i32 num_layers,
+                         const render_target *output) {
+  u64 key = HASH_FNV1A_INIT;
+  key = hash_fnv1a(key, &output->width, sizeof output->width);
+  key = hash_fnv1a(key, &output->height, sizeof output->height);
+  key = hash_fnv1a(key, &num_layers, sizeof num_layers);
+  for (i32 i = 0; i < num_layers; ++i) {
+    const compositor_layer *l = &layers[i];
+    key = hash_fnv1a(key, &l->num_effects, sizeof l->num_effects);
+    key = hash_fnv1a(key, l->effects, l->num_effects * sizeof *l->effects);
+  }
+  return key;
+}
+
+// the hash alone could let a different structure reuse the graph
+static bool same_structure(const compositor *c, const compositor_layer *layers,
+                           i32 num_layers, const render_target *output) {
+  if (output->width != c->built_width || output->height != c->built_height ||
+      num_layers != c->built_num_layers) {
+    return false;
+  }
+
+  compositor_effect *const *effects = c->built_effects;
+  for (i32 i = 0; i < num_layers; ++i) {
+    const compositor_layer *l = &layers[i];
+    if (l->num_effects != c->built_num_effects[i] ||
+        memcmp(l->effects, effects, l->num_effects * sizeof *effects) != 0) {
+      return false;
+    }
+    effects += l->num_effects;
+  }
+  return true;
+}
+
+static bool store_structure(compositor *c, const compositor_layer *layers,
+                            i32 num_layers, const render_target *output) {
+  i32 num_effects = 0;
+  for (i32 i = 0; i < num_layers; ++i) {
+    num_effects += layers[i].num_effects;
+  }
+
+  if (num_layers > c->built_layers_capacity) {
+    i32 *counts = realloc(c->built_num_effects, num_layers * sizeof *counts);
+    if (!counts) {
+      log_error("unable to allocate compositor structure");
+      return false;
+    }
+    c->built_num_effects = counts;
+    c->built_layers_capacity = num_layers;
+  }
+  if (num_effects > c->built_effects_capacity) {
+    compositor_effect **effects =
+        realloc(c->built_effects, num_effects * sizeof *effects);
+    if (!effects) {
+      log_error("unable to allocate compositor structure");
+      return false;
+    }
+    c->built_effects = effects;
+    c->built_effects_capacity = num_effects;
+  }
+
+  compositor_effect **effects = c->built_effects;
+  for (i32 i = 0; i < num_layers; ++i) {
+    const compositor_layer *l = &layers[i];
+    c->built_num_effects[i] = l->num_effects;
+    memcpy(effects, l->effects, l->num_effects * sizeof *effects);
+    effects += l->num_effects;
+  }
+  c->built_width = output->width;
+  c->built_height = output->height;
+  c->built_num_layers = num_layers;
+  return true;
+}
+
+static bool build(compositor *c, const compositor_layer *layers,
+                  i32 num_layers, const render_target *output) {
+  render_graph *g = &c->graph;
+  render_graph_reset(g);
+  if (!render_graph_add_pass(g, &(render_pass){
+                                    .name = "clear",
+                                    .output = RENDER_GRAPH_OUTPUT,
+                                    .clear = true,
+                                    .clear_color = {0.0f, 0.0f, 0.0f, 1.0f},
+                                })) {
+    return false;
+  }
+
+  for (i32 i = 0; i < num_layers; ++i) {
+    const compositor_layer *l = &layers[i];
+    if (l->num_effects == 0) {
+      if (!render_graph_add_pass(g, &(render_pass){
+                                        .name = "layer",
+                                        .run = draw_layer,
+                                        .arg = i,
+                                        .user = c,
+                                        .output = RENDER_GRAPH_OUTPUT,
+                                    })) {
+        return false;
+      }
+      continue;
+    }
+
+    render_resource r = render_graph_create(g, COMPOSITOR_FORMAT,
+                                            output->width, output->height);
+    if (r < 0 || !render_graph_add_pass(g, &(render_pass){
+                                               .name = "layer source",
+                                               .run = draw_source,
+                                               .arg = i,
+                                               .user = c,
+                                               .output = r,
+                                           })) {
+      return false;
+    }
+    for (i32 j = 0; j < l->num_effects; ++j) {
+      compositor_effect *e = l->effects[j];
+      if ((r = e->add_passes(e, g, r)) < 0) {
+        log_error("unable to add effect %d of layer %d", j, i);
+        return false;
+      }
+    }
+    if (!render_graph_add_pass(g, &(render_pass){
+                                      .name = "composite",
+                                      .run = draw_composite,
+                                      .arg = i,
+                                      .user = c,
+                                      .inputs = {r},
+                                      .num_inputs = 1,
+                                      .output = RENDER_GRAPH_OUTPUT,
+                                  })) {
+      return false;
+    }
+  }
+
+  if (!render_graph_compile(g)) {
+    return false;
+  }
+  log_debug("built compositor graph: %d layers, %d passes, %d resources in "
+            "%d targets",
+            num_layers, g->num_passes, g->num_resources, g->num_targets);
+  return true;
+}
+
+bool compositor_draw(compositor *c, const compositor_layer *layers,
+                     i32 num_layers, const render_target *output) {
+  u64 key = structure_key(layers, num_layers, output);
+  if (!c->built || key != c->structure ||
+      !same_structure(c, layers, num_layers, output)) {
+    if (!store_structure(c, layers, num_layers, output) ||
+        !build(c, layers, num_layers, output)) {
+      log_error("unable to build compositor graph");
+      c->built = false;
+      return false;
+    }
+    c->structure = key;
+    c->built = true;
+    ++c->num_builds;
+  }
+
+  c->layers = layers;
+  render_graph_execute(&c->graph, output);
+  c->layers = NULL;
+  glDisable(GL_BLEND);
+  glActiveTexture(GL_TEXTURE0);
+  return true;
+}
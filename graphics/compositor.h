@@ -0,0 +1,103 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "fbo_pool.h"
+#include "render_graph.h"
+#include "render_target.h"
+#include "shader.h"
+#include "uniform_buffer.h"
+#include <glad/gles2.h>
+
+// uniform buffer binding point of the layer_params block, see
+// shaders/layer_params.glsl
+#define COMPOSITOR_PARAMS_BINDING 0
+// format of the targets layers with effects are drawn into
+#define COMPOSITOR_FORMAT GL_RGBA8
+
+typedef enum {
+  COMPOSITOR_BLEND_NORMAL,
+  COMPOSITOR_BLEND_ADD,
+  COMPOSITOR_BLEND_MULTIPLY,
+  COMPOSITOR_BLEND_SCREEN,
+} compositor_blend;
+
+typedef struct compositor_effect compositor_effect;
+// processes a layer before it is blended. add_passes adds the passes reading
+// input to g and returns the resource they write, -1 on errors. Effects are
+// told apart by address, the same effect has to be passed every frame for the
+// graph to be kept.
+struct compositor_effect {
+  render_resource (*add_passes)(compositor_effect *e, render_graph *g,
+                                render_resource input);
+};
+
+// one full-screen pass of program, which samples the layer from the sampler
+// source on unit 0 at uv, see shaders/effect.vs.glsl
+typedef struct {
+  compositor_effect effect;
+  shader_program *program;
+  i32 source_handle;
+} compositor_shader_effect;
+
+void compositor_shader_effect_init(compositor_shader_effect *e,
+                                   shader_program *program);
+// adds a pass of run reading input to g, writing a new resource of input's
+// format and size. Returns the new resource, -1 on errors.
+render_resource compositor_add_effect_pass(render_graph *g,
+                                           render_resource input,
+                                           const char *name,
+                                           render_pass_callback run,
+                                           void *user);
+
+typedef struct {
+  // draws the layer's source with premultiplied alpha, vertices from
+  // shaders/layer.vs.glsl
+  shader_program *program;
+  // bound to units 0 and up
+  const GLuint *textures;
+  i32 num_textures;
+  // maps the layer's quad, -1 to 1 on both axes, to the output:
+  // x' = t[0] x + t[1] y + t[2], y' = t[3] x + t[4] y + t[5]
+  GLfloat transform[6];
+  GLfloat opacity;
+  compositor_blend blend;
+  // applied in order before blending
+  compositor_effect **effects;
+  i32 num_effects;
+} compositor_layer;
+
+#define COMPOSITOR_IDENTITY {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f}
+
+// blends layers bottom to top through a render graph. The graph only depends
+// on the number of layers, their effects and the output size, it is rebuilt
+// when those change and otherwise executed as is with the layers' current
+// sources, transforms, opacities and blend modes.
+typedef struct {
+  shader_manager *manager;
+  fbo_pool pool;
+  render_graph graph;
+  // what the graph was built for. The hash rejects most changes, a match is
+  // confirmed against the layer count and effect lists.
+  u64 structure;
+  i32 built_width, built_height;
+  i32 built_num_layers;
+  // effect count of every layer, and their effects back to back
+  i32 *built_num_effects;
+  compositor_effect **built_effects;
+  i32 built_layers_capacity;
+  i32 built_effects_capacity;
+  bool built;
+  // draws a layer drawn into a target by its effects
+  shader_program *composite;
+  uniform_buffer params;
+  // layers of the frame being drawn, read by the passes
+  const compositor_layer *layers;
+  i64 num_builds;
+} compositor;
+
+bool compositor_init(compositor *c, shader_manager *m);
+// call before shader_manager_free
+void compositor_free(compositor *c);
+// clears output to black and blends layers over it, leaving output bound
+bool compositor_draw(compositor *c, const compositor_layer *layers,
+                     i32 num_layers, const render_target *output);
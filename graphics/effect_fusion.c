@@ -0,0 +1,210 @@
+#include "effect_fusion.h"
+#include "../utils/hash.h"
+#include <assert.h>
+#include <log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  // function in shaders/effects
+  const char *function;
+  // takes a sampler3D after its parameters
+  bool takes_texture;
+} pixel_effect_info;
+
+static const pixel_effect_info pixel_effects[CHAIN_EFFECT_NUM_KINDS] = {
+    [CHAIN_EFFECT_EXPOSURE] = {"exposure", false},
+    [CHAIN_EFFECT_COLOUR_BALANCE] = {"colour_balance", false},
+    [CHAIN_EFFECT_LUT] = {"lut", true},
+    [CHAIN_EFFECT_VIGNETTE] = {"vignette", false},
+};
+
+// std140 layout of the effect_params block
+typedef struct {
+  GLfloat params[EFFECT_FUSION_MAX_RUN][4];
+} effect_params;
+
+static void run_fused(i32 arg, const GLuint *inputs, void *user) {
+  (void)arg;
+  fused_pass *p = user;
+  if (!shader_program_use(p->program)) {
+    return;
+  }
+
+  effect_params params = {0};
+  i32 num_textures = 0;
+  for (i32 i = 0; i < p->num_effects; ++i) {
+    const chain_effect *e = &p->chain[i];
+    memcpy(params.params[i], e->params, sizeof params.params[i]);
+    if (pixel_effects[e->kind].takes_texture) {
+      glActiveTexture(GL_TEXTURE1 + num_textures++);
+      glBindTexture(GL_TEXTURE_3D, e->texture);
+    }
+  }
+  uniform_buffer_update(&p->fuser->params, &params);
+
+  glDisable(GL_BLEND);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, inputs[0]);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static render_resource add_fused(compositor_effect *effect, render_graph *g,
+                                 render_resource input) {
+  return compositor_add_effect_pass(g, input, "fused effects", run_fused,
+                                    effect);
+}
+
+bool effect_fuser_init(effect_fuser *f, shader_manager *m) {
+  f->num_compiled = 0;
+  if (!uniform_buffer_init(&f->params, EFFECT_FUSION_PARAMS_BINDING,
+                           sizeof(effect_params))) {
+    log_error("unable to create effect parameter buffer");
+    goto fail_params;
+  }
+  if (!shader_variants_init_vf(&f->variants, m, "effect.vs.glsl",
+                               "fused.fs.glsl")) {
+    log_error("unable to create fused effect variants");
+    goto fail_variants;
+  }
+  return true;
+
+fail_variants:
+  uniform_buffer_free(&f->params);
+fail_params:
+  return false;
+}
+
+void effect_fuser_free(effect_fuser *f) {
+  log_info("effect fusion: %d programs compiled", f->num_compiled);
+  shader_variants_free(&f->variants);
+  uniform_buffer_free(&f->params);
+}
+
+// program of a run of per-pixel effects, generated the first time the
+// sequence is compiled
+static shader_program *fused_program(effect_fuser *f,
+                                     const chain_effect *chain,
+                                     i32 num_effects) {
+  u64 key = HASH_FNV1A_INIT;
+  for (i32 i = 0; i < num_effects; ++i) {
+    key = hash_fnv1a(key, &chain[i].kind, sizeof chain[i].kind);
+  }
+  shader_program *p = shader_variants_find(&f->variants, key);
+  if (p) {
+    return p;
+  }
+
+  // a sampler per effect taking one, and the calls in chain order
+  char defines[2048];
+  i32 length = snprintf(defines, sizeof defines, "#define EFFECT_UNIFORMS");
+  i32 num_textures = 0;
+  for (i32 i = 0; i < num_effects; ++i) {
+    if (pixel_effects[chain[i].kind].takes_texture) {
+      length += snprintf(&defines[length], sizeof defines - length,
+                         " uniform mediump sampler3D effect_texture_%d;",
+                         num_textures++);
+    }
+  }
+  length += snprintf(&defines[length], sizeof defines - length,
+                     "\n#define EFFECT_CHAIN(c, uv)");
+  num_textures = 0;
+  for (i32 i = 0; i < num_effects; ++i) {
+    const pixel_effect_info *info = &pixel_effects[chain[i].kind];
+    length += snprintf(&defines[length], sizeof defines - length,
+                       " c = %s(c, uv, params[%d]", info->function, i);
+    if (info->takes_texture) {
+      length += snprintf(&defines[length], sizeof defines - length,
+                         ", effect_texture_%d", num_textures++);
+    }
+    length += snprintf(&defines[length], sizeof defines - length, ");");
+  }
+  length += snprintf(&defines[length], sizeof defines - length, "\n");
+  assert(length < ssizeof(defines));
+
+  if (!(p = shader_variants_add(&f->variants, key, defines))) {
+    return NULL;
+  }
+  shader_program_set_sampler(p, shader_program_uniform(p, "source"), 0);
+  for (i32 i = 0; i < num_textures; ++i) {
+    char name[32];
+    snprintf(name, sizeof name, "effect_texture_%d", i);
+    shader_program_set_sampler(p, shader_program_uniform(p, name), 1 + i);
+  }
+  shader_program_bind_block(p, "effect_params", EFFECT_FUSION_PARAMS_BINDING);
+  ++f->num_compiled;
+  log_info("compiled %d fused effects into one program", num_effects);
+  return p;
+}
+
+bool effect_fuser_compile(effect_fuser *f, const chain_effect *chain,
+                          i32 num_effects, fused_chain *out) {
+  out->num_effects = 0;
+  out->num_passes = 0;
+  // at most one of either per effect, malloc(0) may be NULL
+  if (!(out->effects = malloc(num_effects * sizeof *out->effects)) &&
+      num_effects > 0) {
+    log_error("unable to allocate fused chain");
+    goto fail_effects;
+  }
+  if (!(out->passes = malloc(num_effects * sizeof *out->passes)) &&
+      num_effects > 0) {
+    log_error("unable to allocate fused passes");
+    goto fail_passes;
+  }
+
+  for (i32 i = 0; i < num_effects;) {
+    assert(chain[i].kind >= 0 && chain[i].kind < CHAIN_EFFECT_NUM_KINDS);
+    if (chain[i].kind == CHAIN_EFFECT_NEIGHBOURHOOD) {
+      out->effects[out->num_effects++] = chain[i].neighbourhood;
+      ++i;
+      continue;
+    }
+
+    // the longest run of per-pixel effects one program can take
+    i32 run = 0;
+    i32 num_textures = 0;
+    for (; i + run < num_effects && run < EFFECT_FUSION_MAX_RUN; ++run) {
+      const chain_effect *e = &chain[i + run];
+      if (e->kind == CHAIN_EFFECT_NEIGHBOURHOOD) {
+        break;
+      }
+      if (pixel_effects[e->kind].takes_texture &&
+          num_textures++ == EFFECT_FUSION_MAX_TEXTURES) {
+        break;
+      }
+    }
+
+    shader_program *program = fused_program(f, &chain[i], run);
+    if (!program) {
+      log_error("unable to fuse effects %d to %d", i, i + run - 1);
+      goto fail_program;
+    }
+    fused_pass *p = &out->passes[out->num_passes++];
+    *p = (fused_pass){
+        .effect = {.add_passes = add_fused},
+        .fuser = f,
+        .program = program,
+        .chain = &chain[i],
+        .num_effects = run,
+    };
+    out->effects[out->num_effects++] = &p->effect;
+    i += run;
+  }
+
+  log_debug("fused %d effects into %d passes", num_effects, out->num_effects);
+  return true;
+
+fail_program:
+  free(out->passes);
+fail_passes:
+  free(out->effects);
+fail_effects:
+  return false;
+}
+
+void fused_chain_free(fused_chain *c) {
+  free(c->passes);
+  free(c->effects);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "compositor.h"
+#include "shader.h"
+#include "uniform_buffer.h"
+#include <glad/gles2.h>
+
+// uniform buffer binding point of the effect_params block, see
+// shaders/fused.fs.glsl
+#define EFFECT_FUSION_PARAMS_BINDING 1
+// per-pixel effects fused into one pass, longer runs are split
+#define EFFECT_FUSION_MAX_RUN 16
+// textures one fused pass samples besides its source
+#define EFFECT_FUSION_MAX_TEXTURES 4
+
+typedef enum {
+  // reads neighbouring pixels, runs as its own passes and breaks fusion
+  CHAIN_EFFECT_NEIGHBOURHOOD,
+  // params.x stops
+  CHAIN_EFFECT_EXPOSURE,
+  // params.rgb offsets added to the midtones
+  CHAIN_EFFECT_COLOUR_BALANCE,
+  // texture is a 3D LUT of params.x entries per side, params.y the strength
+  CHAIN_EFFECT_LUT,
+  // params.x amount, params.y radius, params.z softness
+  CHAIN_EFFECT_VIGNETTE,
+  CHAIN_EFFECT_NUM_KINDS,
+} chain_effect_kind;
+
+// an effect of a layer's chain. Per-pixel effects are GLSL functions of
+// shaders/effects, see pixel_effects.glsl, fused with their neighbours.
+typedef struct {
+  chain_effect_kind kind;
+  // read every frame, changing them does not recompile anything
+  GLfloat params[4];
+  // sampler3D of effects that take one, 0 otherwise
+  GLuint texture;
+  // run as is for CHAIN_EFFECT_NEIGHBOURHOOD
+  compositor_effect *neighbourhood;
+} chain_effect;
+
+// consecutive per-pixel effects drawn by one generated program
+typedef struct {
+  compositor_effect effect;
+  struct effect_fuser *fuser;
+  shader_program *program;
+  const chain_effect *chain;
+  i32 num_effects;
+} fused_pass;
+
+// a chain compiled to the effects of a compositor_layer
+typedef struct {
+  compositor_effect **effects;
+  i32 num_effects;
+  fused_pass *passes;
+  i32 num_passes;
+} fused_chain;
+
+// compiles effect chains into passes, one generated fragment program per
+// distinct sequence of per-pixel effects. Programs are kept as shader
+// variants, shared by every chain with the same sequence and stored in the
+// shader manager's program cache.
+typedef struct effect_fuser {
+  shader_variants variants;
+  uniform_buffer params;
+  i32 num_compiled;
+} effect_fuser;
+
+bool effect_fuser_init(effect_fuser *f, shader_manager *m);
+// call before shader_manager_free
+void effect_fuser_free(effect_fuser *f);
+// compiles chain into out. chain is read whenever the passes run and has to
+// outlive out.
+bool effect_fuser_compile(effect_fuser *f, const chain_effect *chain,
+                          i32 num_effects, fused_chain *out);
+void fused_chain_free(fused_chain *c);
@@ -0,0 +1,149 @@
+#include "egl_headless.h"
+#include <dlfcn.h>
+#include <log.h>
+
+// the loader callbacks take no user data
+static void *libegl;
+static PFNEGLGETPROCADDRESSPROC get_proc_address;
+
+// core EGL functions are exported by libEGL, extensions and GLES functions are
+// resolved through eglGetProcAddress
+static GLADapiproc load_proc(const char *name) {
+  GLADapiproc proc = (GLADapiproc)dlsym(libegl, name);
+  if (!proc && get_proc_address) {
+    proc = (GLADapiproc)get_proc_address(name);
+  }
+  return proc;
+}
+
+static EGLDisplay get_display(void) {
+  if (GLAD_EGL_EXT_platform_base && GLAD_EGL_MESA_platform_surfaceless) {
+    EGLDisplay display = eglGetPlatformDisplayEXT(
+        EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display != EGL_NO_DISPLAY) {
+      return display;
+    }
+    log_warn("unable to get surfaceless EGL display");
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool egl_headless_init(egl_headless *h) {
+  if (!(libegl = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL))) {
+    log_error("unable to load libEGL: %s", dlerror());
+    goto fail_dlopen;
+  }
+  get_proc_address =
+      (PFNEGLGETPROCADDRESSPROC)dlsym(libegl, "eglGetProcAddress");
+
+  // client extensions, needed to pick the platform
+  if (!gladLoadEGL(EGL_NO_DISPLAY, load_proc)) {
+    log_error("unable to load EGL function pointers");
+    goto fail_load_egl;
+  }
+
+  h->display = get_display();
+  if (h->display == EGL_NO_DISPLAY) {
+    log_error("unable to get EGL display");
+    goto fail_display;
+  }
+
+  EGLint major, minor;
+  if (!eglInitialize(h->display, &major, &minor)) {
+    log_error("unable to initialize EGL: 0x%x", eglGetError());
+    goto fail_display;
+  }
+
+  // display extensions
+  if (!gladLoadEGL(h->display, load_proc)) {
+    log_error("unable to load EGL function pointers");
+    goto fail_load_display;
+  }
+
+  if (!eglBindAPI(EGL_OPENGL_ES_API)) {
+    log_error("unable to bind OpenGL ES API: 0x%x", eglGetError());
+    goto fail_load_display;
+  }
+
+  bool surfaceless = GLAD_EGL_KHR_surfaceless_context;
+  EGLint config_attr[] = {
+      EGL_SURFACE_TYPE,    surfaceless ? 0 : EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+      EGL_NONE,
+  };
+  EGLConfig config;
+  EGLint num_configs;
+  if (!eglChooseConfig(h->display, config_attr, &config, 1, &num_configs) ||
+      num_configs == 0) {
+    log_error("no EGL config supports OpenGL ES 3");
+    goto fail_load_display;
+  }
+
+  EGLint context_attr[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 2,
+      EGL_NONE,
+  };
+  h->context =
+      eglCreateContext(h->display, config, EGL_NO_CONTEXT, context_attr);
+  if (h->context == EGL_NO_CONTEXT) {
+    log_error("unable to create OpenGL ES 3.2 context: 0x%x", eglGetError());
+    goto fail_context;
+  }
+
+  h->surface = EGL_NO_SURFACE;
+  if (!surfaceless) {
+    EGLint pbuffer_attr[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    h->surface = eglCreatePbufferSurface(h->display, config, pbuffer_attr);
+    if (h->surface == EGL_NO_SURFACE) {
+      log_error("unable to create pbuffer surface: 0x%x", eglGetError());
+      goto fail_surface;
+    }
+  }
+
+  if (!eglMakeCurrent(h->display, h->surface, h->surface, h->context)) {
+    log_error("unable to make EGL context current: 0x%x", eglGetError());
+    goto fail_make_current;
+  }
+
+  if (!gladLoadGLES2(load_proc)) {
+    log_error("unable to load OpenGL function pointers");
+    goto fail_load_gles;
+  }
+
+  log_info("headless EGL %d.%d %s context on %s", major, minor,
+           surfaceless ? "surfaceless" : "pbuffer",
+           (const char *)glGetString(GL_RENDERER));
+  return true;
+
+fail_load_gles:
+  eglMakeCurrent(h->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+fail_make_current:
+  if (h->surface != EGL_NO_SURFACE) {
+    eglDestroySurface(h->display, h->surface);
+  }
+fail_surface:
+  eglDestroyContext(h->display, h->context);
+fail_context:
+fail_load_display:
+  eglTerminate(h->display);
+fail_display:
+fail_load_egl:
+  dlclose(libegl);
+  libegl = NULL;
+  get_proc_address = NULL;
+fail_dlopen:
+  return false;
+}
+
+void egl_headless_free(egl_headless *h) {
+  eglMakeCurrent(h->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (h->surface != EGL_NO_SURFACE) {
+    eglDestroySurface(h->display, h->surface);
+  }
+  eglDestroyContext(h->display, h->context);
+  eglTerminate(h->display);
+  dlclose(libegl);
+  libegl = NULL;
+  get_proc_address = NULL;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/egl.h>
+#include <glad/gles2.h>
+
+// GLES 3.2 context without a window system, for rendering on machines without
+// a display. Uses EGL_MESA_platform_surfaceless where available, so it runs on
+// llvmpipe without a GPU, and falls back to the default display. Rendering
+// goes to framebuffer objects, see render_target.
+typedef struct {
+  EGLDisplay display;
+  EGLContext context;
+  // 1x1 pbuffer if contexts cannot be made current without a surface,
+  // EGL_NO_SURFACE otherwise
+  EGLSurface surface;
+} egl_headless;
+
+// makes the context current and loads the EGL and GLES function pointers
+bool egl_headless_init(egl_headless *h);
+void egl_headless_free(egl_headless *h);
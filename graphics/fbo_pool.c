@@ -0,0 +1,101 @@
+#include "fbo_pool.h"
+#include <log.h>
+#include <stdlib.h>
+
+void fbo_pool_init(fbo_pool *p) {
+  p->entries = NULL;
+  p->num_entries = 0;
+  p->capacity = 0;
+  p->num_created = 0;
+  p->num_reused = 0;
+}
+
+static void delete_entry(fbo_pool *p, i32 i) {
+  render_target_free(p->entries[i].target);
+  free(p->entries[i].target);
+  p->entries[i] = p->entries[--p->num_entries];
+}
+
+void fbo_pool_free(fbo_pool *p) {
+  log_info("framebuffer pool: %d targets created, %" PRIi64 " reused",
+           p->num_created, p->num_reused);
+  for (i32 i = 0; i < p->num_entries; ++i) {
+    if (p->entries[i].in_use) {
+      log_warn("framebuffer %u still in use",
+               p->entries[i].target->framebuffer);
+    }
+  }
+  while (p->num_entries > 0) {
+    delete_entry(p, 0);
+  }
+  free(p->entries);
+}
+
+render_target *fbo_pool_acquire(fbo_pool *p, GLenum internal_format,
+                                i32 width, i32 height) {
+  i32 num_free = 0;
+  for (i32 i = 0; i < p->num_entries; ++i) {
+    fbo_pool_entry *e = &p->entries[i];
+    if (e->in_use) {
+      continue;
+    }
+    ++num_free;
+    render_target *t = e->target;
+    if (t->internal_format == internal_format && t->width == width &&
+        t->height == height) {
+      e->in_use = true;
+      ++p->num_reused;
+      return t;
+    }
+  }
+
+  // targets of sizes no longer rendered would pile up otherwise
+  for (i32 i = 0; i < p->num_entries && num_free >= FBO_POOL_MAX_FREE;) {
+    if (!p->entries[i].in_use) {
+      delete_entry(p, i);
+      --num_free;
+    } else {
+      ++i;
+    }
+  }
+
+  if (p->num_entries == p->capacity) {
+    i32 capacity = p->capacity ? p->capacity * 2 : 8;
+    fbo_pool_entry *entries = realloc(p->entries, capacity * sizeof *entries);
+    if (!entries) {
+      log_error("unable to grow framebuffer pool");
+      goto fail_grow;
+    }
+    p->entries = entries;
+    p->capacity = capacity;
+  }
+
+  render_target *t = malloc(sizeof *t);
+  if (!t) {
+    log_error("unable to allocate render target");
+    goto fail_alloc;
+  }
+  if (!render_target_init(t, internal_format, width, height)) {
+    goto fail_target;
+  }
+
+  p->entries[p->num_entries++] = (fbo_pool_entry){.target = t, .in_use = true};
+  ++p->num_created;
+  return t;
+
+fail_target:
+  free(t);
+fail_alloc:
+fail_grow:
+  return NULL;
+}
+
+void fbo_pool_release(fbo_pool *p, render_target *t) {
+  for (i32 i = 0; i < p->num_entries; ++i) {
+    if (p->entries[i].target == t) {
+      p->entries[i].in_use = false;
+      return;
+    }
+  }
+  log_warn("framebuffer %u is not from the pool", t->framebuffer);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "render_target.h"
+#include <glad/gles2.h>
+
+// released targets kept for reuse beyond the ones in use
+#define FBO_POOL_MAX_FREE 8
+
+typedef struct {
+  // allocated on its own so pointers handed out stay valid as the pool grows
+  render_target *target;
+  bool in_use;
+} fbo_pool_entry;
+
+// render targets recycled in buckets of one format and size. Targets are used
+// by one context only, its commands are ordered, so released targets can be
+// drawn into again right away.
+typedef struct {
+  fbo_pool_entry *entries;
+  i32 num_entries;
+  i32 capacity;
+  i32 num_created;
+  i64 num_reused;
+} fbo_pool;
+
+void fbo_pool_init(fbo_pool *p);
+// every target must have been released
+void fbo_pool_free(fbo_pool *p);
+// a target of the bucket, NULL on errors
+render_target *fbo_pool_acquire(fbo_pool *p, GLenum internal_format,
+                                i32 width, i32 height);
+void fbo_pool_release(fbo_pool *p, render_target *t);
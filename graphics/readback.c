@@ -0,0 +1,115 @@
+#include "readback.h"
+#include <assert.h>
+#include <log.h>
+
+// frames are expected within a second, slower copies are reported as errors
+#define READBACK_TIMEOUT ((GLuint64)1e9)
+
+bool readback_ring_init(readback_ring *r, i32 num_slots, i32 width,
+                        i32 height) {
+  if (num_slots < 1 || num_slots > READBACK_MAX_SLOTS) {
+    log_error("invalid number of readback slots: %d", num_slots);
+    return false;
+  }
+
+  r->num_slots = num_slots;
+  r->first = 0;
+  r->num_pending = 0;
+  r->mapped = -1;
+  r->width = width;
+  r->height = height;
+  r->size = (usize)width * height * 4;
+
+  GLuint buffers[READBACK_MAX_SLOTS];
+  glGenBuffers(num_slots, buffers);
+  for (i32 i = 0; i < num_slots; ++i) {
+    if (buffers[i] == 0) {
+      log_error("unable to create readback buffers");
+      glDeleteBuffers(num_slots, buffers);
+      return false;
+    }
+  }
+
+  for (i32 i = 0; i < num_slots; ++i) {
+    r->slots[i] = (readback_slot){.buffer = buffers[i], .fence = 0};
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)r->size, NULL,
+                 GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return true;
+}
+
+void readback_ring_free(readback_ring *r) {
+  if (r->mapped >= 0) {
+    readback_ring_unmap(r);
+  }
+  for (i32 i = 0; i < r->num_slots; ++i) {
+    if (r->slots[i].fence) {
+      glDeleteSync(r->slots[i].fence);
+    }
+    glDeleteBuffers(1, &r->slots[i].buffer);
+  }
+}
+
+bool readback_ring_start(readback_ring *r) {
+  if (r->num_pending == r->num_slots) {
+    return false;
+  }
+
+  readback_slot *slot =
+      &r->slots[(r->first + r->num_pending) % r->num_slots];
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, r->width, r->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // without a flush the fence may never be signalled while polling
+  glFlush();
+  ++r->num_pending;
+  return true;
+}
+
+readback_result readback_ring_map(readback_ring *r, bool wait,
+                                  const u8 **data) {
+  assert(r->num_pending > 0 && r->mapped < 0);
+  readback_slot *slot = &r->slots[r->first];
+  GLenum status = glClientWaitSync(slot->fence, 0, wait ? READBACK_TIMEOUT : 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    if (!wait) {
+      return READBACK_RESULT_PENDING;
+    }
+    log_error("readback did not finish within %.1fs",
+              (double)READBACK_TIMEOUT * 1e-9);
+    return READBACK_RESULT_ERROR;
+  } else if (status == GL_WAIT_FAILED) {
+    log_error("unable to wait for readback: 0x%x", glGetError());
+    return READBACK_RESULT_ERROR;
+  }
+  glDeleteSync(slot->fence);
+  slot->fence = 0;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+  *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)r->size,
+                           GL_MAP_READ_BIT);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (!*data) {
+    log_error("unable to map readback buffer: 0x%x", glGetError());
+    // the frame is lost, the slot can be reused
+    r->first = (r->first + 1) % r->num_slots;
+    --r->num_pending;
+    return READBACK_RESULT_ERROR;
+  }
+
+  r->mapped = r->first;
+  return READBACK_RESULT_SUCCESS;
+}
+
+void readback_ring_unmap(readback_ring *r) {
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, r->slots[r->mapped].buffer);
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  r->mapped = -1;
+  r->first = (r->first + 1) % r->num_slots;
+  --r->num_pending;
+}
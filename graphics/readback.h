@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/gles2.h>
+
+#define READBACK_MAX_SLOTS 8
+
+typedef struct {
+  GLuint buffer;
+  // signalled once the copy into buffer is done
+  GLsync fence;
+} readback_slot;
+
+// copies rendered frames into a ring of pixel pack buffers without waiting for
+// the GPU. A frame is mapped slots - 1 frames later, by then the copy is
+// usually done and mapping does not stall.
+typedef struct {
+  readback_slot slots[READBACK_MAX_SLOTS];
+  i32 num_slots;
+  // oldest pending slot
+  i32 first;
+  i32 num_pending;
+  // mapped slot, -1 if none
+  i32 mapped;
+  i32 width, height;
+  usize size;
+} readback_ring;
+
+bool readback_ring_init(readback_ring *r, i32 num_slots, i32 width,
+                        i32 height);
+void readback_ring_free(readback_ring *r);
+// starts copying the bound read framebuffer as RGBA8, false if every slot is
+// pending
+bool readback_ring_start(readback_ring *r);
+typedef enum {
+  READBACK_RESULT_SUCCESS,
+  // the copy is not done yet
+  READBACK_RESULT_PENDING,
+  READBACK_RESULT_ERROR,
+} readback_result;
+
+// maps the oldest pending readback, rows bottom-up and width * 4 bytes apart.
+// Some readback must be pending. Waits for the copy if wait is set.
+readback_result readback_ring_map(readback_ring *r, bool wait,
+                                  const u8 **data);
+// unmaps the slot returned by readback_ring_map and frees it for the next
+// readback
+void readback_ring_unmap(readback_ring *r);
@@ -0,0 +1,196 @@
+#include "render_graph.h"
+#include <assert.h>
+#include <log.h>
+#include <stdlib.h>
+
+void render_graph_init(render_graph *g, fbo_pool *pool) {
+  g->pool = pool;
+  g->passes = NULL;
+  g->num_passes = 0;
+  g->passes_capacity = 0;
+  g->resources = NULL;
+  g->num_resources = 0;
+  g->resources_capacity = 0;
+  g->targets = NULL;
+  g->num_targets = 0;
+  g->targets_capacity = 0;
+  g->compiled = false;
+}
+
+static void release_targets(render_graph *g) {
+  for (i32 i = 0; i < g->num_targets; ++i) {
+    fbo_pool_release(g->pool, g->targets[i].target);
+  }
+  g->num_targets = 0;
+  for (i32 i = 0; i < g->num_resources; ++i) {
+    g->resources[i].target = NULL;
+  }
+  g->compiled = false;
+}
+
+void render_graph_free(render_graph *g) {
+  release_targets(g);
+  free(g->passes);
+  free(g->resources);
+  free(g->targets);
+}
+
+void render_graph_reset(render_graph *g) {
+  release_targets(g);
+  g->num_passes = 0;
+  g->num_resources = 0;
+}
+
+// makes room for one more element of an array
+static bool reserve(void **array, i32 count, i32 *capacity, usize size) {
+  if (count < *capacity) {
+    return true;
+  }
+
+  i32 new_capacity = *capacity ? *capacity * 2 : 8;
+  void *new_array = realloc(*array, new_capacity * size);
+  if (!new_array) {
+    return false;
+  }
+  *array = new_array;
+  *capacity = new_capacity;
+  return true;
+}
+
+render_resource render_graph_create(render_graph *g, GLenum internal_format,
+                                    i32 width, i32 height) {
+  if (!reserve((void **)&g->resources, g->num_resources,
+               &g->resources_capacity, sizeof *g->resources)) {
+    log_error("unable to grow render graph resources");
+    return -1;
+  }
+
+  g->resources[g->num_resources] = (render_graph_resource){
+      .internal_format = internal_format,
+      .width = width,
+      .height = height,
+      .first = -1,
+      .last = -1,
+      .target = NULL,
+  };
+  g->compiled = false;
+  return g->num_resources++;
+}
+
+bool render_graph_add_pass(render_graph *g, const render_pass *pass) {
+  assert(pass->num_inputs <= RENDER_GRAPH_MAX_INPUTS);
+  assert(pass->output == RENDER_GRAPH_OUTPUT ||
+         (pass->output >= 0 && pass->output < g->num_resources));
+  for (i32 i = 0; i < pass->num_inputs; ++i) {
+    assert(pass->inputs[i] >= 0 && pass->inputs[i] < g->num_resources);
+    assert(pass->inputs[i] != pass->output);
+  }
+
+  if (!reserve((void **)&g->passes, g->num_passes, &g->passes_capacity,
+               sizeof *g->passes)) {
+    log_error("unable to grow render graph passes");
+    return false;
+  }
+  g->passes[g->num_passes++] = *pass;
+  g->compiled = false;
+  return true;
+}
+
+static void use_resource(render_graph *g, render_resource r, i32 pass) {
+  if (r == RENDER_GRAPH_OUTPUT) {
+    return;
+  }
+  render_graph_resource *res = &g->resources[r];
+  if (res->first < 0) {
+    res->first = pass;
+  }
+  res->last = pass;
+}
+
+// a target no resource needs by pass, taken from the pool if there is none
+static render_target *assign_target(render_graph *g,
+                                    const render_graph_resource *res,
+                                    i32 pass) {
+  for (i32 i = 0; i < g->num_targets; ++i) {
+    render_graph_target *t = &g->targets[i];
+    if (t->busy_until < pass &&
+        t->target->internal_format == res->internal_format &&
+        t->target->width == res->width && t->target->height == res->height) {
+      t->busy_until = res->last;
+      return t->target;
+    }
+  }
+
+  if (!reserve((void **)&g->targets, g->num_targets, &g->targets_capacity,
+               sizeof *g->targets)) {
+    log_error("unable to grow render graph targets");
+    return NULL;
+  }
+  render_target *target = fbo_pool_acquire(g->pool, res->internal_format,
+                                           res->width, res->height);
+  if (!target) {
+    return NULL;
+  }
+  g->targets[g->num_targets++] =
+      (render_graph_target){.target = target, .busy_until = res->last};
+  return target;
+}
+
+bool render_graph_compile(render_graph *g) {
+  release_targets(g);
+  for (i32 i = 0; i < g->num_resources; ++i) {
+    g->resources[i].first = -1;
+    g->resources[i].last = -1;
+  }
+
+  for (i32 i = 0; i < g->num_passes; ++i) {
+    const render_pass *pass = &g->passes[i];
+    for (i32 j = 0; j < pass->num_inputs; ++j) {
+      if (g->resources[pass->inputs[j]].first < 0) {
+        log_error("render pass '%s' reads resource %d before it is written",
+                  pass->name, pass->inputs[j]);
+        return false;
+      }
+      use_resource(g, pass->inputs[j], i);
+    }
+    use_resource(g, pass->output, i);
+  }
+
+  // resources are assigned in the order they are first written
+  for (i32 i = 0; i < g->num_passes; ++i) {
+    render_resource r = g->passes[i].output;
+    if (r == RENDER_GRAPH_OUTPUT || g->resources[r].first != i) {
+      continue;
+    }
+    if (!(g->resources[r].target = assign_target(g, &g->resources[r], i))) {
+      release_targets(g);
+      return false;
+    }
+  }
+
+  g->compiled = true;
+  return true;
+}
+
+void render_graph_execute(render_graph *g, const render_target *output) {
+  assert(g->compiled);
+  for (i32 i = 0; i < g->num_passes; ++i) {
+    const render_pass *pass = &g->passes[i];
+    render_target_bind(pass->output == RENDER_GRAPH_OUTPUT
+                           ? output
+                           : g->resources[pass->output].target);
+    if (pass->clear) {
+      glClearColor(pass->clear_color[0], pass->clear_color[1],
+                   pass->clear_color[2], pass->clear_color[3]);
+      glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    GLuint inputs[RENDER_GRAPH_MAX_INPUTS];
+    for (i32 j = 0; j < pass->num_inputs; ++j) {
+      inputs[j] = g->resources[pass->inputs[j]].target->texture;
+    }
+    if (pass->run) {
+      pass->run(pass->arg, inputs, pass->user);
+    }
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "fbo_pool.h"
+#include "render_target.h"
+#include <glad/gles2.h>
+
+#define RENDER_GRAPH_MAX_INPUTS 4
+// the target the graph is executed into, it can only be written
+#define RENDER_GRAPH_OUTPUT (-1)
+
+// intermediate image, an index into the graph's resources
+typedef i32 render_resource;
+
+// draws into the bound output of a pass. inputs are the textures of the
+// pass' input resources, arg and user are the pass' own.
+typedef void (*render_pass_callback)(i32 arg, const GLuint *inputs,
+                                     void *user);
+
+typedef struct {
+  // for logging
+  const char *name;
+  // NULL if the pass only clears
+  render_pass_callback run;
+  i32 arg;
+  void *user;
+  render_resource inputs[RENDER_GRAPH_MAX_INPUTS];
+  i32 num_inputs;
+  render_resource output;
+  // clears the output to clear_color before running
+  bool clear;
+  GLfloat clear_color[4];
+} render_pass;
+
+typedef struct {
+  GLenum internal_format;
+  i32 width, height;
+  // first and last pass using the resource, -1 if none does
+  i32 first, last;
+  // assigned when compiling, resources whose lifetimes do not overlap share
+  // targets
+  render_target *target;
+} render_graph_resource;
+
+typedef struct {
+  render_target *target;
+  // last pass of the resource currently assigned the target
+  i32 busy_until;
+} render_graph_target;
+
+// passes drawing into transient resources, executed in the order they were
+// added. Compiling assigns every resource a target from the pool, reusing
+// the targets of resources no later pass reads, so building the graph once
+// and executing it every frame takes no GL object management.
+typedef struct {
+  fbo_pool *pool;
+  render_pass *passes;
+  i32 num_passes;
+  i32 passes_capacity;
+  render_graph_resource *resources;
+  i32 num_resources;
+  i32 resources_capacity;
+  // taken from the pool by the last compile
+  render_graph_target *targets;
+  i32 num_targets;
+  i32 targets_capacity;
+  bool compiled;
+} render_graph;
+
+void render_graph_init(render_graph *g, fbo_pool *pool);
+void render_graph_free(render_graph *g);
+// removes every pass and resource and returns the targets to the pool
+void render_graph_reset(render_graph *g);
+// -1 on errors
+render_resource render_graph_create(render_graph *g, GLenum internal_format,
+                                    i32 width, i32 height);
+// a pass may not read its own output nor the graph's output
+bool render_graph_add_pass(render_graph *g, const render_pass *pass);
+// works out resource lifetimes and assigns targets, false if a resource is
+// read before it is written or no target could be created
+bool render_graph_compile(render_graph *g);
+// runs every pass, output is only drawn into
+void render_graph_execute(render_graph *g, const render_target *output);
@@ -0,0 +1,55 @@
+#include "render_target.h"
+#include <log.h>
+
+bool render_target_init(render_target *t, GLenum internal_format, i32 width,
+                        i32 height) {
+  t->internal_format = internal_format;
+  t->width = width;
+  t->height = height;
+
+  glGenTextures(1, &t->texture);
+  if (t->texture == 0) {
+    log_error("unable to create render target texture");
+    goto fail_texture;
+  }
+  glBindTexture(GL_TEXTURE_2D, t->texture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenFramebuffers(1, &t->framebuffer);
+  if (t->framebuffer == 0) {
+    log_error("unable to create framebuffer");
+    goto fail_framebuffer;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, t->framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         t->texture, 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    log_error("incomplete %dx%d framebuffer: 0x%x", width, height, status);
+    goto fail_incomplete;
+  }
+
+  return true;
+
+fail_incomplete:
+  glDeleteFramebuffers(1, &t->framebuffer);
+fail_framebuffer:
+  glDeleteTextures(1, &t->texture);
+fail_texture:
+  return false;
+}
+
+void render_target_free(render_target *t) {
+  glDeleteFramebuffers(1, &t->framebuffer);
+  glDeleteTextures(1, &t->texture);
+}
+
+void render_target_bind(const render_target *t) {
+  glBindFramebuffer(GL_FRAMEBUFFER, t->framebuffer);
+  glViewport(0, 0, t->width, t->height);
+}
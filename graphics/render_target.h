@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/gles2.h>
+
+// framebuffer object rendering into a single colour texture
+typedef struct {
+  GLuint framebuffer;
+  GLuint texture;
+  GLenum internal_format;
+  i32 width, height;
+} render_target;
+
+// internal_format must be colour-renderable, e.g. GL_RGBA8
+bool render_target_init(render_target *t, GLenum internal_format, i32 width,
+                        i32 height);
+void render_target_free(render_target *t);
+// binds the framebuffer for drawing and sets the viewport to cover it
+void render_target_bind(const render_target *t);
@@ -1,13 +1,20 @@
 #include "shader.h"
 #include "../utils/fs.h"
+#include "../utils/hash.h"
 #include <assert.h>
 #include <ctype.h>
 #include <log.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <timespec.h>
 
-bool shader_manager_init(shader_manager *m, const char *shader_dir) {
+// nested #include levels before a cycle is assumed
+#define SHADER_MAX_INCLUDE_DEPTH 16
+
+bool shader_manager_init(shader_manager *m, const char *shader_dir,
+                         const char *cache_dir) {
   m->head = NULL;
   m->shader_dir = path_absolute(shader_dir);
   if (!m->shader_dir) {
@@ -19,8 +26,31 @@ bool shader_manager_init(shader_manager *m, const char *shader_dir) {
     goto fail_filewatch_init;
   }
 
+  m->parallel_compile = GLAD_GL_KHR_parallel_shader_compile;
+  if (m->parallel_compile) {
+    // let the driver pick the number of compiler threads
+    glMaxShaderCompilerThreadsKHR(0xffffffff);
+  }
+
+  if (!shader_index_init(&m->index)) {
+    goto fail_index_init;
+  }
+
+  if (!shader_cache_init(&m->cache, cache_dir)) {
+    log_warn("unable to initialize shader cache, compiling from source");
+    shader_cache_init(&m->cache, NULL);
+  }
+
+  m->has_worker = !m->parallel_compile && shader_worker_init(&m->worker);
+  if (!m->parallel_compile && !m->has_worker) {
+    log_warn("no parallel shader compilation, reloads link on the render "
+             "thread");
+  }
+
+  m->num_pending = 0;
   return true;
 
+fail_index_init:
   filewatch_free(m->fw);
 fail_filewatch_init:
   free(m->shader_dir);
@@ -35,12 +65,29 @@ static void free_uniforms(shader_uniform *uniforms, i32 num_uniforms) {
   free(uniforms);
 }
 
+static void free_handles(shader_program *p) {
+  for (i32 i = 0; i < p->num_handles; ++i) {
+    free(p->handles[i].name);
+  }
+  free(p->handles);
+  for (i32 i = 0; i < p->num_blocks; ++i) {
+    free(p->blocks[i].name);
+  }
+  free(p->blocks);
+}
+
+static void discard_pending_program(shader_program *p);
+static void set_dependencies(shader_program *p, char **paths, i32 num_paths);
 static void free_shader_program(shader_program *program) {
+  discard_pending_program(program);
+  set_dependencies(program, NULL, 0);
   glDeleteProgram(program->program);
   free_uniforms(program->uniforms, program->num_uniforms);
+  free_handles(program);
   for (i32 i = 0; i < program->num_shaders; ++i) {
     free(program->source_paths[i]);
   }
+  free(program->defines);
   free(program);
 }
 
@@ -50,27 +97,43 @@ void shader_manager_free(shader_manager *m) {
   while (m->head) {
     shader_program_destroy(m, m->head);
   }
+  if (m->has_worker) {
+    shader_worker_free(&m->worker);
+  }
+  shader_index_free(&m->index);
+  shader_cache_free(&m->cache);
 }
 
-static bool load_gl_program(shader_program *p);
+static bool start_gl_program(shader_program *p, bool background);
+static void poll_gl_program(shader_program *p);
 bool shader_manager_update(shader_manager *m) {
   filewatch_event e;
   while (filewatch_poll(m->fw, &e)) {
     log_info("%s %d%d%d%d%d%d", e.name, e.created, e.modified, e.deleted,
              e.movedfrom, e.movedto, e.isdir);
-    shader_program *sp = m->head;
-    while (sp) {
-      for (i32 i = 0; i < sp->num_shaders; ++i) {
-        if (strcmp(sp->source_paths[i], e.name) == 0) {
-          log_info("reloading shader '%s'", e.name);
-          load_gl_program(sp);
-          break;
-        }
-      }
-      sp = sp->next;
+    const shader_index_entry *dependents = shader_index_find(&m->index, e.name);
+    i32 n = dependents ? dependents->num_programs : 0;
+    // reloading updates the index entry being read
+    shader_program **programs = n ? malloc(n * sizeof *programs) : NULL;
+    if (n && !programs) {
+      log_error("unable to allocate programs to reload");
+      n = 0;
+    } else if (n) {
+      memcpy(programs, dependents->programs, n * sizeof *programs);
+    }
+
+    for (i32 i = 0; i < n; ++i) {
+      log_info("reloading shader '%s' for a change in '%s'",
+               programs[i]->source_paths[0], e.name);
+      start_gl_program(programs[i], true);
     }
+    free(programs);
     filewatch_free_event(m->fw, &e);
   }
+
+  for (shader_program *sp = m->head; sp && m->num_pending > 0; sp = sp->next) {
+    poll_gl_program(sp);
+  }
   return true;
 }
 
@@ -145,11 +208,7 @@ static const char *shader_type_to_string(GLenum type) {
   return "unknown";
 }
 
-static GLuint load_gl_shader_from_file(GLenum type, const char *path) {
-  GLuint shader = glCreateShader(type);
-  if (shader == 0) {
-    goto fail_create_shader;
-  }
+static GLchar *read_file(const char *path, usize *size) {
   FILE *file = fopen(path, "rb");
   if (!file) {
     goto fail_open_file;
@@ -158,52 +217,294 @@ static GLuint load_gl_shader_from_file(GLenum type, const char *path) {
   if (fseek(file, 0, SEEK_END)) {
     goto fail_seek;
   }
-  i64 size = ftell(file);
+  i64 file_size = ftell(file);
   if (fseek(file, 0, SEEK_SET)) {
     goto fail_seek;
   }
 
-  GLchar *buffer = malloc(size);
+  GLchar *buffer = malloc(file_size);
   if (!buffer) {
     goto fail_alloc_buffer;
   }
 
-  if ((i64)fread(buffer, 1, size, file) != size) {
+  if ((i64)fread(buffer, 1, file_size, file) != file_size) {
     goto fail_fread;
   }
 
-  glShaderSource(shader, 1, (const GLchar *[]){buffer}, (GLint[]){size});
-  glCompileShader(shader);
-  GLint status, log_length;
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-  if (!status) {
-    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
-    log_warn("error compiling %s shader at path '%s'",
-             shader_type_to_string(type), path);
-    char *log = malloc(log_length + 1);
-    if (log) {
-      glGetShaderInfoLog(shader, log_length + 1, NULL, log);
-      log_multiline(LOG_WARN, log, __FILE__, __LINE__);
-    } else {
-      log_fatal("<unable to allocate log message buffer>");
-    }
-    goto fail_compile;
-  }
-
-  free(buffer);
   fclose(file);
-  return shader;
+  *size = (usize)file_size;
+  return buffer;
 
-fail_compile:
 fail_fread:
   free(buffer);
 fail_alloc_buffer:
 fail_seek:
   fclose(file);
 fail_open_file:
-  glDeleteShader(shader);
-fail_create_shader:
-  return 0;
+  log_warn("unable to read shader source '%s'", path);
+  return NULL;
+}
+
+typedef struct {
+  GLchar *data;
+  usize size;
+  usize capacity;
+} source_buffer;
+
+static bool append_source(source_buffer *b, const char *s, usize n) {
+  if (b->size + n > b->capacity) {
+    usize capacity = b->capacity ? b->capacity : 4096;
+    while (capacity < b->size + n) {
+      capacity *= 2;
+    }
+
+    GLchar *data = realloc(b->data, capacity);
+    if (!data) {
+      log_error("unable to grow shader source buffer");
+      return false;
+    }
+    b->data = data;
+    b->capacity = capacity;
+  }
+
+  memcpy(&b->data[b->size], s, n);
+  b->size += n;
+  return true;
+}
+
+typedef struct {
+  char **paths;
+  i32 num_paths;
+  i32 capacity;
+} path_list;
+
+static bool add_path(path_list *l, const char *path) {
+  for (i32 i = 0; i < l->num_paths; ++i) {
+    if (strcmp(l->paths[i], path) == 0) {
+      return true;
+    }
+  }
+
+  if (l->num_paths == l->capacity) {
+    i32 capacity = l->capacity ? l->capacity * 2 : 8;
+    char **paths = realloc(l->paths, capacity * sizeof *paths);
+    if (!paths) {
+      log_error("unable to grow shader dependency list");
+      return false;
+    }
+    l->paths = paths;
+    l->capacity = capacity;
+  }
+
+  if (!(l->paths[l->num_paths] = strdup(path))) {
+    log_error("unable to allocate shader dependency path");
+    return false;
+  }
+  ++l->num_paths;
+  return true;
+}
+
+// the name of an #include "name" directive, NULL for other lines
+static const char *include_name(const char *line, const char *end,
+                                usize *name_len) {
+  const char *c = line;
+  while (c < end && (*c == ' ' || *c == '\t')) {
+    ++c;
+  }
+  if (c == end || *c++ != '#') {
+    return NULL;
+  }
+  while (c < end && (*c == ' ' || *c == '\t')) {
+    ++c;
+  }
+  if ((usize)(end - c) < strlen("include") ||
+      strncmp(c, "include", strlen("include")) != 0) {
+    return NULL;
+  }
+  c += strlen("include");
+  while (c < end && (*c == ' ' || *c == '\t')) {
+    ++c;
+  }
+  if (c == end || *c++ != '"') {
+    return NULL;
+  }
+
+  const char *name = c;
+  while (c < end && *c != '"') {
+    ++c;
+  }
+  if (c == end) {
+    return NULL;
+  }
+
+  *name_len = c - name;
+  return name;
+}
+
+// includes are relative to the including file
+static char *resolve_include(const char *including, const char *name,
+                             usize name_len) {
+  char *child = strndup(name, name_len);
+  if (!child) {
+    return NULL;
+  }
+
+  const char *slash = strrchr(including, '/');
+  char *dir = slash ? strndup(including, slash - including + 1) : NULL;
+  char *joined = dir && !is_pathsep(child[0])
+                     ? path_concat(dir, child, false)
+                     : strdup(child);
+  free(dir);
+  free(child);
+  if (!joined) {
+    return NULL;
+  }
+
+  // event paths are canonical, missing files are kept as written
+  char *canonical = path_absolute(joined);
+  if (canonical) {
+    free(joined);
+    return canonical;
+  }
+
+  return joined;
+}
+
+// expands #include "file" lines recursively, recording every file read in
+// deps (including ones that could not be read, so creating them reloads)
+static bool preprocess_shader(const char *path, i32 depth, source_buffer *out,
+                              path_list *deps) {
+  if (!add_path(deps, path)) {
+    return false;
+  }
+
+  if (depth > SHADER_MAX_INCLUDE_DEPTH) {
+    log_warn("#include nesting deeper than %d at '%s'",
+             SHADER_MAX_INCLUDE_DEPTH, path);
+    return false;
+  }
+
+  usize size;
+  GLchar *source = read_file(path, &size);
+  if (!source) {
+    return false;
+  }
+
+  bool ok = true;
+  const char *line = source, *end = source + size;
+  for (i32 line_number = 1; line < end && ok; ++line_number) {
+    const char *next = memchr(line, '\n', end - line);
+    next = next ? next + 1 : end;
+    usize name_len;
+    const char *name = include_name(line, next, &name_len);
+    if (!name) {
+      ok = append_source(out, line, next - line);
+    } else {
+      char *child = resolve_include(path, name, name_len);
+      char directive[32];
+      // error messages point at the right line of each file
+      snprintf(directive, sizeof directive, "\n#line %d\n", line_number + 1);
+      ok = child && append_source(out, "#line 1\n", strlen("#line 1\n")) &&
+           preprocess_shader(child, depth + 1, out, deps) &&
+           append_source(out, directive, strlen(directive));
+      if (!child) {
+        log_error("unable to allocate include path");
+      } else if (!ok) {
+        log_warn("unable to include '%s' in '%s'", child, path);
+      }
+      free(child);
+    }
+    line = next;
+  }
+
+  free(source);
+  return ok;
+}
+
+// splices #define lines in after the #version line, which has to come first
+static bool insert_defines(source_buffer *b, const char *defines) {
+  usize split = 0;
+  i32 line_number = 1;
+  const char *line = b->data, *end = b->data + b->size;
+  while (line < end) {
+    const char *next = memchr(line, '\n', end - line);
+    next = next ? next + 1 : end;
+    const char *c = line;
+    while (c < next && (*c == ' ' || *c == '\t')) {
+      ++c;
+    }
+    if ((usize)(next - c) >= strlen("#version") &&
+        strncmp(c, "#version", strlen("#version")) == 0) {
+      split = next - b->data;
+      ++line_number;
+      break;
+    }
+    line = next;
+  }
+
+  char directive[32];
+  snprintf(directive, sizeof directive, "\n#line %d\n", line_number);
+  source_buffer out = {.data = NULL, .size = 0, .capacity = 0};
+  if (!append_source(&out, b->data, split) ||
+      !append_source(&out, defines, strlen(defines)) ||
+      !append_source(&out, directive, strlen(directive)) ||
+      !append_source(&out, &b->data[split], b->size - split)) {
+    free(out.data);
+    return false;
+  }
+
+  free(b->data);
+  *b = out;
+  return true;
+}
+
+static void set_dependencies(shader_program *p, char **paths, i32 num_paths) {
+  for (i32 i = 0; i < p->num_dependencies; ++i) {
+    shader_index_remove(&p->manager->index, p->dependencies[i], p);
+    free(p->dependencies[i]);
+  }
+  free(p->dependencies);
+
+  p->dependencies = paths;
+  p->num_dependencies = num_paths;
+  for (i32 i = 0; i < num_paths; ++i) {
+    if (!shader_index_add(&p->manager->index, paths[i], p)) {
+      log_warn("'%s' will not reload on changes to '%s'", p->source_paths[0],
+               paths[i]);
+    }
+  }
+}
+
+static void log_shader_error(GLuint shader, GLenum type, const char *path) {
+  GLint log_length;
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
+  log_warn("error compiling %s shader at path '%s'",
+           shader_type_to_string(type), path);
+  char *log = malloc(log_length + 1);
+  if (log) {
+    glGetShaderInfoLog(shader, log_length + 1, NULL, log);
+    log_multiline(LOG_WARN, log, __FILE__, __LINE__);
+    free(log);
+  } else {
+    log_fatal("<unable to allocate log message buffer>");
+  }
+}
+
+static void log_program_error(const shader_program *p, GLuint program) {
+  GLint log_length;
+  glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_length);
+  log_warn("error compiling shader program, with shader paths:");
+  for (i32 i = 0; i < p->num_shaders; ++i) {
+    log_warn("- %s", p->source_paths[i]);
+  }
+  char *log = malloc(log_length + 1);
+  if (log) {
+    glGetProgramInfoLog(program, log_length + 1, NULL, log);
+    log_multiline(LOG_WARN, log, __FILE__, __LINE__);
+    free(log);
+  } else {
+    log_fatal("<unable to allocate log message buffer>");
+  }
 }
 
 static void delete_attached_shaders(GLuint program) {
@@ -239,13 +540,14 @@ static bool fetch_uniforms(GLuint program, i32 *num_uniforms,
     glGetActiveUniform(program, i, u->name_len + 1, &u->name_len, &u->size,
                        &u->type, u->name);
     u->location = glGetUniformLocation(program, u->name);
+    u->hash = hash_fnv1a_str(HASH_FNV1A_INIT, u->name);
   }
 
   return true;
 
 fail_alloc_names:
   for (i32 j = 0; j < i; ++j) {
-    free((*uniforms)[i].name);
+    free((*uniforms)[j].name);
   }
   free(*uniforms);
 fail_alloc_structs:
@@ -254,61 +556,224 @@ fail_alloc_structs:
   return false;
 }
 
-static bool load_gl_program(shader_program *p) {
-  GLuint program = glCreateProgram();
-  if (program == 0) {
-    goto fail_create_program;
+static GLint find_location(const shader_program *p, u64 hash,
+                           const char *name) {
+  for (i32 i = 0; i < p->num_uniforms; ++i) {
+    const shader_uniform *u = &p->uniforms[i];
+    if (u->hash == hash && strcmp(u->name, name) == 0) {
+      return u->location;
+    }
   }
+  return -1;
+}
 
-  assert(p->num_shaders <= MAX_SHADERS_IN_PROGRAM);
-  for (i32 i = 0; i < p->num_shaders; ++i) {
-    GLuint shader =
-        load_gl_shader_from_file(p->shader_types[i], p->source_paths[i]);
-    if (!shader) {
-      goto fail_create_shaders;
-    }
-    glAttachShader(program, shader);
+static void apply_handle(shader_program *p, shader_uniform_handle *h) {
+  h->location = find_location(p, h->hash, h->name);
+  if (h->location >= 0 && h->sampler_unit >= 0) {
+    glProgramUniform1i(p->program, h->location, h->sampler_unit);
   }
+}
 
-  glLinkProgram(program);
-  GLint status, log_length;
-  glGetProgramiv(program, GL_LINK_STATUS, &status);
-  if (!status) {
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_length);
-    log_warn("error compiling shader program, with shader paths:");
-    for (i32 i = 0; i < p->num_shaders; ++i) {
-      log_warn("- %s", p->source_paths[i]);
-    }
-    char *log = malloc(log_length + 1);
-    if (log) {
-      glGetProgramInfoLog(program, log_length + 1, NULL, log);
-      log_multiline(LOG_WARN, log, __FILE__, __LINE__);
-    } else {
-      log_fatal("<unable to allocate log message buffer>");
-    }
+static void apply_block(shader_program *p, const shader_block_binding *b) {
+  GLuint index = glGetUniformBlockIndex(p->program, b->name);
+  if (index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(p->program, index, b->binding);
+  }
+}
+
+static void discard_pending_program(shader_program *p) {
+  if (p->pending_job) {
+    shader_worker_cancel(&p->manager->worker, p->pending_job);
+    p->pending_job = NULL;
+    --p->manager->num_pending;
+  }
+  if (p->pending) {
+    delete_attached_shaders(p->pending);
+    glDeleteProgram(p->pending);
+    p->pending = 0;
+    --p->manager->num_pending;
+  }
+}
 
-    goto fail_link_program;
+// the previous program stays in use until its replacement has linked
+static void install_program(shader_program *p, GLuint program, bool hit) {
+  struct timespec end;
+  timespec_get(&end, TIME_UTC);
+  double elapsed = timespec_to_double(timespec_sub(end, p->pending_start));
+  if (hit) {
+    p->manager->cache.hit_time += elapsed;
+  } else {
+    p->manager->cache.miss_time += elapsed;
   }
+  log_debug("%s program '%s' in %.2fms", hit ? "loaded cached" : "compiled",
+            p->source_paths[0], elapsed * 1e3);
 
+  glDeleteProgram(p->program);
   p->program = program;
   ++p->update_counter;
-  delete_attached_shaders(program);
   if (!fetch_uniforms(p->program, &p->num_uniforms, &p->uniforms)) {
     log_warn("error fetching uniform variables from shader program");
   }
+  for (i32 i = 0; i < p->num_handles; ++i) {
+    apply_handle(p, &p->handles[i]);
+  }
+  for (i32 i = 0; i < p->num_blocks; ++i) {
+    apply_block(p, &p->blocks[i]);
+  }
+}
+
+// compiles and links from source without waiting for the driver, or loads the
+// program from the cache right away. Background loads go to the worker where
+// the driver cannot compile in parallel.
+static bool start_gl_program(shader_program *p, bool background) {
+  discard_pending_program(p);
+  timespec_get(&p->pending_start, TIME_UTC);
+  const GLchar *sources[MAX_SHADERS_IN_PROGRAM];
+  GLint sizes[MAX_SHADERS_IN_PROGRAM];
+  path_list deps = {.paths = NULL, .num_paths = 0, .capacity = 0};
+  i32 num_sources;
+  assert(p->num_shaders <= MAX_SHADERS_IN_PROGRAM);
+  for (num_sources = 0; num_sources < p->num_shaders; ++num_sources) {
+    source_buffer b = {.data = NULL, .size = 0, .capacity = 0};
+    if (!preprocess_shader(p->source_paths[num_sources], 0, &b, &deps) ||
+        (p->defines && !insert_defines(&b, p->defines))) {
+      free(b.data);
+      break;
+    }
+    sources[num_sources] = b.data;
+    sizes[num_sources] = (GLint)b.size;
+  }
+
+  // dependencies are tracked even if a file is missing, so fixing it reloads
+  set_dependencies(p, deps.paths, deps.num_paths);
+  if (num_sources < p->num_shaders) {
+    goto fail_read_sources;
+  }
+
+  GLuint program = glCreateProgram();
+  if (program == 0) {
+    goto fail_create_program;
+  }
+
+  shader_manager *m = p->manager;
+  p->pending_key = shader_cache_key(&m->cache, p->num_shaders,
+                                    p->shader_types, sources, sizes);
+  if (shader_cache_load(&m->cache, p->pending_key, program)) {
+    install_program(p, program, true);
+  } else if (background && m->has_worker &&
+             (p->pending_job = shader_worker_link(&m->worker, p->num_shaders,
+                                                  p->shader_types, sources,
+                                                  sizes))) {
+    // the worker creates its own program
+    glDeleteProgram(program);
+    ++m->num_pending;
+  } else {
+    for (i32 i = 0; i < p->num_shaders; ++i) {
+      GLuint shader = glCreateShader(p->shader_types[i]);
+      if (shader == 0) {
+        goto fail_create_shaders;
+      }
+
+      glShaderSource(shader, 1, &sources[i], &sizes[i]);
+      glCompileShader(shader);
+      glAttachShader(program, shader);
+      p->pending_shaders[i] = shader;
+    }
+
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    // submitted now, the link status is asked for later
+    glFlush();
+    p->pending = program;
+    p->pending_updates = 0;
+    ++p->manager->num_pending;
+  }
+
+  for (i32 i = 0; i < num_sources; ++i) {
+    free((GLchar *)sources[i]);
+  }
   return true;
 
-fail_link_program:
 fail_create_shaders:
   delete_attached_shaders(program);
+  glDeleteProgram(program);
 fail_create_program:
+fail_read_sources:
+  for (i32 i = 0; i < num_sources; ++i) {
+    free((GLchar *)sources[i]);
+  }
   return false;
 }
 
+// true if the pending program linked and replaced the current one
+static bool finish_gl_program(shader_program *p) {
+  GLuint program = p->pending;
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    for (i32 i = 0; i < p->num_shaders; ++i) {
+      glGetShaderiv(p->pending_shaders[i], GL_COMPILE_STATUS, &status);
+      if (!status) {
+        log_shader_error(p->pending_shaders[i], p->shader_types[i],
+                         p->source_paths[i]);
+      }
+    }
+    log_program_error(p, program);
+    discard_pending_program(p);
+    return false;
+  }
+
+  delete_attached_shaders(program);
+  p->pending = 0;
+  --p->manager->num_pending;
+  shader_cache_store(&p->manager->cache, p->pending_key, program);
+  install_program(p, program, false);
+  return true;
+}
+
+// finishes a pending program once the driver is done with it, without
+// blocking where the driver compiles in parallel or the worker links
+static void poll_gl_program(shader_program *p) {
+  if (p->pending_job) {
+    if (!shader_link_job_done(p->pending_job)) {
+      return;
+    }
+
+    shader_link_job_take(p->pending_job, &p->pending, p->pending_shaders);
+    p->pending_job = NULL;
+    if (!p->pending) {
+      log_error("unable to create program '%s'", p->source_paths[0]);
+      --p->manager->num_pending;
+      return;
+    }
+    finish_gl_program(p);
+    return;
+  }
+  if (!p->pending) {
+    return;
+  }
+
+  GLint done = GL_TRUE;
+  if (p->manager->parallel_compile) {
+    glGetProgramiv(p->pending, GL_COMPLETION_STATUS_KHR, &done);
+  } else {
+    // gives the driver a frame before the status query waits for it
+    done = p->pending_updates++ > 0;
+  }
+  if (done) {
+    finish_gl_program(p);
+  }
+}
+
+static bool load_gl_program(shader_program *p) {
+  return start_gl_program(p, false) &&
+         (!p->pending || finish_gl_program(p));
+}
+
 static shader_program *create_shader_program(shader_manager *m, i32 num_shaders,
                                              const GLenum *shader_types,
-                                             const char **shader_paths) {
-  (void)m;
+                                             const char **shader_paths,
+                                             const char *defines) {
   assert(num_shaders <= MAX_SHADERS_IN_PROGRAM &&
          "too many shaders, raise the constant MAX_SHADERS_IN_PROGRAM to "
          "increase the limit");
@@ -322,33 +787,53 @@ static shader_program *create_shader_program(shader_manager *m, i32 num_shaders,
   p->next = NULL;
   p->num_shaders = num_shaders;
   memcpy(p->shader_types, shader_types, num_shaders * sizeof(shader_types[0]));
-  for (i32 i = 0; i < num_shaders; ++i) {
-    if (!(p->source_paths[i] =
-              path_concat(m->shader_dir, shader_paths[i], false))) {
+  i32 num_paths;
+  for (num_paths = 0; num_paths < num_shaders; ++num_paths) {
+    if (!(p->source_paths[num_paths] =
+              path_concat(m->shader_dir, shader_paths[num_paths], false))) {
       goto fail_alloc_paths;
     }
   }
+  p->defines = defines ? strdup(defines) : NULL;
+  if (defines && !p->defines) {
+    goto fail_strdup_defines;
+  }
   p->program = 0;
   p->update_counter = 0;
+  p->manager = m;
+  p->pending = 0;
+  p->pending_job = NULL;
+  p->pending_updates = 0;
+  p->dependencies = NULL;
+  p->num_dependencies = 0;
   p->num_uniforms = 0;
   p->uniforms = NULL;
+  p->num_handles = 0;
+  p->handles = NULL;
+  p->num_blocks = 0;
+  p->blocks = NULL;
 
   if (!load_gl_program(p)) {
     log_warn("error loading gl program, program will be in unusable state");
   }
   return p;
 
+fail_strdup_defines:
 fail_alloc_paths:
+  for (i32 i = 0; i < num_paths; ++i) {
+    free(p->source_paths[i]);
+  }
   free(p);
 fail_alloc:
   return NULL;
 }
 
-shader_program *shader_create(shader_manager *m, i32 num_shaders,
-                              const GLenum *shader_types,
-                              const char **shader_paths) {
-  shader_program *program =
-      create_shader_program(m, num_shaders, shader_types, shader_paths);
+shader_program *shader_create_defines(shader_manager *m, i32 num_shaders,
+                                      const GLenum *shader_types,
+                                      const char **shader_paths,
+                                      const char *defines) {
+  shader_program *program = create_shader_program(
+      m, num_shaders, shader_types, shader_paths, defines);
   if (!program) {
     return NULL;
   }
@@ -356,12 +841,19 @@ shader_program *shader_create(shader_manager *m, i32 num_shaders,
   program->prev = NULL;
   program->next = m->head;
   if (m->head) {
-    m->head = program;
+    m->head->prev = program;
   }
   m->head = program;
   return program;
 }
 
+shader_program *shader_create(shader_manager *m, i32 num_shaders,
+                              const GLenum *shader_types,
+                              const char **shader_paths) {
+  return shader_create_defines(m, num_shaders, shader_types, shader_paths,
+                               NULL);
+}
+
 i32 shader_program_use(shader_program *p) {
   if (p->update_counter > 0) {
     glUseProgram(p->program);
@@ -369,3 +861,182 @@ i32 shader_program_use(shader_program *p) {
 
   return p->update_counter;
 }
+
+i32 shader_program_uniform(shader_program *p, const char *name) {
+  u64 hash = hash_fnv1a_str(HASH_FNV1A_INIT, name);
+  for (i32 i = 0; i < p->num_handles; ++i) {
+    if (p->handles[i].hash == hash && strcmp(p->handles[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  shader_uniform_handle *handles =
+      realloc(p->handles, (p->num_handles + 1) * sizeof *handles);
+  if (!handles) {
+    goto fail_alloc_handles;
+  }
+  p->handles = handles;
+
+  shader_uniform_handle *h = &handles[p->num_handles];
+  h->name = strdup(name);
+  if (!h->name) {
+    goto fail_strdup_name;
+  }
+  h->hash = hash;
+  h->sampler_unit = -1;
+  apply_handle(p, h);
+  if (p->update_counter > 0 && h->location < 0) {
+    log_debug("uniform '%s' not active in '%s'", name, p->source_paths[0]);
+  }
+  return p->num_handles++;
+
+fail_strdup_name:
+fail_alloc_handles:
+  log_error("unable to allocate uniform handle '%s'", name);
+  return -1;
+}
+
+GLint shader_program_location(const shader_program *p, i32 handle) {
+  if (handle < 0 || handle >= p->num_handles) {
+    return -1;
+  }
+  return p->handles[handle].location;
+}
+
+void shader_program_set_sampler(shader_program *p, i32 handle, GLint unit) {
+  if (handle < 0 || handle >= p->num_handles) {
+    return;
+  }
+  p->handles[handle].sampler_unit = unit;
+  apply_handle(p, &p->handles[handle]);
+}
+
+bool shader_program_bind_block(shader_program *p, const char *name,
+                               GLuint binding) {
+  for (i32 i = 0; i < p->num_blocks; ++i) {
+    if (strcmp(p->blocks[i].name, name) == 0) {
+      p->blocks[i].binding = binding;
+      apply_block(p, &p->blocks[i]);
+      return true;
+    }
+  }
+
+  shader_block_binding *blocks =
+      realloc(p->blocks, (p->num_blocks + 1) * sizeof *blocks);
+  if (!blocks) {
+    goto fail_alloc_blocks;
+  }
+  p->blocks = blocks;
+
+  shader_block_binding *b = &blocks[p->num_blocks];
+  b->name = strdup(name);
+  if (!b->name) {
+    goto fail_strdup_name;
+  }
+  b->binding = binding;
+  ++p->num_blocks;
+  if (p->program) {
+    apply_block(p, b);
+  }
+  return true;
+
+fail_strdup_name:
+fail_alloc_blocks:
+  log_error("unable to allocate uniform block binding '%s'", name);
+  return false;
+}
+
+bool shader_variants_init(shader_variants *v, shader_manager *m,
+                          i32 num_shaders, const GLenum *shader_types,
+                          const char **shader_paths) {
+  assert(num_shaders <= MAX_SHADERS_IN_PROGRAM);
+  v->manager = m;
+  v->num_shaders = num_shaders;
+  memcpy(v->shader_types, shader_types, num_shaders * sizeof(shader_types[0]));
+  i32 i;
+  for (i = 0; i < num_shaders; ++i) {
+    if (!(v->shader_paths[i] = strdup(shader_paths[i]))) {
+      goto fail_strdup_paths;
+    }
+  }
+  v->keys = NULL;
+  v->programs = NULL;
+  v->num_variants = 0;
+  v->capacity = 0;
+  return true;
+
+fail_strdup_paths:
+  for (i32 j = 0; j < i; ++j) {
+    free(v->shader_paths[j]);
+  }
+  // freeing is still safe
+  v->num_shaders = 0;
+  v->keys = NULL;
+  v->programs = NULL;
+  v->num_variants = 0;
+  return false;
+}
+
+bool shader_variants_init_vf(shader_variants *v, shader_manager *m,
+                             const char *vs, const char *fs) {
+  return shader_variants_init(
+      v, m, 2, (GLenum[]){GL_VERTEX_SHADER, GL_FRAGMENT_SHADER},
+      (const char *[]){vs, fs});
+}
+
+void shader_variants_free(shader_variants *v) {
+  for (i32 i = 0; i < v->num_variants; ++i) {
+    shader_program_destroy(v->manager, v->programs[i]);
+  }
+  for (i32 i = 0; i < v->num_shaders; ++i) {
+    free(v->shader_paths[i]);
+  }
+  free(v->keys);
+  free(v->programs);
+}
+
+shader_program *shader_variants_find(const shader_variants *v, u64 key) {
+  for (i32 i = 0; i < v->num_variants; ++i) {
+    if (v->keys[i] == key) {
+      return v->programs[i];
+    }
+  }
+  return NULL;
+}
+
+shader_program *shader_variants_add(shader_variants *v, u64 key,
+                                    const char *defines) {
+  assert(!shader_variants_find(v, key));
+  if (v->num_variants == v->capacity) {
+    i32 capacity = v->capacity ? v->capacity * 2 : 4;
+    u64 *keys = realloc(v->keys, capacity * sizeof *keys);
+    if (!keys) {
+      goto fail_grow;
+    }
+    v->keys = keys;
+    shader_program **programs =
+        realloc(v->programs, capacity * sizeof *programs);
+    if (!programs) {
+      goto fail_grow;
+    }
+    v->programs = programs;
+    v->capacity = capacity;
+  }
+
+  shader_program *p =
+      shader_create_defines(v->manager, v->num_shaders, v->shader_types,
+                            (const char **)v->shader_paths, defines);
+  if (!p) {
+    return NULL;
+  }
+
+  log_debug("created variant %016" PRIx64 " of '%s'", key, p->source_paths[0]);
+  v->keys[v->num_variants] = key;
+  v->programs[v->num_variants] = p;
+  ++v->num_variants;
+  return p;
+
+fail_grow:
+  log_error("unable to grow shader variants");
+  return NULL;
+}
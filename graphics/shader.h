@@ -2,7 +2,11 @@
 
 #include "../utils/filewatch.h"
 #include "../utils/types.h"
+#include "shader_cache.h"
+#include "shader_index.h"
+#include "shader_worker.h"
 #include <glad/gles2.h>
+#include <time.h>
 
 #define MAX_SHADERS_IN_PROGRAM 2
 typedef struct {
@@ -11,34 +15,92 @@ typedef struct {
   GLchar *name;
   GLsizei name_len;
   GLint size;
+  u64 hash;
 } shader_uniform;
 
+// uniform looked up by name once, re-resolved whenever the program reloads
+typedef struct {
+  char *name;
+  u64 hash;
+  // -1 if the current program has no such active uniform
+  GLint location;
+  // texture unit re-applied after reloads, -1 if not a sampler
+  GLint sampler_unit;
+} shader_uniform_handle;
+
+// uniform block bound to a uniform buffer binding point across reloads
+typedef struct {
+  char *name;
+  GLuint binding;
+} shader_block_binding;
+
 typedef struct shader_program {
   GLuint program;
   i32 num_shaders;
   GLenum shader_types[MAX_SHADERS_IN_PROGRAM];
   char *source_paths[MAX_SHADERS_IN_PROGRAM];
+  // #define lines inserted after #version in every source, NULL if none
+  char *defines;
   i32 num_uniforms;
   shader_uniform *uniforms;
+  i32 num_handles;
+  shader_uniform_handle *handles;
+  i32 num_blocks;
+  shader_block_binding *blocks;
   i32 update_counter;
+  struct shader_manager *manager;
+
+  // replacement being compiled and linked, 0 if none. program stays in use
+  // until it has linked.
+  GLuint pending;
+  GLuint pending_shaders[MAX_SHADERS_IN_PROGRAM];
+  // reload being linked by the manager's worker, its program becomes pending
+  // once done
+  shader_link_job *pending_job;
+  // updates since pending was linked on this thread, without the extension
+  // or a worker the link status is first asked for an update later
+  i32 pending_updates;
+  u64 pending_key;
+  struct timespec pending_start;
+  // every file the sources were built from, #includes resolved
+  char **dependencies;
+  i32 num_dependencies;
 
   struct shader_program *prev;
   struct shader_program *next;
 } shader_program;
 
-typedef struct {
+typedef struct shader_manager {
   shader_program *head;
   char *shader_dir;
   filewatch *fw;
+  shader_cache cache;
+  // source path to dependent programs, for reloading
+  shader_index index;
+  i32 num_pending;
+  // GL_KHR_parallel_shader_compile, reloads are polled instead of waited for
+  bool parallel_compile;
+  // links reloads without the extension
+  shader_worker worker;
+  bool has_worker;
 } shader_manager;
 
-bool shader_manager_init(shader_manager *m, const char *shader_dir);
+// cache_dir holds program binaries, NULL compiles every program from source
+bool shader_manager_init(shader_manager *m, const char *shader_dir,
+                         const char *cache_dir);
 void shader_manager_free(shader_manager *m);
+// starts reloading programs whose sources changed and swaps in the ones that
+// finished linking, without waiting for the driver
 bool shader_manager_update(shader_manager *m);
 
 shader_program *shader_create(shader_manager *m, i32 num_shaders,
                               const GLenum *shader_types,
                               const char **shader_paths);
+// defines are #define lines, see shader_variants
+shader_program *shader_create_defines(shader_manager *m, i32 num_shaders,
+                                      const GLenum *shader_types,
+                                      const char **shader_paths,
+                                      const char *defines);
 shader_program *shader_create_vf(shader_manager *m, const char *vs,
                                  const char *fs);
 shader_program *shader_create_compute(shader_manager *m, const char *cs);
@@ -47,3 +109,43 @@ void shader_program_destroy(shader_manager *m, shader_program *program);
 // 0 -> unusable
 // > 0 -> usable, return value is the update counter
 i32 shader_program_use(shader_program *p);
+
+// handle to the uniform called name, registered on first use, -1 on error.
+// handles stay valid across reloads, look them up once after creation.
+i32 shader_program_uniform(shader_program *p, const char *name);
+// location of a handle in the current program, -1 if not active
+GLint shader_program_location(const shader_program *p, i32 handle);
+// binds a sampler uniform to a texture unit, kept across reloads
+void shader_program_set_sampler(shader_program *p, i32 handle, GLint unit);
+// binds the uniform block called name to a uniform buffer binding point,
+// kept across reloads
+bool shader_program_bind_block(shader_program *p, const char *name,
+                               GLuint binding);
+
+// programs specialized from the same sources by #define sets, created on first
+// use and kept until the set is freed. variants compile to branch-free code
+// instead of one program checking every case at run time.
+typedef struct {
+  shader_manager *manager;
+  i32 num_shaders;
+  GLenum shader_types[MAX_SHADERS_IN_PROGRAM];
+  char *shader_paths[MAX_SHADERS_IN_PROGRAM];
+  u64 *keys;
+  shader_program **programs;
+  i32 num_variants;
+  i32 capacity;
+} shader_variants;
+
+bool shader_variants_init(shader_variants *v, shader_manager *m,
+                          i32 num_shaders, const GLenum *shader_types,
+                          const char **shader_paths);
+bool shader_variants_init_vf(shader_variants *v, shader_manager *m,
+                             const char *vs, const char *fs);
+// destroys every variant, call before shader_manager_free
+void shader_variants_free(shader_variants *v);
+// NULL if key has not been added
+shader_program *shader_variants_find(const shader_variants *v, u64 key);
+// compiles the variant for key from defines, the caller derives both from the
+// same parameters
+shader_program *shader_variants_add(shader_variants *v, u64 key,
+                                    const char *defines);
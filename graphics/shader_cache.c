@@ -0,0 +1,218 @@
+#include "shader_cache.h"
+#include "../utils/fs.h"
+#include "../utils/hash.h"
+#include <errno.h>
+#include <log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHADER_CACHE_MAGIC "CVEDPRG"
+
+typedef struct {
+  char magic[8];
+  u32 version;
+  GLenum format;
+  u64 key;
+  u32 size;
+  u32 reserved;
+} shader_cache_header;
+
+static u64 hash_gl_string(u64 h, GLenum name) {
+  const GLubyte *s = glGetString(name);
+  return s ? hash_fnv1a_str(h, (const char *)s) : h;
+}
+
+bool shader_cache_init(shader_cache *c, const char *dir) {
+  c->dir = NULL;
+  // keys are still computed without a cache on disk
+  c->driver_hash = 0;
+  c->num_hits = 0;
+  c->num_misses = 0;
+  c->hit_time = 0.0;
+  c->miss_time = 0.0;
+  if (!dir) {
+    return true;
+  }
+
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  if (num_formats == 0) {
+    log_info("driver has no program binary formats, shader cache is off");
+    return true;
+  }
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    log_warn("unable to create shader cache directory '%s': %s", dir,
+             strerror(errno));
+    return false;
+  }
+
+  if (!(c->dir = strdup(dir))) {
+    log_error("unable to allocate shader cache directory");
+    return false;
+  }
+
+  // binaries are only valid for the driver build that produced them
+  u64 h = HASH_FNV1A_INIT;
+  h = hash_gl_string(h, GL_VENDOR);
+  h = hash_gl_string(h, GL_RENDERER);
+  h = hash_gl_string(h, GL_VERSION);
+  h = hash_gl_string(h, GL_SHADING_LANGUAGE_VERSION);
+  c->driver_hash = h;
+  return true;
+}
+
+void shader_cache_free(shader_cache *c) {
+  if (c->dir) {
+    log_info("shader cache: %d hits in %.1fms, %d misses in %.1fms",
+             c->num_hits, c->hit_time * 1e3, c->num_misses,
+             c->miss_time * 1e3);
+  }
+  free(c->dir);
+}
+
+u64 shader_cache_key(const shader_cache *c, i32 num_shaders,
+                     const GLenum *types, const GLchar **sources,
+                     const GLint *sizes) {
+  u64 h = c->driver_hash;
+  for (i32 i = 0; i < num_shaders; ++i) {
+    h = hash_fnv1a(h, &types[i], sizeof types[i]);
+    h = hash_fnv1a(h, &sizes[i], sizeof sizes[i]);
+    h = hash_fnv1a(h, sources[i], sizes[i]);
+  }
+
+  return h;
+}
+
+static char *entry_path(const shader_cache *c, u64 key) {
+  char name[32];
+  snprintf(name, sizeof name, "%016" PRIx64 ".bin", key);
+  return path_concat(c->dir, name, false);
+}
+
+bool shader_cache_load(shader_cache *c, u64 key, GLuint program) {
+  if (!c->dir) {
+    return false;
+  }
+
+  char *path = entry_path(c, key);
+  if (!path) {
+    log_error("unable to allocate shader cache path");
+    goto fail_path;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    goto fail_open;
+  }
+
+  shader_cache_header h;
+  if (fread(&h, sizeof h, 1, f) != 1 ||
+      memcmp(h.magic, SHADER_CACHE_MAGIC, sizeof h.magic) != 0 ||
+      h.version != SHADER_CACHE_VERSION || h.key != key) {
+    log_warn("invalid shader cache entry '%s'", path);
+    goto fail_header;
+  }
+
+  void *binary = malloc(h.size);
+  if (!binary) {
+    log_error("unable to allocate program binary");
+    goto fail_binary;
+  }
+
+  if (fread(binary, 1, h.size, f) != h.size) {
+    log_warn("truncated shader cache entry '%s'", path);
+    goto fail_read;
+  }
+
+  // drivers reject binaries of other versions with a link failure
+  glProgramBinary(program, h.format, binary, h.size);
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    log_info("driver rejected shader cache entry '%s'", path);
+    goto fail_link;
+  }
+
+  free(binary);
+  fclose(f);
+  free(path);
+  ++c->num_hits;
+  return true;
+
+fail_link:
+fail_read:
+  free(binary);
+fail_binary:
+fail_header:
+  fclose(f);
+  // stale or corrupt entries are rewritten after compiling from source
+  unlink(path);
+fail_open:
+  free(path);
+fail_path:
+  ++c->num_misses;
+  return false;
+}
+
+void shader_cache_store(shader_cache *c, u64 key, GLuint program) {
+  if (!c->dir) {
+    return;
+  }
+
+  GLint size = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) {
+    return;
+  }
+
+  void *binary = malloc(size);
+  if (!binary) {
+    log_error("unable to allocate program binary");
+    goto fail_binary;
+  }
+
+  shader_cache_header h = {
+      .version = SHADER_CACHE_VERSION,
+      .key = key,
+      .reserved = 0,
+  };
+  memcpy(h.magic, SHADER_CACHE_MAGIC, sizeof h.magic);
+  GLsizei length;
+  glGetProgramBinary(program, size, &length, &h.format, binary);
+  h.size = length;
+
+  char *path = entry_path(c, key);
+  char *tmp = path ? malloc(strlen(path) + 5) : NULL;
+  if (!tmp) {
+    log_error("unable to allocate shader cache path");
+    goto fail_path;
+  }
+  sprintf(tmp, "%s.tmp", path);
+
+  // renamed into place so concurrent instances never read a partial entry
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    log_warn("unable to create shader cache entry '%s': %s", tmp,
+             strerror(errno));
+    goto fail_open;
+  }
+
+  bool ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+            fwrite(binary, 1, length, f) == (usize)length;
+  if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+    log_warn("unable to write shader cache entry '%s'", path);
+    unlink(tmp);
+  }
+
+fail_open:
+fail_path:
+  free(tmp);
+  free(path);
+  free(binary);
+fail_binary:
+  return;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/gles2.h>
+
+#define SHADER_CACHE_VERSION 1
+
+// linked program binaries on disk, keyed by the shader sources and the driver
+// that compiled them
+typedef struct {
+  // NULL when the cache is disabled or the driver has no binary formats
+  char *dir;
+  u64 driver_hash;
+  i32 num_hits;
+  i32 num_misses;
+  // seconds spent creating programs from binaries and from source
+  double hit_time;
+  double miss_time;
+} shader_cache;
+
+// dir may be NULL to always compile from source
+bool shader_cache_init(shader_cache *c, const char *dir);
+void shader_cache_free(shader_cache *c);
+u64 shader_cache_key(const shader_cache *c, i32 num_shaders,
+                     const GLenum *types, const GLchar **sources,
+                     const GLint *sizes);
+// links program from a cached binary, false if there is none or the driver
+// rejects it
+bool shader_cache_load(shader_cache *c, u64 key, GLuint program);
+// programs must be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+void shader_cache_store(shader_cache *c, u64 key, GLuint program);
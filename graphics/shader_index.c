@@ -0,0 +1,113 @@
+#include "shader_index.h"
+#include "../utils/hash.h"
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHADER_INDEX_INITIAL_CAPACITY 64
+
+bool shader_index_init(shader_index *x) {
+  x->capacity = SHADER_INDEX_INITIAL_CAPACITY;
+  x->num_entries = 0;
+  if (!(x->entries = calloc(x->capacity, sizeof *x->entries))) {
+    log_error("unable to allocate shader index");
+    return false;
+  }
+
+  return true;
+}
+
+void shader_index_free(shader_index *x) {
+  for (i32 i = 0; i < x->capacity; ++i) {
+    free(x->entries[i].path);
+    free(x->entries[i].programs);
+  }
+  free(x->entries);
+}
+
+// linear probing, capacity is a power of two
+static shader_index_entry *probe(shader_index_entry *entries, i32 capacity,
+                                 const char *path) {
+  u32 mask = capacity - 1;
+  u32 i = (u32)hash_fnv1a_str(HASH_FNV1A_INIT, path) & mask;
+  while (entries[i].path && strcmp(entries[i].path, path) != 0) {
+    i = (i + 1) & mask;
+  }
+
+  return &entries[i];
+}
+
+static bool grow(shader_index *x) {
+  i32 capacity = x->capacity * 2;
+  shader_index_entry *entries = calloc(capacity, sizeof *entries);
+  if (!entries) {
+    log_error("unable to grow shader index");
+    return false;
+  }
+
+  for (i32 i = 0; i < x->capacity; ++i) {
+    if (x->entries[i].path) {
+      *probe(entries, capacity, x->entries[i].path) = x->entries[i];
+    }
+  }
+
+  free(x->entries);
+  x->entries = entries;
+  x->capacity = capacity;
+  return true;
+}
+
+bool shader_index_add(shader_index *x, const char *path,
+                      struct shader_program *p) {
+  // kept at most half full
+  if (2 * (x->num_entries + 1) > x->capacity && !grow(x)) {
+    return false;
+  }
+
+  shader_index_entry *e = probe(x->entries, x->capacity, path);
+  if (!e->path) {
+    if (!(e->path = strdup(path))) {
+      log_error("unable to allocate shader index path");
+      return false;
+    }
+    ++x->num_entries;
+  }
+
+  for (i32 i = 0; i < e->num_programs; ++i) {
+    if (e->programs[i] == p) {
+      return true;
+    }
+  }
+
+  if (e->num_programs == e->capacity) {
+    i32 capacity = e->capacity ? e->capacity * 2 : 4;
+    struct shader_program **programs =
+        realloc(e->programs, capacity * sizeof *programs);
+    if (!programs) {
+      log_error("unable to grow shader index entry");
+      return false;
+    }
+    e->programs = programs;
+    e->capacity = capacity;
+  }
+
+  e->programs[e->num_programs++] = p;
+  return true;
+}
+
+void shader_index_remove(shader_index *x, const char *path,
+                         struct shader_program *p) {
+  shader_index_entry *e = probe(x->entries, x->capacity, path);
+  for (i32 i = 0; i < e->num_programs; ++i) {
+    if (e->programs[i] == p) {
+      e->programs[i] = e->programs[--e->num_programs];
+      return;
+    }
+  }
+}
+
+const shader_index_entry *shader_index_find(const shader_index *x,
+                                            const char *path) {
+  const shader_index_entry *e = probe(x->entries, x->capacity, path);
+  return e->path ? e : NULL;
+}
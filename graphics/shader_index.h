@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../utils/types.h"
+
+struct shader_program;
+
+typedef struct {
+  // NULL for empty slots
+  char *path;
+  struct shader_program **programs;
+  i32 num_programs;
+  i32 capacity;
+} shader_index_entry;
+
+// source path to the programs built from it, directly or through #include.
+// Paths stay in the table once added, with no programs once unused.
+typedef struct {
+  shader_index_entry *entries;
+  i32 capacity;
+  i32 num_entries;
+} shader_index;
+
+bool shader_index_init(shader_index *x);
+void shader_index_free(shader_index *x);
+bool shader_index_add(shader_index *x, const char *path,
+                      struct shader_program *p);
+void shader_index_remove(shader_index *x, const char *path,
+                         struct shader_program *p);
+// NULL if no program was ever built from path
+const shader_index_entry *shader_index_find(const shader_index *x,
+                                            const char *path);
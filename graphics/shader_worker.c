@@ -0,0 +1,264 @@
+#include "shader_worker.h"
+#include "../utils/threading_utils.h"
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct shader_link_job {
+  shader_link_job *next;
+  // written by the worker, read by the render thread once done is set
+  GLuint program;
+  atomic_bool done;
+  // guarded by the worker's mutex, the worker deletes the program of
+  // cancelled jobs it is working on
+  bool cancelled;
+  i32 num_shaders;
+  GLenum *types;
+  GLchar **sources;
+  GLint *sizes;
+  GLuint *shaders;
+};
+
+static void free_job(shader_link_job *j) {
+  for (i32 i = 0; i < j->num_shaders; ++i) {
+    free(j->sources[i]);
+  }
+  free(j);
+}
+
+// on the worker's context or the render thread's, objects are shared
+static void delete_objects(shader_link_job *j) {
+  for (i32 i = 0; i < j->num_shaders; ++i) {
+    glDeleteShader(j->shaders[i]);
+  }
+  glDeleteProgram(j->program);
+}
+
+static void link_job(shader_link_job *j) {
+  if (!(j->program = glCreateProgram())) {
+    return;
+  }
+
+  for (i32 i = 0; i < j->num_shaders; ++i) {
+    if (!(j->shaders[i] = glCreateShader(j->types[i]))) {
+      break;
+    }
+    glShaderSource(j->shaders[i], 1, (const GLchar **)&j->sources[i],
+                   &j->sizes[i]);
+    glCompileShader(j->shaders[i]);
+    glAttachShader(j->program, j->shaders[i]);
+  }
+  glProgramParameteri(j->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                      GL_TRUE);
+  glLinkProgram(j->program);
+
+  // waits for the driver here rather than on the render thread, finishing
+  // makes the results visible to the other context
+  GLint status;
+  glGetProgramiv(j->program, GL_LINK_STATUS, &status);
+  glFinish();
+}
+
+static int thread_callback(void *arg) {
+  shader_worker *w = arg;
+  bool ok = shared_context_make_current(&w->context);
+  mtx_lock(&w->mutex);
+  w->started = true;
+  w->running = ok;
+  cnd_broadcast(&w->cond);
+  mtx_unlock(&w->mutex);
+  if (!ok) {
+    return 1;
+  }
+
+  mtx_lock(&w->mutex);
+  while (true) {
+    while (!w->head && !w->exit) {
+      cnd_wait(&w->cond, &w->mutex);
+    }
+    if (!w->head) {
+      break;
+    }
+
+    shader_link_job *j = w->head;
+    if (!(w->head = j->next)) {
+      w->tail = NULL;
+    }
+    mtx_unlock(&w->mutex);
+    link_job(j);
+    mtx_lock(&w->mutex);
+    if (j->cancelled) {
+      delete_objects(j);
+      free_job(j);
+    } else {
+      atomic_store_explicit(&j->done, true, memory_order_release);
+    }
+  }
+  mtx_unlock(&w->mutex);
+
+  shared_context_release(&w->context);
+  return 0;
+}
+
+bool shader_worker_init(shader_worker *w) {
+  w->head = NULL;
+  w->tail = NULL;
+  w->started = false;
+  w->running = false;
+  w->exit = false;
+  if (!shared_context_init(&w->context)) {
+    goto fail_context;
+  }
+
+  i32 error;
+  if ((error = mtx_init(&w->mutex, mtx_plain)) != thrd_success) {
+    log_error("unable to initialize shader worker mutex: %s",
+              thrd_error_to_string(error));
+    goto fail_mutex;
+  }
+  if ((error = cnd_init(&w->cond)) != thrd_success) {
+    log_error("unable to initialize shader worker condition: %s",
+              thrd_error_to_string(error));
+    goto fail_cond;
+  }
+  if ((error = thrd_create(&w->thread, thread_callback, w)) != thrd_success) {
+    log_error("unable to start shader worker thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  // the context may only turn out unusable on the worker
+  mtx_lock(&w->mutex);
+  while (!w->started) {
+    cnd_wait(&w->cond, &w->mutex);
+  }
+  bool running = w->running;
+  mtx_unlock(&w->mutex);
+  if (!running) {
+    thrd_join(w->thread, NULL);
+    goto fail_thread;
+  }
+  return true;
+
+fail_thread:
+  cnd_destroy(&w->cond);
+fail_cond:
+  mtx_destroy(&w->mutex);
+fail_mutex:
+  shared_context_free(&w->context);
+fail_context:
+  return false;
+}
+
+void shader_worker_free(shader_worker *w) {
+  mtx_lock(&w->mutex);
+  w->exit = true;
+  // jobs nobody waits for any more are not started
+  while (w->head) {
+    shader_link_job *j = w->head;
+    w->head = j->next;
+    free_job(j);
+  }
+  w->tail = NULL;
+  cnd_broadcast(&w->cond);
+  mtx_unlock(&w->mutex);
+
+  i32 error;
+  if ((error = thrd_join(w->thread, NULL)) != thrd_success) {
+    log_error("unable to join shader worker thread: %s",
+              thrd_error_to_string(error));
+  }
+  cnd_destroy(&w->cond);
+  mtx_destroy(&w->mutex);
+  shared_context_free(&w->context);
+}
+
+shader_link_job *shader_worker_link(shader_worker *w, i32 num_shaders,
+                                    const GLenum *types,
+                                    const GLchar **sources,
+                                    const GLint *sizes) {
+  // the arrays follow the job in one allocation, pointers first to keep
+  // them aligned
+  shader_link_job *j = calloc(
+      1, sizeof *j + num_shaders * (sizeof *j->sources + sizeof *j->types +
+                                    sizeof *j->sizes + sizeof *j->shaders));
+  if (!j) {
+    log_error("unable to allocate shader link job");
+    goto fail_job;
+  }
+
+  j->sources = (GLchar **)(j + 1);
+  j->types = (GLenum *)(j->sources + num_shaders);
+  j->sizes = (GLint *)(j->types + num_shaders);
+  j->shaders = (GLuint *)(j->sizes + num_shaders);
+  memcpy(j->types, types, num_shaders * sizeof *types);
+  memcpy(j->sizes, sizes, num_shaders * sizeof *sizes);
+  atomic_init(&j->done, false);
+  for (; j->num_shaders < num_shaders; ++j->num_shaders) {
+    if (!(j->sources[j->num_shaders] = malloc(sizes[j->num_shaders]))) {
+      log_error("unable to allocate shader source");
+      goto fail_sources;
+    }
+    memcpy(j->sources[j->num_shaders], sources[j->num_shaders],
+           sizes[j->num_shaders]);
+  }
+
+  mtx_lock(&w->mutex);
+  if (w->tail) {
+    w->tail->next = j;
+  } else {
+    w->head = j;
+  }
+  w->tail = j;
+  cnd_signal(&w->cond);
+  mtx_unlock(&w->mutex);
+  return j;
+
+fail_sources:
+  free_job(j);
+fail_job:
+  return NULL;
+}
+
+bool shader_link_job_done(shader_link_job *j) {
+  return atomic_load_explicit(&j->done, memory_order_acquire);
+}
+
+void shader_link_job_take(shader_link_job *j, GLuint *program,
+                          GLuint *shaders) {
+  *program = j->program;
+  memcpy(shaders, j->shaders, j->num_shaders * sizeof *shaders);
+  free_job(j);
+}
+
+void shader_worker_cancel(shader_worker *w, shader_link_job *j) {
+  mtx_lock(&w->mutex);
+  if (shader_link_job_done(j)) {
+    mtx_unlock(&w->mutex);
+    delete_objects(j);
+    free_job(j);
+    return;
+  }
+
+  // queued jobs are dropped, the one being linked is left to the worker
+  shader_link_job *prev = NULL;
+  shader_link_job *queued = w->head;
+  while (queued && queued != j) {
+    prev = queued;
+    queued = queued->next;
+  }
+  if (queued) {
+    if (prev) {
+      prev->next = j->next;
+    } else {
+      w->head = j->next;
+    }
+    if (w->tail == j) {
+      w->tail = prev;
+    }
+    free_job(j);
+  } else {
+    j->cancelled = true;
+  }
+  mtx_unlock(&w->mutex);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "shared_context.h"
+#include <glad/gles2.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+typedef struct shader_link_job shader_link_job;
+
+// compiles and links programs on a thread of its own, on a context sharing
+// objects with the render thread's, so drivers without
+// GL_KHR_parallel_shader_compile do not stall the render thread either
+typedef struct {
+  shared_context context;
+  thrd_t thread;
+  mtx_t mutex;
+  cnd_t cond;
+  // jobs not started yet, oldest first
+  shader_link_job *head;
+  shader_link_job *tail;
+  // set by the thread once its context is current or failed to be
+  bool started;
+  bool running;
+  bool exit;
+} shader_worker;
+
+// call with the render thread's context current
+bool shader_worker_init(shader_worker *w);
+// call once every job is taken or cancelled
+void shader_worker_free(shader_worker *w);
+
+// queues compiling and linking the sources, which are copied. NULL on errors.
+shader_link_job *shader_worker_link(shader_worker *w, i32 num_shaders,
+                                    const GLenum *types,
+                                    const GLchar **sources,
+                                    const GLint *sizes);
+// true once the program and its shaders are ready for the render thread,
+// linked or not
+bool shader_link_job_done(shader_link_job *j);
+// hands the program and its num_shaders shaders of a done job to the caller
+// and frees the job. program is 0 if it could not be created.
+void shader_link_job_take(shader_link_job *j, GLuint *program,
+                          GLuint *shaders);
+// drops the job, deleting its program whenever the worker is done with it
+void shader_worker_cancel(shader_worker *w, shader_link_job *j);
@@ -0,0 +1,77 @@
+#include "shared_context.h"
+#include <log.h>
+
+bool shared_context_init(shared_context *c) {
+  c->display = eglGetCurrentDisplay();
+  EGLContext share = eglGetCurrentContext();
+  if (c->display == EGL_NO_DISPLAY || share == EGL_NO_CONTEXT) {
+    log_error("no current EGL context to share objects with");
+    goto fail_current;
+  }
+
+  // the same config as the shared context, so the two are compatible
+  EGLint config_id;
+  EGLConfig config;
+  EGLint num_configs;
+  if (!eglQueryContext(c->display, share, EGL_CONFIG_ID, &config_id) ||
+      !eglChooseConfig(c->display,
+                       (EGLint[]){EGL_CONFIG_ID, config_id, EGL_NONE},
+                       &config, 1, &num_configs) ||
+      num_configs == 0) {
+    log_error("unable to find the config of the current EGL context: 0x%x",
+              eglGetError());
+    goto fail_current;
+  }
+
+  EGLint context_attr[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 2,
+      EGL_NONE,
+  };
+  c->context = eglCreateContext(c->display, config, share, context_attr);
+  if (c->context == EGL_NO_CONTEXT) {
+    log_error("unable to create shared OpenGL ES 3.2 context: 0x%x",
+              eglGetError());
+    goto fail_context;
+  }
+
+  c->surface = EGL_NO_SURFACE;
+  if (!GLAD_EGL_KHR_surfaceless_context) {
+    EGLint pbuffer_attr[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    c->surface = eglCreatePbufferSurface(c->display, config, pbuffer_attr);
+    if (c->surface == EGL_NO_SURFACE) {
+      log_error("unable to create pbuffer surface for shared context: 0x%x",
+                eglGetError());
+      goto fail_surface;
+    }
+  }
+  return true;
+
+fail_surface:
+  eglDestroyContext(c->display, c->context);
+fail_context:
+fail_current:
+  return false;
+}
+
+void shared_context_free(shared_context *c) {
+  if (c->surface != EGL_NO_SURFACE) {
+    eglDestroySurface(c->display, c->surface);
+  }
+  eglDestroyContext(c->display, c->context);
+}
+
+bool shared_context_make_current(shared_context *c) {
+  if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+      !eglMakeCurrent(c->display, c->surface, c->surface, c->context)) {
+    log_error("unable to make shared EGL context current: 0x%x",
+              eglGetError());
+    return false;
+  }
+  return true;
+}
+
+void shared_context_release(shared_context *c) {
+  eglMakeCurrent(c->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglReleaseThread();
+}
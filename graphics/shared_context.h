@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/egl.h>
+
+// GLES context sharing objects with the EGL context current on the thread
+// that creates it, for a worker thread to make current. Both the preview
+// window and egl_headless run on EGL contexts with the EGL functions loaded.
+typedef struct {
+  EGLDisplay display;
+  EGLContext context;
+  // 1x1 pbuffer if contexts cannot be made current without a surface,
+  // EGL_NO_SURFACE otherwise
+  EGLSurface surface;
+} shared_context;
+
+bool shared_context_init(shared_context *c);
+// the context must not be current on any thread
+void shared_context_free(shared_context *c);
+// binds the context to the calling thread
+bool shared_context_make_current(shared_context *c);
+// unbinds the context from the calling thread
+void shared_context_release(shared_context *c);
@@ -0,0 +1,127 @@
+#include "texture_pool.h"
+#include <log.h>
+#include <stdlib.h>
+
+void texture_pool_init(texture_pool *p) {
+  p->entries = NULL;
+  p->num_entries = 0;
+  p->capacity = 0;
+  p->num_created = 0;
+  p->num_reused = 0;
+}
+
+static void delete_entry(texture_pool *p, i32 i) {
+  texture_pool_entry *e = &p->entries[i];
+  glDeleteTextures(1, &e->texture);
+  if (e->fence) {
+    glDeleteSync(e->fence);
+  }
+  p->entries[i] = p->entries[--p->num_entries];
+}
+
+void texture_pool_free(texture_pool *p) {
+  log_info("texture pool: %d textures created, %" PRIi64 " reused",
+           p->num_created, p->num_reused);
+  for (i32 i = 0; i < p->num_entries; ++i) {
+    if (p->entries[i].in_use) {
+      log_warn("texture %u still in use", p->entries[i].texture);
+    }
+  }
+  while (p->num_entries > 0) {
+    delete_entry(p, 0);
+  }
+  free(p->entries);
+}
+
+// done once the GPU finished every command issued before the release
+static bool entry_idle(texture_pool_entry *e) {
+  if (!e->fence) {
+    return true;
+  }
+
+  GLenum status = glClientWaitSync(e->fence, 0, 0);
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+    return false;
+  }
+  glDeleteSync(e->fence);
+  e->fence = 0;
+  return true;
+}
+
+GLuint texture_pool_acquire(texture_pool *p, GLenum internal_format,
+                            i32 width, i32 height) {
+  i32 num_free = 0;
+  for (i32 i = 0; i < p->num_entries; ++i) {
+    texture_pool_entry *e = &p->entries[i];
+    if (e->in_use) {
+      continue;
+    }
+    ++num_free;
+    if (e->internal_format == internal_format && e->width == width &&
+        e->height == height && entry_idle(e)) {
+      e->in_use = true;
+      ++p->num_reused;
+      glBindTexture(GL_TEXTURE_2D, e->texture);
+      return e->texture;
+    }
+  }
+
+  // textures of sizes no longer shown would pile up otherwise
+  for (i32 i = 0; i < p->num_entries && num_free >= TEXTURE_POOL_MAX_FREE;) {
+    if (!p->entries[i].in_use && entry_idle(&p->entries[i])) {
+      delete_entry(p, i);
+      --num_free;
+    } else {
+      ++i;
+    }
+  }
+
+  if (p->num_entries == p->capacity) {
+    i32 capacity = p->capacity ? p->capacity * 2 : 16;
+    texture_pool_entry *entries =
+        realloc(p->entries, capacity * sizeof *entries);
+    if (!entries) {
+      log_error("unable to grow texture pool");
+      return 0;
+    }
+    p->entries = entries;
+    p->capacity = capacity;
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  if (texture == 0) {
+    log_error("unable to create texture");
+    return 0;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  p->entries[p->num_entries++] = (texture_pool_entry){
+      .texture = texture,
+      .internal_format = internal_format,
+      .width = width,
+      .height = height,
+      .in_use = true,
+      .fence = 0,
+  };
+  ++p->num_created;
+  return texture;
+}
+
+void texture_pool_release(texture_pool *p, GLuint texture) {
+  for (i32 i = 0; i < p->num_entries; ++i) {
+    texture_pool_entry *e = &p->entries[i];
+    if (e->texture == texture && e->in_use) {
+      e->in_use = false;
+      e->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      return;
+    }
+  }
+
+  log_warn("texture %u does not belong to the pool", texture);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/gles2.h>
+
+// released textures kept for reuse beyond the ones in flight
+#define TEXTURE_POOL_MAX_FREE 16
+
+typedef struct {
+  GLuint texture;
+  GLenum internal_format;
+  i32 width, height;
+  bool in_use;
+  // signalled once the GPU is done with a released texture
+  GLsync fence;
+} texture_pool_entry;
+
+// immutable (glTexStorage2D) textures recycled by size and format, so showing
+// a frame does not create and delete GL objects
+typedef struct texture_pool {
+  texture_pool_entry *entries;
+  i32 num_entries;
+  i32 capacity;
+  i32 num_created;
+  i64 num_reused;
+} texture_pool;
+
+void texture_pool_init(texture_pool *p);
+// every texture must have been released
+void texture_pool_free(texture_pool *p);
+// bound to GL_TEXTURE_2D, linearly filtered and clamped to the edge. 0 on
+// errors.
+GLuint texture_pool_acquire(texture_pool *p, GLenum internal_format,
+                            i32 width, i32 height);
+// the texture is handed out again once the commands issued so far are done
+void texture_pool_release(texture_pool *p, GLuint texture);
@@ -0,0 +1,39 @@
+#include "uniform_buffer.h"
+#include <log.h>
+
+bool uniform_buffer_init(uniform_buffer *b, GLuint binding, GLsizeiptr size) {
+  b->buffer = 0;
+  GLint max_size;
+  glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_size);
+  if (size > max_size) {
+    log_error("uniform block of %ld bytes exceeds the limit of %d",
+              (long)size, max_size);
+    return false;
+  }
+
+  glGenBuffers(1, &b->buffer);
+  if (b->buffer == 0) {
+    log_error("unable to create uniform buffer");
+    return false;
+  }
+
+  b->binding = binding;
+  b->size = size;
+  glBindBuffer(GL_UNIFORM_BUFFER, b->buffer);
+  glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding, b->buffer);
+  return true;
+}
+
+void uniform_buffer_free(uniform_buffer *b) {
+  glDeleteBuffers(1, &b->buffer);
+  b->buffer = 0;
+}
+
+void uniform_buffer_update(uniform_buffer *b, const void *data) {
+  glBindBuffer(GL_UNIFORM_BUFFER, b->buffer);
+  // orphans the storage so the update does not wait for draws still reading
+  // the previous frame's parameters
+  glBufferData(GL_UNIFORM_BUFFER, b->size, data, GL_STREAM_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, b->binding, b->buffer);
+}
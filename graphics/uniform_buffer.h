@@ -0,0 +1,17 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <glad/gles2.h>
+
+// std140 parameter block updated once per frame and bound to a fixed binding
+// point, see shader_program_bind_block
+typedef struct {
+  GLuint buffer;
+  GLuint binding;
+  GLsizeiptr size;
+} uniform_buffer;
+
+bool uniform_buffer_init(uniform_buffer *b, GLuint binding, GLsizeiptr size);
+void uniform_buffer_free(uniform_buffer *b);
+// replaces the whole block, data must follow the std140 layout of the block
+void uniform_buffer_update(uniform_buffer *b, const void *data);
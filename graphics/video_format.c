@@ -0,0 +1,125 @@
+#include "video_format.h"
+#include <libavutil/pixdesc.h>
+#include <stdio.h>
+
+bool video_format_init(video_format *f, enum AVPixelFormat pixfmt,
+                       enum AVColorSpace colorspace, enum AVColorRange range,
+                       enum AVColorTransferCharacteristic transfer,
+                       i32 height) {
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pixfmt);
+  if (!desc || desc->nb_components != 3 || desc->comp[1].plane != 1 ||
+      (desc->comp[2].plane != 1 && desc->comp[2].plane != 2) ||
+      (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE)) ||
+      desc->comp[0].depth > 16) {
+    return false;
+  }
+
+  f->pixfmt = pixfmt;
+  f->planar = desc->comp[2].plane == 2;
+  f->bit_depth = desc->comp[0].depth;
+  f->shift = desc->comp[0].shift;
+  f->container_bits = desc->comp[0].step * 8;
+
+  switch (colorspace) {
+  case AVCOL_SPC_BT709:
+    f->matrix = VIDEO_MATRIX_BT709;
+    break;
+  case AVCOL_SPC_BT2020_NCL:
+  case AVCOL_SPC_BT2020_CL:
+    f->matrix = VIDEO_MATRIX_BT2020;
+    break;
+  case AVCOL_SPC_BT470BG:
+  case AVCOL_SPC_SMPTE170M:
+  case AVCOL_SPC_SMPTE240M:
+  case AVCOL_SPC_FCC:
+    f->matrix = VIDEO_MATRIX_BT601;
+    break;
+  default:
+    // untagged HD is almost always BT.709
+    f->matrix = height >= 720 ? VIDEO_MATRIX_BT709 : VIDEO_MATRIX_BT601;
+    break;
+  }
+
+  f->range = range == AVCOL_RANGE_JPEG ? VIDEO_RANGE_FULL : VIDEO_RANGE_LIMITED;
+
+  switch (transfer) {
+  case AVCOL_TRC_SMPTE2084:
+    f->transfer = VIDEO_TRANSFER_PQ;
+    break;
+  case AVCOL_TRC_ARIB_STD_B67:
+    f->transfer = VIDEO_TRANSFER_HLG;
+    break;
+  default:
+    f->transfer = VIDEO_TRANSFER_SDR;
+    break;
+  }
+  return true;
+}
+
+u64 video_format_key(const video_format *f) {
+  // the pixel format implies the planes, depth, shift and container size
+  return (u64)(u32)f->pixfmt | (u64)f->matrix << 32 | (u64)f->range << 40 |
+         (u64)f->transfer << 48;
+}
+
+i32 video_format_defines(const video_format *f, i32 layer, char *defines,
+                         usize size) {
+  double kr, kb;
+  switch (f->matrix) {
+  case VIDEO_MATRIX_BT601:
+    kr = 0.299, kb = 0.114;
+    break;
+  case VIDEO_MATRIX_BT709:
+    kr = 0.2126, kb = 0.0722;
+    break;
+  case VIDEO_MATRIX_BT2020:
+  default:
+    kr = 0.2627, kb = 0.0593;
+    break;
+  }
+  double kg = 1.0 - kr - kb;
+
+  // texture samples are normalized to the container, scale them back to codes
+  double scale =
+      (double)((1ull << f->container_bits) - 1) / (double)(1ull << f->shift);
+  double max_code = (double)((1ull << f->bit_depth) - 1);
+  double y_gain, y_offset, c_gain, c_offset;
+  if (f->range == VIDEO_RANGE_FULL) {
+    y_gain = scale / max_code;
+    y_offset = 0.0;
+    c_gain = scale / max_code;
+    c_offset = -(double)(1ull << (f->bit_depth - 1)) / max_code;
+  } else {
+    double step = (double)(1ull << (f->bit_depth - 8));
+    y_gain = scale / (219.0 * step);
+    y_offset = -16.0 / 219.0;
+    c_gain = scale / (224.0 * step);
+    c_offset = -128.0 / 224.0;
+  }
+
+  // columns of the Y'CbCr to R'G'B' matrix
+  double cb[3] = {0.0, -2.0 * kb * (1.0 - kb) / kg, 2.0 * (1.0 - kb)};
+  double cr[3] = {2.0 * (1.0 - kr), -2.0 * kr * (1.0 - kr) / kg, 0.0};
+  double offset[3];
+  for (i32 i = 0; i < 3; ++i) {
+    offset[i] = y_offset + (cb[i] + cr[i]) * c_offset;
+  }
+
+  const char *to_display = "sdr_to_display";
+  if (f->transfer == VIDEO_TRANSFER_PQ) {
+    to_display = "pq_to_display";
+  } else if (f->transfer == VIDEO_TRANSFER_HLG) {
+    to_display = "hlg_to_display";
+  }
+  return snprintf(defines, size,
+                  "#define YUV%d_SAMPLE %s\n"
+                  "#define YUV%d_MATRIX mat3(%.7f, %.7f, %.7f, %.7f, %.7f, "
+                  "%.7f, %.7f, %.7f, %.7f)\n"
+                  "#define YUV%d_OFFSET vec3(%.7f, %.7f, %.7f)\n"
+                  "#define YUV%d_TO_DISPLAY %s\n",
+                  layer, f->planar ? "sample_planar" : "sample_semi_planar",
+                  layer, y_gain, y_gain, y_gain, cb[0] * c_gain,
+                  cb[1] * c_gain, cb[2] * c_gain, cr[0] * c_gain,
+                  cr[1] * c_gain, cr[2] * c_gain, layer, offset[0], offset[1],
+                  offset[2], layer, to_display);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <libavutil/pixfmt.h>
+
+typedef enum {
+  VIDEO_MATRIX_BT601,
+  VIDEO_MATRIX_BT709,
+  VIDEO_MATRIX_BT2020,
+} video_matrix;
+
+typedef enum {
+  VIDEO_RANGE_LIMITED,
+  VIDEO_RANGE_FULL,
+} video_range;
+
+typedef enum {
+  VIDEO_TRANSFER_SDR,
+  VIDEO_TRANSFER_PQ,
+  VIDEO_TRANSFER_HLG,
+} video_transfer;
+
+// colour properties a frame is converted to RGB with, unspecified values
+// resolved to what players commonly assume
+typedef struct {
+  enum AVPixelFormat pixfmt;
+  // Cb and Cr in planes of their own, or interleaved like NV12
+  bool planar;
+  video_matrix matrix;
+  video_range range;
+  video_transfer transfer;
+  i32 bit_depth;
+  // bits the samples are shifted up by in their container, 6 for P010
+  i32 shift;
+  i32 container_bits;
+} video_format;
+
+// false if pixfmt is not a planar or semi-planar YUV format, the layouts
+// frames are mapped and uploaded in
+bool video_format_init(video_format *f, enum AVPixelFormat pixfmt,
+                       enum AVColorSpace colorspace, enum AVColorRange range,
+                       enum AVColorTransferCharacteristic transfer,
+                       i32 height);
+// identifies the shader variant of a format
+u64 video_format_key(const video_format *f);
+// writes the YUV<layer>_SAMPLE, _MATRIX, _OFFSET and _TO_DISPLAY defines used
+// with shaders/yuv.glsl to defines, returns the length like snprintf
+i32 video_format_defines(const video_format *f, i32 layer, char *defines,
+                         usize size);
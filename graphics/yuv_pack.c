@@ -0,0 +1,70 @@
+#include "yuv_pack.h"
+#include <log.h>
+
+bool yuv_packer_supports(enum AVPixelFormat format, i32 width, i32 height) {
+  // every texel holds four bytes of a single row
+  switch (format) {
+  case AV_PIX_FMT_NV12:
+    return width % 4 == 0 && height % 2 == 0;
+  case AV_PIX_FMT_YUV420P:
+    // chroma rows are width / 2 bytes, two of them per target row
+    return width % 8 == 0 && height % 4 == 0;
+  default:
+    return false;
+  }
+}
+
+bool yuv_packer_init(yuv_packer *p, shader_manager *m,
+                     enum AVPixelFormat format, i32 width, i32 height) {
+  if (!yuv_packer_supports(format, width, height)) {
+    log_error("unable to pack %dx%d frames into pixel format %d on the GPU",
+              width, height, format);
+    goto fail_format;
+  }
+
+  p->manager = m;
+  p->format = format;
+  p->width = width;
+  p->height = height;
+  if (!render_target_init(&p->target, GL_RGBA8, width / 4, height * 3 / 2)) {
+    goto fail_target;
+  }
+
+  p->program = shader_create_defines(
+      m, 2, (GLenum[]){GL_VERTEX_SHADER, GL_FRAGMENT_SHADER},
+      (const char *[]){"test.vs.glsl", "yuv_pack.fs.glsl"},
+      format == AV_PIX_FMT_NV12 ? "#define PACK_NV12 1\n" : NULL);
+  if (!p->program) {
+    goto fail_program;
+  }
+  // the initial compile is synchronous, unusable means it failed
+  if (shader_program_use(p->program) == 0) {
+    log_error("unable to compile YUV packing shader");
+    goto fail_use;
+  }
+  p->source_handle = shader_program_uniform(p->program, "source");
+  shader_program_set_sampler(p->program, p->source_handle, 0);
+  return true;
+
+fail_use:
+  shader_program_destroy(m, p->program);
+fail_program:
+  render_target_free(&p->target);
+fail_target:
+fail_format:
+  return false;
+}
+
+void yuv_packer_free(yuv_packer *p) {
+  shader_program_destroy(p->manager, p->program);
+  render_target_free(&p->target);
+}
+
+void yuv_packer_run(yuv_packer *p, GLuint source) {
+  render_target_bind(&p->target);
+  // a reload that failed keeps the last program that linked
+  shader_program_use(p->program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, source);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "render_target.h"
+#include "shader.h"
+#include <glad/gles2.h>
+#include <libavutil/pixfmt.h>
+
+// converts rendered RGB frames to limited range BT.709 8-bit 4:2:0 on the
+// GPU. The planes are packed four bytes per RGBA8 texel, rows in memory order,
+// so reading the target back yields the frame laid out as av_image_fill_arrays
+// with an alignment of 1 expects it, at a quarter of the bytes of RGBA.
+typedef struct {
+  shader_manager *manager;
+  shader_program *program;
+  i32 source_handle;
+  // width / 4 by height * 3 / 2 texels
+  render_target target;
+  enum AVPixelFormat format;
+  i32 width, height;
+} yuv_packer;
+
+// whether width x height frames can be packed into format, NV12 and YUV420P
+// are supported
+bool yuv_packer_supports(enum AVPixelFormat format, i32 width, i32 height);
+bool yuv_packer_init(yuv_packer *p, shader_manager *m,
+                     enum AVPixelFormat format, i32 width, i32 height);
+void yuv_packer_free(yuv_packer *p);
+// packs source, a width x height RGB texture with its bottom row first, and
+// leaves the packer's target bound for reading it back
+void yuv_packer_run(yuv_packer *p, GLuint source);
@@ -1,22 +1,39 @@
 #include "audio/al_util.h"
+#include "audio/audio_thread.h"
+#include "audio/offline_render.h"
+#include "audio/pcm_cache.h"
+#include "audio/waveform.h"
 #include "bindings/ffmpeg.h"
+#include "graphics/blur.h"
+#include "graphics/compositor.h"
+#include "graphics/effect_fusion.h"
+#include "graphics/egl_headless.h"
+#include "graphics/readback.h"
+#include "graphics/render_target.h"
 #include "graphics/shader.h"
+#include "graphics/texture_pool.h"
+#include "graphics/video_format.h"
+#include "graphics/yuv_pack.h"
 #include "utils/types.h"
 #include <AL/al.h>
 #include <AL/alc.h>
 #include <AL/alext.h>
 #include <GLFW/glfw3.h>
+#include <assert.h>
 #include <ctype.h>
 #include <glad/gles2.h>
 #include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/log.h>
 #include <libavutil/mathematics.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/pixfmt.h>
 #include <log.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <threads.h>
 #include <timespec.h>
 #define GLFW_EXPOSE_NATIVE_X11
@@ -28,11 +45,55 @@
 #include "lualib.h"
 
 #include "bindings/gl.h"
+#include "media/clip.h"
 #include "media/decode_thread.h"
+#include "media/export.h"
+#include "media/frame_upload.h"
+#include "media/playback_clock.h"
 #include "media/read_thread.h"
+#include "media/reverse_playback.h"
+#include "utils/hash.h"
 #include "utils/threading_utils.h"
+#include "utils/time_utils.h"
 
 lua_State *lua;
+
+// J/K/L shuttle controls, negative speeds play backwards
+#define SHUTTLE_MAX_SPEED 32.0
+double shuttle_speed = 1.0;
+bool shuttle_paused = false;
+
+// clip transitions, in seconds
+#define PREROLL_LOOKAHEAD_DEFAULT 2.0
+#define CROSSFADE_DEFAULT 0.0
+// sample rate of --render-audio output
+#define RENDER_SAMPLE_RATE_DEFAULT 48000
+#define RENDER_SAMPLE_RATE_MIN 8000
+#define RENDER_SAMPLE_RATE_MAX 384000
+// decoded audio of the playlist, for scrubbing
+#define PCM_CACHE_SAMPLE_RATE 48000
+// linked shader programs, reused while sources and driver are unchanged
+#define SHADER_CACHE_DIR_DEFAULT "shader_cache"
+// largest frame decoded straight into the upload buffer
+#define UPLOAD_MAX_WIDTH 3840
+#define UPLOAD_MAX_HEIGHT 2160
+// frames slower than this are reported as hitches
+#define FRAME_TIME_HITCH 0.05
+// output of --headless, frames are stepped at the first clip's frame rate
+#define HEADLESS_WIDTH_DEFAULT 1920
+#define HEADLESS_HEIGHT_DEFAULT 1080
+#define HEADLESS_FRAME_RATE_DEFAULT 30
+// grade of every clip, CVED_VIGNETTE darkens from the radius outwards
+#define CLIP_MAX_EFFECTS 4
+#define VIGNETTE_RADIUS 0.5f
+#define VIGNETTE_SOFTNESS 0.5f
+// halvings of the pyramid CVED_GLOW spreads the glow over
+#define GLOW_LEVELS 5
+// frames being read back while the next ones render
+#define EXPORT_READBACK_SLOTS 3
+#define EXPORT_VIDEO_CODEC_DEFAULT "ffv1"
+#define EXPORT_AUDIO_CODEC_DEFAULT "aac"
+
 static void glfw_error_callback(int error, const char *msg) {
   (void)error;
   log_error("GLFW error: %s", msg);
@@ -49,6 +110,26 @@ static void glfw_key_callback(GLFWwindow *w, int key, int scancode, int action,
              (mods & GLFW_MOD_CONTROL)) {
     lua_settop(lua, 0);
     luaL_dofile(lua, "test.lua");
+  } else if (action == GLFW_PRESS && key == 'K') {
+    shuttle_paused = !shuttle_paused;
+  } else if (action == GLFW_PRESS && key == 'L') {
+    shuttle_paused = false;
+    if (shuttle_speed < -1.0) {
+      shuttle_speed /= 2.0;
+    } else if (shuttle_speed < 0.0) {
+      shuttle_speed = 1.0;
+    } else if (shuttle_speed < SHUTTLE_MAX_SPEED) {
+      shuttle_speed *= 2.0;
+    }
+  } else if (action == GLFW_PRESS && key == 'J') {
+    shuttle_paused = false;
+    if (shuttle_speed > 1.0) {
+      shuttle_speed /= 2.0;
+    } else if (shuttle_speed > 0.0) {
+      shuttle_speed = -1.0;
+    } else if (shuttle_speed > -SHUTTLE_MAX_SPEED) {
+      shuttle_speed *= 2.0;
+    }
   }
 }
 
@@ -229,17 +310,588 @@ void av_log_callback(void *avcl, int level, const char *fmt, va_list vl) {
   }
 }
 
-struct timespec get_now() {
-  struct timespec ts;
-  timespec_get(&ts, TIME_UTC);
-  return ts;
+static double env_double(const char *name, double default_value) {
+  const char *value = getenv(name);
+  if (!value) {
+    return default_value;
+  }
+
+  char *end;
+  double result = strtod(value, &end);
+  if (end == value || *end != '\0') {
+    log_warn("invalid value '%s' of %s, using default %g", value, name,
+             default_value);
+    return default_value;
+  }
+
+  return result;
 }
 
-int main() {
-  init_logging();
-  av_log_set_callback(av_log_callback);
-  av_log_set_level(AV_LOG_DEBUG);
+// CVED_RENDER_SAMPLE_RATE, rates the encoders and resampler cannot take fall
+// back to the default
+static i32 render_sample_rate(void) {
+  double rate = env_double("CVED_RENDER_SAMPLE_RATE",
+                           RENDER_SAMPLE_RATE_DEFAULT);
+  if (rate != floor(rate) || rate < RENDER_SAMPLE_RATE_MIN ||
+      rate > RENDER_SAMPLE_RATE_MAX) {
+    log_error("CVED_RENDER_SAMPLE_RATE %g is not a whole number of Hz "
+              "between %d and %d, using default %d",
+              rate, RENDER_SAMPLE_RATE_MIN, RENDER_SAMPLE_RATE_MAX,
+              RENDER_SAMPLE_RATE_DEFAULT);
+    return RENDER_SAMPLE_RATE_DEFAULT;
+  }
+
+  return (i32)rate;
+}
+
+// starts caching the decoded audio of every playlist entry in the background
+// when CVED_PCM_CACHE_DIR is set
+static pcm_cache_entry *open_pcm_caches(pcm_cache *cache, const char **urls,
+                                        i32 num_urls) {
+  const char *dir = getenv("CVED_PCM_CACHE_DIR");
+  if (!dir) {
+    return NULL;
+  }
+
+  i64 budget = (i64)(env_double("CVED_PCM_CACHE_BUDGET_MB",
+                                PCM_CACHE_BUDGET_DEFAULT >> 20)
+                     * (1 << 20));
+  if (!pcm_cache_init(cache, dir, budget)) {
+    log_error("unable to initialize PCM cache, scrubbing audio is uncached");
+    return NULL;
+  }
+
+  pcm_cache_entry *entries = calloc(num_urls, sizeof *entries);
+  if (!entries) {
+    log_error("unable to allocate PCM cache entries");
+    pcm_cache_free(cache);
+    return NULL;
+  }
+
+  for (i32 i = 0; i < num_urls; ++i) {
+    if (!pcm_cache_open(cache, &entries[i], urls[i], PCM_CACHE_SAMPLE_RATE)) {
+      log_warn("unable to cache audio of '%s'", urls[i]);
+      entries[i].url = NULL;
+    }
+  }
+
+  return entries;
+}
+
+static void close_pcm_caches(pcm_cache *cache, pcm_cache_entry *entries,
+                             i32 num_urls) {
+  if (!entries) {
+    return;
+  }
+
+  for (i32 i = 0; i < num_urls; ++i) {
+    if (entries[i].url) {
+      pcm_cache_entry_close(&entries[i]);
+    }
+  }
+  free(entries);
+  pcm_cache_free(cache);
+}
+
+// loads or generates the waveforms of the playlist in the background when
+// CVED_ANALYZE_AUDIO is set, results are kept in sidecars next to the sources
+static waveform_job *start_waveform_jobs(const char **urls, i32 num_urls) {
+  if (!getenv("CVED_ANALYZE_AUDIO")) {
+    return NULL;
+  }
+
+  waveform_job *jobs = calloc(num_urls, sizeof *jobs);
+  if (!jobs) {
+    log_error("unable to allocate waveform jobs");
+    return NULL;
+  }
+
+  for (i32 i = 0; i < num_urls; ++i) {
+    if (!waveform_job_start(&jobs[i], urls[i])) {
+      log_warn("unable to start waveform of '%s'", urls[i]);
+      jobs[i].url = NULL;
+    }
+  }
+
+  return jobs;
+}
+
+static void free_waveform_jobs(waveform_job *jobs, i32 num_urls) {
+  if (!jobs) {
+    return;
+  }
+
+  for (i32 i = 0; i < num_urls; ++i) {
+    if (jobs[i].url) {
+      waveform_job_free(&jobs[i]);
+    }
+  }
+  free(jobs);
+}
+
+typedef struct {
+  const char *url;
+  clip *clip;
+  // timeline time the next frame is due at, the start of the frame on screen
+  // while playing backwards
+  double next_pts;
+  hw_texture tex;
+  bool eof;
+  // set while playing backwards, the clip's decoders are idle meanwhile
+  reverse_playback *reverse;
+  // changes of direction open their decoders in the background, the frame on
+  // screen is held until they are ready
+  reverse_playback_opener reverse_opener;
+  bool opening_reverse;
+  clip_preroll reopen;
+  bool reopening;
+  // GOPs of the video stream, kept from the first reverse playback so later
+  // ones start without indexing the file again
+  packet_index *index;
+} video_layer;
+
+// replaces the frame on screen, the previous one is kept if frame cannot be
+// mapped. Frames decoded in reverse are always uploaded through u.
+static void show_frame(video_layer *l, AVFrame *frame, frame_uploader *u) {
+  hw_texture tex;
+  bool ok = u ? frame_uploader_upload(u, frame, &tex)
+              : decode_context_map_texture(&l->clip->video, frame, &tex);
+  if (ok) {
+    decode_thread_free_texture(&l->tex);
+    l->tex = tex;
+  }
+}
+
+static bool video_layer_advance(video_layer *l, const playback_clock *clock,
+                                double speed) {
+  if (l->eof || speed <= 0.0) {
+    return true;
+  }
+
+  decode_context_set_speed(&l->clip->video, speed);
+  AVFrame *next_frame = av_frame_alloc();
+  if (!next_frame) {
+    log_error("unable to allocate frame");
+    return false;
+  }
+
+  bool ok = true;
+  double now;
+  while ((now = playback_clock_time(clock)) >= l->next_pts) {
+    decode_frame_result r = clip_decode_video_frame(
+        l->clip, next_frame,
+        &(decode_frame_info){
+            .packet_receive_info =
+                {
+                    .block = true,
+                    .num_messages = 1,
+                },
+            .lag = (now - l->next_pts) / speed,
+        });
+    if (r == DECODE_FRAME_RESULT_SUCCESS) {
+      l->next_pts =
+          clip_video_time(l->clip, next_frame->pts + next_frame->duration);
+      if (playback_clock_time(clock) < l->next_pts) {
+        show_frame(l, next_frame, NULL);
+        break;
+      }
+      decode_context_drop_late_frame(&l->clip->video);
+    } else if (r == DECODE_FRAME_RESULT_EOF) {
+      l->eof = true;
+      break;
+    } else if (r == DECODE_FRAME_RESULT_ERROR) {
+      ok = false;
+      break;
+    }
+    av_frame_unref(next_frame);
+  }
+
+  av_frame_free(&next_frame);
+  return ok;
+}
+
+static void video_layer_start_reverse(video_layer *l, double t) {
+  clip *c = l->clip;
+  AVRational tb =
+      c->fmt->streams[c->streams[CLIP_VIDEO_STREAM].index]->time_base;
+  l->opening_reverse = reverse_playback_open_start(
+      &l->reverse_opener,
+      &(reverse_playback_init_info){
+          .url = l->url,
+          .stream_index = c->streams[CLIP_VIDEO_STREAM].index,
+          .start_pts = llround(clip_media_time(c, t) / av_q2d(tb)),
+          .memory_budget = REVERSE_PLAYBACK_MEMORY_BUDGET_DEFAULT,
+          .index = l->index,
+      });
+  l->next_pts = t;
+}
 
+// keeps the index of the reverse playback that just opened
+static void video_layer_keep_index(video_layer *l) {
+  if (l->index || !(l->index = malloc(sizeof *l->index))) {
+    return;
+  }
+  if (!packet_index_copy(l->index, &l->reverse->index)) {
+    free(l->index);
+    l->index = NULL;
+  }
+}
+
+// reopens the clip at t in the background, forward decoding continues where
+// reverse playback stopped
+static void video_layer_start_reopen(video_layer *l,
+                                     const clip_open_info *open_info,
+                                     double t) {
+  clip_open_info info = *open_info;
+  info.url = l->url;
+  info.offset = l->clip->offset;
+  info.seek = fmax(t - l->clip->offset, 0.0);
+  l->reopening = clip_preroll_start(&l->reopen, &info);
+}
+
+static void video_layer_free_reverse(video_layer *l) {
+  reverse_playback_free(l->reverse);
+  free(l->reverse);
+  l->reverse = NULL;
+}
+
+// follows the sign of speed, opening decoders for the new direction off the
+// render thread. Returns false if the direction cannot change, *resumed is
+// set once the clip plays forward again.
+static bool video_layer_update_direction(video_layer *l,
+                                         const clip_open_info *open_info,
+                                         double t, double speed,
+                                         bool *resumed) {
+  *resumed = false;
+  if (l->opening_reverse) {
+    if (!reverse_playback_open_ready(&l->reverse_opener)) {
+      return true;
+    }
+
+    l->opening_reverse = false;
+    if (!(l->reverse = reverse_playback_open_finish(&l->reverse_opener))) {
+      return false;
+    }
+    video_layer_keep_index(l);
+  }
+
+  if (l->reopening) {
+    if (!clip_preroll_ready(&l->reopen)) {
+      return true;
+    }
+
+    l->reopening = false;
+    clip *c = clip_preroll_finish(&l->reopen);
+    if (!c) {
+      log_error("unable to reopen clip '%s'", l->url);
+      return false;
+    }
+
+    video_layer_free_reverse(l);
+    l->eof = false;
+    // textures imported by the clip's decoder go away with it
+    if (!l->tex.pool) {
+      decode_thread_free_texture(&l->tex);
+    }
+    clip_close(l->clip);
+    free(l->clip);
+    l->clip = c;
+    l->next_pts = t;
+    *resumed = true;
+    return true;
+  }
+
+  if (speed < 0.0 && !l->reverse) {
+    video_layer_start_reverse(l, t);
+    return l->opening_reverse;
+  } else if (speed > 0.0 && l->reverse) {
+    video_layer_start_reopen(l, open_info, t);
+    return l->reopening;
+  }
+
+  return true;
+}
+
+// shows the latest frame starting before the clock without waiting for the
+// reverse decoder, false on errors. Reaching the start of the clip sets eof.
+static bool video_layer_rewind(video_layer *l, frame_uploader *u,
+                               const playback_clock *clock) {
+  AVFrame *frame = av_frame_alloc();
+  if (!frame) {
+    log_error("unable to allocate frame");
+    return false;
+  }
+
+  AVRational tb = reverse_playback_time_base(l->reverse);
+  bool ok = true;
+  double now;
+  while ((now = playback_clock_time(clock)) < l->next_pts) {
+    decode_frame_result r = reverse_playback_next_frame(
+        l->reverse, frame,
+        &(mpmc_receive_info){
+            .block = false,
+            .num_messages = 1,
+        });
+    if (r == DECODE_FRAME_RESULT_TIMEOUT) {
+      // the frame on screen stays until the decoder catches up
+      break;
+    } else if (r == DECODE_FRAME_RESULT_EOF) {
+      l->eof = true;
+      break;
+    } else if (r == DECODE_FRAME_RESULT_ERROR) {
+      ok = false;
+      break;
+    }
+
+    l->next_pts =
+        l->clip->offset + frame->pts * av_q2d(tb) - l->clip->start_time;
+    if (now >= l->next_pts) {
+      show_frame(l, frame, u);
+      break;
+    }
+    av_frame_unref(frame);
+  }
+
+  av_frame_free(&frame);
+  return ok;
+}
+
+static void close_video_layer(video_layer *l) {
+  if (!l->clip) {
+    return;
+  }
+
+  if (l->opening_reverse) {
+    l->opening_reverse = false;
+    if ((l->reverse = reverse_playback_open_finish(&l->reverse_opener))) {
+      video_layer_free_reverse(l);
+    }
+  }
+  if (l->reopening) {
+    l->reopening = false;
+    clip *c = clip_preroll_finish(&l->reopen);
+    if (c) {
+      clip_close(c);
+      free(c);
+    }
+  }
+  if (l->reverse) {
+    video_layer_free_reverse(l);
+  }
+  if (l->index) {
+    packet_index_free(l->index);
+    free(l->index);
+    l->index = NULL;
+  }
+
+  const catchup_stats *stats = &l->clip->video.stats;
+  log_info("video frames dropped: %" PRIi64 " at demux, %" PRIi64
+           " before decode, %" PRIi64 " after decode",
+           stats->dropped_at_demux, stats->dropped_before_decode,
+           stats->dropped_after_decode);
+  decode_thread_free_texture(&l->tex);
+  clip_close(l->clip);
+  free(l->clip);
+  l->clip = NULL;
+}
+
+static bool start_clip_audio(audio_thread *a, clip *c, double t) {
+  if (!c->has_audio) {
+    // the previous clip must not keep playing underneath
+    audio_thread_set_source(a, NULL, 0.0);
+    return false;
+  }
+
+  decode_context dc = clip_take_audio(c);
+  if (!audio_thread_set_source(a, &dc, c->offset - c->start_time)) {
+    log_error("unable to start audio playback of clip");
+    return false;
+  }
+
+  // clips joined during a crossfade are already playing
+  return audio_thread_skip_to(a, clip_media_time(c, t));
+}
+
+// samplers and parameter block of the video programs, kept across reloads
+static void bind_program_inputs(shader_program *p) {
+  if (!p) {
+    return;
+  }
+
+  // the compositor binds the planes to units 0 to 2
+  static const char *samplers[] = {"y_plane", "chroma_plane", "cr_plane"};
+  for (i32 i = 0; i < (i32)(sizeof samplers / sizeof samplers[0]); ++i) {
+    shader_program_set_sampler(p, shader_program_uniform(p, samplers[i]), i);
+  }
+  shader_program_bind_block(p, "layer_params", COMPOSITOR_PARAMS_BINDING);
+}
+
+// variant of v converting each texture with its own colour properties,
+// compiled the first time a combination is drawn
+static shader_program *video_program(shader_variants *v,
+                                     const hw_texture **textures,
+                                     i32 num_textures) {
+  video_format formats[2];
+  assert(num_textures <= 2);
+  u64 key = HASH_FNV1A_INIT;
+  for (i32 i = 0; i < num_textures; ++i) {
+    const hw_texture *tex = textures[i];
+    if (!video_format_init(&formats[i], tex->pixfmt, tex->colorspace,
+                           tex->color_range, tex->color_trc, tex->height)) {
+      return NULL;
+    }
+    u64 format_key = video_format_key(&formats[i]);
+    key = hash_fnv1a(key, &format_key, sizeof format_key);
+  }
+
+  shader_program *p = shader_variants_find(v, key);
+  if (p) {
+    return p;
+  }
+
+  char defines[1024];
+  i32 length = 0;
+  for (i32 i = 0; i < num_textures; ++i) {
+    length += video_format_defines(&formats[i], i, &defines[length],
+                                   sizeof defines - length);
+  }
+  assert(length < ssizeof(defines));
+
+  log_info("compiling shader for %s%s%s",
+           av_get_pix_fmt_name(formats[0].pixfmt),
+           num_textures > 1 ? " and " : "",
+           num_textures > 1 ? av_get_pix_fmt_name(formats[1].pixfmt) : "");
+  p = shader_variants_add(v, key, defines);
+  bind_program_inputs(p);
+  return p;
+}
+
+// effects of every clip from CVED_EXPOSURE in stops, CVED_GLOW, the intensity
+// of glow, and CVED_VIGNETTE, the darkening at the corners. Unset effects are
+// left out, as is the glow when glow is NULL. Returns the number of effects
+// written to chain.
+static i32 clip_chain(chain_effect *chain, glow_effect *glow) {
+  i32 n = 0;
+  double exposure = env_double("CVED_EXPOSURE", 0.0);
+  if (exposure != 0.0) {
+    chain[n++] = (chain_effect){
+        .kind = CHAIN_EFFECT_EXPOSURE,
+        .params = {(GLfloat)exposure},
+    };
+  }
+  double glow_intensity = env_double("CVED_GLOW", 0.0);
+  if (glow_intensity != 0.0 && glow) {
+    glow->intensity = (GLfloat)glow_intensity;
+    chain[n++] = (chain_effect){
+        .kind = CHAIN_EFFECT_NEIGHBOURHOOD,
+        .neighbourhood = &glow->effect,
+    };
+  }
+  double vignette = env_double("CVED_VIGNETTE", 0.0);
+  if (vignette != 0.0) {
+    chain[n++] = (chain_effect){
+        .kind = CHAIN_EFFECT_VIGNETTE,
+        .params = {(GLfloat)vignette, VIGNETTE_RADIUS, VIGNETTE_SOFTNESS},
+    };
+  }
+  return n;
+}
+
+// compositor layers of the clips with a frame to show, the next clip faded in
+// over the current one while crossfading. Every layer runs effects. Returns
+// the number of layers.
+static i32 clip_layers(shader_variants *v, const video_layer *layers,
+                       const fused_chain *effects, double t, double crossfade,
+                       compositor_layer *out) {
+  bool crossfading = layers[0].tex.pixfmt != AV_PIX_FMT_NONE &&
+                     layers[1].tex.pixfmt != AV_PIX_FMT_NONE && crossfade > 0;
+  i32 n = 0;
+  for (i32 i = 0; i < 2; ++i) {
+    const hw_texture *tex = &layers[i].tex;
+    shader_program *p;
+    if (tex->pixfmt == AV_PIX_FMT_NONE || (i == 1 && n > 0 && !crossfading) ||
+        !(p = video_program(v, &tex, 1))) {
+      continue;
+    }
+
+    double opacity = 1.0;
+    if (i == 1 && crossfading) {
+      opacity = fmin(fmax((t - layers[1].clip->offset) / crossfade, 0.0), 1.0);
+    }
+    out[n++] = (compositor_layer){
+        .program = p,
+        .textures = tex->textures,
+        .num_textures = 3,
+        .transform = COMPOSITOR_IDENTITY,
+        .opacity = (GLfloat)opacity,
+        .blend = COMPOSITOR_BLEND_NORMAL,
+        .effects = effects->effects,
+        .num_effects = effects->num_effects,
+    };
+  }
+  return n;
+}
+
+// hands finished readbacks of width x height frames to the exporter, waiting
+// for the oldest one if wait is set. RGBA readbacks are bottom-up, the others
+// are planes packed by yuv_packer. False on errors.
+static bool export_readbacks(readback_ring *r, exporter *e,
+                             enum AVPixelFormat format, i32 width, i32 height,
+                             bool wait) {
+  while (r->num_pending > 0) {
+    struct timespec begin = get_now();
+    const u8 *data;
+    readback_result result = readback_ring_map(r, wait, &data);
+    if (result == READBACK_RESULT_PENDING) {
+      return true;
+    } else if (result == READBACK_RESULT_ERROR) {
+      return false;
+    }
+    wait = false;
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame) {
+      log_error("unable to allocate frame");
+      readback_ring_unmap(r);
+      return false;
+    }
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+      log_error("unable to allocate frame buffer");
+      av_frame_free(&frame);
+      readback_ring_unmap(r);
+      return false;
+    }
+
+    if (format == AV_PIX_FMT_RGBA) {
+      // GL rows are bottom-up
+      i32 row_size = width * 4;
+      for (i32 y = 0; y < height; ++y) {
+        memcpy(frame->data[0] + (i64)y * frame->linesize[0],
+               data + (i64)(height - 1 - y) * row_size, row_size);
+      }
+    } else {
+      u8 *planes[4];
+      int linesizes[4];
+      av_image_fill_arrays(planes, linesizes, data, format, width, height, 1);
+      av_image_copy(frame->data, frame->linesize, (const u8 **)planes,
+                    linesizes, format, width, height);
+    }
+    readback_ring_unmap(r);
+    exporter_record(e, EXPORT_STAGE_READBACK, seconds_since(begin));
+
+    if (!exporter_send_frame(e, frame)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// preview window with a current GLES 3.2 context, NULL on errors
+static GLFWwindow *open_preview_window(void) {
   if (!glfwInit()) {
     log_fatal("unable to initialize GLFW");
     goto fail_glfw;
@@ -271,6 +923,90 @@ int main() {
     goto fail_glad;
   }
 
+  glfwSwapInterval(1);
+  return w;
+
+fail_glad:
+  glfwDestroyWindow(w);
+fail_window:
+  glfwTerminate();
+fail_glfw:
+  return NULL;
+}
+
+// w is NULL when rendering headless
+static void close_gl_context(GLFWwindow *w, egl_headless *egl) {
+  if (w) {
+    glfwDestroyWindow(w);
+    glfwTerminate();
+  } else {
+    egl_headless_free(egl);
+  }
+}
+
+int main(int argc, char **argv) {
+  init_logging();
+  av_log_set_callback(av_log_callback);
+  av_log_set_level(AV_LOG_DEBUG);
+
+  // --render-audio <out.wav> mixes the playlist to a file without a window
+  // or audio device
+  const char *render_audio_path = NULL;
+  if (argc > 2 && strcmp(argv[1], "--render-audio") == 0) {
+    render_audio_path = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+  // --headless plays the playlist into an offscreen framebuffer as fast as it
+  // renders, without a window or audio device. --export <path> also encodes
+  // the frames and the mixed audio to a file.
+  bool headless = false;
+  const char *export_path = NULL;
+  if (argc > 2 && strcmp(argv[1], "--export") == 0) {
+    export_path = argv[2];
+    headless = true;
+    argc -= 2;
+    argv += 2;
+  } else if (argc > 1 && strcmp(argv[1], "--headless") == 0) {
+    headless = true;
+    --argc;
+    ++argv;
+  }
+
+  const char *default_url = "/home/torani/Downloads/[ASW] Tearmoon Teikoku "
+                            "Monogatari - 12 [1080p HEVC][C6FC48AF].mkv";
+  /* "/home/torani/Videos/ortensia3.mkv", */
+  /* "/home/torani/OSU IS DYING #osu #osugame #gaming #fyp " */
+  /* "[7158923633832824107].mp4", */
+  const char **urls = argc > 1 ? (const char **)&argv[1] : &default_url;
+  i32 num_urls = argc > 1 ? argc - 1 : 1;
+  double crossfade = env_double("CVED_CROSSFADE", CROSSFADE_DEFAULT);
+
+  if (render_audio_path) {
+    return offline_render_playlist(
+               urls, num_urls,
+               &(offline_render_info){
+                   .path = render_audio_path,
+                   .sample_rate = render_sample_rate(),
+                   .crossfade = crossfade,
+                   .source_loudness = getenv("CVED_ANALYZE_AUDIO") != NULL,
+               })
+               ? 0
+               : 1;
+  }
+
+  pcm_cache audio_cache;
+  pcm_cache_entry *audio_cache_entries =
+      open_pcm_caches(&audio_cache, urls, num_urls);
+  waveform_job *waveform_jobs = start_waveform_jobs(urls, num_urls);
+
+  GLFWwindow *w = NULL;
+  egl_headless egl;
+  if (headless ? !egl_headless_init(&egl) : !(w = open_preview_window())) {
+    log_fatal("unable to create OpenGL ES context");
+    goto fail_context;
+  }
+
   init_gl_logging();
   lua = luaL_newstate();
   if (!lua) {
@@ -285,96 +1021,219 @@ int main() {
   lua_setglobal(lua, "setDrawCallback");
   luaL_dofile(lua, "test.lua");
 
-  AVFormatContext *f;
-  avformat_open_input(
-      &f,
-      "/home/torani/Downloads/[ASW] Tearmoon Teikoku "
-      "Monogatari - 12 [1080p HEVC][C6FC48AF].mkv",
-      /* "/home/torani/Videos/ortensia3.mkv", */
-      /* "/home/torani/OSU IS DYING #osu #osugame #gaming #fyp " */
-      /* "[7158923633832824107].mp4", */
-      NULL, NULL);
-  avformat_find_stream_info(f, NULL);
-  read_thread_handle rt;
-  i32 streams[] = {READ_THREAD_STREAM_INDEX_AUTO_VIDEO,
-                   READ_THREAD_STREAM_INDEX_AUTO_AUDIO};
-  i32 num_streams = sizeof(streams) / sizeof(streams[0]);
-  stream_info stream_infos[sizeof(streams) / sizeof(streams[0])];
-  if (!read_thread_init(&rt,
-                        &(read_thread_init_info){
-                            .format_context = f,
-                            .num_streams = num_streams,
-                            .stream_indices = streams,
-                            .num_buffered_packets = NULL,
-                        },
-                        stream_infos)) {
-    log_error("unable to start read thread");
-  }
-
-  decode_context video, audio;
-  if (!decode_context_init(&video, &(decode_thread_init_info){
-                                       .fmt = f,
-                                       .rt = &rt,
-                                       .si = stream_infos[0],
-                                       .hwaccel = true,
-                                   })) {
-    log_error("unable to create video decoding context");
-  }
-  if (!decode_context_init(&audio, &(decode_thread_init_info){
-                                       .fmt = f,
-                                       .rt = &rt,
-                                       .si = stream_infos[1],
-                                   })) {
-    log_error("unable to create audio decoding context");
+  texture_pool textures;
+  texture_pool_init(&textures);
+  frame_uploader uploader;
+  if (!frame_uploader_init(&uploader, &textures,
+                           frame_upload_size(AV_PIX_FMT_YUV420P,
+                                             UPLOAD_MAX_WIDTH,
+                                             UPLOAD_MAX_HEIGHT),
+                           FRAME_UPLOAD_NUM_DECODE_SLOTS_DEFAULT)) {
+    log_fatal("unable to create frame uploader");
+    goto fail_uploader;
   }
 
-  glfwSwapInterval(1);
+  render_target target;
+  if (headless) {
+    if (!render_target_init(&target, GL_RGBA8,
+                            (i32)env_double("CVED_HEADLESS_WIDTH",
+                                            HEADLESS_WIDTH_DEFAULT),
+                            (i32)env_double("CVED_HEADLESS_HEIGHT",
+                                            HEADLESS_HEIGHT_DEFAULT))) {
+      log_fatal("unable to create headless render target");
+      goto fail_target;
+    }
+    render_target_bind(&target);
+  }
+
+  clip_open_info open_info = {
+      .hwaccel = env_double("CVED_HWACCEL", 1.0) != 0.0,
+      .uploader = &uploader,
+      // headless rendering waits for every frame
+      .catchup = headless ? NULL
+                          : &(catchup_policy){
+                                .drop_nonref_lag = 0.1,
+                                .skip_to_keyframe_lag = 1.0,
+                            },
+  };
+  double preroll_lookahead =
+      env_double("CVED_PREROLL_LOOKAHEAD", PREROLL_LOOKAHEAD_DEFAULT);
+
+  i32 next_url = 1;
+
+  // layers[0] is the current clip, layers[1] the next one once pre-rolled
+  video_layer layers[2];
+  for (i32 i = 0; i < 2; ++i) {
+    layers[i] = (video_layer){.clip = NULL};
+    layers[i].tex.pixfmt = AV_PIX_FMT_NONE;
+  }
+
+  open_info.url = urls[0];
+  open_info.offset = 0.0;
+  layers[0].url = urls[0];
+  if (!(layers[0].clip = malloc(sizeof *layers[0].clip)) ||
+      !clip_open(layers[0].clip, &open_info)) {
+    log_fatal("unable to open clip '%s'", urls[0]);
+    free(layers[0].clip);
+    goto fail_clip;
+  }
+  layers[0].next_pts = layers[0].clip->offset;
+
+  clip_preroll preroll;
+  bool prerolling = false;
 
   GLuint vao;
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
 
   shader_manager sm;
-  if (!shader_manager_init(&sm, "shaders")) {
-    log_error("unable to initialize shader manager");
+  const char *shader_cache_dir = getenv("CVED_SHADER_CACHE_DIR");
+  if (!shader_manager_init(&sm, "shaders",
+                           shader_cache_dir ? shader_cache_dir
+                                            : SHADER_CACHE_DIR_DEFAULT)) {
+    log_fatal("unable to initialize shader manager");
+    goto fail_shader_manager;
   }
 
-  shader_program *p = shader_create_vf(&sm, "test.vs.glsl", "test.fs.glsl");
-  if (!p) {
-    log_error("unable to create shader program");
+  shader_variants video_variants;
+  if (!shader_variants_init_vf(&video_variants, &sm, "layer.vs.glsl",
+                               "layer.fs.glsl")) {
+    log_fatal("unable to create video shader variants");
+    goto fail_variants;
+  }
+  compositor comp;
+  bool has_compositor = compositor_init(&comp, &sm);
+  if (!has_compositor) {
+    log_error("unable to create compositor, drawing nothing");
+  }
+  // compiled once, the chain's parameters are read by the passes every frame
+  effect_fuser fuser;
+  bool has_fuser = has_compositor && effect_fuser_init(&fuser, &sm);
+  blur_library blur;
+  bool has_blur = has_compositor && blur_library_init(&blur, &sm);
+  glow_effect glow;
+  if (has_blur) {
+    glow_effect_init(&glow, &blur, GLOW_LEVELS, 0.0f);
+  }
+  chain_effect chain[CLIP_MAX_EFFECTS];
+  i32 chain_length = clip_chain(chain, has_blur ? &glow : NULL);
+  fused_chain clip_effects = {.num_effects = 0};
+  if (chain_length > 0 &&
+      !(has_fuser &&
+        effect_fuser_compile(&fuser, chain, chain_length, &clip_effects))) {
+    log_error("unable to compile clip effects, drawing clips as is");
+    clip_effects = (fused_chain){.num_effects = 0};
   }
 
-  ALCdevice *al_device = alcOpenDevice(NULL);
-  ALCcontext *al = alcCreateContext(al_device, NULL);
-  alcMakeContextCurrent(al);
-
-  ALuint buffers[4], source;
-  i32 num_buffers = sizeof(buffers) / sizeof(buffers[0]);
-  alGenBuffers(num_buffers, buffers);
-  alGenSources(1, &source);
+  ALCdevice *al_device = NULL;
+  ALCcontext *al = NULL;
+  audio_thread audio;
+  bool has_audio = false;
+  if (!headless) {
+    al_device = alcOpenDevice(NULL);
+    al = alcCreateContext(al_device, NULL);
+    alcMakeContextCurrent(al);
 
-  audio_playback_context apc;
-  audio_playback_context_init(&apc, audio);
-  i32 samples_per_buffer = apc.frame_size * audio.cc->sample_rate / 60;
-  for (i32 i = 0; i < num_buffers; ++i) {
-    ALuint buffer = buffers[i];
-    audio_playback_context_fill_buffer(&apc, buffer, samples_per_buffer);
-    alSourceQueueBuffers(source, 1, &buffer);
+    // later clips are resampled to the format of the first one
+    audio_output_format audio_out;
+    audio_output_format_init(&audio_out, layers[0].clip->has_audio
+                                             ? layers[0].clip->audio.cc
+                                             : NULL);
+    has_audio = audio_thread_init(&audio, &audio_out);
+    if (!has_audio) {
+      log_error("unable to start audio thread, playing without audio");
+    } else {
+      start_clip_audio(&audio, layers[0].clip, 0.0);
+    }
   }
 
+  playback_clock clock;
+  // exact, so NTSC rates are not rounded on the way to the encoder
+  AVRational frame_rate = {HEADLESS_FRAME_RATE_DEFAULT, 1};
+  double frame_step = 0.0;
+  if (headless) {
+    const clip *c = layers[0].clip;
+    AVStream *vs = c->fmt->streams[c->streams[CLIP_VIDEO_STREAM].index];
+    AVRational rate =
+        vs->avg_frame_rate.num ? vs->avg_frame_rate : vs->r_frame_rate;
+    if (rate.num > 0 && rate.den > 0) {
+      frame_rate = rate;
+    }
+    frame_step = av_q2d(av_inv_q(frame_rate));
+    playback_clock_init_stepped(&clock, 0.0, 1.0);
+  } else {
+    playback_clock_init(&clock, 0.0, 1.0);
+  }
+  bool quit = false;
+  exporter exporter;
+  readback_ring readback;
+  // converts frames to the encoder's format before they are read back
+  yuv_packer packer;
+  enum AVPixelFormat export_format = AV_PIX_FMT_RGBA;
+  bool exporting = false;
+  bool export_ok = true;
+  if (export_path) {
+    const char *video_codec = getenv("CVED_EXPORT_VIDEO_CODEC");
+    const char *audio_codec = getenv("CVED_EXPORT_AUDIO_CODEC");
+    exporting = exporter_init(
+            &exporter,
+            &(export_info){
+                .path = export_path,
+                .width = target.width,
+                .height = target.height,
+                .frame_rate = frame_rate,
+                .video_codec =
+                    video_codec ? video_codec : EXPORT_VIDEO_CODEC_DEFAULT,
+                .audio_codec =
+                    audio_codec ? audio_codec : EXPORT_AUDIO_CODEC_DEFAULT,
+                .urls = urls,
+                .num_urls = num_urls,
+                .crossfade = crossfade,
+                .sample_rate = render_sample_rate(),
+            });
+    if (exporting) {
+      enum AVPixelFormat format = exporter_pixel_format(&exporter);
+      if (yuv_packer_supports(format, target.width, target.height) &&
+          yuv_packer_init(&packer, &sm, format, target.width,
+                          target.height)) {
+        export_format = format;
+        log_info("converting frames to %s before readback",
+                 av_get_pix_fmt_name(format));
+      } else {
+        log_info("reading back RGBA frames, the exporter converts them");
+      }
+      const render_target *read =
+          export_format == AV_PIX_FMT_RGBA ? &target : &packer.target;
+      if (!readback_ring_init(&readback, EXPORT_READBACK_SLOTS, read->width,
+                              read->height)) {
+        if (export_format != AV_PIX_FMT_RGBA) {
+          yuv_packer_free(&packer);
+        }
+        exporter_finish(&exporter);
+        exporting = false;
+      }
+    }
+    if (!exporting) {
+      log_fatal("unable to export to '%s'", export_path);
+      export_ok = false;
+      quit = true;
+    }
+  }
 
-  i32 p_local_counter = -1;
-  hw_texture cur_frame;
-  cur_frame.pixfmt = AV_PIX_FMT_NONE;
+  double max_av_offset = 0.0;
   struct timespec start = get_now();
-  struct timespec next_pts = get_now();
-  alSourcePlay(source);
-  while (!glfwWindowShouldClose(w)) {
-    glfwPollEvents();
+  struct timespec last_frame = start;
+  i64 num_frames = 0;
+  // the window's default framebuffer, resized with the window
+  render_target window_target = {.framebuffer = 0, .texture = 0};
+  while (!quit && !(w && glfwWindowShouldClose(w))) {
+    struct timespec frame_begin = get_now();
+    if (w) {
+      glfwPollEvents();
 
-    i32 width, height;
-    glfwGetFramebufferSize(w, &width, &height);
-    glViewport(0, 0, width, height);
+      glfwGetFramebufferSize(w, &window_target.width, &window_target.height);
+      glViewport(0, 0, window_target.width, window_target.height);
+    }
 
     if (callback_ref_init) {
       lua_rawgeti(lua, LUA_REGISTRYINDEX, callback_ref);
@@ -388,97 +1247,234 @@ int main() {
       log_error("error while updating shaders");
     }
 
-    AVFrame *next_frame = av_frame_alloc();
-    while (timespec_ge(get_now(), next_pts)) {
-      decode_frame_result r = decode_context_decode_frame(
-          &video, next_frame,
-          &(decode_frame_info){.packet_receive_info = {
-                                   .block = true,
-                                   .num_messages = 1,
-                               }});
-      if (r == DECODE_FRAME_RESULT_SUCCESS) {
-        i64 frame_end_pts = next_frame->pts + next_frame->duration;
-        AVRational tb = f->streams[video.si.index]->time_base;
-        next_pts = timespec_add(
-            start, timespec_from_double(frame_end_pts * av_q2d(tb)));
-        if (timespec_lt(get_now(), next_pts)) {
-          decode_context_map_texture(&video, next_frame, &cur_frame);
-          break;
+    double speed = shuttle_paused ? 0.0 : shuttle_speed;
+    if (speed != clock.speed) {
+      log_info("playback speed: %.0fx", speed);
+      playback_clock_set_speed(&clock, speed);
+      // audio stays silent while playing backwards
+      if (has_audio) {
+        if (speed > 0.0 && !audio_thread_set_speed(&audio, speed)) {
+          log_warn("unable to change audio playback speed");
         }
-      } else if (r == DECODE_FRAME_RESULT_EOF) {
-        glfwSetWindowShouldClose(w, true);
-        break;
-      } else if (r == DECODE_FRAME_RESULT_ERROR) {
+        audio_thread_set_paused(&audio, speed <= 0.0);
+      }
+    }
+
+    // video follows the audio being heard whenever there is audible audio
+    double audio_t;
+    if (has_audio && audio_thread_clock_time(&audio, &audio_t)) {
+      double offset = playback_clock_sync(&clock, audio_t);
+      log_trace("A/V offset: %.2fms", offset * 1e3);
+      max_av_offset = fmax(max_av_offset, fabs(offset));
+    }
+    double t = playback_clock_time(&clock);
+    clip *cur = layers[0].clip;
+    // only muted audio follows the clock
+    if (has_audio && speed > AUDIO_PLAYBACK_MAX_TEMPO) {
+      audio_thread_drop_until(&audio, clip_media_time(cur, t));
+    }
+
+    // open the next clip ahead of the cut, so the switch does not stall
+    if (!prerolling && !layers[1].clip && next_url < num_urls &&
+        (layers[0].eof ||
+         t >= clip_end(cur) - crossfade - preroll_lookahead)) {
+      open_info.url = urls[next_url];
+      open_info.offset = fmax(clip_end(cur) - crossfade, t);
+      if (!(prerolling = clip_preroll_start(&preroll, &open_info))) {
+        log_error("unable to pre-roll clip '%s'", urls[next_url]);
+        ++next_url;
+      }
+    }
+    // headless rendering waits for the clip rather than moving past the cut
+    if (prerolling && (headless || clip_preroll_ready(&preroll))) {
+      prerolling = false;
+      if (!(layers[1].clip = clip_preroll_finish(&preroll))) {
+        log_error("unable to open clip '%s', skipping it", urls[next_url]);
+      } else {
+        layers[1].url = urls[next_url];
+        layers[1].next_pts = layers[1].clip->offset;
+        layers[1].eof = false;
+      }
+      ++next_url;
+    }
+
+    frame_uploader_reclaim(&uploader);
+    bool resumed;
+    if (!video_layer_update_direction(&layers[0], &open_info, t, speed,
+                                      &resumed)) {
+      log_error("unable to change playback direction");
+      shuttle_speed = 1.0;
+      shuttle_paused = true;
+    } else if (resumed && has_audio) {
+      start_clip_audio(&audio, layers[0].clip, t);
+    }
+
+    if (layers[0].reverse) {
+      // the reverse frame is held while the clip reopens
+      if (speed < 0.0 && !video_layer_rewind(&layers[0], &uploader, &clock)) {
         log_fatal("unable to decode frame");
-        glfwSetWindowShouldClose(w, true);
-        break;
+        quit = true;
+      } else if (layers[0].eof) {
+        // hold the first frame rather than switching clips
+        layers[0].eof = false;
+        shuttle_paused = true;
+      }
+    } else {
+      for (i32 i = 0; i < 2; ++i) {
+        if (layers[i].clip &&
+            !video_layer_advance(&layers[i], &clock, speed)) {
+          log_fatal("unable to decode frame");
+          quit = true;
+        }
       }
-      av_frame_unref(next_frame);
     }
-    av_frame_free(&next_frame);
 
-    // render
-    i32 p_counter;
-    if (cur_frame.pixfmt != AV_PIX_FMT_NONE &&
-        (p_counter = shader_program_use(p))) {
-      if (p_counter != p_local_counter) {
-        for (i32 i = 0; i < p->num_uniforms; ++i) {
-          if (strcmp(p->uniforms[i].name, "y_plane") == 0) {
-            glUniform1i(p->uniforms[i].location, 0);
-          } else if (strcmp(p->uniforms[i].name, "chroma_plane") == 0) {
-            glUniform1i(p->uniforms[i].location, 1);
-          }
+    if (layers[0].eof || (layers[1].clip && t >= clip_end(cur))) {
+      if (layers[1].clip) {
+        log_info("switching to clip %d", next_url - 1);
+        // the audio decoder reads from the old clip, release it first
+        if (has_audio) {
+          start_clip_audio(&audio, layers[1].clip, t);
         }
-        p_local_counter = p_counter;
+        close_video_layer(&layers[0]);
+        layers[0] = layers[1];
+        layers[1] = (video_layer){.clip = NULL};
+        layers[1].tex.pixfmt = AV_PIX_FMT_NONE;
+      } else if (!prerolling && next_url >= num_urls) {
+        quit = true;
       }
+    }
 
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, cur_frame.textures[0]);
-      glActiveTexture(GL_TEXTURE1);
-      glBindTexture(GL_TEXTURE_2D, cur_frame.textures[1]);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    }
-    glfwSwapBuffers(w);
-
-    ALint num_processed;
-    alGetSourcei(source, AL_BUFFERS_PROCESSED, &num_processed);
-    for (i32 i = 0; i < num_processed; ++i) {
-      ALuint buffer;
-      alSourceUnqueueBuffers(source, 1, &buffer);
-      if (audio_playback_context_fill_buffer(&apc, buffer, samples_per_buffer) <
-          0) {
-        break;
+    // render
+    compositor_layer frame_layers[2];
+    i32 num_frame_layers = clip_layers(&video_variants, layers, &clip_effects,
+                                       t, crossfade, frame_layers);
+    if (has_compositor &&
+        !compositor_draw(&comp, frame_layers, num_frame_layers,
+                         w ? &window_target : &target)) {
+      log_error("unable to composite frame");
+    }
+    if (exporting) {
+      exporter_record(&exporter, EXPORT_STAGE_RENDER,
+                      seconds_since(frame_begin));
+      // a slot has to be free before the frame can be read back
+      if (!export_readbacks(&readback, &exporter, export_format,
+                            target.width, target.height,
+                            readback.num_pending == readback.num_slots)) {
+        log_fatal("unable to export frame");
+        export_ok = false;
+        quit = true;
+      } else if (export_format != AV_PIX_FMT_RGBA) {
+        yuv_packer_run(&packer, target.texture);
+        readback_ring_start(&readback);
+        render_target_bind(&target);
+      } else {
+        readback_ring_start(&readback);
       }
-      alSourceQueueBuffers(source, 1, &buffer);
     }
+
+    if (w) {
+      glfwSwapBuffers(w);
+    } else {
+      playback_clock_step(&clock, frame_step);
+    }
+    ++num_frames;
+
+    struct timespec now = get_now();
+    double frame_time = timespec_to_double(timespec_sub(now, last_frame));
+    last_frame = now;
+    log_trace("frame time: %.2fms", frame_time * 1e3);
+    if (w && frame_time > FRAME_TIME_HITCH) {
+      log_warn("frame took %.2fms", frame_time * 1e3);
+    }
+  }
+
+  double elapsed = seconds_since(start);
+  log_info("rendered %" PRIi64 " frames in %.2fs (%.1f fps)", num_frames,
+           elapsed, (double)num_frames / elapsed);
+  if (exporting) {
+    while (export_ok && readback.num_pending > 0) {
+      export_ok = export_readbacks(&readback, &exporter, export_format,
+                                   target.width, target.height, true);
+    }
+    readback_ring_free(&readback);
+    if (export_format != AV_PIX_FMT_RGBA) {
+      yuv_packer_free(&packer);
+    }
+    export_ok = exporter_finish(&exporter) && export_ok;
   }
 
-  alDeleteBuffers(num_buffers, buffers);
-  alDeleteSources(1, &source);
-  alcMakeContextCurrent(NULL);
-  alcDestroyContext(al);
-  alcCloseDevice(al_device);
-  audio_playback_context_free(&apc);
+  if (prerolling) {
+    clip *c = clip_preroll_finish(&preroll);
+    if (c) {
+      clip_close(c);
+      free(c);
+    }
+  }
 
-  decode_thread_free_texture(&cur_frame);
-  shader_manager_free(&sm);
+  if (has_audio) {
+    audio_thread_stats stats;
+    audio_thread_get_stats(&audio, &stats);
+    log_info("audio: %d underruns, %d ring underflows, %d buffers queued",
+             stats.num_underruns, stats.num_ring_underflows,
+             stats.num_buffers);
+    log_info("A/V sync: %.2fms max offset, %.2fms drift, %" PRIi64
+             " samples compensated",
+             max_av_offset * 1e3, stats.drift * 1e3,
+             stats.num_compensated_samples);
+    audio_thread_free(&audio);
+  }
+  if (!headless) {
+    alcMakeContextCurrent(NULL);
+    alcDestroyContext(al);
+    alcCloseDevice(al_device);
+  }
 
-  decode_context_free(&video);
-  read_thread_free(&rt);
-  stream_info_free(stream_infos, num_streams);
-  avformat_close_input(&f);
+  for (i32 i = 0; i < 2; ++i) {
+    close_video_layer(&layers[i]);
+  }
+  frame_uploader_free(&uploader);
+  if (headless) {
+    render_target_free(&target);
+  }
+  texture_pool_free(&textures);
+  fused_chain_free(&clip_effects);
+  if (has_blur) {
+    blur_library_free(&blur);
+  }
+  if (has_fuser) {
+    effect_fuser_free(&fuser);
+  }
+  if (has_compositor) {
+    compositor_free(&comp);
+  }
+  shader_variants_free(&video_variants);
+  shader_manager_free(&sm);
 
   lua_close(lua);
-  glfwDestroyWindow(w);
-  glfwTerminate();
+  close_gl_context(w, &egl);
+  close_pcm_caches(&audio_cache, audio_cache_entries, num_urls);
+  free_waveform_jobs(waveform_jobs, num_urls);
 
-  return EXIT_SUCCESS;
+  return export_ok ? EXIT_SUCCESS : EXIT_FAILURE;
 
+fail_variants:
+  shader_manager_free(&sm);
+fail_shader_manager:
+  close_video_layer(&layers[0]);
+fail_clip:
+  if (headless) {
+    render_target_free(&target);
+  }
+fail_target:
+  frame_uploader_free(&uploader);
+fail_uploader:
+  texture_pool_free(&textures);
+  lua_close(lua);
 fail_lua:
-fail_glad:
-  glfwDestroyWindow(w);
-fail_window:
-  glfwTerminate();
-fail_glfw:
+  close_gl_context(w, &egl);
+fail_context:
+  close_pcm_caches(&audio_cache, audio_cache_entries, num_urls);
+  free_waveform_jobs(waveform_jobs, num_urls);
   return EXIT_FAILURE;
 }
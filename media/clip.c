@@ -0,0 +1,274 @@
+#include "clip.h"
+#include "../utils/threading_utils.h"
+#include <libavutil/error.h>
+#include <log.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double stream_start_time(const AVStream *s) {
+  return s->start_time != AV_NOPTS_VALUE ? s->start_time * av_q2d(s->time_base)
+                                         : 0.0;
+}
+
+static bool clip_open_audio(clip *c, const clip_open_info *info) {
+  c->preroll_frame = NULL;
+  if (c->streams[CLIP_AUDIO_STREAM].index < 0) {
+    log_error("clip '%s' has no audio stream", info->url);
+    goto fail_audio;
+  }
+
+  if (!(c->has_audio = decode_context_init(
+            &c->audio, &(decode_thread_init_info){
+                           .fmt = c->fmt,
+                           .rt = &c->rt,
+                           .si = c->streams[CLIP_AUDIO_STREAM],
+                       }))) {
+    log_error("unable to create audio decoding context");
+    goto fail_audio;
+  }
+
+  AVStream *as = c->fmt->streams[c->streams[CLIP_AUDIO_STREAM].index];
+  c->start_time = stream_start_time(as);
+  c->duration = c->fmt->duration != AV_NOPTS_VALUE
+                    ? c->fmt->duration / (double)AV_TIME_BASE
+                    : as->duration * av_q2d(as->time_base);
+  return true;
+
+fail_audio:
+  read_thread_free(&c->rt);
+  stream_info_free(c->streams, CLIP_NUM_STREAMS);
+  avformat_close_input(&c->fmt);
+  return false;
+}
+
+bool clip_open(clip *c, const clip_open_info *info) {
+  c->fmt = NULL;
+  c->offset = info->offset;
+  c->has_audio = false;
+  c->audio_taken = false;
+
+  i32 error;
+  if ((error = avformat_open_input(&c->fmt, info->url, NULL, NULL)) < 0) {
+    log_error("unable to open clip '%s': %s", info->url, av_err2str(error));
+    goto fail_open_input;
+  }
+
+  if ((error = avformat_find_stream_info(c->fmt, NULL)) < 0) {
+    log_error("unable to find stream info of clip '%s': %s", info->url,
+              av_err2str(error));
+    goto fail_stream_info;
+  }
+
+  // the read thread demuxes from wherever the file is when it starts
+  if (info->seek > 0.0) {
+    i64 ts = llround(info->seek * AV_TIME_BASE);
+    if (c->fmt->start_time != AV_NOPTS_VALUE) {
+      ts += c->fmt->start_time;
+    }
+    if ((error = avformat_seek_file(c->fmt, -1, INT64_MIN, ts, ts, 0)) < 0) {
+      log_warn("unable to seek clip '%s' to %.3fs, reading from the start: %s",
+               info->url, info->seek, av_err2str(error));
+    }
+  }
+
+  i32 stream_indices[CLIP_NUM_STREAMS] = {
+      [CLIP_VIDEO_STREAM] = READ_THREAD_STREAM_INDEX_AUTO_VIDEO,
+      [CLIP_AUDIO_STREAM] = READ_THREAD_STREAM_INDEX_AUTO_AUDIO,
+  };
+  // video packets are discarded by the read thread if it does not know the
+  // stream
+  i32 first_stream = info->audio_only ? CLIP_AUDIO_STREAM : 0;
+  c->streams[CLIP_VIDEO_STREAM].index = -1;
+  if (!read_thread_init(&c->rt,
+                        &(read_thread_init_info){
+                            .format_context = c->fmt,
+                            .num_streams = CLIP_NUM_STREAMS - first_stream,
+                            .stream_indices = &stream_indices[first_stream],
+                            .num_buffered_packets = NULL,
+                        },
+                        &c->streams[first_stream])) {
+    log_error("unable to start read thread");
+    goto fail_read_thread;
+  }
+
+  if (info->audio_only) {
+    return clip_open_audio(c, info);
+  }
+
+  if (c->streams[CLIP_VIDEO_STREAM].index < 0) {
+    log_error("clip '%s' has no video stream", info->url);
+    goto fail_video;
+  }
+
+  if (!decode_context_init(&c->video,
+                           &(decode_thread_init_info){
+                               .fmt = c->fmt,
+                               .rt = &c->rt,
+                               .si = c->streams[CLIP_VIDEO_STREAM],
+                               .hwaccel = info->hwaccel,
+                               .uploader = info->uploader,
+                               .catchup = info->catchup,
+                           })) {
+    log_error("unable to create video decoding context");
+    goto fail_video;
+  }
+
+  if (c->streams[CLIP_AUDIO_STREAM].index >= 0) {
+    if (!(c->has_audio = decode_context_init(
+              &c->audio, &(decode_thread_init_info){
+                             .fmt = c->fmt,
+                             .rt = &c->rt,
+                             .si = c->streams[CLIP_AUDIO_STREAM],
+                         }))) {
+      log_warn("unable to create audio decoding context, clip is silent");
+    }
+  }
+
+  AVStream *vs = c->fmt->streams[c->streams[CLIP_VIDEO_STREAM].index];
+  c->start_time = stream_start_time(vs);
+  c->duration = c->fmt->duration != AV_NOPTS_VALUE
+                    ? c->fmt->duration / (double)AV_TIME_BASE
+                    : vs->duration * av_q2d(vs->time_base);
+
+  if (!(c->preroll_frame = av_frame_alloc())) {
+    log_error("unable to allocate pre-roll frame");
+    goto fail_alloc_frame;
+  }
+
+  // frames before the seek target are only decoded as references
+  double target = c->start_time + info->seek;
+  do {
+    av_frame_unref(c->preroll_frame);
+    if (decode_context_decode_frame(&c->video, c->preroll_frame,
+                                    &(decode_frame_info){
+                                        .packet_receive_info =
+                                            {
+                                                .block = true,
+                                                .num_messages = 1,
+                                            },
+                                    }) != DECODE_FRAME_RESULT_SUCCESS) {
+      log_error("unable to decode first frame of clip '%s'", info->url);
+      goto fail_preroll;
+    }
+  } while (info->seek > 0.0 && c->preroll_frame->pts != AV_NOPTS_VALUE &&
+           (c->preroll_frame->pts + c->preroll_frame->duration) *
+                   av_q2d(vs->time_base) <=
+               target);
+
+  return true;
+
+fail_preroll:
+  av_frame_free(&c->preroll_frame);
+fail_alloc_frame:
+  if (c->has_audio) {
+    decode_context_free(&c->audio);
+  }
+  decode_context_free(&c->video);
+fail_video:
+  read_thread_free(&c->rt);
+  stream_info_free(c->streams, CLIP_NUM_STREAMS);
+fail_read_thread:
+fail_stream_info:
+  avformat_close_input(&c->fmt);
+fail_open_input:
+  return false;
+}
+
+void clip_close(clip *c) {
+  av_frame_free(&c->preroll_frame);
+  if (c->has_audio && !c->audio_taken) {
+    decode_context_free(&c->audio);
+  }
+  if (c->streams[CLIP_VIDEO_STREAM].index >= 0) {
+    decode_context_free(&c->video);
+  }
+  read_thread_free(&c->rt);
+  stream_info_free(c->streams, CLIP_NUM_STREAMS);
+  avformat_close_input(&c->fmt);
+}
+
+decode_frame_result clip_decode_video_frame(clip *c, AVFrame *frame,
+                                            decode_frame_info *info) {
+  if (c->preroll_frame && c->preroll_frame->buf[0]) {
+    av_frame_move_ref(frame, c->preroll_frame);
+    return DECODE_FRAME_RESULT_SUCCESS;
+  }
+
+  return decode_context_decode_frame(&c->video, frame, info);
+}
+
+decode_context clip_take_audio(clip *c) {
+  c->audio_taken = true;
+  return c->audio;
+}
+
+double clip_video_time(const clip *c, i64 pts) {
+  AVRational tb = c->fmt->streams[c->streams[CLIP_VIDEO_STREAM].index]->time_base;
+  return c->offset + pts * av_q2d(tb) - c->start_time;
+}
+
+double clip_media_time(const clip *c, double time) {
+  return time - c->offset + c->start_time;
+}
+
+double clip_end(const clip *c) { return c->offset + c->duration; }
+
+static int preroll_thread_callback(void *arg) {
+  clip_preroll *p = arg;
+  p->success = clip_open(p->clip, &p->info);
+  atomic_store(&p->done, true);
+  return p->success ? 0 : 1;
+}
+
+bool clip_preroll_start(clip_preroll *p, const clip_open_info *info) {
+  p->info = *info;
+  atomic_init(&p->done, false);
+  p->success = false;
+  if (!(p->url = strdup(info->url))) {
+    log_error("unable to copy clip URL");
+    goto fail_strdup;
+  }
+  p->info.url = p->url;
+
+  if (!(p->clip = malloc(sizeof *p->clip))) {
+    log_error("unable to allocate clip");
+    goto fail_alloc_clip;
+  }
+
+  i32 error;
+  if ((error = thrd_create(&p->thread, preroll_thread_callback, p)) !=
+      thrd_success) {
+    log_error("unable to start pre-roll thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  return true;
+
+fail_thread:
+  free(p->clip);
+fail_alloc_clip:
+  free(p->url);
+fail_strdup:
+  return false;
+}
+
+bool clip_preroll_ready(clip_preroll *p) { return atomic_load(&p->done); }
+
+clip *clip_preroll_finish(clip_preroll *p) {
+  i32 error;
+  if ((error = thrd_join(p->thread, NULL)) != thrd_success) {
+    log_error("unable to join pre-roll thread: %s",
+              thrd_error_to_string(error));
+  }
+
+  clip *c = p->clip;
+  free(p->url);
+  if (!p->success) {
+    free(c);
+    return NULL;
+  }
+
+  return c;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../utils/types.h"
+#include "decode_thread.h"
+#include "read_thread.h"
+#include <libavformat/avformat.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#define CLIP_VIDEO_STREAM 0
+#define CLIP_AUDIO_STREAM 1
+#define CLIP_NUM_STREAMS 2
+
+// a media file placed on the timeline, with its demuxer and decoders
+typedef struct {
+  AVFormatContext *fmt;
+  read_thread_handle rt;
+  stream_info streams[CLIP_NUM_STREAMS];
+  decode_context video;
+  decode_context audio;
+  bool has_audio;
+  // the audio decoder is freed by its new owner (audio_playback_context)
+  bool audio_taken;
+  // first video frame, decoded while pre-rolling
+  AVFrame *preroll_frame;
+
+  // timeline position of the start of the clip, in seconds
+  double offset;
+  double duration;
+  // presentation time of the first frame in the file, in seconds
+  double start_time;
+} clip;
+
+typedef struct {
+  const char *url;
+  double offset;
+  bool hwaccel;
+  struct frame_uploader *uploader;
+  const catchup_policy *catchup;
+  // only demux and decode audio, there is no video decoder or pre-roll frame
+  bool audio_only;
+  // time after the start of the file (in seconds) playback starts at. Audio
+  // starts at a packet at or before it, the pre-roll frame is the one shown
+  // at that time.
+  double seek;
+} clip_open_info;
+
+// opens and probes the file, starts decoding and decodes the first video frame
+bool clip_open(clip *c, const clip_open_info *info);
+void clip_close(clip *c);
+decode_frame_result clip_decode_video_frame(clip *c, AVFrame *frame,
+                                            decode_frame_info *info);
+decode_context clip_take_audio(clip *c);
+// timeline time (in seconds) of a timestamp of the video stream
+double clip_video_time(const clip *c, i64 pts);
+// timeline time to time within the file, both in seconds
+double clip_media_time(const clip *c, double time);
+double clip_end(const clip *c);
+
+// opens a clip on a background thread, so the next clip is ready before the
+// cut
+typedef struct {
+  thrd_t thread;
+  clip_open_info info;
+  char *url;
+  clip *clip;
+  atomic_bool done;
+  bool success;
+} clip_preroll;
+
+bool clip_preroll_start(clip_preroll *p, const clip_open_info *info);
+bool clip_preroll_ready(clip_preroll *p);
+// waits for the pre-roll to finish, NULL if the clip could not be opened
+clip *clip_preroll_finish(clip_preroll *p);
@@ -1,5 +1,8 @@
 #include "decode_thread.h"
+#include "../graphics/texture_pool.h"
 #include "../utils/mpmc.h"
+#include "../utils/time_utils.h"
+#include "frame_upload.h"
 #include "read_thread.h"
 #include <assert.h>
 #include <glad/egl.h>
@@ -15,8 +18,15 @@
 #include <libavutil/pixdesc.h>
 #include <libdrm/drm_fourcc.h>
 #include <log.h>
+#include <string.h>
 #include <threads.h>
-#include <unistd.h>
+
+// surfaces allocated beyond what the decoder needs, one per layer showing a
+// frame plus headroom for frames waiting to be shown or for the GPU
+#define DECODE_EXTRA_HW_FRAMES 4
+// longest wait (in ns) for the GPU to finish with retired frames when the
+// decoder is freed
+#define RETIRED_FRAME_WAIT_TIMEOUT ((GLuint64)1e9)
 
 typedef struct {
   AVFormatContext *fmt;
@@ -89,81 +99,117 @@ fail_create_hwctx:
   return false;
 }
 
-static bool init_nv12_texture(i32 w, i32 h, const AVDRMFrameDescriptor *drm,
-                              hw_texture *tex) {
-  memset(tex, 0, sizeof *tex);
-  for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
-    tex->vaapi_fds[i] = -1;
+static void free_import(vaapi_import *import) {
+  for (i32 i = 0; i < 2; ++i) {
+    if (import->textures[i]) {
+      glDeleteTextures(1, &import->textures[i]);
+    }
+    if (import->images[i] != EGL_NO_IMAGE_KHR) {
+      eglDestroyImageKHR(eglGetCurrentDisplay(), import->images[i]);
+    }
   }
-  i32 i = 0;
-  for (i32 pl = 0; pl < drm->nb_layers; ++pl) {
-    for (i32 pp = 0; pp < drm->layers[pl].nb_planes; ++pp) {
-      if (i >= 2) {
-        log_error("invalid format");
-        goto fail;
-      }
-      i32 layer_w = w / (i + 1);
-      i32 layer_h = h / (i + 1);
-      const AVDRMPlaneDescriptor *plane = &drm->layers[pl].planes[pp];
-      // clang-format off
-      EGLint attr[] = {
-         EGL_LINUX_DRM_FOURCC_EXT, drm->layers[pl].format, 
-         EGL_WIDTH, layer_w,
-         EGL_HEIGHT, layer_h,
-         EGL_DMA_BUF_PLANE0_FD_EXT, drm->objects[plane->object_index].fd,
-         EGL_DMA_BUF_PLANE0_OFFSET_EXT, plane->offset,
-         EGL_DMA_BUF_PLANE0_PITCH_EXT, plane->pitch,
-         EGL_NONE
-      };
-      // clang-format on
+}
 
-      tex->images[i] = eglCreateImageKHR(eglGetCurrentDisplay(), EGL_NO_CONTEXT,
-                                         EGL_LINUX_DMA_BUF_EXT, NULL, attr);
-      if (!tex->images[i]) {
-        goto fail;
-      }
+static void free_imports(decode_context *d) {
+  for (i32 i = 0; i < d->num_imports; ++i) {
+    free_import(&d->imports[i]);
+  }
+  d->num_imports = 0;
+}
 
-      glGenTextures(1, &tex->textures[i]);
-      if (tex->textures[i] == 0) {
-        goto fail;
-      }
+static void free_stale_imports(decode_context *d) {
+  for (i32 i = 0; i < d->num_stale_imports; ++i) {
+    free_import(&d->stale_imports[i]);
+  }
+  d->num_stale_imports = 0;
+}
 
-      glBindTexture(GL_TEXTURE_2D, tex->textures[i]);
-      glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, tex->images[i]);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      ++i;
+// the textures of the frame on screen may belong to the old frames context,
+// so its imports are kept until every texture handed out is reclaimed
+static void switch_imports(decode_context *d, const void *frames) {
+  i32 num_stale = d->num_stale_imports + d->num_imports;
+  if (num_stale > d->stale_imports_capacity) {
+    vaapi_import *stale =
+        realloc(d->stale_imports, num_stale * sizeof *stale);
+    if (!stale) {
+      log_error("unable to keep surface imports, waiting for the GPU");
+      glFinish();
+      free_imports(d);
+      goto done;
     }
+    d->stale_imports = stale;
+    d->stale_imports_capacity = num_stale;
   }
 
-  return true;
-fail:
-  for (i32 i = 0; i < 2; ++i) {
-    if (tex->textures[i]) {
-      glDeleteTextures(1, &tex->textures[i]);
-    }
-    if (tex->images[i]) {
-      eglDestroyImageKHR(eglGetCurrentDisplay(), &tex->images[i]);
-    }
+  memcpy(&d->stale_imports[d->num_stale_imports], d->imports,
+         d->num_imports * sizeof *d->imports);
+  d->num_stale_imports = num_stale;
+  d->num_imports = 0;
+
+done:
+  d->num_stale_import_refs += d->num_import_refs;
+  d->num_import_refs = 0;
+  ++d->import_generation;
+  d->imports_frames = frames;
+  if (d->num_stale_import_refs == 0) {
+    free_stale_imports(d);
   }
-  for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
-    int fd = tex->vaapi_fds[i];
-    if (fd >= 0) {
-      close(fd);
+}
+
+static void release_import_ref(decode_context *d, u32 generation) {
+  if (generation == d->import_generation) {
+    --d->num_import_refs;
+  } else if (--d->num_stale_import_refs == 0) {
+    free_stale_imports(d);
+  }
+}
+
+// frees retired frames the GPU is done with, or all of them if wait is set
+static void reclaim_retired(decode_context *d, bool wait) {
+  for (i32 i = 0; i < d->num_retired;) {
+    retired_frame *r = &d->retired[i];
+    GLenum status =
+        glClientWaitSync(r->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                         wait ? RETIRED_FRAME_WAIT_TIMEOUT : 0);
+    if (!wait && status != GL_ALREADY_SIGNALED &&
+        status != GL_CONDITION_SATISFIED) {
+      ++i;
+      continue;
     }
+
+    glDeleteSync(r->fence);
+    av_frame_free(&r->frame);
+    release_import_ref(d, r->import_generation);
+    d->retired[i] = d->retired[--d->num_retired];
   }
-  return false;
 }
 
-static bool init_p010_texture(i32 w, i32 h, const AVDRMFrameDescriptor *drm,
-                              hw_texture *tex) {
-  memset(tex, 0, sizeof *tex);
-  for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
-    tex->vaapi_fds[i] = -1;
+static void retire_frame(decode_context *d, AVFrame *frame, u32 generation) {
+  if (d->num_retired == d->retired_capacity) {
+    i32 capacity = d->retired_capacity ? d->retired_capacity * 2 : 8;
+    retired_frame *retired = realloc(d->retired, capacity * sizeof *retired);
+    if (!retired) {
+      log_error("unable to retire frame, waiting for the GPU");
+      glFinish();
+      av_frame_free(&frame);
+      release_import_ref(d, generation);
+      return;
+    }
+    d->retired = retired;
+    d->retired_capacity = capacity;
   }
-  EGLint egl_fmts[] = {DRM_FORMAT_R16, DRM_FORMAT_GR1616};
+
+  d->retired[d->num_retired++] = (retired_frame){
+      .frame = frame,
+      .fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+      .import_generation = generation,
+  };
+}
+
+// imports the luma and chroma planes of a mapped surface. fourccs replaces the
+// formats the layers were exported with, NULL keeps them.
+static bool import_planes(i32 w, i32 h, const AVDRMFrameDescriptor *drm,
+                          const u32 *fourccs, vaapi_import *import) {
   i32 i = 0;
   for (i32 pl = 0; pl < drm->nb_layers; ++pl) {
     for (i32 pp = 0; pp < drm->layers[pl].nb_planes; ++pp) {
@@ -176,7 +222,8 @@ static bool init_p010_texture(i32 w, i32 h, const AVDRMFrameDescriptor *drm,
       const AVDRMPlaneDescriptor *plane = &drm->layers[pl].planes[pp];
       // clang-format off
       EGLint attr[] = {
-         EGL_LINUX_DRM_FOURCC_EXT, egl_fmts[i], 
+         EGL_LINUX_DRM_FOURCC_EXT,
+         fourccs ? (EGLint)fourccs[i] : (EGLint)drm->layers[pl].format,
          EGL_WIDTH, layer_w,
          EGL_HEIGHT, layer_h,
          EGL_DMA_BUF_PLANE0_FD_EXT, drm->objects[plane->object_index].fd,
@@ -186,19 +233,25 @@ static bool init_p010_texture(i32 w, i32 h, const AVDRMFrameDescriptor *drm,
       };
       // clang-format on
 
-      tex->images[i] = eglCreateImageKHR(eglGetCurrentDisplay(), EGL_NO_CONTEXT,
-                                         EGL_LINUX_DMA_BUF_EXT, NULL, attr);
-      if (!tex->images[i]) {
+      import->images[i] =
+          eglCreateImageKHR(eglGetCurrentDisplay(), EGL_NO_CONTEXT,
+                            EGL_LINUX_DMA_BUF_EXT, NULL, attr);
+      if (import->images[i] == EGL_NO_IMAGE_KHR) {
         goto fail;
       }
 
-      glGenTextures(1, &tex->textures[i]);
-      if (tex->textures[i] == 0) {
+      glGenTextures(1, &import->textures[i]);
+      if (import->textures[i] == 0) {
         goto fail;
       }
 
-      glBindTexture(GL_TEXTURE_2D, tex->textures[i]);
-      glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, tex->images[i]);
+      glBindTexture(GL_TEXTURE_2D, import->textures[i]);
+      if (GLAD_GL_EXT_EGL_image_storage) {
+        // immutable, the driver skips completeness checks when sampling
+        glEGLImageTargetTexStorageEXT(GL_TEXTURE_2D, import->images[i], NULL);
+      } else {
+        glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, import->images[i]);
+      }
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -207,39 +260,118 @@ static bool init_p010_texture(i32 w, i32 h, const AVDRMFrameDescriptor *drm,
     }
   }
 
+  if (i != 2) {
+    log_error("invalid format");
+    goto fail;
+  }
+
   return true;
 fail:
-  for (i32 i = 0; i < 2; ++i) {
-    if (tex->textures[i]) {
-      glDeleteTextures(1, &tex->textures[i]);
-    }
-    if (tex->images[i]) {
-      eglDestroyImageKHR(eglGetCurrentDisplay(), &tex->images[i]);
+  free_import(import);
+  return false;
+}
+
+// textures of the surface frame was decoded into, imported on first use
+static const vaapi_import *import_surface(decode_context *d,
+                                          const AVFrame *frame,
+                                          enum AVPixelFormat sw_format) {
+  if (frame->hw_frames_ctx->data != d->imports_frames) {
+    switch_imports(d, frame->hw_frames_ctx->data);
+  }
+
+  uintptr_t surface = (uintptr_t)frame->data[3];
+  for (i32 i = 0; i < d->num_imports; ++i) {
+    if (d->imports[i].surface == surface) {
+      return &d->imports[i];
     }
   }
-  for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
-    int fd = tex->vaapi_fds[i];
-    if (fd >= 0) {
-      close(fd);
+
+  if (d->num_imports == d->imports_capacity) {
+    i32 capacity = d->imports_capacity ? d->imports_capacity * 2 : 16;
+    vaapi_import *imports = realloc(d->imports, capacity * sizeof *imports);
+    if (!imports) {
+      log_error("unable to grow surface imports");
+      goto fail_grow;
     }
+    d->imports = imports;
+    d->imports_capacity = capacity;
   }
-  return false;
+
+  static const u32 p010_fourccs[] = {DRM_FORMAT_R16, DRM_FORMAT_GR1616};
+  const u32 *fourccs;
+  switch (sw_format) {
+  case AV_PIX_FMT_NV12:
+    fourccs = NULL;
+    break;
+  case AV_PIX_FMT_P010:
+  case AV_PIX_FMT_P016:
+    fourccs = p010_fourccs;
+    break;
+  default:
+    log_error("unsupported surface format %s", av_get_pix_fmt_name(sw_format));
+    goto fail_format;
+  }
+
+  AVFrame *drm_frame = av_frame_alloc();
+  if (!drm_frame) {
+    log_error("unable to allocate HWFrame");
+    goto fail_hwframe_alloc;
+  }
+  drm_frame->format = AV_PIX_FMT_DRM_PRIME;
+  i32 error;
+  if ((error = av_hwframe_map(drm_frame, frame,
+                              AV_HWFRAME_MAP_READ | AV_HWFRAME_MAP_DIRECT)) <
+      0) {
+    log_error("unable to map HWFrame: %s", av_err2str(error));
+    goto fail_map_hwframe;
+  }
+
+  vaapi_import *import = &d->imports[d->num_imports];
+  *import = (vaapi_import){
+      .surface = surface,
+      .textures = {0, 0},
+      .images = {EGL_NO_IMAGE_KHR, EGL_NO_IMAGE_KHR},
+  };
+  if (!import_planes(frame->width, frame->height,
+                     (const AVDRMFrameDescriptor *)drm_frame->data[0], fourccs,
+                     import)) {
+    log_error("unable to create %s textures", av_get_pix_fmt_name(sw_format));
+    goto fail_import;
+  }
+  // the images hold their own references to the buffers, unmapping closes
+  // the exported file descriptors
+  av_frame_free(&drm_frame);
+  ++d->num_imports;
+
+  return import;
+
+fail_import:
+fail_map_hwframe:
+  av_frame_free(&drm_frame);
+fail_hwframe_alloc:
+fail_format:
+fail_grow:
+  return NULL;
 }
 
 void decode_thread_free_texture(hw_texture *texture) {
   if (texture->pixfmt == AV_PIX_FMT_NONE) {
     return;
   }
-  for (i32 i = 0; i < 2; ++i) {
-    glDeleteTextures(1, &texture->textures[i]);
-    eglDestroyImageKHR(eglGetCurrentDisplay(), &texture->images[i]);
-  }
-  for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
-    int fd = texture->vaapi_fds[i];
-    if (fd >= 0) {
-      close(fd);
+  // imported textures belong to the decode context
+  if (texture->pool) {
+    for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
+      if (texture->textures[i]) {
+        texture_pool_release(texture->pool, texture->textures[i]);
+      }
     }
   }
+  if (texture->owner) {
+    retire_frame(texture->owner, texture->frame, texture->import_generation);
+    texture->frame = NULL;
+    texture->owner = NULL;
+  }
+  av_frame_free(&texture->frame);
 
   texture->pixfmt = AV_PIX_FMT_NONE;
 }
@@ -250,8 +382,31 @@ bool decode_context_init(decode_context *d, decode_thread_init_info *info) {
   d->si = info->si;
   d->preprocess_callback = info->preprocess_frame;
   d->userdata = info->userdata;
+  d->catchup = info->catchup ? *info->catchup : CATCHUP_POLICY_DISABLED;
+  d->stats = (catchup_stats){0};
+  d->skipping_to_keyframe = false;
+  d->speed = 1.0;
+  d->decode_time = 0.0;
+  d->thinning = AVDISCARD_DEFAULT;
+  d->uploader = info->uploader;
+  d->hw.type = AV_HWDEVICE_TYPE_NONE;
+  d->imports_frames = NULL;
+  d->imports = NULL;
+  d->num_imports = 0;
+  d->imports_capacity = 0;
+  d->stale_imports = NULL;
+  d->num_stale_imports = 0;
+  d->stale_imports_capacity = 0;
+  d->import_generation = 0;
+  d->num_import_refs = 0;
+  d->num_stale_import_refs = 0;
+  d->retired = NULL;
+  d->num_retired = 0;
+  d->retired_capacity = 0;
 
   AVStream *s = d->fmt->streams[d->si.index];
+  d->frame_rate = av_q2d(s->avg_frame_rate.num ? s->avg_frame_rate
+                                               : s->r_frame_rate);
   const AVCodec *codec = avcodec_find_decoder(s->codecpar->codec_id);
   if (!codec) {
     log_error("unable to find decoder for codec id: %s",
@@ -298,12 +453,22 @@ bool decode_context_init(decode_context *d, decode_thread_init_info *info) {
     switch (d->hw.type) {
     case AV_HWDEVICE_TYPE_VAAPI:
       d->cc->pix_fmt = AV_PIX_FMT_VAAPI;
+      // surfaces held by shown frames, the decoder stalls without spares
+      d->cc->extra_hw_frames = DECODE_EXTRA_HW_FRAMES;
       break;
     default:
       break;
     }
-  } else {
-    d->hw.type = AV_HWDEVICE_TYPE_NONE;
+  }
+
+  // software decoding, frames are uploaded from the CPU
+  if (d->hw.type == AV_HWDEVICE_TYPE_NONE &&
+      codec->type == AVMEDIA_TYPE_VIDEO) {
+    d->cc->thread_count = 0;
+    d->cc->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (d->uploader) {
+      frame_uploader_attach(d->uploader, d->cc);
+    }
   }
 
   if ((error = avcodec_open2(d->cc, codec, &info->dec_ctx_open_dict)) < 0) {
@@ -323,10 +488,57 @@ fail_codec:
 }
 
 void decode_context_free(decode_context *d) {
+  // imports are only made on the rendering thread, which has a context
+  reclaim_retired(d, true);
+  if (d->num_import_refs + d->num_stale_import_refs > 0) {
+    log_warn("%d imported textures still in use",
+             d->num_import_refs + d->num_stale_import_refs);
+  }
+  free_imports(d);
+  free_stale_imports(d);
+  free(d->imports);
+  free(d->stale_imports);
+  free(d->retired);
   avcodec_close(d->cc);
   avcodec_free_context(&d->cc);
 }
 
+void decode_context_drop_late_frame(decode_context *d) {
+  ++d->stats.dropped_after_decode;
+}
+
+// fraction of the decode budget used at the given speed above which frames are
+// thinned out
+#define THINNING_NONREF_LOAD 0.8
+#define THINNING_NONKEY_LOAD 2.0
+
+void decode_context_set_speed(decode_context *d, double speed) {
+  d->speed = speed;
+
+  // seconds of decoding needed per second of wall-clock time if every frame
+  // is decoded
+  double load = speed * d->frame_rate * d->decode_time;
+  enum AVDiscard thinning = AVDISCARD_DEFAULT;
+  if (speed > 1.0 && load > THINNING_NONKEY_LOAD) {
+    thinning = AVDISCARD_NONKEY;
+  } else if (speed > 1.0 && load > THINNING_NONREF_LOAD) {
+    thinning = AVDISCARD_NONREF;
+  }
+
+  if (thinning == d->thinning) {
+    return;
+  }
+
+  log_debug("decode thinning changed from %d to %d (speed: %.1fx, load: %.2f)",
+            d->thinning, thinning, speed, load);
+  bool keyframes_only = thinning == AVDISCARD_NONKEY;
+  if (keyframes_only != (d->thinning == AVDISCARD_NONKEY) &&
+      !read_thread_cmd_keyframes_only(d->rt, d->si.index, keyframes_only)) {
+    log_warn("unable to issue keyframes only command to read thread");
+  }
+  d->thinning = thinning;
+}
+
 #define DECODE_FRAME_RESULT_EAGAIN DECODE_FRAME_RESULT_TIMEOUT
 static decode_frame_result receive_frame(AVCodecContext *cc, AVFrame *frame) {
   i32 error = avcodec_receive_frame(cc, frame);
@@ -342,18 +554,74 @@ static decode_frame_result receive_frame(AVCodecContext *cc, AVFrame *frame) {
   return DECODE_FRAME_RESULT_ERROR;
 }
 
+static void update_catchup(decode_context *d, double lag) {
+  enum AVDiscard skip =
+      lag > d->catchup.drop_nonref_lag ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  if (skip < d->thinning) {
+    skip = d->thinning;
+  }
+  if (d->cc->skip_frame != skip) {
+    log_debug("decoder skipping frames changed from %d to %d (lag: %.3fs)",
+              d->cc->skip_frame, skip, lag);
+    d->cc->skip_frame = skip;
+  }
+
+  if (!d->skipping_to_keyframe && lag > d->catchup.skip_to_keyframe_lag) {
+    log_debug("skipping to next keyframe (lag: %.3fs)", lag);
+    if (!read_thread_cmd_skip_to_keyframe(d->rt, d->si.index)) {
+      log_warn("unable to issue skip to keyframe command to read thread");
+      return;
+    }
+    d->skipping_to_keyframe = true;
+  }
+}
+
+// packets the decoder would not need to produce the next presentable frame
+static bool should_drop_packet(decode_context *d, const packet_msg *msg) {
+  if (d->skipping_to_keyframe) {
+    // wait for the keyframe the read thread skipped to, packets queued before
+    // the command was handled are dropped as well
+    return !msg->resync;
+  }
+
+  if (d->cc->skip_frame >= AVDISCARD_NONKEY) {
+    return !(msg->pkt->flags & AV_PKT_FLAG_KEY);
+  }
+
+  return d->cc->skip_frame >= AVDISCARD_NONREF &&
+         (msg->pkt->flags & AV_PKT_FLAG_DISPOSABLE);
+}
+
+// busy accumulates the time spent in the decoder, waits for packets excluded
 static decode_frame_result send_packet(decode_context *d,
-                                       decode_frame_info *info) {
+                                       decode_frame_info *info, double *busy) {
   packet_msg msg;
-  receive_packet_result result = read_thread_receive_packet(
-      d->rt, &d->si, &msg, &info->packet_receive_info);
-  switch (result) {
-  case RECEIVE_PACKET_RESULT_TIMEOUT:
-    return DECODE_FRAME_RESULT_TIMEOUT;
-  case RECEIVE_PACKET_RESULT_ERROR:
-    return DECODE_FRAME_RESULT_ERROR;
-  case RECEIVE_PACKET_RESULT_SUCCESS:
-    break;
+  while (true) {
+    receive_packet_result result = read_thread_receive_packet(
+        d->rt, &d->si, &msg, &info->packet_receive_info);
+    switch (result) {
+    case RECEIVE_PACKET_RESULT_TIMEOUT:
+      return DECODE_FRAME_RESULT_TIMEOUT;
+    case RECEIVE_PACKET_RESULT_ERROR:
+      return DECODE_FRAME_RESULT_ERROR;
+    case RECEIVE_PACKET_RESULT_SUCCESS:
+      break;
+    }
+
+    d->stats.dropped_at_demux += msg.num_dropped;
+    if (msg.tag != PACKET_MSG_TAG_PACKET || !should_drop_packet(d, &msg)) {
+      break;
+    }
+
+    av_packet_free(&msg.pkt);
+    ++d->stats.dropped_before_decode;
+  }
+
+  if (d->skipping_to_keyframe) {
+    // references of the resync keyframe are gone, so frames still buffered in
+    // the decoder are useless
+    d->skipping_to_keyframe = false;
+    avcodec_flush_buffers(d->cc);
   }
 
   switch (msg.tag) {
@@ -367,7 +635,9 @@ static decode_frame_result send_packet(decode_context *d,
     break;
   }
 
+  struct timespec begin = get_now();
   i32 error = avcodec_send_packet(d->cc, msg.pkt);
+  *busy += seconds_since(begin);
   assert(error != AVERROR(EAGAIN) && "not logically possible");
   if (error == AVERROR_EOF) {
     return DECODE_FRAME_RESULT_EOF;
@@ -383,57 +653,75 @@ static decode_frame_result send_packet(decode_context *d,
 decode_frame_result decode_context_decode_frame(decode_context *d,
                                                 AVFrame *frame,
                                                 decode_frame_info *info) {
+  // once per frame: the lag is not updated while packets are sent, a resync
+  // is only consumed after it and would otherwise be issued again
+  update_catchup(d, info->lag);
+  double busy = 0.0;
   decode_frame_result result;
-  while ((result = receive_frame(d->cc, frame)) == DECODE_FRAME_RESULT_EAGAIN) {
-    if ((result = send_packet(d, info)) != DECODE_FRAME_RESULT_SUCCESS) {
+  while (true) {
+    struct timespec begin = get_now();
+    result = receive_frame(d->cc, frame);
+    busy += seconds_since(begin);
+    if (result != DECODE_FRAME_RESULT_EAGAIN ||
+        (result = send_packet(d, info, &busy)) !=
+            DECODE_FRAME_RESULT_SUCCESS) {
       break;
     }
   }
 
+  // only full decoding is representative of the cost of every frame
+  if (result == DECODE_FRAME_RESULT_SUCCESS &&
+      d->cc->skip_frame == AVDISCARD_DEFAULT) {
+    d->decode_time =
+        d->decode_time > 0.0 ? 0.9 * d->decode_time + 0.1 * busy : busy;
+  }
+
   return result;
 }
 bool decode_context_map_texture(decode_context *d, AVFrame *frame,
                                 hw_texture *tex) {
+  if (!frame->hw_frames_ctx) {
+    if (!d->uploader) {
+      log_error("no uploader for software decoded frames");
+      return false;
+    }
+    return frame_uploader_upload(d->uploader, frame, tex);
+  }
+
   switch (d->hw.type) {
   case AV_HWDEVICE_TYPE_VAAPI: {
-    AVFrame *hw_frame = av_frame_alloc();
-    if (!hw_frame) {
-      log_error("unable to allocate HWFrame");
-      goto fail_hwframe_alloc;
+    reclaim_retired(d, false);
+    enum AVPixelFormat sw_format =
+        ((AVHWFramesContext *)frame->hw_frames_ctx->data)->sw_format;
+    const vaapi_import *import = import_surface(d, frame, sw_format);
+    if (!import) {
+      return false;
     }
-    hw_frame->format = AV_PIX_FMT_DRM_PRIME;
-    i32 error;
-    if ((error =
-             av_hwframe_map(hw_frame, frame,
-                            AV_HWFRAME_MAP_READ | AV_HWFRAME_MAP_DIRECT) < 0)) {
-      log_error("unable to map HWFrame");
-      goto fail_map_hwframe;
-    }
-    const AVDRMFrameDescriptor *drm =
-        (const AVDRMFrameDescriptor *)hw_frame->data[0];
-    if (!init_nv12_texture(frame->width, frame->height, drm, tex)) {
-      log_error("unable to create NV12 textures");
-      goto fail_init_tex;
+
+    AVFrame *ref = av_frame_clone(frame);
+    if (!ref) {
+      log_error("unable to reference frame");
+      return false;
     }
-    tex->pixfmt = ((AVHWFramesContext *)d->cc->hw_frames_ctx->data)->sw_format;
+
+    memset(tex, 0, sizeof *tex);
+    tex->pixfmt = sw_format;
+    tex->textures[0] = import->textures[0];
+    tex->textures[1] = import->textures[1];
     tex->width = frame->width;
     tex->height = frame->height;
-    for (i32 i = 0; i < AV_DRM_MAX_PLANES; ++i) {
-      tex->vaapi_fds[i] = i < drm->nb_objects ? drm->objects[i].fd : -1;
-    }
-    av_frame_free(&hw_frame);
-
+    tex->colorspace = frame->colorspace;
+    tex->color_range = frame->color_range;
+    tex->color_trc = frame->color_trc;
+    tex->frame = ref;
+    tex->pool = NULL;
+    tex->owner = d;
+    tex->import_generation = d->import_generation;
+    ++d->num_import_refs;
     return true;
-  fail_init_tex:
-  fail_map_hwframe:
-  fail_hwframe_alloc:
-    av_frame_free(&hw_frame);
-    return false;
   }
   default:
     log_error("unsupported HWDevice API");
     return false;
   }
-
-  (void)init_p010_texture;
 }
@@ -8,6 +8,7 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/hwcontext_drm.h>
+#include <math.h>
 #include <stdlib.h>
 #include <threads.h>
 #include <time.h>
@@ -16,7 +17,44 @@ typedef struct {
   enum AVHWDeviceType type;
 } hwdevice_context;
 
+// lag thresholds (in seconds) of the late-frame catch-up policy
 typedef struct {
+  // let the decoder skip non-reference frames and drop disposable packets
+  // before they are sent to the decoder
+  double drop_nonref_lag;
+  // drop every packet until the next keyframe, both in the read thread and
+  // in the decoder
+  double skip_to_keyframe_lag;
+} catchup_policy;
+
+#define CATCHUP_POLICY_DISABLED                                                \
+  ((catchup_policy){.drop_nonref_lag = INFINITY,                               \
+                    .skip_to_keyframe_lag = INFINITY})
+
+typedef struct {
+  i64 dropped_at_demux;
+  i64 dropped_before_decode;
+  i64 dropped_after_decode;
+} catchup_stats;
+
+// textures of a VAAPI surface, imported once and reused whenever the decoder
+// hands the surface out again
+typedef struct {
+  // VASurfaceID
+  uintptr_t surface;
+  GLuint textures[2];
+  EGLImageKHR images[2];
+} vaapi_import;
+
+// an imported frame that is no longer shown, its surface goes back to the
+// decoder once the GPU is done reading it
+typedef struct {
+  AVFrame *frame;
+  GLsync fence;
+  u32 import_generation;
+} retired_frame;
+
+typedef struct decode_context {
   AVFormatContext *fmt;
   AVCodecContext *cc;
   hwdevice_context hw;
@@ -25,11 +63,46 @@ typedef struct {
   bool (*preprocess_callback)(AVFrame **, AVSubtitle *, void *);
   void *userdata;
 
+  catchup_policy catchup;
+  catchup_stats stats;
+  bool skipping_to_keyframe;
+
+  // shuttle playback
+  double speed;
+  double frame_rate;
+  // moving average of the wall-clock time spent per decoded frame
+  double decode_time;
+  enum AVDiscard thinning;
+  // uploads software decoded frames, NULL if they cannot be mapped
+  struct frame_uploader *uploader;
+  // surfaces are only stable within one frames context, imports are replaced
+  // when the decoder switches to another
+  const void *imports_frames;
+  vaapi_import *imports;
+  i32 num_imports;
+  i32 imports_capacity;
+  // imports of earlier frames contexts, freed once every texture handed out
+  // before the switch is reclaimed
+  vaapi_import *stale_imports;
+  i32 num_stale_imports;
+  i32 stale_imports_capacity;
+  // bumped on every switch of frames context
+  u32 import_generation;
+  // imported textures handed out and not yet reclaimed, of the current and of
+  // earlier frames contexts
+  i32 num_import_refs;
+  i32 num_stale_import_refs;
+  retired_frame *retired;
+  i32 num_retired;
+  i32 retired_capacity;
+
   AVFrame *frame;
 } decode_context;
 
 typedef struct {
   mpmc_receive_info packet_receive_info;
+  // how far (in seconds) presentation is behind, <= 0 if on time
+  double lag;
 } decode_frame_info;
 
 typedef struct {
@@ -41,6 +114,11 @@ typedef struct {
   bool (*preprocess_frame)(AVFrame **, AVSubtitle *, void *);
   void *userdata;
   bool hwaccel;
+  // decodes into the uploader's buffer when not hardware accelerated, NULL if
+  // frames are not mapped to textures
+  struct frame_uploader *uploader;
+  // NULL -> CATCHUP_POLICY_DISABLED
+  const catchup_policy *catchup;
 } decode_thread_init_info;
 
 typedef enum {
@@ -61,9 +139,18 @@ typedef struct {
 typedef struct {
   enum AVPixelFormat pixfmt;
   GLuint textures[AV_DRM_MAX_PLANES];
-  EGLImageKHR images[AV_DRM_MAX_PLANES];
-  int vaapi_fds[AV_DRM_MAX_PLANES];
   i32 width, height;
+  enum AVColorSpace colorspace;
+  enum AVColorRange color_range;
+  enum AVColorTransferCharacteristic color_trc;
+  // reference keeping an imported surface from being decoded into while it
+  // is shown, NULL for uploaded frames
+  AVFrame *frame;
+  // owns the textures of uploaded frames, NULL for imported ones
+  struct texture_pool *pool;
+  // decoder the textures were imported by, NULL for uploaded frames
+  struct decode_context *owner;
+  u32 import_generation;
 } hw_texture;
 
 typedef enum {
@@ -75,9 +162,17 @@ typedef enum {
 
 bool decode_context_init(decode_context *d, decode_thread_init_info *info);
 void decode_context_free(decode_context *d);
+// count a decoded frame that was thrown away because it was too late
+void decode_context_drop_late_frame(decode_context *d);
+// playback speed multiplier, frames are thinned out when decoding every frame
+// does not fit the measured decode budget
+void decode_context_set_speed(decode_context *d, double speed);
 decode_frame_result decode_context_decode_frame(decode_context *d,
                                                 AVFrame *frame,
                                                 decode_frame_info *info);
+// imported textures are owned by d and stay valid until they are freed, even
+// when the decoder switches frames context. They must be freed before d.
 bool decode_context_map_texture(decode_context *d, AVFrame *frame,
                                 hw_texture *tex);
+// imported surfaces return to their decoder once the GPU is done with them
 void decode_thread_free_texture(hw_texture *texture);
@@ -0,0 +1,719 @@
+#include "export.h"
+#include "../utils/threading_utils.h"
+#include "../utils/time_utils.h"
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+#include <log.h>
+#include <string.h>
+
+// polling interval of blocking channel operations, 10ms
+#define EXPORT_POLL_TIMEOUT ((i64)10e6)
+#define EXPORT_AUDIO_BIT_RATE 192000
+// MPEG-4 quantizer, 2 is near transparent
+#define EXPORT_MPEG4_QSCALE 3
+
+typedef enum {
+  EXPORT_MSG_TAG_FRAME,
+  EXPORT_MSG_TAG_PACKET,
+  // the stream is finished
+  EXPORT_MSG_TAG_EOF,
+} export_msg_tag;
+
+typedef struct {
+  export_msg_tag tag;
+  i32 stream;
+  union {
+    AVFrame *frame;
+    AVPacket *pkt;
+  };
+} export_msg;
+
+static const char *stage_names[EXPORT_NUM_STAGES] = {
+    [EXPORT_STAGE_RENDER] = "render",
+    [EXPORT_STAGE_READBACK] = "readback",
+    [EXPORT_STAGE_CONVERT] = "convert",
+    [EXPORT_STAGE_ENCODE_VIDEO] = "video encode",
+    [EXPORT_STAGE_AUDIO] = "audio mix and encode",
+    [EXPORT_STAGE_MUX] = "mux",
+};
+
+static void free_msg(export_msg *msg) {
+  if (msg->tag == EXPORT_MSG_TAG_FRAME) {
+    av_frame_free(&msg->frame);
+  } else if (msg->tag == EXPORT_MSG_TAG_PACKET) {
+    av_packet_free(&msg->pkt);
+  }
+}
+
+static void fail(exporter *e) { atomic_store(&e->failed, true); }
+
+// blocks until sent, false once a stage failed. The message is freed if it
+// could not be sent.
+static bool send_msg(exporter *e, mpmc_sender *s, export_msg *msg) {
+  while (mpmc_send(s, &(mpmc_send_info){
+                          .block = true,
+                          .timeout = &(i64){EXPORT_POLL_TIMEOUT},
+                          .num_messages = 1,
+                          .message_data = msg,
+                      }) != 1) {
+    if (atomic_load(&e->failed)) {
+      free_msg(msg);
+      return false;
+    }
+  }
+  return true;
+}
+
+// blocks until received, false once a stage failed
+static bool receive_msg(exporter *e, mpmc_receiver *r, export_msg *msg) {
+  while (mpmc_receive(r, &(mpmc_receive_info){
+                             .block = true,
+                             .timeout = &(i64){EXPORT_POLL_TIMEOUT},
+                             .num_messages = 1,
+                             .message_data = msg,
+                         }) != 1) {
+    if (atomic_load(&e->failed)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void drain(mpmc_receiver *r) {
+  export_msg msg;
+  while (mpmc_receive(r, &(mpmc_receive_info){
+                             .block = false,
+                             .num_messages = 1,
+                             .message_data = &msg,
+                         }) == 1) {
+    free_msg(&msg);
+  }
+}
+
+// sends frame (NULL flushes) and passes every packet on to the muxer.
+// Returns false on errors, busy is the time spent in the encoder.
+static bool encode(exporter *e, AVCodecContext *cc, i32 stream,
+                   const AVFrame *frame, double *busy) {
+  struct timespec begin = get_now();
+  i32 error;
+  if ((error = avcodec_send_frame(cc, frame)) < 0) {
+    log_error("unable to send frame to %s encoder: %s", cc->codec->name,
+              av_err2str(error));
+    return false;
+  }
+
+  while (true) {
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt) {
+      log_error("unable to allocate packet");
+      return false;
+    }
+    error = avcodec_receive_packet(cc, pkt);
+    if (error == AVERROR(EAGAIN) || error == AVERROR_EOF) {
+      av_packet_free(&pkt);
+      break;
+    } else if (error < 0) {
+      log_error("unable to encode %s: %s", cc->codec->name, av_err2str(error));
+      av_packet_free(&pkt);
+      return false;
+    }
+
+    *busy += seconds_since(begin);
+    pkt->stream_index = stream;
+    if (!send_msg(e, &e->packets_sender,
+                  &(export_msg){.tag = EXPORT_MSG_TAG_PACKET,
+                                .stream = stream,
+                                .pkt = pkt})) {
+      return false;
+    }
+    begin = get_now();
+  }
+
+  *busy += seconds_since(begin);
+  return true;
+}
+
+static AVFrame *convert_frame(exporter *e, AVFrame *src) {
+  AVCodecContext *cc = e->video;
+  if (src->format != e->sws_format) {
+    sws_freeContext(e->sws);
+    e->sws = sws_getContext(src->width, src->height, src->format, cc->width,
+                            cc->height, cc->pix_fmt, SWS_BILINEAR, NULL,
+                            NULL, NULL);
+    if (!e->sws) {
+      log_error("unable to convert %s to %s",
+                av_get_pix_fmt_name(src->format),
+                av_get_pix_fmt_name(cc->pix_fmt));
+      e->sws_format = AV_PIX_FMT_NONE;
+      return NULL;
+    }
+    // full range RGB to limited range BT.709, sws defaults to BT.601
+    const int *coefficients = sws_getCoefficients(SWS_CS_ITU709);
+    sws_setColorspaceDetails(e->sws, coefficients, 1, coefficients, 0, 0,
+                             1 << 16, 1 << 16);
+    e->sws_format = src->format;
+  }
+
+  AVFrame *dst = av_frame_alloc();
+  if (!dst) {
+    log_error("unable to allocate frame");
+    return NULL;
+  }
+  dst->format = cc->pix_fmt;
+  dst->width = cc->width;
+  dst->height = cc->height;
+  i32 error;
+  if ((error = av_frame_get_buffer(dst, 0)) < 0) {
+    log_error("unable to allocate frame buffer: %s", av_err2str(error));
+    av_frame_free(&dst);
+    return NULL;
+  }
+
+  sws_scale(e->sws, (const u8 *const *)src->data, src->linesize, 0,
+            src->height, dst->data, dst->linesize);
+  dst->pts = src->pts;
+  return dst;
+}
+
+static int convert_thread(void *arg) {
+  exporter *e = arg;
+  export_stage_stats *stats = &e->stats[EXPORT_STAGE_CONVERT];
+  export_msg msg;
+  while (receive_msg(e, &e->frames, &msg)) {
+    if (msg.tag == EXPORT_MSG_TAG_FRAME &&
+        msg.frame->format != e->video->pix_fmt) {
+      struct timespec begin = get_now();
+      AVFrame *converted = convert_frame(e, msg.frame);
+      av_frame_free(&msg.frame);
+      if (!converted) {
+        fail(e);
+        return 1;
+      }
+      msg.frame = converted;
+      stats->busy += seconds_since(begin);
+      ++stats->num_items;
+    }
+
+    bool eof = msg.tag == EXPORT_MSG_TAG_EOF;
+    if (!send_msg(e, &e->converted_sender, &msg)) {
+      return 1;
+    }
+    if (eof) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int encode_video_thread(void *arg) {
+  exporter *e = arg;
+  export_stage_stats *stats = &e->stats[EXPORT_STAGE_ENCODE_VIDEO];
+  export_msg msg;
+  while (receive_msg(e, &e->converted, &msg)) {
+    bool eof = msg.tag == EXPORT_MSG_TAG_EOF;
+    bool ok = encode(e, e->video, EXPORT_VIDEO_STREAM,
+                     eof ? NULL : msg.frame, &stats->busy);
+    free_msg(&msg);
+    if (!ok) {
+      fail(e);
+      return 1;
+    }
+
+    if (eof) {
+      return send_msg(e, &e->packets_sender,
+                      &(export_msg){.tag = EXPORT_MSG_TAG_EOF,
+                                    .stream = EXPORT_VIDEO_STREAM})
+                 ? 0
+                 : 1;
+    }
+    ++stats->num_items;
+  }
+
+  return 1;
+}
+
+// copies num_samples planar samples into frame at offset, in the encoder's
+// layout
+static void put_samples(AVFrame *frame, i32 offset, float **planes,
+                        i32 num_samples) {
+  if (frame->format == AV_SAMPLE_FMT_FLTP) {
+    for (i32 ch = 0; ch < MIXER_NUM_CHANNELS; ++ch) {
+      memcpy((float *)frame->data[ch] + offset, planes[ch],
+             num_samples * sizeof(float));
+    }
+    return;
+  }
+
+  float *out = (float *)frame->data[0] + offset * MIXER_NUM_CHANNELS;
+  for (i32 i = 0; i < num_samples; ++i) {
+    for (i32 ch = 0; ch < MIXER_NUM_CHANNELS; ++ch) {
+      out[i * MIXER_NUM_CHANNELS + ch] = planes[ch][i];
+    }
+  }
+}
+
+// mixes the playlist into frames of the encoder's frame size
+static int audio_thread(void *arg) {
+  exporter *e = arg;
+  AVCodecContext *cc = e->audio;
+  export_stage_stats *stats = &e->stats[EXPORT_STAGE_AUDIO];
+  bool variable_size =
+      cc->frame_size == 0 ||
+      (cc->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE);
+  i32 frame_size = cc->frame_size > 0 ? cc->frame_size : MIXER_BLOCK_SIZE;
+
+  AVFrame *frame = av_frame_alloc();
+  if (!frame) {
+    log_error("unable to allocate audio frame");
+    goto fail_frame;
+  }
+  frame->format = cc->sample_fmt;
+  frame->nb_samples = frame_size;
+  frame->sample_rate = cc->sample_rate;
+  i32 error;
+  if ((error = av_channel_layout_copy(&frame->ch_layout, &cc->ch_layout)) <
+          0 ||
+      (error = av_frame_get_buffer(frame, 0)) < 0) {
+    log_error("unable to allocate audio frame buffer: %s", av_err2str(error));
+    goto fail_buffer;
+  }
+
+  float block[MIXER_NUM_CHANNELS][MIXER_BLOCK_SIZE];
+  float *planes[MIXER_NUM_CHANNELS];
+  i32 fill = 0;
+  i64 pts = 0;
+  while (!atomic_load(&e->failed)) {
+    struct timespec begin = get_now();
+    for (i32 ch = 0; ch < MIXER_NUM_CHANNELS; ++ch) {
+      planes[ch] = block[ch];
+    }
+    i32 n;
+    if (!playlist_mix_next(&e->mix, planes, &n)) {
+      log_warn("unable to decode some audio, exporting the rest");
+    }
+    stats->busy += seconds_since(begin);
+
+    bool end = n == 0;
+    while (n > 0 || (end && fill > 0)) {
+      i32 count = n < frame_size - fill ? n : frame_size - fill;
+      if (fill == 0 && (error = av_frame_make_writable(frame)) < 0) {
+        log_error("unable to reuse audio frame: %s", av_err2str(error));
+        goto fail_encode;
+      }
+      put_samples(frame, fill, planes, count);
+      fill += count;
+      n -= count;
+      for (i32 ch = 0; ch < MIXER_NUM_CHANNELS; ++ch) {
+        planes[ch] += count;
+      }
+
+      if (fill < frame_size && !end) {
+        break;
+      }
+      // the last frame is padded with silence unless it may be short
+      if (end && !variable_size) {
+        av_samples_set_silence(frame->extended_data, fill, frame_size - fill,
+                               MIXER_NUM_CHANNELS, cc->sample_fmt);
+        fill = frame_size;
+      }
+      frame->nb_samples = fill;
+      frame->pts = pts;
+      pts += fill;
+      fill = 0;
+      if (!encode(e, cc, EXPORT_AUDIO_STREAM, frame, &stats->busy)) {
+        goto fail_encode;
+      }
+      ++stats->num_items;
+    }
+
+    if (end) {
+      break;
+    }
+  }
+
+  if (atomic_load(&e->failed) ||
+      !encode(e, cc, EXPORT_AUDIO_STREAM, NULL, &stats->busy)) {
+    goto fail_encode;
+  }
+  av_frame_free(&frame);
+  return send_msg(e, &e->packets_sender,
+                  &(export_msg){.tag = EXPORT_MSG_TAG_EOF,
+                                .stream = EXPORT_AUDIO_STREAM})
+             ? 0
+             : 1;
+
+fail_encode:
+fail_buffer:
+  av_frame_free(&frame);
+fail_frame:
+  fail(e);
+  return 1;
+}
+
+static int mux_thread(void *arg) {
+  exporter *e = arg;
+  export_stage_stats *stats = &e->stats[EXPORT_STAGE_MUX];
+  i32 num_streams = (i32)e->fmt->nb_streams;
+  i32 num_eof = 0;
+  export_msg msg;
+  while (num_eof < num_streams && receive_msg(e, &e->packets, &msg)) {
+    if (msg.tag == EXPORT_MSG_TAG_EOF) {
+      ++num_eof;
+      continue;
+    }
+
+    struct timespec begin = get_now();
+    AVCodecContext *cc =
+        msg.stream == EXPORT_VIDEO_STREAM ? e->video : e->audio;
+    av_packet_rescale_ts(msg.pkt, cc->time_base,
+                         e->fmt->streams[msg.stream]->time_base);
+    i32 error = av_interleaved_write_frame(e->fmt, msg.pkt);
+    av_packet_free(&msg.pkt);
+    if (error < 0) {
+      log_error("unable to write packet: %s", av_err2str(error));
+      fail(e);
+      return 1;
+    }
+    stats->busy += seconds_since(begin);
+    ++stats->num_items;
+  }
+
+  return num_eof == num_streams ? 0 : 1;
+}
+
+// the encoder's format closest to 8-bit 4:2:0, which every player decodes
+static enum AVPixelFormat video_pixel_format(const AVCodec *codec) {
+  if (!codec->pix_fmts) {
+    return AV_PIX_FMT_YUV420P;
+  }
+  for (const enum AVPixelFormat *f = codec->pix_fmts; *f != AV_PIX_FMT_NONE;
+       ++f) {
+    if (*f == AV_PIX_FMT_YUV420P) {
+      return *f;
+    }
+  }
+  return codec->pix_fmts[0];
+}
+
+static bool open_video(exporter *e, const export_info *info) {
+  const AVCodec *codec = avcodec_find_encoder_by_name(info->video_codec);
+  if (!codec || codec->type != AVMEDIA_TYPE_VIDEO) {
+    log_error("no video encoder called '%s'", info->video_codec);
+    goto fail_codec;
+  }
+
+  if (!(e->video = avcodec_alloc_context3(codec))) {
+    log_error("unable to allocate video encoder");
+    goto fail_codec;
+  }
+  AVCodecContext *cc = e->video;
+  cc->width = info->width;
+  cc->height = info->height;
+  cc->time_base = av_inv_q(info->frame_rate);
+  cc->framerate = info->frame_rate;
+  cc->sample_aspect_ratio = (AVRational){1, 1};
+  cc->pix_fmt = video_pixel_format(codec);
+  cc->colorspace = AVCOL_SPC_BT709;
+  cc->color_range = AVCOL_RANGE_MPEG;
+  cc->thread_count = 0;
+  if (codec->id == AV_CODEC_ID_MPEG4) {
+    cc->flags |= AV_CODEC_FLAG_QSCALE;
+    cc->global_quality = FF_QP2LAMBDA * EXPORT_MPEG4_QSCALE;
+  }
+  if (e->fmt->oformat->flags & AVFMT_GLOBALHEADER) {
+    cc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  i32 error;
+  if ((error = avcodec_open2(cc, codec, NULL)) < 0) {
+    log_error("unable to open %s encoder: %s", codec->name, av_err2str(error));
+    goto fail_open;
+  }
+
+  AVStream *st = avformat_new_stream(e->fmt, NULL);
+  if (!st) {
+    log_error("unable to create video stream");
+    goto fail_open;
+  }
+  st->time_base = cc->time_base;
+  if ((error = avcodec_parameters_from_context(st->codecpar, cc)) < 0) {
+    log_error("unable to set video stream parameters: %s", av_err2str(error));
+    goto fail_open;
+  }
+
+  log_info("exporting %dx%d %s video as %s", cc->width, cc->height,
+           av_get_pix_fmt_name(cc->pix_fmt), codec->name);
+  return true;
+
+fail_open:
+  avcodec_free_context(&e->video);
+fail_codec:
+  return false;
+}
+
+static bool open_audio(exporter *e, const export_info *info) {
+  const AVCodec *codec = avcodec_find_encoder_by_name(info->audio_codec);
+  if (!codec || codec->type != AVMEDIA_TYPE_AUDIO) {
+    log_error("no audio encoder called '%s'", info->audio_codec);
+    goto fail_codec;
+  }
+
+  // the mix is float
+  enum AVSampleFormat sample_fmt = AV_SAMPLE_FMT_NONE;
+  for (const enum AVSampleFormat *f = codec->sample_fmts;
+       f && *f != AV_SAMPLE_FMT_NONE; ++f) {
+    if (*f == AV_SAMPLE_FMT_FLTP || *f == AV_SAMPLE_FMT_FLT) {
+      sample_fmt = *f;
+      break;
+    }
+  }
+  if (sample_fmt == AV_SAMPLE_FMT_NONE) {
+    log_error("%s encoder does not take float samples", codec->name);
+    goto fail_codec;
+  }
+
+  if (!(e->audio = avcodec_alloc_context3(codec))) {
+    log_error("unable to allocate audio encoder");
+    goto fail_codec;
+  }
+  AVCodecContext *cc = e->audio;
+  cc->sample_fmt = sample_fmt;
+  cc->sample_rate = info->sample_rate;
+  cc->ch_layout = (AVChannelLayout)AV_CHANNEL_LAYOUT_STEREO;
+  cc->bit_rate = EXPORT_AUDIO_BIT_RATE;
+  cc->time_base = (AVRational){1, info->sample_rate};
+  if (e->fmt->oformat->flags & AVFMT_GLOBALHEADER) {
+    cc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  i32 error;
+  if ((error = avcodec_open2(cc, codec, NULL)) < 0) {
+    log_error("unable to open %s encoder: %s", codec->name, av_err2str(error));
+    goto fail_open;
+  }
+
+  AVStream *st = avformat_new_stream(e->fmt, NULL);
+  if (!st) {
+    log_error("unable to create audio stream");
+    goto fail_open;
+  }
+  st->time_base = cc->time_base;
+  if ((error = avcodec_parameters_from_context(st->codecpar, cc)) < 0) {
+    log_error("unable to set audio stream parameters: %s", av_err2str(error));
+    goto fail_open;
+  }
+
+  if (!playlist_mix_init(&e->mix, info->urls, info->num_urls,
+                         info->sample_rate, info->crossfade)) {
+    goto fail_open;
+  }
+
+  return true;
+
+fail_open:
+  avcodec_free_context(&e->audio);
+fail_codec:
+  return false;
+}
+
+static bool init_channel(mpmc_sender *sender, mpmc_receiver *receiver,
+                         i32 size) {
+  return mpmc_init(
+      &(mpmc_init_info){
+          .message_size = sizeof(export_msg),
+          .initial_num_messages = size,
+          .auto_grow = false,
+          .enable_timeout = true,
+      },
+      sender, receiver);
+}
+
+bool exporter_init(exporter *e, const export_info *info) {
+  e->start = get_now();
+  e->video = NULL;
+  e->audio = NULL;
+  e->sws = NULL;
+  e->sws_format = AV_PIX_FMT_NONE;
+  e->num_threads = 0;
+  e->next_pts = 0;
+  atomic_init(&e->failed, false);
+  memset(e->stats, 0, sizeof e->stats);
+
+  i32 error;
+  if ((error = avformat_alloc_output_context2(&e->fmt, NULL, NULL,
+                                              info->path)) < 0) {
+    log_error("unable to guess container of '%s': %s", info->path,
+              av_err2str(error));
+    goto fail_fmt;
+  }
+
+  if (!open_video(e, info)) {
+    goto fail_video;
+  }
+  if (info->num_urls > 0 && !open_audio(e, info)) {
+    goto fail_audio;
+  }
+
+  if (!(e->fmt->oformat->flags & AVFMT_NOFILE) &&
+      (error = avio_open(&e->fmt->pb, info->path, AVIO_FLAG_WRITE)) < 0) {
+    log_error("unable to open '%s' for writing: %s", info->path,
+              av_err2str(error));
+    goto fail_avio;
+  }
+
+  if ((error = avformat_write_header(e->fmt, NULL)) < 0) {
+    log_error("unable to write header: %s", av_err2str(error));
+    goto fail_header;
+  }
+
+  if (!init_channel(&e->frames_sender, &e->frames, EXPORT_FRAME_QUEUE_SIZE)) {
+    log_error("unable to initialize frame MPMC channels");
+    goto fail_frames;
+  }
+  if (!init_channel(&e->converted_sender, &e->converted,
+                    EXPORT_FRAME_QUEUE_SIZE)) {
+    log_error("unable to initialize converted frame MPMC channels");
+    goto fail_converted;
+  }
+  if (!init_channel(&e->packets_sender, &e->packets,
+                    EXPORT_PACKET_QUEUE_SIZE)) {
+    log_error("unable to initialize packet MPMC channels");
+    goto fail_packets;
+  }
+
+  thrd_start_t starts[] = {convert_thread, encode_video_thread, mux_thread,
+                           audio_thread};
+  i32 num_threads = e->audio ? 4 : 3;
+  for (; e->num_threads < num_threads; ++e->num_threads) {
+    if ((error = thrd_create(&e->threads[e->num_threads],
+                             starts[e->num_threads], e)) != thrd_success) {
+      log_error("unable to start export thread: %s",
+                thrd_error_to_string(error));
+      goto fail_thread;
+    }
+  }
+
+  return true;
+
+fail_thread:
+  fail(e);
+  for (i32 i = 0; i < e->num_threads; ++i) {
+    thrd_join(e->threads[i], NULL);
+  }
+  drain(&e->packets);
+  drain(&e->converted);
+  drain(&e->frames);
+  mpmc_free(MPMC_COMMON_HANDLE(e->packets));
+fail_packets:
+  mpmc_free(MPMC_COMMON_HANDLE(e->converted));
+fail_converted:
+  mpmc_free(MPMC_COMMON_HANDLE(e->frames));
+fail_frames:
+fail_header:
+  if (!(e->fmt->oformat->flags & AVFMT_NOFILE)) {
+    avio_closep(&e->fmt->pb);
+  }
+fail_avio:
+  if (e->audio) {
+    playlist_mix_free(&e->mix);
+    avcodec_free_context(&e->audio);
+  }
+fail_audio:
+  avcodec_free_context(&e->video);
+fail_video:
+  avformat_free_context(e->fmt);
+fail_fmt:
+  return false;
+}
+
+enum AVPixelFormat exporter_pixel_format(const exporter *e) {
+  return e->video->pix_fmt;
+}
+
+bool exporter_send_frame(exporter *e, AVFrame *frame) {
+  frame->pts = e->next_pts++;
+  // frames converted on the GPU go straight to the encoder
+  return send_msg(e,
+                  frame->format == e->video->pix_fmt ? &e->converted_sender
+                                                     : &e->frames_sender,
+                  &(export_msg){.tag = EXPORT_MSG_TAG_FRAME,
+                                .stream = EXPORT_VIDEO_STREAM,
+                                .frame = frame});
+}
+
+void exporter_record(exporter *e, export_stage stage, double seconds) {
+  e->stats[stage].busy += seconds;
+  ++e->stats[stage].num_items;
+}
+
+static void log_stats(const exporter *e) {
+  double elapsed = seconds_since(e->start);
+  log_info("exported %" PRIi64 " frames in %.2fs (%.1f fps)", e->next_pts,
+           elapsed, (double)e->next_pts / elapsed);
+
+  i32 slowest = -1;
+  for (i32 i = 0; i < EXPORT_NUM_STAGES; ++i) {
+    const export_stage_stats *s = &e->stats[i];
+    if (s->num_items == 0) {
+      continue;
+    }
+    // what the stage could sustain on its own
+    log_info("%s: %" PRIi64 " items, %.2fs busy (%.0f%%), %.1f items/s",
+             stage_names[i], s->num_items, s->busy,
+             s->busy / elapsed * 100.0, (double)s->num_items / s->busy);
+    if (slowest < 0 || s->busy > e->stats[slowest].busy) {
+      slowest = i;
+    }
+  }
+  if (slowest >= 0) {
+    log_info("export is bound by the %s stage", stage_names[slowest]);
+  }
+}
+
+bool exporter_finish(exporter *e) {
+  bool ok = send_msg(e, &e->frames_sender,
+                     &(export_msg){.tag = EXPORT_MSG_TAG_EOF,
+                                   .stream = EXPORT_VIDEO_STREAM});
+  for (i32 i = 0; i < e->num_threads; ++i) {
+    i32 ret, error;
+    if ((error = thrd_join(e->threads[i], &ret)) != thrd_success) {
+      log_error("unable to join export thread: %s",
+                thrd_error_to_string(error));
+      ok = false;
+    } else if (ret != 0) {
+      ok = false;
+    }
+  }
+
+  i32 error;
+  if (ok && (error = av_write_trailer(e->fmt)) < 0) {
+    log_error("unable to write trailer: %s", av_err2str(error));
+    ok = false;
+  }
+  if (ok) {
+    log_stats(e);
+  } else {
+    log_error("export to '%s' failed", e->fmt->url);
+  }
+
+  drain(&e->packets);
+  drain(&e->converted);
+  drain(&e->frames);
+  mpmc_free(MPMC_COMMON_HANDLE(e->packets));
+  mpmc_free(MPMC_COMMON_HANDLE(e->converted));
+  mpmc_free(MPMC_COMMON_HANDLE(e->frames));
+  if (!(e->fmt->oformat->flags & AVFMT_NOFILE)) {
+    avio_closep(&e->fmt->pb);
+  }
+  if (e->audio) {
+    playlist_mix_free(&e->mix);
+    avcodec_free_context(&e->audio);
+  }
+  avcodec_free_context(&e->video);
+  sws_freeContext(e->sws);
+  avformat_free_context(e->fmt);
+  return ok;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "../audio/offline_render.h"
+#include "../utils/mpmc.h"
+#include "../utils/types.h"
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+
+#define EXPORT_VIDEO_STREAM 0
+#define EXPORT_AUDIO_STREAM 1
+// frames queued between two stages
+#define EXPORT_FRAME_QUEUE_SIZE 4
+// audio packets are small and many, the muxer needs some of them buffered
+#define EXPORT_PACKET_QUEUE_SIZE 64
+
+// render and readback run on the caller's thread, the others on their own
+typedef enum {
+  EXPORT_STAGE_RENDER,
+  EXPORT_STAGE_READBACK,
+  EXPORT_STAGE_CONVERT,
+  EXPORT_STAGE_ENCODE_VIDEO,
+  EXPORT_STAGE_AUDIO,
+  EXPORT_STAGE_MUX,
+  EXPORT_NUM_STAGES,
+} export_stage;
+
+typedef struct {
+  i64 num_items;
+  // seconds spent working, waits for the neighbouring stages excluded
+  double busy;
+} export_stage_stats;
+
+typedef struct {
+  // the container is guessed from the extension
+  const char *path;
+  i32 width, height;
+  AVRational frame_rate;
+  // encoder names, e.g. "ffv1" or "mpeg4". The audio encoder has to take
+  // float samples, e.g. "aac".
+  const char *video_codec;
+  const char *audio_codec;
+  // playlist mixed into the audio stream, no audio stream if num_urls is 0
+  const char **urls;
+  i32 num_urls;
+  double crossfade;
+  i32 sample_rate;
+} export_info;
+
+// encodes rendered frames to a file. Conversion, video encoding, audio mixing
+// and encoding, and muxing each run on their own thread, connected by bounded
+// channels, so export runs at the speed of the slowest stage.
+typedef struct {
+  AVFormatContext *fmt;
+  AVCodecContext *video;
+  // NULL without audio
+  AVCodecContext *audio;
+  playlist_mix mix;
+  struct SwsContext *sws;
+  // format sws converts from, AV_PIX_FMT_NONE before the first frame
+  enum AVPixelFormat sws_format;
+
+  thrd_t threads[4];
+  i32 num_threads;
+  // rendered frames, to the conversion stage
+  mpmc_sender frames_sender;
+  mpmc_receiver frames;
+  // frames in the encoder's format, to the video encoder
+  mpmc_sender converted_sender;
+  mpmc_receiver converted;
+  // encoded packets of both streams, to the muxer
+  mpmc_sender packets_sender;
+  mpmc_receiver packets;
+
+  i64 next_pts;
+  // set by the first stage that fails, the others stop
+  atomic_bool failed;
+  struct timespec start;
+  // every stage is only updated by the thread running it
+  export_stage_stats stats[EXPORT_NUM_STAGES];
+} exporter;
+
+bool exporter_init(exporter *e, const export_info *info);
+// pixel format of the video encoder, frames in it skip the conversion stage
+enum AVPixelFormat exporter_pixel_format(const exporter *e);
+// queues the next frame and takes ownership of it. Every frame has to be in
+// the same format. Blocks while the pipeline is full, false once a stage
+// failed.
+bool exporter_send_frame(exporter *e, AVFrame *frame);
+// accounts time the caller spent in the render or readback stage
+void exporter_record(exporter *e, export_stage stage, double seconds);
+// flushes every stage, finishes the file and reports per-stage throughput.
+// Frees e, false if any stage failed.
+bool exporter_finish(exporter *e);
@@ -0,0 +1,92 @@
+#include "frame_pool.h"
+#include <libavutil/imgutils.h>
+#include <log.h>
+#include <stdlib.h>
+
+bool frame_pool_init(frame_pool *p, i32 capacity) {
+  p->capacity = capacity;
+  p->frames = calloc(capacity, sizeof(p->frames[0]));
+  if (!p->frames) {
+    log_error("unable to allocate frame pool");
+    goto fail_alloc_frames;
+  }
+
+  if (!mpmc_init(
+          &(mpmc_init_info){
+              .message_size = sizeof(AVFrame *),
+              .initial_num_messages = capacity,
+              .auto_grow = false,
+              .enable_timeout = true,
+          },
+          &p->free_sender, &p->free_receiver)) {
+    log_error("unable to initialize frame pool MPMC channel");
+    goto fail_mpmc;
+  }
+
+  i32 i;
+  for (i = 0; i < capacity; ++i) {
+    if (!(p->frames[i] = av_frame_alloc())) {
+      log_error("unable to allocate frame");
+      goto fail_alloc_frame;
+    }
+  }
+
+  if (mpmc_send(&p->free_sender, &(mpmc_send_info){
+                                     .num_messages = capacity,
+                                     .message_data = p->frames,
+                                 }) != capacity) {
+    log_error("unable to fill frame pool");
+    goto fail_fill;
+  }
+
+  return true;
+
+fail_fill:
+fail_alloc_frame:
+  for (i32 j = 0; j < i; ++j) {
+    av_frame_free(&p->frames[j]);
+  }
+  mpmc_free(MPMC_COMMON_HANDLE(p->free_sender));
+fail_mpmc:
+  free(p->frames);
+fail_alloc_frames:
+  return false;
+}
+
+i32 frame_pool_capacity_for_budget(i64 budget, enum AVPixelFormat pixfmt,
+                                   i32 width, i32 height) {
+  i32 frame_size = av_image_get_buffer_size(pixfmt, width, height, 1);
+  if (frame_size <= 0) {
+    log_warn("unable to determine frame size of format %d, %dx%d", pixfmt,
+             width, height);
+    return 0;
+  }
+
+  return (i32)(budget / frame_size);
+}
+
+void frame_pool_free(frame_pool *p) {
+  // frames still acquired at this point are owned by the pool as well
+  for (i32 i = 0; i < p->capacity; ++i) {
+    av_frame_free(&p->frames[i]);
+  }
+  mpmc_free(MPMC_COMMON_HANDLE(p->free_sender));
+  free(p->frames);
+}
+
+AVFrame *frame_pool_acquire(frame_pool *p, mpmc_receive_info *info) {
+  AVFrame *frame = NULL;
+  info->num_messages = 1;
+  info->message_data = &frame;
+  return mpmc_receive(&p->free_receiver, info) == 1 ? frame : NULL;
+}
+
+void frame_pool_release(frame_pool *p, AVFrame *frame) {
+  av_frame_unref(frame);
+  if (mpmc_send(&p->free_sender, &(mpmc_send_info){
+                                     .num_messages = 1,
+                                     .message_data = &frame,
+                                 }) != 1) {
+    log_error("unable to return frame to frame pool");
+  }
+}
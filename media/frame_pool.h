@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../utils/mpmc.h"
+#include "../utils/types.h"
+#include <libavutil/frame.h>
+
+// fixed set of AVFrame structs shared between threads, acquiring blocks while
+// every frame is in use, which bounds the memory held by decoded frames
+typedef struct {
+  i32 capacity;
+  AVFrame **frames;
+  mpmc_sender free_sender;
+  mpmc_receiver free_receiver;
+} frame_pool;
+
+bool frame_pool_init(frame_pool *p, i32 capacity);
+// number of frames of the given format fitting into budget bytes
+i32 frame_pool_capacity_for_budget(i64 budget, enum AVPixelFormat pixfmt,
+                                   i32 width, i32 height);
+void frame_pool_free(frame_pool *p);
+
+// NULL on timeout
+AVFrame *frame_pool_acquire(frame_pool *p, mpmc_receive_info *info);
+// unreferences the frame data and puts the frame back into the pool
+void frame_pool_release(frame_pool *p, AVFrame *frame);
@@ -0,0 +1,451 @@
+#include "frame_upload.h"
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <log.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// row and plane alignment within slots, at least what SIMD decoders need
+#define FRAME_UPLOAD_ALIGN 64
+// decoders may read a little past the end of the last plane
+#define FRAME_UPLOAD_PADDING (FRAME_UPLOAD_ALIGN + 16)
+
+// waiting longer on a staging slot means the GPU is hung
+#define FRAME_UPLOAD_FENCE_TIMEOUT 1000000000ull
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+typedef struct {
+  i32 num_planes;
+  // visible size of each plane, in pixels
+  i32 widths[4];
+  i32 heights[4];
+  // bytes per pixel and components per pixel of each plane
+  i32 pixel_bytes[4];
+  i32 channels[4];
+  i32 linesizes[4];
+  usize offsets[4];
+  usize size;
+} plane_layout;
+
+// YUV formats with 8 to 16 bit native-endian components only, those are the
+// ones shaders/yuv.glsl converts
+static bool plane_layout_init(plane_layout *l, enum AVPixelFormat pixfmt,
+                              i32 width, i32 height, i32 aligned_width,
+                              i32 aligned_height) {
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pixfmt);
+  if (!desc || desc->nb_components != 3 ||
+      (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+                      AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_BITSTREAM |
+                      AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT)) ||
+      desc->comp[0].depth > 16) {
+    return false;
+  }
+
+  l->num_planes = av_pix_fmt_count_planes(pixfmt);
+  l->size = 0;
+  for (i32 p = 0; p < l->num_planes; ++p) {
+    bool chroma = p == 1 || p == 2;
+    i32 sw = chroma ? desc->log2_chroma_w : 0;
+    i32 sh = chroma ? desc->log2_chroma_h : 0;
+    l->widths[p] = AV_CEIL_RSHIFT(width, sw);
+    l->heights[p] = AV_CEIL_RSHIFT(height, sh);
+    l->channels[p] = 0;
+    for (i32 c = 0; c < desc->nb_components; ++c) {
+      if (desc->comp[c].plane == p) {
+        l->pixel_bytes[p] = desc->comp[c].step;
+        ++l->channels[p];
+      }
+    }
+    if (l->channels[p] < 1 || l->channels[p] > 2) {
+      return false;
+    }
+
+    l->linesizes[p] = ALIGN_UP(AV_CEIL_RSHIFT(aligned_width, sw) *
+                                   l->pixel_bytes[p],
+                               FRAME_UPLOAD_ALIGN);
+    l->offsets[p] = l->size;
+    l->size += ALIGN_UP((usize)l->linesizes[p] *
+                            AV_CEIL_RSHIFT(aligned_height, sh),
+                        FRAME_UPLOAD_ALIGN);
+  }
+  l->size += FRAME_UPLOAD_PADDING;
+  return true;
+}
+
+i64 frame_upload_size(enum AVPixelFormat pixfmt, i32 width, i32 height) {
+  plane_layout l;
+  // decoders pad the coded size to whole macroblocks
+  i32 aligned_width = ALIGN_UP(width, 64);
+  i32 aligned_height = ALIGN_UP(height, 64);
+  return plane_layout_init(&l, pixfmt, width, height, aligned_width,
+                           aligned_height)
+             ? (i64)l.size
+             : -1;
+}
+
+bool frame_uploader_init(frame_uploader *u, texture_pool *pool,
+                         usize slot_size, i32 num_decode_slots) {
+  u->pool = pool;
+  u->slot_size = ALIGN_UP(slot_size, FRAME_UPLOAD_ALIGN);
+  u->mapped = NULL;
+  u->next_staging = 0;
+  u->num_direct = 0;
+  u->num_staged = 0;
+  u->num_unbuffered = 0;
+  // decoders would write into memory only mapped during uploads otherwise
+  u->num_decode_slots = GLAD_GL_EXT_buffer_storage ? num_decode_slots : 0;
+  i32 num_slots = u->num_decode_slots + FRAME_UPLOAD_NUM_STAGING_SLOTS;
+  GLsizeiptr size = (GLsizeiptr)u->slot_size * num_slots;
+
+  u->slots = calloc(num_slots, sizeof *u->slots);
+  if (!u->slots) {
+    log_error("unable to allocate upload slots");
+    goto fail_alloc_slots;
+  }
+  for (i32 i = 0; i < num_slots; ++i) {
+    u->slots[i] = (frame_upload_slot){
+        .owner = u,
+        .offset = (usize)i * u->slot_size,
+        .state = FRAME_UPLOAD_SLOT_FREE,
+        .fence = 0,
+    };
+  }
+
+  if (mtx_init(&u->mutex, mtx_plain) != thrd_success) {
+    log_error("unable to initialize upload slot mutex");
+    goto fail_mutex;
+  }
+
+  glGenBuffers(1, &u->buffer);
+  if (u->buffer == 0) {
+    log_error("unable to create pixel upload buffer");
+    goto fail_gen_buffer;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->buffer);
+  if (GLAD_GL_EXT_buffer_storage) {
+    // decoders read their reference frames back, so the buffer has to live
+    // in cached client memory rather than write-combined memory
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT |
+                       GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+    glBufferStorageEXT(GL_PIXEL_UNPACK_BUFFER, size, NULL,
+                       flags | GL_CLIENT_STORAGE_BIT_EXT);
+    u->mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    if (!u->mapped) {
+      log_error("unable to map pixel upload buffer");
+      goto fail_map;
+    }
+  } else {
+    log_info("GL_EXT_buffer_storage not supported, frames are copied into "
+             "the upload buffer");
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  log_info("upload buffer: %d decode and %d staging slots of %.1fMiB",
+           u->num_decode_slots, FRAME_UPLOAD_NUM_STAGING_SLOTS,
+           u->slot_size / (1024.0 * 1024.0));
+  return true;
+
+fail_map:
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glDeleteBuffers(1, &u->buffer);
+fail_gen_buffer:
+  mtx_destroy(&u->mutex);
+fail_mutex:
+  free(u->slots);
+fail_alloc_slots:
+  return false;
+}
+
+void frame_uploader_free(frame_uploader *u) {
+  log_info("frames uploaded: %" PRIi64 " decoded in place, %" PRIi64
+           " staged, %" PRIi64 " unbuffered",
+           u->num_direct, u->num_staged, u->num_unbuffered);
+  i32 num_slots = u->num_decode_slots + FRAME_UPLOAD_NUM_STAGING_SLOTS;
+  for (i32 i = 0; i < num_slots; ++i) {
+    if (u->slots[i].state == FRAME_UPLOAD_SLOT_DECODING) {
+      log_warn("frame in upload slot %d outlives the uploader", i);
+    }
+    if (u->slots[i].fence) {
+      glDeleteSync(u->slots[i].fence);
+    }
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->buffer);
+  if (u->mapped) {
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glDeleteBuffers(1, &u->buffer);
+  mtx_destroy(&u->mutex);
+  free(u->slots);
+}
+
+static void release_slot(void *opaque, u8 *data) {
+  (void)data;
+  frame_upload_slot *slot = opaque;
+  mtx_lock(&slot->owner->mutex);
+  slot->state = FRAME_UPLOAD_SLOT_RELEASED;
+  mtx_unlock(&slot->owner->mutex);
+}
+
+// AVCodecContext.get_buffer2, falls back to ordinary buffers once every slot
+// is taken or the frame does not fit
+static int get_buffer(AVCodecContext *cc, AVFrame *frame, int flags) {
+  frame_uploader *u = cc->opaque;
+  i32 aligned_width = frame->width, aligned_height = frame->height;
+  i32 linesize_align[AV_NUM_DATA_POINTERS];
+  avcodec_align_dimensions2(cc, &aligned_width, &aligned_height,
+                            linesize_align);
+  plane_layout l;
+  if (!plane_layout_init(&l, frame->format, frame->width, frame->height,
+                         aligned_width, aligned_height) ||
+      l.size > u->slot_size) {
+    return avcodec_default_get_buffer2(cc, frame, flags);
+  }
+  for (i32 p = 0; p < l.num_planes; ++p) {
+    if (linesize_align[p] && l.linesizes[p] % linesize_align[p] != 0) {
+      return avcodec_default_get_buffer2(cc, frame, flags);
+    }
+  }
+
+  frame_upload_slot *slot = NULL;
+  mtx_lock(&u->mutex);
+  for (i32 i = 0; i < u->num_decode_slots; ++i) {
+    if (u->slots[i].state == FRAME_UPLOAD_SLOT_FREE) {
+      slot = &u->slots[i];
+      slot->state = FRAME_UPLOAD_SLOT_DECODING;
+      break;
+    }
+  }
+  mtx_unlock(&u->mutex);
+  if (!slot) {
+    return avcodec_default_get_buffer2(cc, frame, flags);
+  }
+
+  u8 *data = u->mapped + slot->offset;
+  frame->buf[0] = av_buffer_create(data, l.size, release_slot, slot, 0);
+  if (!frame->buf[0]) {
+    mtx_lock(&u->mutex);
+    slot->state = FRAME_UPLOAD_SLOT_FREE;
+    mtx_unlock(&u->mutex);
+    return AVERROR(ENOMEM);
+  }
+
+  for (i32 p = 0; p < l.num_planes; ++p) {
+    frame->data[p] = data + l.offsets[p];
+    frame->linesize[p] = l.linesizes[p];
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+void frame_uploader_attach(frame_uploader *u, AVCodecContext *cc) {
+  if (u->num_decode_slots == 0 ||
+      !(cc->codec->capabilities & AV_CODEC_CAP_DR1)) {
+    return;
+  }
+
+  cc->opaque = u;
+  cc->get_buffer2 = get_buffer;
+}
+
+static bool texture_format(i32 channels, i32 component_bytes,
+                           GLenum *internal_format, GLenum *format,
+                           GLenum *type) {
+  if (component_bytes == 2 && !GLAD_GL_EXT_texture_norm16) {
+    log_error("GL_EXT_texture_norm16 is required for frames deeper than 8 "
+              "bits");
+    return false;
+  }
+
+  *format = channels == 1 ? GL_RED : GL_RG;
+  if (component_bytes == 1) {
+    *internal_format = channels == 1 ? GL_R8 : GL_RG8;
+    *type = GL_UNSIGNED_BYTE;
+  } else {
+    *internal_format = channels == 1 ? GL_R16_EXT : GL_RG16_EXT;
+    *type = GL_UNSIGNED_SHORT;
+  }
+  return true;
+}
+
+// uploads every plane from the bound unpack buffer, or from client memory if
+// none is bound
+static bool upload_planes(texture_pool *pool, const plane_layout *l,
+                          const u8 *const *data, const i32 *linesizes,
+                          hw_texture *tex) {
+  for (i32 p = 0; p < l->num_planes; ++p) {
+    i32 component_bytes = l->pixel_bytes[p] / l->channels[p];
+    GLenum internal_format, format, type;
+    if (!texture_format(l->channels[p], component_bytes, &internal_format,
+                        &format, &type)) {
+      return false;
+    }
+
+    tex->textures[p] = texture_pool_acquire(pool, internal_format,
+                                            l->widths[p], l->heights[p]);
+    if (tex->textures[p] == 0) {
+      log_error("unable to create plane texture");
+      return false;
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, linesizes[p] / l->pixel_bytes[p]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, l->widths[p], l->heights[p],
+                    format, type, data[p]);
+  }
+
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  return true;
+}
+
+static void set_fence(frame_uploader *u, frame_upload_slot *slot) {
+  GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  mtx_lock(&u->mutex);
+  if (slot->fence) {
+    glDeleteSync(slot->fence);
+  }
+  slot->fence = fence;
+  mtx_unlock(&u->mutex);
+}
+
+// uploads from the decode slot the frame was decoded into
+static bool upload_direct(frame_uploader *u, const AVFrame *frame,
+                          const plane_layout *l, hw_texture *tex) {
+  const u8 *offsets[4];
+  for (i32 p = 0; p < l->num_planes; ++p) {
+    offsets[p] = (const u8 *)(uintptr_t)(frame->data[p] - u->mapped);
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->buffer);
+  bool ok = upload_planes(u->pool, l, offsets, frame->linesize, tex);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  set_fence(u, &u->slots[(frame->buf[0]->data - u->mapped) / u->slot_size]);
+  ++u->num_direct;
+  return ok;
+}
+
+// copies the frame into the next staging slot and uploads from there
+static bool upload_staged(frame_uploader *u, const AVFrame *frame,
+                          const plane_layout *l, hw_texture *tex) {
+  frame_upload_slot *slot = &u->slots[u->num_decode_slots + u->next_staging];
+  u->next_staging = (u->next_staging + 1) % FRAME_UPLOAD_NUM_STAGING_SLOTS;
+  if (slot->fence) {
+    // the GPU is FRAME_UPLOAD_NUM_STAGING_SLOTS uploads behind
+    GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     FRAME_UPLOAD_FENCE_TIMEOUT);
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+      log_warn("upload slot still in use, overwriting it");
+    }
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u->buffer);
+  u8 *dst = u->mapped ? u->mapped + slot->offset
+                      : glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, slot->offset,
+                                         l->size,
+                                         GL_MAP_WRITE_BIT |
+                                             GL_MAP_INVALIDATE_RANGE_BIT |
+                                             GL_MAP_UNSYNCHRONIZED_BIT);
+  if (!dst) {
+    log_error("unable to map upload slot");
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return false;
+  }
+
+  const u8 *offsets[4];
+  for (i32 p = 0; p < l->num_planes; ++p) {
+    av_image_copy_plane(dst + l->offsets[p], l->linesizes[p], frame->data[p],
+                        frame->linesize[p], l->widths[p] * l->pixel_bytes[p],
+                        l->heights[p]);
+    offsets[p] = (const u8 *)(uintptr_t)(slot->offset + l->offsets[p]);
+  }
+  if (!u->mapped) {
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  }
+
+  bool ok = upload_planes(u->pool, l, offsets, l->linesizes, tex);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  set_fence(u, slot);
+  ++u->num_staged;
+  return ok;
+}
+
+bool frame_uploader_upload(frame_uploader *u, const AVFrame *frame,
+                           hw_texture *tex) {
+  plane_layout l;
+  if (!plane_layout_init(&l, frame->format, frame->width, frame->height,
+                         frame->width, frame->height)) {
+    log_error("unable to upload frames of format %s",
+              av_get_pix_fmt_name(frame->format));
+    return false;
+  }
+  for (i32 p = 0; p < l.num_planes; ++p) {
+    if (frame->linesize[p] <= 0 ||
+        frame->linesize[p] % l.pixel_bytes[p] != 0) {
+      log_error("unable to upload frame with line size %d",
+                frame->linesize[p]);
+      return false;
+    }
+  }
+
+  memset(tex, 0, sizeof *tex);
+
+  usize buffer_size = u->slot_size * (u->num_decode_slots +
+                                      FRAME_UPLOAD_NUM_STAGING_SLOTS);
+  bool ok;
+  if (u->mapped && frame->buf[0] && frame->buf[0]->data >= u->mapped &&
+      frame->buf[0]->data < u->mapped + buffer_size) {
+    ok = upload_direct(u, frame, &l, tex);
+  } else if (l.size <= u->slot_size) {
+    ok = upload_staged(u, frame, &l, tex);
+  } else {
+    ok = upload_planes(u->pool, &l, (const u8 *const *)frame->data,
+                       frame->linesize, tex);
+    ++u->num_unbuffered;
+  }
+
+  if (!ok) {
+    for (i32 p = 0; p < l.num_planes; ++p) {
+      if (tex->textures[p]) {
+        texture_pool_release(u->pool, tex->textures[p]);
+      }
+    }
+    tex->pixfmt = AV_PIX_FMT_NONE;
+    return false;
+  }
+
+  tex->pixfmt = frame->format;
+  tex->pool = u->pool;
+  tex->width = frame->width;
+  tex->height = frame->height;
+  tex->colorspace = frame->colorspace;
+  tex->color_range = frame->color_range;
+  tex->color_trc = frame->color_trc;
+  return true;
+}
+
+void frame_uploader_reclaim(frame_uploader *u) {
+  mtx_lock(&u->mutex);
+  for (i32 i = 0; i < u->num_decode_slots; ++i) {
+    frame_upload_slot *slot = &u->slots[i];
+    if (slot->state != FRAME_UPLOAD_SLOT_RELEASED) {
+      continue;
+    }
+
+    if (slot->fence) {
+      GLenum status = glClientWaitSync(slot->fence, 0, 0);
+      if (status != GL_ALREADY_SIGNALED &&
+          status != GL_CONDITION_SATISFIED) {
+        continue;
+      }
+      glDeleteSync(slot->fence);
+      slot->fence = 0;
+    }
+    slot->state = FRAME_UPLOAD_SLOT_FREE;
+  }
+  mtx_unlock(&u->mutex);
+}
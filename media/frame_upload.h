@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../graphics/texture_pool.h"
+#include "../utils/types.h"
+#include "decode_thread.h"
+#include <glad/gles2.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <threads.h>
+
+// slots the GPU reads copied frames from, round robin
+#define FRAME_UPLOAD_NUM_STAGING_SLOTS 3
+#define FRAME_UPLOAD_NUM_DECODE_SLOTS_DEFAULT 8
+
+typedef enum {
+  FRAME_UPLOAD_SLOT_FREE,
+  // holds the data of a frame that is still referenced
+  FRAME_UPLOAD_SLOT_DECODING,
+  // unreferenced, free once the GPU is done reading it
+  FRAME_UPLOAD_SLOT_RELEASED,
+} frame_upload_slot_state;
+
+typedef struct {
+  struct frame_uploader *owner;
+  usize offset;
+  frame_upload_slot_state state;
+  // signalled once the GPU read the slot, 0 if it never did
+  GLsync fence;
+} frame_upload_slot;
+
+// streams CPU-decoded frames to textures through one pixel buffer object,
+// split into decode slots and a ring of staging slots. With
+// GL_EXT_buffer_storage the buffer stays mapped and decoders write their
+// output straight into decode slots, so uploading is only a GPU copy.
+// Otherwise frames are copied into a staging slot mapped per upload.
+typedef struct frame_uploader {
+  // plane textures are taken from and released back to the pool
+  texture_pool *pool;
+  GLuint buffer;
+  // the whole buffer while persistently mapped, NULL otherwise
+  u8 *mapped;
+  usize slot_size;
+  i32 num_decode_slots;
+  // decode slots followed by the staging slots
+  frame_upload_slot *slots;
+  i32 next_staging;
+  // guards slot states, decoders allocate and free on their own threads
+  mtx_t mutex;
+
+  i64 num_direct;
+  i64 num_staged;
+  i64 num_unbuffered;
+} frame_uploader;
+
+// slot_size should fit the largest frame expected, see frame_upload_size
+bool frame_uploader_init(frame_uploader *u, texture_pool *pool,
+                         usize slot_size, i32 num_decode_slots);
+// every frame allocated from the uploader must have been freed
+void frame_uploader_free(frame_uploader *u);
+// bytes a frame of this format takes in a slot
+i64 frame_upload_size(enum AVPixelFormat pixfmt, i32 width, i32 height);
+
+// sets up a software decoder to decode into the uploader's buffer, must be
+// called before avcodec_open2
+void frame_uploader_attach(frame_uploader *u, AVCodecContext *cc);
+// uploads every plane of a CPU frame to textures from the pool
+bool frame_uploader_upload(frame_uploader *u, const AVFrame *frame,
+                           hw_texture *tex);
+// frees decode slots of unreferenced frames the GPU is done with, call once
+// per frame on the rendering thread
+void frame_uploader_reclaim(frame_uploader *u);
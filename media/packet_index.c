@@ -0,0 +1,234 @@
+#include "packet_index.h"
+#include <libavcodec/packet.h>
+#include <libavutil/error.h>
+#include <log.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  i64 *data;
+  i32 len, cap;
+} i64_array;
+
+static bool i64_array_push(i64_array *a, i64 value) {
+  if (a->len >= a->cap) {
+    i32 new_cap = (a->cap + 1) * 3 / 2;
+    i64 *new_data = realloc(a->data, new_cap * sizeof(a->data[0]));
+    if (!new_data) {
+      return false;
+    }
+
+    a->data = new_data;
+    a->cap = new_cap;
+  }
+
+  a->data[a->len++] = value;
+  return true;
+}
+
+static int compare_i64(const void *a, const void *b) {
+  i64 x = *(const i64 *)a, y = *(const i64 *)b;
+  return (x > y) - (x < y);
+}
+
+// end of the stream in its time base, AV_NOPTS_VALUE if unknown
+static i64 stream_end(const AVFormatContext *fmt, const AVStream *st) {
+  i64 start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+  if (st->duration != AV_NOPTS_VALUE) {
+    return start + st->duration;
+  } else if (fmt->duration != AV_NOPTS_VALUE) {
+    return start + av_rescale_q(fmt->duration, AV_TIME_BASE_Q, st->time_base);
+  }
+  return AV_NOPTS_VALUE;
+}
+
+// GOPs from the demuxer's index entries, false without keyframe entries.
+// Entries are sorted by decode timestamp. Containers with an entry per packet
+// (MP4) give frame counts, the others are estimated from the frame rate.
+// Reordered frames may fall on either side of a keyframe, so the counts are
+// padded by the codec's reorder delay: frame counts only split GOPs into
+// segments and have to be upper bounds, the decoder stops at the next GOP.
+static bool build_from_entries(packet_index *idx, const AVFormatContext *fmt,
+                               AVStream *st) {
+  i32 num_entries = avformat_index_get_entries_count(st);
+  i32 num_keys = 0;
+  bool every_packet = false;
+  for (i32 i = 0; i < num_entries; ++i) {
+    if (avformat_index_get_entry(st, i)->flags & AVINDEX_KEYFRAME) {
+      ++num_keys;
+    } else {
+      every_packet = true;
+    }
+  }
+  if (num_keys == 0) {
+    return false;
+  }
+
+  AVRational rate =
+      st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
+  i64 end = stream_end(fmt, st);
+  if (!every_packet && (rate.num <= 0 || rate.den <= 0 ||
+                        end == AV_NOPTS_VALUE)) {
+    // nothing to estimate frame counts from
+    return false;
+  }
+
+  if (!(idx->gops = calloc(num_keys, sizeof(idx->gops[0])))) {
+    log_error("unable to allocate GOP array");
+    return false;
+  }
+
+  i32 padding = st->codecpar->video_delay + 1;
+  i32 gop = -1;
+  for (i32 i = 0; i < num_entries; ++i) {
+    const AVIndexEntry *e = avformat_index_get_entry(st, i);
+    if (e->flags & AVINDEX_KEYFRAME) {
+      idx->gops[++gop] = (packet_index_gop){
+          .key_pts = e->timestamp,
+          .num_frames = padding,
+      };
+    }
+    if (gop >= 0 && every_packet) {
+      ++idx->gops[gop].num_frames;
+    }
+  }
+  idx->num_gops = num_keys;
+
+  if (!every_packet) {
+    double frame_duration = av_q2d(av_inv_q(rate)) / av_q2d(st->time_base);
+    for (i32 i = 0; i < num_keys; ++i) {
+      i64 next = i + 1 < num_keys ? idx->gops[i + 1].key_pts : end;
+      idx->gops[i].num_frames += (i32)ceil(
+          (double)(next - idx->gops[i].key_pts) / frame_duration);
+    }
+  }
+
+  log_debug("indexed %d GOPs of stream %d from the container index%s",
+            idx->num_gops, st->index,
+            every_packet ? "" : ", frame counts estimated");
+  return true;
+}
+
+bool packet_index_build(packet_index *idx, AVFormatContext *fmt,
+                        i32 stream_index) {
+  idx->stream_index = stream_index;
+  idx->time_base = fmt->streams[stream_index]->time_base;
+  idx->num_gops = 0;
+  idx->gops = NULL;
+  if (build_from_entries(idx, fmt, fmt->streams[stream_index])) {
+    return true;
+  }
+
+  i64_array keys = {0}, frames = {0};
+  AVPacket *pkt = av_packet_alloc();
+  if (!pkt) {
+    log_error("unable to allocate packet");
+    goto fail_alloc_packet;
+  }
+
+  i32 error;
+  while ((error = av_read_frame(fmt, pkt)) >= 0) {
+    i64 pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    bool ok = true;
+    if (pkt->stream_index == stream_index && pts != AV_NOPTS_VALUE) {
+      ok = i64_array_push(&frames, pts) &&
+           (!(pkt->flags & AV_PKT_FLAG_KEY) || i64_array_push(&keys, pts));
+    }
+    av_packet_unref(pkt);
+    if (!ok) {
+      log_error("unable to grow packet index");
+      goto fail_push;
+    }
+  }
+
+  if (error != AVERROR_EOF) {
+    log_error("error reading frame while building packet index: %s",
+              av_err2str(error));
+    goto fail_read;
+  }
+
+  if (keys.len == 0) {
+    log_error("no keyframes found in stream %d", stream_index);
+    goto fail_no_keys;
+  }
+
+  // packets are in decode order, GOPs are defined in presentation order
+  qsort(keys.data, keys.len, sizeof(keys.data[0]), compare_i64);
+  qsort(frames.data, frames.len, sizeof(frames.data[0]), compare_i64);
+
+  idx->gops = calloc(keys.len, sizeof(idx->gops[0]));
+  if (!idx->gops) {
+    log_error("unable to allocate GOP array");
+    goto fail_alloc_gops;
+  }
+
+  idx->num_gops = keys.len;
+  for (i32 i = 0; i < keys.len; ++i) {
+    idx->gops[i].key_pts = keys.data[i];
+  }
+
+  i32 gop = -1;
+  for (i32 i = 0; i < frames.len; ++i) {
+    while (gop + 1 < keys.len && frames.data[i] >= keys.data[gop + 1]) {
+      ++gop;
+    }
+
+    // leading frames before the first keyframe are not decodable
+    if (gop >= 0) {
+      ++idx->gops[gop].num_frames;
+    }
+  }
+
+  log_debug("indexed %d GOPs, %d frames of stream %d", idx->num_gops,
+            frames.len, stream_index);
+  free(frames.data);
+  free(keys.data);
+  av_packet_free(&pkt);
+  return true;
+
+fail_alloc_gops:
+fail_no_keys:
+fail_read:
+fail_push:
+  av_packet_free(&pkt);
+fail_alloc_packet:
+  free(frames.data);
+  free(keys.data);
+  return false;
+}
+
+bool packet_index_copy(packet_index *dst, const packet_index *src) {
+  *dst = *src;
+  dst->gops = NULL;
+  if (src->num_gops == 0) {
+    return true;
+  }
+  if (!(dst->gops = malloc(src->num_gops * sizeof(dst->gops[0])))) {
+    log_error("unable to allocate GOP array");
+    dst->num_gops = 0;
+    return false;
+  }
+  memcpy(dst->gops, src->gops, src->num_gops * sizeof(dst->gops[0]));
+  return true;
+}
+
+void packet_index_free(packet_index *idx) {
+  free(idx->gops);
+  idx->gops = NULL;
+  idx->num_gops = 0;
+}
+
+i32 packet_index_find_gop(const packet_index *idx, i64 pts) {
+  i32 lo = 0, hi = idx->num_gops;
+  while (lo < hi) {
+    i32 mid = lo + (hi - lo) / 2;
+    if (idx->gops[mid].key_pts <= pts) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo - 1;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <libavformat/avformat.h>
+
+// a group of pictures, covering presentation timestamps in
+// [key_pts, next GOP's key_pts)
+typedef struct {
+  i64 key_pts;
+  i32 num_frames;
+} packet_index_gop;
+
+typedef struct {
+  i32 stream_index;
+  AVRational time_base;
+  i32 num_gops;
+  packet_index_gop *gops;
+} packet_index;
+
+// GOPs from the index the demuxer reads with the header, scanning every packet
+// of the stream only for containers without one. fmt must be freshly opened
+// and is left at an unspecified position.
+bool packet_index_build(packet_index *idx, AVFormatContext *fmt,
+                        i32 stream_index);
+bool packet_index_copy(packet_index *dst, const packet_index *src);
+void packet_index_free(packet_index *idx);
+// index of the GOP containing pts, -1 if pts is before the first keyframe
+i32 packet_index_find_gop(const packet_index *idx, i64 pts);
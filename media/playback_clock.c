@@ -0,0 +1,55 @@
+#include "playback_clock.h"
+#include "../utils/time_utils.h"
+#include <math.h>
+
+void playback_clock_init(playback_clock *c, double time, double speed) {
+  c->speed = speed;
+  c->slew = 0.0;
+  c->base_time = time;
+  c->base_wall = get_now();
+  c->stepped = false;
+}
+
+void playback_clock_init_stepped(playback_clock *c, double time, double speed) {
+  playback_clock_init(c, time, speed);
+  c->stepped = true;
+}
+
+double playback_clock_time(const playback_clock *c) {
+  if (c->stepped) {
+    return c->base_time;
+  }
+  double elapsed = seconds_since(c->base_wall);
+  return c->base_time + elapsed * (c->speed + c->slew);
+}
+
+void playback_clock_set_speed(playback_clock *c, double speed) {
+  c->base_time = playback_clock_time(c);
+  c->base_wall = get_now();
+  c->speed = speed;
+  c->slew = 0.0;
+}
+
+void playback_clock_seek(playback_clock *c, double time) {
+  c->base_time = time;
+  c->base_wall = get_now();
+  c->slew = 0.0;
+}
+
+double playback_clock_sync(playback_clock *c, double master_time) {
+  double time = playback_clock_time(c);
+  double offset = master_time - time;
+  double max_slew = fabs(c->speed) * PLAYBACK_CLOCK_MAX_SLEW;
+  if (fabs(offset) > PLAYBACK_CLOCK_MAX_SLEW_OFFSET || max_slew == 0.0) {
+    playback_clock_seek(c, master_time);
+    return offset;
+  }
+
+  playback_clock_seek(c, time);
+  c->slew = fmin(fmax(offset / PLAYBACK_CLOCK_SLEW_TIME, -max_slew), max_slew);
+  return offset;
+}
+
+void playback_clock_step(playback_clock *c, double dt) {
+  c->base_time += dt * c->speed;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../utils/types.h"
+#include <time.h>
+
+// offset from the master clock beyond which syncing jumps to it, seconds
+#define PLAYBACK_CLOCK_MAX_SLEW_OFFSET 0.1
+// smaller offsets are corrected over about this many seconds
+#define PLAYBACK_CLOCK_SLEW_TIME 0.5
+// largest correction relative to the speed, 5% is barely noticeable
+#define PLAYBACK_CLOCK_MAX_SLEW 0.05
+
+// maps wall-clock time to media time (in seconds) at a variable speed
+typedef struct {
+  double speed;
+  // media seconds per second added to the speed while catching up with the
+  // master clock
+  double slew;
+  // media time at the last speed change
+  double base_time;
+  struct timespec base_wall;
+  // ignores the wall clock and only moves when stepped, for rendering faster
+  // or slower than real time
+  bool stepped;
+} playback_clock;
+
+void playback_clock_init(playback_clock *c, double time, double speed);
+void playback_clock_init_stepped(playback_clock *c, double time, double speed);
+double playback_clock_time(const playback_clock *c);
+// 0 pauses the clock
+void playback_clock_set_speed(playback_clock *c, double speed);
+void playback_clock_seek(playback_clock *c, double time);
+// slaves the clock to a master clock reading, returns master minus own time.
+// Small offsets are corrected by running slightly faster or slower, larger
+// ones by seeking.
+double playback_clock_sync(playback_clock *c, double master_time);
+// advances a stepped clock by dt seconds of wall-clock time
+void playback_clock_step(playback_clock *c, double dt);
@@ -13,6 +13,9 @@
 typedef struct {
   i32 stream_index;
   i32 num_buffered_packets;
+  bool skip_to_keyframe;
+  bool keyframes_only;
+  i32 num_dropped;
   mpmc_sender sender;
 } packet_stream;
 
@@ -26,11 +29,16 @@ typedef struct {
 typedef enum {
   CMD_MSG_TAG_EXIT,
   CMD_MSG_TAG_LATE_PACKET,
+  CMD_MSG_TAG_SKIP_TO_KEYFRAME,
+  CMD_MSG_TAG_KEYFRAMES_ONLY,
 } cmd_msg_tag;
 
 typedef struct {
   cmd_msg_tag tag;
-  union {};
+  i32 stream_index;
+  union {
+    bool enable;
+  };
 } cmd_msg;
 
 typedef struct {
@@ -86,6 +94,20 @@ static inline bool thread_context_handle_commands(thread_context *tc,
   case CMD_MSG_TAG_LATE_PACKET:
     tc->packet_late = true;
     break;
+  case CMD_MSG_TAG_SKIP_TO_KEYFRAME:
+    for (i32 i = 0; i < tc->td->num_streams; ++i) {
+      if (tc->td->packets[i].stream_index == cmd.stream_index) {
+        tc->td->packets[i].skip_to_keyframe = true;
+      }
+    }
+    break;
+  case CMD_MSG_TAG_KEYFRAMES_ONLY:
+    for (i32 i = 0; i < tc->td->num_streams; ++i) {
+      if (tc->td->packets[i].stream_index == cmd.stream_index) {
+        tc->td->packets[i].keyframes_only = cmd.enable;
+      }
+    }
+    break;
   }
 
   tc->timeout = -1;
@@ -119,8 +141,9 @@ static inline bool thread_context_read_frame(thread_context *tc, bool *eof) {
 static bool packet_queues_full(thread_context *tc) {
   thread_data *t = tc->td;
   for (i32 i = 0; i < t->num_streams; ++i) {
-    if (mpmc_hint_num_recvable(MPMC_COMMON_HANDLE(t->packets[i].sender)) <
-        t->packets[i].num_buffered_packets) {
+    if (t->packets[i].stream_index >= 0 &&
+        mpmc_hint_num_recvable(MPMC_COMMON_HANDLE(t->packets[i].sender)) <
+            t->packets[i].num_buffered_packets) {
       return false;
     }
   }
@@ -149,6 +172,19 @@ static inline bool thread_context_try_send_packet(thread_context *tc) {
     return true;
   }
 
+  bool resync = false;
+  if (stream->skip_to_keyframe || stream->keyframes_only) {
+    if (!(tc->packet->flags & AV_PKT_FLAG_KEY)) {
+      av_packet_unref(tc->packet);
+      tc->packet_pending = false;
+      ++stream->num_dropped;
+      return true;
+    }
+
+    // cleared once the keyframe is sent, a retry has to resync as well
+    resync = stream->skip_to_keyframe;
+  }
+
   // wait if...
   bool should_send =
       // late packet messages
@@ -169,10 +205,17 @@ static inline bool thread_context_try_send_packet(thread_context *tc) {
                                              .message_data = &(packet_msg){
                                                  .tag = PACKET_MSG_TAG_PACKET,
                                                  .pkt = tc->packet,
+                                                 .num_dropped =
+                                                     stream->num_dropped,
+                                                 .resync = resync,
                                              }});
   if (num_sent == 1) {
     tc->packet = NULL;
     tc->packet_pending = false;
+    stream->num_dropped = 0;
+    if (resync) {
+      stream->skip_to_keyframe = false;
+    }
     return true;
   }
 
@@ -192,6 +235,8 @@ static inline bool thread_context_send_last_packets(thread_context *tc) {
                                 .message_data = &(packet_msg){
                                     .tag = tc->error ? PACKET_MSG_TAG_ERROR
                                                      : PACKET_MSG_TAG_EOF,
+                                    .num_dropped = t->packets[i].num_dropped,
+                                    .resync = true,
                                 }}) != 1) {
         log_warn("unable to send %s packet message for stream %d",
                  tc->error ? "ERROR" : "EOF", t->packets[i].stream_index);
@@ -268,6 +313,8 @@ bool read_thread_init(read_thread_handle *t, const read_thread_init_info *info,
         log_warn("unable to find %s stream in media",
                  av_get_media_type_string(type));
         info->stream_indices[num_packet_mpmc] = -1;
+        td->packets[num_packet_mpmc].stream_index = -1;
+        streams[num_packet_mpmc].index = -1;
         continue;
       }
     }
@@ -275,6 +322,9 @@ bool read_thread_init(read_thread_handle *t, const read_thread_init_info *info,
         info->num_buffered_packets ? info->num_buffered_packets[num_packet_mpmc]
                                    : READ_THREAD_NUM_BUFFERED_PACKETS_DEFAULT;
     td->packets[num_packet_mpmc].stream_index = index;
+    td->packets[num_packet_mpmc].skip_to_keyframe = false;
+    td->packets[num_packet_mpmc].keyframes_only = false;
+    td->packets[num_packet_mpmc].num_dropped = 0;
     streams[num_packet_mpmc].index = index;
     if (!mpmc_init(
             &(mpmc_init_info){
@@ -346,6 +396,9 @@ void flush_packet_receiver(mpmc_receiver *receiver) {
 
 void stream_info_free(stream_info *streams, i32 num_streams) {
   for (i32 i = 0; i < num_streams; ++i) {
+    if (streams[i].index < 0) {
+      continue;
+    }
     flush_packet_receiver(&streams[i].receiver);
     mpmc_free(MPMC_COMMON_HANDLE(streams[i].receiver));
   }
@@ -375,6 +428,31 @@ bool read_thread_cmd_late_packet(read_thread_handle *t) {
                          });
 }
 
+bool read_thread_cmd_skip_to_keyframe(read_thread_handle *t,
+                                      i32 stream_index) {
+  return send_message(t, &(mpmc_send_info){
+                             .num_messages = 1,
+                             .message_data =
+                                 &(cmd_msg){
+                                     .tag = CMD_MSG_TAG_SKIP_TO_KEYFRAME,
+                                     .stream_index = stream_index,
+                                 },
+                         });
+}
+
+bool read_thread_cmd_keyframes_only(read_thread_handle *t, i32 stream_index,
+                                    bool enable) {
+  return send_message(t, &(mpmc_send_info){
+                             .num_messages = 1,
+                             .message_data =
+                                 &(cmd_msg){
+                                     .tag = CMD_MSG_TAG_KEYFRAMES_ONLY,
+                                     .stream_index = stream_index,
+                                     .enable = enable,
+                                 },
+                         });
+}
+
 bool read_thread_receive(read_thread_handle *t, stream_info *si,
                          packet_msg *msg, bool *packet_received,
                          bool cmd_late_packet) {
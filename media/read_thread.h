@@ -43,6 +43,11 @@ typedef struct {
   union {
     AVPacket *pkt;
   };
+  // number of packets of this stream dropped by the read thread since the
+  // previous message
+  i32 num_dropped;
+  // first packet sent after a skip-to-keyframe command was completed
+  bool resync;
 } packet_msg;
 
 typedef enum {
@@ -59,6 +64,12 @@ void stream_info_free(stream_info *streams, i32 num_streams);
 
 bool read_thread_cmd_exit(read_thread_handle *t);
 bool read_thread_cmd_late_packet(read_thread_handle *t);
+// drop packets of the stream until the next keyframe (catch-up)
+bool read_thread_cmd_skip_to_keyframe(read_thread_handle *t,
+                                      i32 stream_index);
+// only forward keyframes of the stream (shuttle playback)
+bool read_thread_cmd_keyframes_only(read_thread_handle *t, i32 stream_index,
+                                    bool enable);
 receive_packet_result read_thread_receive_packet(read_thread_handle *t,
                                                  stream_info *si,
                                                  packet_msg *msg,
@@ -0,0 +1,500 @@
+#include "reverse_playback.h"
+#include "../utils/threading_utils.h"
+#include "read_thread.h"
+#include <libavutil/error.h>
+#include <log.h>
+#include <stdlib.h>
+
+struct reverse_segment {
+  bool eof;
+  i32 num_frames;
+  AVFrame *frames[];
+};
+
+typedef enum {
+  CMD_MSG_TAG_EXIT,
+} cmd_msg_tag;
+
+typedef struct {
+  cmd_msg_tag tag;
+} cmd_msg;
+
+typedef enum {
+  WORKER_STATUS_OK,
+  WORKER_STATUS_EXIT,
+  WORKER_STATUS_ERROR,
+} worker_status;
+
+// polling interval of blocking operations in the worker thread, 10ms
+#define WORKER_POLL_TIMEOUT ((i64)10e6)
+
+static bool exit_requested(reverse_playback *r) {
+  cmd_msg cmd;
+  return mpmc_receive(&r->cmds, &(mpmc_receive_info){
+                                    .block = false,
+                                    .num_messages = 1,
+                                    .message_data = &cmd,
+                                }) == 1 &&
+         cmd.tag == CMD_MSG_TAG_EXIT;
+}
+
+static void free_segment(reverse_playback *r, reverse_segment *s) {
+  for (i32 i = 0; i < s->num_frames; ++i) {
+    if (s->frames[i]) {
+      frame_pool_release(&r->pool, s->frames[i]);
+    }
+  }
+  free(s);
+}
+
+static worker_status send_segment(reverse_playback *r, reverse_segment *s) {
+  while (mpmc_send(&r->segments_sender,
+                   &(mpmc_send_info){
+                       .block = true,
+                       .timeout = &(i64){WORKER_POLL_TIMEOUT},
+                       .num_messages = 1,
+                       .message_data = &s,
+                   }) != 1) {
+    if (exit_requested(r)) {
+      free_segment(r, s);
+      return WORKER_STATUS_EXIT;
+    }
+  }
+
+  return WORKER_STATUS_OK;
+}
+
+static worker_status keep_frame(reverse_playback *r, reverse_segment *s,
+                                AVFrame *frame) {
+  AVFrame *dst;
+  while (!(dst = frame_pool_acquire(
+               &r->pool, &(mpmc_receive_info){
+                             .block = true,
+                             .timeout = &(i64){WORKER_POLL_TIMEOUT},
+                         }))) {
+    if (exit_requested(r)) {
+      return WORKER_STATUS_EXIT;
+    }
+  }
+
+  av_frame_move_ref(dst, frame);
+  s->frames[s->num_frames++] = dst;
+  return WORKER_STATUS_OK;
+}
+
+// decodes frames [first, last) (presentation order) of the GOP, discarding
+// frames at or after end_pts
+static worker_status decode_segment(reverse_playback *r, AVPacket *pkt,
+                                    AVFrame *frame, i32 gop, i32 first,
+                                    i32 last, i64 end_pts,
+                                    reverse_segment *s) {
+  const packet_index_gop *g = &r->index.gops[gop];
+  i64 next_key_pts =
+      gop + 1 < r->index.num_gops ? r->index.gops[gop + 1].key_pts : INT64_MAX;
+  if (end_pts > next_key_pts) {
+    end_pts = next_key_pts;
+  }
+
+  i32 error;
+  if ((error = av_seek_frame(r->fmt, r->stream_index, g->key_pts,
+                             AVSEEK_FLAG_BACKWARD)) < 0) {
+    log_error("unable to seek to keyframe: %s", av_err2str(error));
+    return WORKER_STATUS_ERROR;
+  }
+  avcodec_flush_buffers(r->cc);
+
+  i32 ordinal = 0;
+  while (true) {
+    error = avcodec_receive_frame(r->cc, frame);
+    if (error == AVERROR(EAGAIN)) {
+      if (exit_requested(r)) {
+        return WORKER_STATUS_EXIT;
+      }
+
+      if ((error = av_read_frame(r->fmt, pkt)) == AVERROR_EOF) {
+        error = avcodec_send_packet(r->cc, NULL);
+      } else if (error >= 0) {
+        if (pkt->stream_index == r->stream_index) {
+          error = avcodec_send_packet(r->cc, pkt);
+        }
+        av_packet_unref(pkt);
+      }
+
+      if (error < 0) {
+        log_error("error feeding reverse decoder: %s", av_err2str(error));
+        return WORKER_STATUS_ERROR;
+      }
+      continue;
+    } else if (error == AVERROR_EOF) {
+      return WORKER_STATUS_OK;
+    } else if (error < 0) {
+      log_error("error decoding frame: %s", av_err2str(error));
+      return WORKER_STATUS_ERROR;
+    }
+
+    i64 pts = frame->best_effort_timestamp;
+    if (pts < g->key_pts) {
+      // leading frames of an open GOP belong to the previous one
+      av_frame_unref(frame);
+      continue;
+    }
+
+    if (pts >= end_pts || ordinal >= last) {
+      av_frame_unref(frame);
+      break;
+    }
+
+    worker_status status = WORKER_STATUS_OK;
+    if (ordinal >= first) {
+      status = keep_frame(r, s, frame);
+    }
+    av_frame_unref(frame);
+    if (status != WORKER_STATUS_OK) {
+      return status;
+    }
+    ++ordinal;
+  }
+
+  return WORKER_STATUS_OK;
+}
+
+static worker_status decode_backwards(reverse_playback *r, AVPacket *pkt,
+                                      AVFrame *frame) {
+  i64 end_pts = r->start_pts == AV_NOPTS_VALUE ? INT64_MAX : r->start_pts + 1;
+  i32 gop = r->start_pts == AV_NOPTS_VALUE
+                ? r->index.num_gops - 1
+                : packet_index_find_gop(&r->index, r->start_pts);
+  for (; gop >= 0; --gop) {
+    i32 num_frames = r->index.gops[gop].num_frames;
+    for (i32 last = num_frames; last > 0; last -= r->segment_frames) {
+      i32 first = last > r->segment_frames ? last - r->segment_frames : 0;
+      reverse_segment *s =
+          malloc(sizeof *s + (last - first) * sizeof(s->frames[0]));
+      if (!s) {
+        log_error("unable to allocate reverse segment");
+        return WORKER_STATUS_ERROR;
+      }
+      s->eof = false;
+      s->num_frames = 0;
+
+      worker_status status =
+          decode_segment(r, pkt, frame, gop, first, last, end_pts, s);
+      if (status != WORKER_STATUS_OK) {
+        free_segment(r, s);
+        return status;
+      }
+
+      // segments past the start position end up empty
+      if (s->num_frames == 0) {
+        free_segment(r, s);
+        continue;
+      }
+
+      if ((status = send_segment(r, s)) != WORKER_STATUS_OK) {
+        return status;
+      }
+    }
+    end_pts = INT64_MAX;
+  }
+
+  return WORKER_STATUS_OK;
+}
+
+static int thread_callback(void *arg) {
+  reverse_playback *r = arg;
+  worker_status status = WORKER_STATUS_ERROR;
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  if (!pkt || !frame) {
+    log_error("unable to allocate packet or frame for reverse decoding");
+    goto finish;
+  }
+
+  status = decode_backwards(r, pkt, frame);
+
+finish:
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  if (status != WORKER_STATUS_EXIT) {
+    reverse_segment *s = malloc(sizeof *s);
+    if (s) {
+      s->eof = true;
+      s->num_frames = 0;
+      send_segment(r, s);
+    } else {
+      log_error("unable to allocate EOF segment");
+    }
+  }
+  return status == WORKER_STATUS_ERROR ? 1 : 0;
+}
+
+bool reverse_playback_init(reverse_playback *r,
+                           const reverse_playback_init_info *info) {
+  r->fmt = NULL;
+  r->cur = NULL;
+  r->cur_pos = -1;
+  r->start_pts = info->start_pts;
+  r->index = (packet_index){0};
+
+  i32 error;
+  if ((error = avformat_open_input(&r->fmt, info->url, NULL, NULL)) < 0) {
+    log_error("unable to open '%s' for reverse playback: %s", info->url,
+              av_err2str(error));
+    goto fail_open_input;
+  }
+
+  if ((error = avformat_find_stream_info(r->fmt, NULL)) < 0) {
+    log_error("unable to find stream info: %s", av_err2str(error));
+    goto fail_stream_info;
+  }
+
+  const AVCodec *codec;
+  r->stream_index = info->stream_index >= 0
+                        ? info->stream_index
+                        : av_find_best_stream(r->fmt, AVMEDIA_TYPE_VIDEO,
+                                              -1, -1, NULL, 0);
+  if (r->stream_index < 0) {
+    log_error("unable to find video stream for reverse playback");
+    goto fail_stream_info;
+  }
+
+  // indexed before the worker starts, so callers can keep the index
+  if (info->index) {
+    if (!packet_index_copy(&r->index, info->index)) {
+      goto fail_stream_info;
+    }
+  } else if (!packet_index_build(&r->index, r->fmt, r->stream_index)) {
+    log_error("unable to build packet index for reverse playback");
+    goto fail_stream_info;
+  }
+
+  AVStream *s = r->fmt->streams[r->stream_index];
+  if (!(codec = avcodec_find_decoder(s->codecpar->codec_id))) {
+    log_error("unable to find decoder for codec id: %s",
+              avcodec_get_name(s->codecpar->codec_id));
+    goto fail_codec;
+  }
+
+  if (!(r->cc = avcodec_alloc_context3(codec))) {
+    log_error("unable to allocate AVCodecContext");
+    goto fail_codec;
+  }
+
+  if ((error = avcodec_parameters_to_context(r->cc, s->codecpar)) < 0) {
+    log_error(
+        "unable to copy codec parameters from stream to codec context: %s",
+        av_err2str(error));
+    goto fail_open_codec;
+  }
+
+  // decoding whole GOPs ahead of presentation only keeps up with frame
+  // threading
+  r->cc->thread_count = 0;
+  r->cc->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if ((error = avcodec_open2(r->cc, codec, NULL)) < 0) {
+    log_error("unable to open AVCodecContext for decoding: %s",
+              av_err2str(error));
+    goto fail_open_codec;
+  }
+
+  // one segment is presented while the previous one is decoded
+  i32 capacity = frame_pool_capacity_for_budget(
+      info->memory_budget, r->cc->pix_fmt, r->cc->width, r->cc->height);
+  r->segment_frames = capacity / 2;
+  if (r->segment_frames < 1) {
+    log_error("memory budget of %" PRIi64 " bytes is too small for reverse "
+              "playback",
+              info->memory_budget);
+    goto fail_open_codec;
+  }
+  log_debug("reverse playback with %d frames per segment",
+            r->segment_frames);
+
+  if (!frame_pool_init(&r->pool, capacity)) {
+    log_error("unable to initialize frame pool");
+    goto fail_pool;
+  }
+
+  if (!mpmc_init(
+          &(mpmc_init_info){
+              .message_size = sizeof(cmd_msg),
+              .initial_num_messages = 1,
+              .auto_grow = true,
+              .enable_timeout = true,
+          },
+          &r->cmds_sender, &r->cmds)) {
+    log_error("unable to initialize command MPMC channels");
+    goto fail_cmd_mpmc;
+  }
+
+  if (!mpmc_init(
+          &(mpmc_init_info){
+              .message_size = sizeof(reverse_segment *),
+              .initial_num_messages = 1,
+              .auto_grow = false,
+              .enable_timeout = true,
+          },
+          &r->segments_sender, &r->segments)) {
+    log_error("unable to initialize segment MPMC channels");
+    goto fail_segment_mpmc;
+  }
+
+  if ((error = thrd_create(&r->thread, thread_callback, r)) != thrd_success) {
+    log_error("unable to start reverse decoding thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  return true;
+
+fail_thread:
+  mpmc_free(MPMC_COMMON_HANDLE(r->segments));
+fail_segment_mpmc:
+  mpmc_free(MPMC_COMMON_HANDLE(r->cmds));
+fail_cmd_mpmc:
+  frame_pool_free(&r->pool);
+fail_pool:
+fail_open_codec:
+  avcodec_free_context(&r->cc);
+fail_codec:
+  packet_index_free(&r->index);
+fail_stream_info:
+  avformat_close_input(&r->fmt);
+fail_open_input:
+  return false;
+}
+
+void reverse_playback_free(reverse_playback *r) {
+  if (mpmc_send(&r->cmds_sender, &(mpmc_send_info){
+                                     .num_messages = 1,
+                                     .message_data =
+                                         &(cmd_msg){.tag = CMD_MSG_TAG_EXIT},
+                                 }) != 1) {
+    log_warn("unable to send exit command to reverse decoding thread");
+  }
+
+  i32 ret, error;
+  if ((error = thrd_join(r->thread, &ret)) != thrd_success) {
+    log_error("unable to join reverse decoding thread: %s",
+              thrd_error_to_string(error));
+  } else if (ret != 0) {
+    log_warn("reverse decoding thread exited with error code %d", ret);
+  }
+
+  reverse_segment *s;
+  while (mpmc_receive(&r->segments, &(mpmc_receive_info){
+                                        .block = false,
+                                        .num_messages = 1,
+                                        .message_data = &s,
+                                    }) == 1) {
+    free_segment(r, s);
+  }
+  if (r->cur) {
+    free_segment(r, r->cur);
+    r->cur = NULL;
+  }
+
+  mpmc_free(MPMC_COMMON_HANDLE(r->segments));
+  mpmc_free(MPMC_COMMON_HANDLE(r->cmds));
+  frame_pool_free(&r->pool);
+  packet_index_free(&r->index);
+  avcodec_free_context(&r->cc);
+  avformat_close_input(&r->fmt);
+}
+
+decode_frame_result reverse_playback_next_frame(reverse_playback *r,
+                                                AVFrame *frame,
+                                                mpmc_receive_info *info) {
+  if (!r->cur || r->cur_pos < 0) {
+    if (r->cur) {
+      free_segment(r, r->cur);
+      r->cur = NULL;
+    }
+
+    reverse_segment *s;
+    info->num_messages = 1;
+    info->message_data = &s;
+    i32 num_received = mpmc_receive(&r->segments, info);
+    if (num_received < 0) {
+      return DECODE_FRAME_RESULT_ERROR;
+    } else if (num_received == 0) {
+      return DECODE_FRAME_RESULT_TIMEOUT;
+    }
+
+    if (s->eof) {
+      // keep the EOF segment around so subsequent calls report EOF as well
+      if (mpmc_send(&r->segments_sender, &(mpmc_send_info){
+                                             .num_messages = 1,
+                                             .message_data = &s,
+                                         }) != 1) {
+        free(s);
+      }
+      return DECODE_FRAME_RESULT_EOF;
+    }
+
+    r->cur = s;
+    r->cur_pos = s->num_frames - 1;
+  }
+
+  AVFrame *src = r->cur->frames[r->cur_pos];
+  r->cur->frames[r->cur_pos--] = NULL;
+  av_frame_move_ref(frame, src);
+  frame_pool_release(&r->pool, src);
+  return DECODE_FRAME_RESULT_SUCCESS;
+}
+
+AVRational reverse_playback_time_base(const reverse_playback *r) {
+  return r->fmt->streams[r->stream_index]->time_base;
+}
+
+static int opener_thread_callback(void *arg) {
+  reverse_playback_opener *o = arg;
+  o->success = reverse_playback_init(o->r, &o->info);
+  atomic_store(&o->done, true);
+  return o->success ? 0 : 1;
+}
+
+bool reverse_playback_open_start(reverse_playback_opener *o,
+                                 const reverse_playback_init_info *info) {
+  o->info = *info;
+  atomic_init(&o->done, false);
+  o->success = false;
+  if (!(o->r = malloc(sizeof *o->r))) {
+    log_error("unable to allocate reverse playback");
+    goto fail_alloc;
+  }
+
+  i32 error;
+  if ((error = thrd_create(&o->thread, opener_thread_callback, o)) !=
+      thrd_success) {
+    log_error("unable to start reverse playback opener thread: %s",
+              thrd_error_to_string(error));
+    goto fail_thread;
+  }
+
+  return true;
+
+fail_thread:
+  free(o->r);
+fail_alloc:
+  return false;
+}
+
+bool reverse_playback_open_ready(reverse_playback_opener *o) {
+  return atomic_load(&o->done);
+}
+
+reverse_playback *reverse_playback_open_finish(reverse_playback_opener *o) {
+  i32 error;
+  if ((error = thrd_join(o->thread, NULL)) != thrd_success) {
+    log_error("unable to join reverse playback opener thread: %s",
+              thrd_error_to_string(error));
+  }
+
+  if (!o->success) {
+    free(o->r);
+    return NULL;
+  }
+
+  return o->r;
+}
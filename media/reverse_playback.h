@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../utils/mpmc.h"
+#include "../utils/types.h"
+#include "decode_thread.h"
+#include "frame_pool.h"
+#include "packet_index.h"
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+typedef struct reverse_segment reverse_segment;
+
+// decodes a video stream GOP by GOP on a background thread and hands out the
+// frames in reverse presentation order
+typedef struct {
+  thrd_t thread;
+  AVFormatContext *fmt;
+  AVCodecContext *cc;
+  i32 stream_index;
+  i64 start_pts;
+  // frames kept per segment, GOPs longer than this are decoded in several
+  // passes
+  i32 segment_frames;
+  packet_index index;
+  frame_pool pool;
+  mpmc_sender cmds_sender;
+  mpmc_receiver cmds;
+  mpmc_sender segments_sender;
+  mpmc_receiver segments;
+
+  reverse_segment *cur;
+  i32 cur_pos;
+} reverse_playback;
+
+typedef struct {
+  const char *url;
+  // stream index or READ_THREAD_STREAM_INDEX_AUTO_VIDEO
+  i32 stream_index;
+  // first (i.e. latest) frame to present, AV_NOPTS_VALUE for end of stream
+  i64 start_pts;
+  // upper bound of memory held by decoded frames, in bytes
+  i64 memory_budget;
+  // GOPs of the stream from an earlier reverse playback, NULL to index it
+  const packet_index *index;
+} reverse_playback_init_info;
+
+#define REVERSE_PLAYBACK_MEMORY_BUDGET_DEFAULT ((i64)1 << 30)
+
+bool reverse_playback_init(reverse_playback *r,
+                           const reverse_playback_init_info *info);
+void reverse_playback_free(reverse_playback *r);
+// frames come out with decreasing timestamps, DECODE_FRAME_RESULT_EOF once the
+// start of the stream is reached
+decode_frame_result reverse_playback_next_frame(reverse_playback *r,
+                                                AVFrame *frame,
+                                                mpmc_receive_info *info);
+AVRational reverse_playback_time_base(const reverse_playback *r);
+
+// initializes reverse playback on a background thread, so opening and probing
+// the file does not stall the caller. The URL must outlive the opener.
+typedef struct {
+  thrd_t thread;
+  reverse_playback_init_info info;
+  reverse_playback *r;
+  atomic_bool done;
+  bool success;
+} reverse_playback_opener;
+
+bool reverse_playback_open_start(reverse_playback_opener *o,
+                                 const reverse_playback_init_info *info);
+bool reverse_playback_open_ready(reverse_playback_opener *o);
+// waits for the opener to finish, NULL if reverse playback could not start
+reverse_playback *reverse_playback_open_finish(reverse_playback_opener *o);
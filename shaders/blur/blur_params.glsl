@@ -0,0 +1,9 @@
+// parameters of the blur passes, see graphics/blur.c
+layout(std140) uniform blur_params {
+  // BLUR_GAUSSIAN_MAX_TAPS, x offset in texels, y weight
+  vec4 taps[32];
+  vec2 direction;
+  // Kawase offset, pyramid mix or glow intensity
+  float amount;
+  int num_taps;
+};
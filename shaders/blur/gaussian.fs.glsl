@@ -0,0 +1,23 @@
+#version 320 es
+
+precision highp float;
+
+#include "blur_params.glsl"
+
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+
+// one direction of a separable Gaussian, taps past the centre fall between
+// two texels and read both with one bilinear fetch
+void main() {
+  vec2 texel = direction / vec2(textureSize(source, 0));
+  vec4 sum = texture(source, uv) * taps[0].y;
+  for (int i = 1; i < num_taps; ++i) {
+    vec2 offset = taps[i].x * texel;
+    sum += (texture(source, uv + offset) + texture(source, uv - offset)) *
+           taps[i].y;
+  }
+  color = sum;
+}
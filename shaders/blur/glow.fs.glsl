@@ -0,0 +1,17 @@
+#version 320 es
+
+precision highp float;
+
+#include "blur_params.glsl"
+#include "upsample.glsl"
+
+in vec2 uv;
+out vec4 color;
+
+// the layer and its blurred pyramid
+uniform sampler2D source;
+uniform sampler2D coarse;
+
+void main() {
+  color = texture(source, uv) + upsample(coarse, uv) * amount;
+}
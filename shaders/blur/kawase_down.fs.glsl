@@ -0,0 +1,22 @@
+#version 320 es
+
+precision highp float;
+
+#include "blur_params.glsl"
+
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+
+// dual Kawase downsampling to half the size: the centre and four diagonal
+// bilinear fetches, a source texel apart scaled by amount
+void main() {
+  vec2 d = amount / vec2(textureSize(source, 0));
+  vec4 sum = texture(source, uv) * 4.0;
+  sum += texture(source, uv - d);
+  sum += texture(source, uv + d);
+  sum += texture(source, uv + vec2(d.x, -d.y));
+  sum += texture(source, uv - vec2(d.x, -d.y));
+  color = sum / 8.0;
+}
@@ -0,0 +1,25 @@
+#version 320 es
+
+precision highp float;
+
+#include "blur_params.glsl"
+
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+
+// dual Kawase upsampling to twice the size: a ring of eight bilinear fetches,
+// the diagonal ones weighted double
+void main() {
+  vec2 d = 0.5 * amount / vec2(textureSize(source, 0));
+  vec4 sum = texture(source, uv + vec2(-2.0 * d.x, 0.0));
+  sum += texture(source, uv + vec2(2.0 * d.x, 0.0));
+  sum += texture(source, uv + vec2(0.0, -2.0 * d.y));
+  sum += texture(source, uv + vec2(0.0, 2.0 * d.y));
+  sum += texture(source, uv + vec2(-d.x, d.y)) * 2.0;
+  sum += texture(source, uv + vec2(d.x, d.y)) * 2.0;
+  sum += texture(source, uv + vec2(d.x, -d.y)) * 2.0;
+  sum += texture(source, uv + vec2(-d.x, -d.y)) * 2.0;
+  color = sum / 12.0;
+}
@@ -0,0 +1,18 @@
+#version 320 es
+
+precision highp float;
+
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+
+// halves the size with a 4x4 box: four bilinear fetches a source texel off
+// the 2x2 block the output texel covers
+void main() {
+  vec2 d = 1.0 / vec2(textureSize(source, 0));
+  color = 0.25 * (texture(source, uv + vec2(-d.x, -d.y)) +
+                  texture(source, uv + vec2(d.x, -d.y)) +
+                  texture(source, uv + vec2(-d.x, d.y)) +
+                  texture(source, uv + vec2(d.x, d.y)));
+}
@@ -0,0 +1,17 @@
+#version 320 es
+
+precision highp float;
+
+#include "blur_params.glsl"
+#include "upsample.glsl"
+
+in vec2 uv;
+out vec4 color;
+
+// a level of the pyramid and the blurred result of the coarser ones
+uniform sampler2D source;
+uniform sampler2D coarse;
+
+void main() {
+  color = mix(texture(source, uv), upsample(coarse, uv), amount);
+}
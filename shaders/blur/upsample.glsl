@@ -0,0 +1,9 @@
+// coarse at twice its size with a tent filter, four bilinear fetches half a
+// coarse texel apart
+vec4 upsample(sampler2D coarse, vec2 uv) {
+  vec2 d = 0.5 / vec2(textureSize(coarse, 0));
+  return 0.25 * (texture(coarse, uv + vec2(-d.x, -d.y)) +
+                 texture(coarse, uv + vec2(d.x, -d.y)) +
+                 texture(coarse, uv + vec2(-d.x, d.y)) +
+                 texture(coarse, uv + vec2(d.x, d.y)));
+}
@@ -0,0 +1,16 @@
+#version 320 es
+
+precision highp float;
+
+#include "layer_params.glsl"
+
+in vec2 tc;
+out vec4 color;
+
+// premultiplied result of a layer's effects
+uniform sampler2D source;
+
+void main() {
+  // targets are bottom-up, tc is top-down
+  color = texture(source, vec2(tc.x, 1.0 - tc.y)) * opacity;
+}
@@ -0,0 +1,16 @@
+#version 320 es
+
+const vec2 vertices[] = vec2[](
+  vec2(-1.0, 1.0),
+  vec2(1.0, 1.0),
+  vec2(-1.0, -1.0),
+  vec2(1.0, -1.0)
+);
+
+// coordinates in the compositor's targets, bottom-up like the targets
+out vec2 uv;
+
+void main(){
+  gl_Position = vec4(vertices[gl_VertexID], 0.0, 1.0);
+  uv = vertices[gl_VertexID] * 0.5 + 0.5;
+}
@@ -0,0 +1,7 @@
+// adds p.rgb weighted towards the midtones, shadows and highlights keep
+// their colour
+vec4 colour_balance(vec4 c, vec2 uv, vec4 p) {
+  float luma = dot(c.rgb, vec3(0.2126, 0.7152, 0.0722));
+  float midtones = 1.0 - abs(2.0 * clamp(luma, 0.0, 1.0) - 1.0);
+  return vec4(max(c.rgb + p.rgb * midtones, 0.0), c.a);
+}
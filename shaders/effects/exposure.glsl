@@ -0,0 +1,4 @@
+// p.x stops, applied to display R'G'B' like a gain
+vec4 exposure(vec4 c, vec2 uv, vec4 p) {
+  return vec4(c.rgb * exp2(p.x), c.a);
+}
@@ -0,0 +1,6 @@
+// 3D LUT of p.x entries per side, mixed in by p.y
+vec4 lut(vec4 c, vec2 uv, vec4 p, mediump sampler3D table) {
+  // the outer entries are at texel centres
+  vec3 coord = clamp(c.rgb, 0.0, 1.0) * ((p.x - 1.0) / p.x) + 0.5 / p.x;
+  return vec4(mix(c.rgb, texture(table, coord).rgb, p.y), c.a);
+}
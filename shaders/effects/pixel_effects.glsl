@@ -0,0 +1,8 @@
+// per-pixel effects fused by graphics/effect_fusion.c. Each is a function
+// vec4 name(vec4 c, vec2 uv, vec4 p) of the straight colour, the position in
+// the frame and its parameters, followed by a sampler if it takes one.
+
+#include "exposure.glsl"
+#include "colour_balance.glsl"
+#include "lut.glsl"
+#include "vignette.glsl"
@@ -0,0 +1,6 @@
+// darkens by up to p.x beyond p.y from the centre, fading in over p.z, in
+// units of the half diagonal
+vec4 vignette(vec4 c, vec2 uv, vec4 p) {
+  float d = distance(uv, vec2(0.5)) * 1.41421356;
+  return vec4(c.rgb * (1.0 - p.x * smoothstep(p.y, p.y + p.z, d)), c.a);
+}
@@ -0,0 +1,26 @@
+#version 320 es
+
+precision highp float;
+
+// a run of per-pixel effects in one pass. EFFECT_UNIFORMS and EFFECT_CHAIN
+// are generated per run, see graphics/effect_fusion.c.
+
+#include "effects/pixel_effects.glsl"
+
+in vec2 uv;
+out vec4 color;
+
+uniform sampler2D source;
+// EFFECT_FUSION_MAX_RUN entries, one per effect
+layout(std140) uniform effect_params {
+  vec4 params[16];
+};
+EFFECT_UNIFORMS
+
+void main() {
+  vec4 c = texture(source, uv);
+  // effects see straight colour, the compositor blends premultiplied
+  c.rgb /= max(c.a, 1.0 / 255.0);
+  EFFECT_CHAIN(c, uv)
+  color = vec4(c.rgb * c.a, c.a);
+}
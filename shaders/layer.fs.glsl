@@ -0,0 +1,19 @@
+#version 320 es
+
+precision highp float;
+
+#include "layer_params.glsl"
+#include "yuv.glsl"
+
+in vec2 tc;
+out vec4 color;
+
+uniform sampler2D y_plane;
+uniform sampler2D chroma_plane;
+uniform sampler2D cr_plane;
+
+void main() {
+  vec3 yuv = YUV0_SAMPLE(y_plane, chroma_plane, cr_plane, tc);
+  color = vec4(YUV0_TO_DISPLAY(YUV0_MATRIX * yuv + YUV0_OFFSET), 1.0) *
+          opacity;
+}
@@ -0,0 +1,22 @@
+#version 320 es
+
+precision highp float;
+
+#include "layer_params.glsl"
+
+const vec2 vertices[] = vec2[](
+  vec2(-1.0, 1.0),
+  vec2(1.0, 1.0),
+  vec2(-1.0, -1.0),
+  vec2(1.0, -1.0)
+);
+
+out vec2 tc;
+
+void main(){
+  vec3 v = vec3(vertices[gl_VertexID], 1.0);
+  gl_Position = vec4(dot(transform_x.xyz, v), dot(transform_y.xyz, v), 0.0,
+                     1.0);
+  tc = vertices[gl_VertexID] * 0.5 + 0.5;
+  tc.y = 1.0 - tc.y;
+}
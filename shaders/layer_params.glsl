@@ -0,0 +1,7 @@
+// per-layer parameters of the compositor, see graphics/compositor.c. The
+// transform maps the layer's quad to the output, rows of a 2x3 affine matrix.
+layout(std140) uniform layer_params {
+  vec4 transform_x;
+  vec4 transform_y;
+  float opacity;
+};
@@ -0,0 +1,59 @@
+// Y'CbCr to display R'G'B'. The plane layout, matrix, offset and transfer of
+// each layer are specialized per clip by the YUV<n>_* defines, see
+// graphics/video_format.c.
+
+vec3 sample_semi_planar(sampler2D y_plane, sampler2D chroma_plane,
+                        sampler2D cr_plane, vec2 tc) {
+  return vec3(texture(y_plane, tc).r, texture(chroma_plane, tc).rg);
+}
+
+vec3 sample_planar(sampler2D y_plane, sampler2D chroma_plane,
+                   sampler2D cr_plane, vec2 tc) {
+  return vec3(texture(y_plane, tc).r, texture(chroma_plane, tc).r,
+              texture(cr_plane, tc).r);
+}
+
+vec3 sdr_to_display(vec3 rgb) {
+  return rgb;
+}
+
+// HDR is tone mapped to SDR with diffuse white at 203 nits, BT.2100
+const float sdr_white = 203.0;
+const float hdr_peak = 1000.0 / sdr_white;
+
+const mat3 bt2020_to_bt709 = mat3(
+    1.6605, -0.1246, -0.0182,
+   -0.5876,  1.1329, -0.1006,
+   -0.0728, -0.0083,  1.1187);
+
+// linear light relative to diffuse white to BT.709 R'G'B'
+vec3 hdr_to_display(vec3 linear) {
+  vec3 c = max(bt2020_to_bt709 * linear, 0.0);
+  // extended Reinhard, hdr_peak maps to 1
+  c = c * (1.0 + c / (hdr_peak * hdr_peak)) / (1.0 + c);
+  return pow(c, vec3(1.0 / 2.4));
+}
+
+vec3 pq_to_display(vec3 rgb) {
+  const float m1 = 0.1593017578125;
+  const float m2 = 78.84375;
+  const float c1 = 0.8359375;
+  const float c2 = 18.8515625;
+  const float c3 = 18.6875;
+  vec3 p = pow(clamp(rgb, 0.0, 1.0), vec3(1.0 / m2));
+  vec3 nits = 10000.0 * pow(max(p - c1, 0.0) / (c2 - c3 * p), vec3(1.0 / m1));
+  return hdr_to_display(nits / sdr_white);
+}
+
+vec3 hlg_to_display(vec3 rgb) {
+  const float a = 0.17883277;
+  const float b = 0.28466892;
+  const float c = 0.55991073;
+  vec3 e = clamp(rgb, 0.0, 1.0);
+  vec3 scene = mix(e * e / 3.0, (exp((e - c) / a) + b) / 12.0,
+                   step(0.5, e));
+  // system gamma of a 1000 nit display
+  float luma = dot(scene, vec3(0.2627, 0.6780, 0.0593));
+  vec3 nits = 1000.0 * pow(luma, 0.2) * scene;
+  return hdr_to_display(nits / sdr_white);
+}
@@ -0,0 +1,61 @@
+#version 320 es
+
+precision highp float;
+
+// packs an RGB frame into limited range BT.709 4:2:0 planes, four bytes per
+// texel. Target row r is row r of the planes in memory: the luma rows, then
+// with PACK_NV12 one row of interleaved Cb Cr per chroma row, otherwise the
+// Cb plane and the Cr plane with two chroma rows per target row.
+
+uniform sampler2D source;
+out vec4 color;
+
+const vec3 luma_weights = vec3(0.2126, 0.7152, 0.0722);
+
+ivec2 size;
+
+float to_luma(vec3 rgb) {
+  return (16.0 + 219.0 * dot(rgb, luma_weights)) / 255.0;
+}
+
+vec2 to_chroma(vec3 rgb) {
+  float y = dot(rgb, luma_weights);
+  vec2 c = vec2((rgb.b - y) / 1.8556, (rgb.r - y) / 1.5748);
+  return (128.0 + 224.0 * c) / 255.0;
+}
+
+// source rows are bottom-up, y counts from the top
+float luma(int x, int y) {
+  return to_luma(texelFetch(source, ivec2(x, size.y - 1 - y), 0).rgb);
+}
+
+// the 2x2 block of chroma sample (x, y), averaged by one bilinear fetch at
+// its centre
+vec2 chroma(int x, int y) {
+  vec2 centre = vec2(2 * x + 1, size.y - 1 - 2 * y) / vec2(size);
+  return to_chroma(texture(source, centre).rgb);
+}
+
+void main() {
+  size = textureSize(source, 0);
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  int x = p.x * 4;
+  if (p.y < size.y) {
+    color = vec4(luma(x, p.y), luma(x + 1, p.y), luma(x + 2, p.y),
+                 luma(x + 3, p.y));
+    return;
+  }
+
+  int row = p.y - size.y;
+#ifdef PACK_NV12
+  color = vec4(chroma(p.x * 2, row), chroma(p.x * 2 + 1, row));
+#else
+  int plane_rows = size.y / 4;
+  int plane = row / plane_rows;
+  int offset = row % plane_rows * size.x + x;
+  int cx = offset % (size.x / 2);
+  int cy = offset / (size.x / 2);
+  color = vec4(chroma(cx, cy)[plane], chroma(cx + 1, cy)[plane],
+               chroma(cx + 2, cy)[plane], chroma(cx + 3, cy)[plane]);
+#endif
+}
@@ -0,0 +1,117 @@
+// forces an underrun in the mixer and checks the track stays on the timeline:
+// the block that underran is silent and the next block plays the samples due
+// at its position, not the late ones
+#include "../audio/mixer.h"
+#include <log.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 48000
+#define NUM_BLOCKS 4
+// the centre pan law is unity gain up to rounding
+#define TOLERANCE 1e-4f
+
+// the decoder stand-in writes sample k of the track as k + 1, and only
+// decodes as many blocks as the test has released
+static atomic_int num_released;
+
+void audio_output_format_init_planar(audio_output_format *f,
+                                     i32 num_channels, i32 sample_rate) {
+  f->sample_rate = sample_rate;
+  f->frame_size = num_channels * sizeof(float);
+}
+
+bool audio_playback_context_init(audio_playback_context *c, decode_context dc,
+                                  const audio_output_format *out) {
+  (void)dc;
+  c->out = *out;
+  c->num_out = 0;
+  return true;
+}
+
+void audio_playback_context_free(audio_playback_context *c) { (void)c; }
+
+i32 audio_playback_context_decode(audio_playback_context *c, u8 **data,
+                                  i32 total_samples) {
+  while (c->num_out >= atomic_load(&num_released) * (i64)MIXER_BLOCK_SIZE) {
+    thrd_sleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+  }
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    for (i32 k = 0; k < total_samples; ++k) {
+      ((float *)data[i])[k] = (float)(c->num_out + k + 1);
+    }
+  }
+  c->num_out += total_samples;
+  return total_samples;
+}
+
+void decode_context_free(decode_context *d) { (void)d; }
+
+// expected holds the value of the first sample, 0 for a silent block
+static bool check_block(float **out, float expected, i32 block) {
+  for (i32 i = 0; i < MIXER_NUM_CHANNELS; ++i) {
+    for (i32 k = 0; k < MIXER_BLOCK_SIZE; ++k) {
+      float want = expected == 0.0f ? 0.0f : expected + k;
+      if (fabsf(out[i][k] - want) > TOLERANCE * want) {
+        log_error("block %d, channel %d, sample %d: %g instead of %g", block,
+                  i, k, out[i][k], want);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(void) {
+  mixer m;
+  if (!mixer_init(&m, SAMPLE_RATE, 1)) {
+    return EXIT_FAILURE;
+  }
+  i32 track = mixer_add_track(&m, (decode_context){0},
+                              &(mixer_track_info){
+                                  .duration = NUM_BLOCKS * MIXER_BLOCK_SIZE,
+                                  .gain = 1.0f,
+                              });
+  if (track < 0) {
+    mixer_free(&m);
+    return EXIT_FAILURE;
+  }
+
+  float left[MIXER_BLOCK_SIZE], right[MIXER_BLOCK_SIZE];
+  float *out[MIXER_NUM_CHANNELS] = {left, right};
+  bool ok = true;
+
+  atomic_store(&num_released, 1);
+  mixer_wait(&m, MIXER_BLOCK_SIZE);
+  ok &= mixer_mix(&m, out, MIXER_BLOCK_SIZE);
+  ok &= check_block(out, 1.0f, 0);
+
+  // nothing decoded for the second block
+  ok &= mixer_mix(&m, out, MIXER_BLOCK_SIZE);
+  ok &= check_block(out, 0.0f, 1);
+  if (m.tracks[track].num_underruns != 1) {
+    log_error("%d underruns instead of 1", m.tracks[track].num_underruns);
+    ok = false;
+  }
+
+  // the second block arrives late with the third, only the third is played
+  atomic_store(&num_released, 3);
+  mixer_wait(&m, MIXER_BLOCK_SIZE);
+  ok &= mixer_mix(&m, out, MIXER_BLOCK_SIZE);
+  ok &= check_block(out, 2 * MIXER_BLOCK_SIZE + 1.0f, 2);
+
+  atomic_store(&num_released, NUM_BLOCKS);
+  mixer_wait(&m, MIXER_BLOCK_SIZE);
+  ok &= mixer_mix(&m, out, MIXER_BLOCK_SIZE);
+  ok &= check_block(out, 3 * MIXER_BLOCK_SIZE + 1.0f, 3);
+  if (mixer_num_active_tracks(&m) != 0) {
+    log_error("track still active after its duration");
+    ok = false;
+  }
+
+  mixer_free(&m);
+  if (ok) {
+    log_info("mixer underrun: ok");
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "types.h"
+
+// 64-bit FNV-1a, for cache keys rather than hash tables under attack
+#define HASH_FNV1A_INIT 0xcbf29ce484222325ull
+
+static inline u64 hash_fnv1a(u64 h, const void *data, usize size) {
+  const u8 *p = data;
+  for (usize i = 0; i < size; ++i) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+
+  return h;
+}
+
+static inline u64 hash_fnv1a_str(u64 h, const char *s) {
+  const u8 *p = (const u8 *)s;
+  for (; *p; ++p) {
+    h ^= *p;
+    h *= 0x100000001b3ull;
+  }
+
+  return h;
+}
@@ -0,0 +1,73 @@
+#include "spsc_ring.h"
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool spsc_ring_init(spsc_ring *r, usize capacity) {
+  usize cap = 1;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+
+  r->data = malloc(cap);
+  if (!r->data) {
+    log_error("unable to allocate ring buffer of %zu bytes", cap);
+    return false;
+  }
+
+  r->capacity = cap;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  return true;
+}
+
+void spsc_ring_free(spsc_ring *r) {
+  free(r->data);
+  r->data = NULL;
+}
+
+usize spsc_ring_can_read(spsc_ring *r) {
+  return atomic_load_explicit(&r->tail, memory_order_acquire) -
+         atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+usize spsc_ring_can_write(spsc_ring *r) {
+  return r->capacity - spsc_ring_can_read(r);
+}
+
+usize spsc_ring_write(spsc_ring *r, const void *src, usize size) {
+  usize tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  usize head = atomic_load_explicit(&r->head, memory_order_acquire);
+  usize free_bytes = r->capacity - (tail - head);
+  if (size > free_bytes) {
+    size = free_bytes;
+  }
+
+  usize offset = tail & (r->capacity - 1);
+  usize first = r->capacity - offset < size ? r->capacity - offset : size;
+  memcpy(&r->data[offset], src, first);
+  memcpy(r->data, (const u8 *)src + first, size - first);
+  atomic_store_explicit(&r->tail, tail + size, memory_order_release);
+  return size;
+}
+
+usize spsc_ring_peek(spsc_ring *r, void *dst, usize size) {
+  usize head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  usize tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (size > tail - head) {
+    size = tail - head;
+  }
+
+  usize offset = head & (r->capacity - 1);
+  usize first = r->capacity - offset < size ? r->capacity - offset : size;
+  memcpy(dst, &r->data[offset], first);
+  memcpy((u8 *)dst + first, r->data, size - first);
+  return size;
+}
+
+usize spsc_ring_read(spsc_ring *r, void *dst, usize size) {
+  size = spsc_ring_peek(r, dst, size);
+  usize head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  atomic_store_explicit(&r->head, head + size, memory_order_release);
+  return size;
+}
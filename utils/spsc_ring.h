@@ -0,0 +1,24 @@
+#pragma once
+
+#include "types.h"
+#include <stdatomic.h>
+
+// lock-free single-producer single-consumer byte ring, the capacity is rounded
+// up to a power of two
+typedef struct {
+  u8 *data;
+  usize capacity;
+  _Alignas(64) atomic_size_t head;
+  _Alignas(64) atomic_size_t tail;
+} spsc_ring;
+
+bool spsc_ring_init(spsc_ring *r, usize capacity);
+void spsc_ring_free(spsc_ring *r);
+
+usize spsc_ring_can_read(spsc_ring *r);
+usize spsc_ring_can_write(spsc_ring *r);
+// both return the number of bytes transferred, which may be less than size
+usize spsc_ring_write(spsc_ring *r, const void *src, usize size);
+usize spsc_ring_read(spsc_ring *r, void *dst, usize size);
+// like read, but leaves the bytes in the ring
+usize spsc_ring_peek(spsc_ring *r, void *dst, usize size);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <time.h>
+#include <timespec.h>
+
+// wall-clock time, for measuring intervals
+static inline struct timespec get_now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts;
+}
+
+static inline double seconds_since(struct timespec begin) {
+  return timespec_to_double(timespec_sub(get_now(), begin));
+}
@@ -5,9 +5,11 @@
 #include <stdbool.h>
 
 typedef uint8_t u8;
+typedef int16_t i16;
 typedef int32_t i32;
 typedef int64_t i64;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef size_t usize;
 
 // signed version of sizeof